@@ -25,6 +25,11 @@
 #include <ntstatus.h>
 #endif
 
+#ifdef AES_NI
+#include <cpuid.h>
+#include <wmmintrin.h>
+#endif
+
 #ifdef _WIN32_BCRYPT
 static NTSTATUS init_ctx(aes_context *ctx) {
   NTSTATUS status = STATUS_SUCCESS;
@@ -196,14 +201,35 @@ static const EVP_CIPHER *aes_cbc(uint16_t key_len) {
   }
 }
 
-static int aes_encrypt_ex(const EVP_CIPHER *cipher, uint8_t *in, uint8_t *out,
-                          uint16_t len, uint8_t *iv, aes_context *ctx) {
-  if (EVP_EncryptInit_ex(ctx->ctx, cipher, NULL, ctx->key, iv) != 1) {
+/*
+ * (Re)initialize the cipher context for a new operation. The key schedule is
+ * only expanded when the cipher or the direction changes, otherwise just the
+ * IV is reset.
+ */
+static int aes_init_ex(const EVP_CIPHER *cipher, int enc, uint8_t *iv,
+                       aes_context *ctx) {
+  if (ctx->cipher == cipher && ctx->enc == enc) {
+    return EVP_CipherInit_ex(ctx->ctx, NULL, NULL, NULL, iv, enc) == 1 ? 0
+                                                                        : -1;
+  }
+  ctx->cipher = NULL;
+  if (EVP_CipherInit_ex(ctx->ctx, cipher, NULL, ctx->key, iv, enc) != 1) {
     return -1;
   }
   if (EVP_CIPHER_CTX_set_padding(ctx->ctx, 0) != 1) {
     return -2;
   }
+  ctx->cipher = cipher;
+  ctx->enc = enc;
+  return 0;
+}
+
+static int aes_encrypt_ex(const EVP_CIPHER *cipher, uint8_t *in, uint8_t *out,
+                          uint16_t len, uint8_t *iv, aes_context *ctx) {
+  int rc = aes_init_ex(cipher, 1, iv, ctx);
+  if (rc) {
+    return rc;
+  }
   int update_len = len;
   if (EVP_EncryptUpdate(ctx->ctx, out, &update_len, in, len) != 1) {
     return -3;
@@ -220,11 +246,9 @@ static int aes_encrypt_ex(const EVP_CIPHER *cipher, uint8_t *in, uint8_t *out,
 
 static int aes_decrypt_ex(const EVP_CIPHER *cipher, uint8_t *in, uint8_t *out,
                           uint16_t len, uint8_t *iv, aes_context *ctx) {
-  if (EVP_DecryptInit_ex(ctx->ctx, cipher, NULL, ctx->key, iv) != 1) {
-    return -1;
-  }
-  if (EVP_CIPHER_CTX_set_padding(ctx->ctx, 0) != 1) {
-    return -2;
+  int rc = aes_init_ex(cipher, 0, iv, ctx);
+  if (rc) {
+    return rc;
   }
   int update_len = len;
   if (EVP_DecryptUpdate(ctx->ctx, out, &update_len, in, len) != 1) {
@@ -240,6 +264,64 @@ static int aes_decrypt_ex(const EVP_CIPHER *cipher, uint8_t *in, uint8_t *out,
   return 0;
 }
 
+#ifdef AES_NI
+
+static int aes_ni_available(void) {
+  unsigned int eax, ebx, ecx, edx;
+
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+    return 0;
+  }
+  return (ecx & bit_AES) && (edx & bit_SSE2);
+}
+
+__attribute__((target("aes,sse2"))) static __m128i
+aes_ni_expand_step(__m128i key, __m128i assist) {
+  assist = _mm_shuffle_epi32(assist, 0xff);
+  key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+  key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+  key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+  return _mm_xor_si128(key, assist);
+}
+
+#define AES_NI_EXPAND(k, rcon)                                                 \
+  aes_ni_expand_step(k, _mm_aeskeygenassist_si128(k, rcon))
+
+/*
+ * Expand a 128 bit key into the encryption and (equivalent inverse cipher)
+ * decryption schedules used by the AES-NI kernels.
+ */
+__attribute__((target("aes,sse2"))) static void
+aes_ni_set_key(const uint8_t *key, aes_context *ctx) {
+  __m128i k[AES_NI_ROUNDS + 1];
+  int i;
+
+  k[0] = _mm_loadu_si128((const __m128i *) key);
+  k[1] = AES_NI_EXPAND(k[0], 0x01);
+  k[2] = AES_NI_EXPAND(k[1], 0x02);
+  k[3] = AES_NI_EXPAND(k[2], 0x04);
+  k[4] = AES_NI_EXPAND(k[3], 0x08);
+  k[5] = AES_NI_EXPAND(k[4], 0x10);
+  k[6] = AES_NI_EXPAND(k[5], 0x20);
+  k[7] = AES_NI_EXPAND(k[6], 0x40);
+  k[8] = AES_NI_EXPAND(k[7], 0x80);
+  k[9] = AES_NI_EXPAND(k[8], 0x1b);
+  k[10] = AES_NI_EXPAND(k[9], 0x36);
+
+  for (i = 0; i <= AES_NI_ROUNDS; i++) {
+    _mm_storeu_si128((__m128i *) (ctx->ni_enc_keys + i * AES_BLOCK_SIZE),
+                     k[i]);
+    _mm_storeu_si128((__m128i *) (ctx->ni_dec_keys + i * AES_BLOCK_SIZE),
+                     i == 0 || i == AES_NI_ROUNDS
+                       ? k[AES_NI_ROUNDS - i]
+                       : _mm_aesimc_si128(k[AES_NI_ROUNDS - i]));
+  }
+
+  insecure_memzero(k, sizeof(k));
+}
+
+#endif
+
 #endif
 
 int aes_set_key(uint8_t *key, uint16_t key_len, aes_context *ctx) {
@@ -273,9 +355,17 @@ int aes_set_key(uint8_t *key, uint16_t key_len, aes_context *ctx) {
       return -2;
     }
   }
+  ctx->cipher = NULL;
   ctx->key_len = key_len;
   memcpy(ctx->key, key, key_len);
 
+#ifdef AES_NI
+  ctx->ni = key_len == 16 && aes_ni_available();
+  if (ctx->ni) {
+    aes_ni_set_key(key, ctx);
+  }
+#endif
+
 #endif
 
   return 0;
@@ -37,6 +37,14 @@
 #define AES_BLOCK_SIZE 16
 #endif
 
+// AES-NI kernels are built on x86 with GCC compatible compilers and used when
+// the CPU supports them, the OpenSSL EVP path is used otherwise
+#if !defined(_WIN32_BCRYPT) && !defined(DISABLE_AESNI) &&                      \
+  (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define AES_NI
+#define AES_NI_ROUNDS 10
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -52,8 +60,16 @@ typedef struct {
   size_t cbKeyObj;
 #else
   EVP_CIPHER_CTX *ctx;
+  const EVP_CIPHER *cipher; // Cipher and direction the key schedule in ctx
+  int enc;                  // was expanded for, NULL if not yet keyed
   uint16_t key_len;
   uint8_t key[32];
+#ifdef AES_NI
+  // Expanded AES-128 key schedules, only valid when ni is set
+  uint8_t ni_enc_keys[(AES_NI_ROUNDS + 1) * AES_BLOCK_SIZE];
+  uint8_t ni_dec_keys[(AES_NI_ROUNDS + 1) * AES_BLOCK_SIZE];
+  int ni;
+#endif
 #endif
 } aes_context;
 
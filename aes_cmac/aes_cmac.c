@@ -25,7 +25,9 @@
 #include "aes_cmac.h"
 #include "../common/insecure_memzero.h"
 
-static uint8_t zero[AES_BLOCK_SIZE];
+#ifdef AES_NI
+#include <wmmintrin.h>
+#endif
 
 /*#include <stdio.h>
 static void dump_hex(char *msg, const unsigned char *buf, unsigned int len) {
@@ -82,62 +84,347 @@ static void cmac_generate_subkey(const uint8_t *key, uint8_t *subkey) {
   subkey[AES_BLOCK_SIZE - 1] ^= 0x87 >> (8 - (carry * 8));
 }
 
-int aes_cmac_encrypt(aes_cmac_context_t *ctx, const uint8_t *message,
-                     const uint16_t message_len, uint8_t *mac) {
+#ifdef AES_NI
 
-  uint8_t n_blocks;
-  uint8_t i;
-  uint8_t remaining_bytes;
+/*
+ * The CBC and CMAC chains are both serial, but independent of each other. The
+ * kernels below run one block of each per iteration, so the rounds of the two
+ * interleave in the AES pipeline and the data is only touched once.
+ *
+ * The ciphertext continues the MAC input after the buffered bytes, so the
+ * first MAC block is spliced together from the two and block j > 0 is read
+ * straight from the ciphertext at offset j * AES_BLOCK_SIZE - buf_len.
+ */
 
-  uint8_t M[AES_BLOCK_SIZE];
-  uint8_t *ptr = (uint8_t *) message;
-  int rc;
+__attribute__((target("aes,sse2"))) static __m128i
+cmac_first_block(const aes_cmac_context_t *ctx, const uint8_t *data) {
 
-  memcpy(mac, zero, AES_BLOCK_SIZE);
-  insecure_memzero(M, AES_BLOCK_SIZE);
+  uint8_t tmp[AES_BLOCK_SIZE];
+  __m128i m;
+
+  memcpy(tmp, ctx->buf, ctx->buf_len);
+  memcpy(tmp + ctx->buf_len, data, AES_BLOCK_SIZE - ctx->buf_len);
+  m = _mm_loadu_si128((const __m128i *) tmp);
+
+  insecure_memzero(tmp, sizeof(tmp));
+
+  return m;
+}
+
+/*
+ * Buffer the tail of the MAC input for aes_cmac_final(), the same bytes as
+ * aes_cmac_update() would have held back.
+ */
+static void cmac_buffer_tail(aes_cmac_context_t *ctx, const uint8_t *end) {
+
+  if (ctx->buf_len == 0) {
+    ctx->buf_len = AES_BLOCK_SIZE;
+  }
+  memcpy(ctx->buf, end - ctx->buf_len, ctx->buf_len);
+}
+
+__attribute__((target("aes,sse2"))) static void
+aes_ni_load_keys(const uint8_t *keys, __m128i *k) {
+  int i;
 
-  if (message_len == 0)
-    n_blocks = 0;
-  else
-    n_blocks = (message_len + (AES_BLOCK_SIZE - 1)) / AES_BLOCK_SIZE - 1;
+  for (i = 0; i <= AES_NI_ROUNDS; i++) {
+    k[i] = _mm_loadu_si128((const __m128i *) (keys + i * AES_BLOCK_SIZE));
+  }
+}
+
+__attribute__((target("aes,sse2"))) static __m128i
+aes_ni_encrypt(__m128i b, const __m128i *k) {
+  int i;
+
+  b = _mm_xor_si128(b, k[0]);
+  for (i = 1; i < AES_NI_ROUNDS; i++) {
+    b = _mm_aesenc_si128(b, k[i]);
+  }
+  return _mm_aesenclast_si128(b, k[AES_NI_ROUNDS]);
+}
+
+__attribute__((target("aes,sse2"))) static void
+aes_ni_cmac_chain(aes_cmac_context_t *ctx, const uint8_t *data,
+                  size_t n_blocks) {
+
+  __m128i mk[AES_NI_ROUNDS + 1];
+  __m128i m, x;
+  size_t i;
 
-  remaining_bytes = (message_len % AES_BLOCK_SIZE);
+  aes_ni_load_keys(ctx->aes_ctx.ni_enc_keys, mk);
 
+  x = _mm_loadu_si128((const __m128i *) ctx->x);
   for (i = 0; i < n_blocks; i++) {
-    do_xor(ptr, mac);
-    rc = aes_encrypt(mac, mac, &ctx->aes_ctx);
-    if (rc) {
-      return rc;
+    m = _mm_loadu_si128((const __m128i *) (data + i * AES_BLOCK_SIZE));
+    x = aes_ni_encrypt(_mm_xor_si128(x, m), mk);
+  }
+  _mm_storeu_si128((__m128i *) ctx->x, x);
+
+  insecure_memzero(mk, sizeof(mk));
+}
+
+__attribute__((target("aes,sse2"))) static __m128i
+cmac_block(const aes_cmac_context_t *ctx, const uint8_t *data, size_t j) {
+
+  if (j == 0) {
+    return cmac_first_block(ctx, data);
+  }
+  return _mm_loadu_si128(
+    (const __m128i *) (data + j * AES_BLOCK_SIZE - ctx->buf_len));
+}
+
+__attribute__((target("aes,sse2"))) static void
+aes_ni_cbc_encrypt_cmac(aes_cmac_context_t *ctx, const aes_context *enc_ctx,
+                        const uint8_t *in, uint8_t *out, size_t n_blocks,
+                        const uint8_t *iv) {
+
+  __m128i ek[AES_NI_ROUNDS + 1], mk[AES_NI_ROUNDS + 1];
+  __m128i c, x, y;
+  size_t i;
+  int r;
+
+  aes_ni_load_keys(enc_ctx->ni_enc_keys, ek);
+  aes_ni_load_keys(ctx->aes_ctx.ni_enc_keys, mk);
+
+  c = _mm_loadu_si128((const __m128i *) iv);
+  x = _mm_loadu_si128((const __m128i *) ctx->x);
+
+  for (i = 0; i < n_blocks; i++) {
+    c = _mm_xor_si128(c, _mm_loadu_si128(
+                           (const __m128i *) (in + i * AES_BLOCK_SIZE)));
+    if (i < 2) {
+      c = aes_ni_encrypt(c, ek);
+    } else {
+      // MAC block i - 2, two blocks behind so that it's long since been
+      // stored and isn't the last one
+      y = _mm_xor_si128(x, cmac_block(ctx, out, i - 2));
+
+      c = _mm_xor_si128(c, ek[0]);
+      y = _mm_xor_si128(y, mk[0]);
+      for (r = 1; r < AES_NI_ROUNDS; r++) {
+        c = _mm_aesenc_si128(c, ek[r]);
+        y = _mm_aesenc_si128(y, mk[r]);
+      }
+      c = _mm_aesenclast_si128(c, ek[AES_NI_ROUNDS]);
+      x = _mm_aesenclast_si128(y, mk[AES_NI_ROUNDS]);
     }
-    ptr += AES_BLOCK_SIZE;
+    _mm_storeu_si128((__m128i *) (out + i * AES_BLOCK_SIZE), c);
+  }
+
+  // Catch up with the MAC. The last block is held back, unless bytes were
+  // buffered before the ciphertext.
+  for (i = n_blocks < 2 ? 0 : n_blocks - 2;
+       i < n_blocks - (ctx->buf_len > 0 ? 0 : 1); i++) {
+    x = aes_ni_encrypt(_mm_xor_si128(x, cmac_block(ctx, out, i)), mk);
   }
+  cmac_buffer_tail(ctx, out + n_blocks * AES_BLOCK_SIZE);
+
+  _mm_storeu_si128((__m128i *) ctx->x, x);
+
+  insecure_memzero(ek, sizeof(ek));
+  insecure_memzero(mk, sizeof(mk));
+}
+
+__attribute__((target("aes,sse2"))) static void
+aes_ni_cmac_cbc_decrypt(aes_cmac_context_t *ctx, const aes_context *enc_ctx,
+                        const uint8_t *in, uint8_t *out, size_t n_blocks,
+                        const uint8_t *iv) {
 
-  if (remaining_bytes == 0) {
-    if (message != NULL && message_len != 0) {
-      memcpy(M, ptr, AES_BLOCK_SIZE);
-      do_xor(ctx->k1, M);
+  __m128i dk[AES_NI_ROUNDS + 1], mk[AES_NI_ROUNDS + 1];
+  __m128i prev, c, p, x, y;
+  size_t i;
+  int r;
+
+  aes_ni_load_keys(enc_ctx->ni_dec_keys, dk);
+  aes_ni_load_keys(ctx->aes_ctx.ni_enc_keys, mk);
+
+  prev = _mm_loadu_si128((const __m128i *) iv);
+  x = _mm_loadu_si128((const __m128i *) ctx->x);
+  p = prev;
+
+  for (i = 0; i < n_blocks; i++) {
+    c = _mm_loadu_si128((const __m128i *) (in + i * AES_BLOCK_SIZE));
+    y = _mm_xor_si128(x, cmac_block(ctx, in, i));
+
+    // The plaintext is stored one block late, MAC block i also covers the
+    // tail of ciphertext block i - 1 when decrypting in place
+    if (i > 0) {
+      _mm_storeu_si128((__m128i *) (out + (i - 1) * AES_BLOCK_SIZE), p);
+    }
+
+    p = _mm_xor_si128(c, dk[0]);
+    if (i < n_blocks - 1 || ctx->buf_len > 0) {
+      y = _mm_xor_si128(y, mk[0]);
+      for (r = 1; r < AES_NI_ROUNDS; r++) {
+        p = _mm_aesdec_si128(p, dk[r]);
+        y = _mm_aesenc_si128(y, mk[r]);
+      }
+      p = _mm_aesdeclast_si128(p, dk[AES_NI_ROUNDS]);
+      x = _mm_aesenclast_si128(y, mk[AES_NI_ROUNDS]);
     } else {
-      do_pad(M, 0);
-      do_xor(ctx->k2, M);
+      for (r = 1; r < AES_NI_ROUNDS; r++) {
+        p = _mm_aesdec_si128(p, dk[r]);
+      }
+      p = _mm_aesdeclast_si128(p, dk[AES_NI_ROUNDS]);
+    }
+    p = _mm_xor_si128(p, prev);
+    prev = c;
+  }
+
+  cmac_buffer_tail(ctx, in + n_blocks * AES_BLOCK_SIZE);
+  _mm_storeu_si128((__m128i *) (out + (n_blocks - 1) * AES_BLOCK_SIZE), p);
+
+  _mm_storeu_si128((__m128i *) ctx->x, x);
+
+  insecure_memzero(dk, sizeof(dk));
+  insecure_memzero(mk, sizeof(mk));
+}
+
+#endif
+
+// Number of bytes run through the block cipher per call when chaining
+#define AES_CMAC_CHUNK_SIZE (32 * AES_BLOCK_SIZE)
+
+/*
+ * Run the CBC-MAC chain over n_blocks complete blocks, starting from and
+ * updating ctx->x. Blocks are handed to the cipher in chunks, so the key
+ * schedule is used for a whole run of blocks at a time.
+ */
+static int cmac_chain_blocks(aes_cmac_context_t *ctx, const uint8_t *data,
+                             size_t n_blocks) {
+
+  uint8_t out[AES_CMAC_CHUNK_SIZE];
+  int rc = 0;
+
+#ifdef AES_NI
+  if (ctx->aes_ctx.ni) {
+    aes_ni_cmac_chain(ctx, data, n_blocks);
+    return 0;
+  }
+#endif
+
+  while (n_blocks > 0) {
+    size_t len = n_blocks * AES_BLOCK_SIZE;
+    if (len > sizeof(out)) {
+      len = sizeof(out);
+    }
+
+    rc = aes_cbc_encrypt((uint8_t *) data, out, len, ctx->x, &ctx->aes_ctx);
+    if (rc) {
+      break;
+    }
+    memcpy(ctx->x, out + len - AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+
+    data += len;
+    n_blocks -= len / AES_BLOCK_SIZE;
+  }
+
+  insecure_memzero(out, sizeof(out));
+
+  return rc;
+}
+
+int aes_cmac_begin(aes_cmac_context_t *ctx) {
+
+  insecure_memzero(ctx->x, AES_BLOCK_SIZE);
+  insecure_memzero(ctx->buf, AES_BLOCK_SIZE);
+  ctx->buf_len = 0;
+
+  return 0;
+}
+
+int aes_cmac_update(aes_cmac_context_t *ctx, const uint8_t *data,
+                    size_t data_len) {
+
+  size_t n;
+  int rc;
+
+  if (data_len == 0) {
+    return 0;
+  }
+
+  // Top up a previously buffered partial block. A full buffered block is
+  // only processed once more data shows that it isn't the last one.
+  if (ctx->buf_len > 0) {
+    n = AES_BLOCK_SIZE - ctx->buf_len;
+    if (n > data_len) {
+      n = data_len;
+    }
+    memcpy(ctx->buf + ctx->buf_len, data, n);
+    ctx->buf_len += n;
+    data += n;
+    data_len -= n;
+
+    if (data_len == 0) {
+      return 0;
+    }
+
+    rc = cmac_chain_blocks(ctx, ctx->buf, 1);
+    if (rc) {
+      return rc;
     }
+    ctx->buf_len = 0;
+  }
+
+  // Chain all complete blocks in one go, holding back the last (possibly
+  // partial) block for aes_cmac_final()
+  n = (data_len - 1) / AES_BLOCK_SIZE;
+  rc = cmac_chain_blocks(ctx, data, n);
+  if (rc) {
+    return rc;
+  }
+  data += n * AES_BLOCK_SIZE;
+  data_len -= n * AES_BLOCK_SIZE;
+
+  memcpy(ctx->buf, data, data_len);
+  ctx->buf_len = data_len;
+
+  return 0;
+}
+
+int aes_cmac_final(aes_cmac_context_t *ctx, uint8_t *mac) {
+
+  uint8_t M[AES_BLOCK_SIZE];
+  int rc;
+
+  memcpy(M, ctx->buf, ctx->buf_len);
+  if (ctx->buf_len == AES_BLOCK_SIZE) {
+    do_xor(ctx->k1, M);
   } else {
-    memcpy(M, ptr, remaining_bytes);
-    do_pad(M, remaining_bytes);
+    do_pad(M, ctx->buf_len);
     do_xor(ctx->k2, M);
   }
 
-  do_xor(M, mac);
+  rc = cmac_chain_blocks(ctx, M, 1);
+  memcpy(mac, ctx->x, AES_BLOCK_SIZE);
+
+  insecure_memzero(M, AES_BLOCK_SIZE);
+  aes_cmac_begin(ctx);
+
+  return rc;
+}
+
+int aes_cmac_encrypt(aes_cmac_context_t *ctx, const uint8_t *message,
+                     const uint16_t message_len, uint8_t *mac) {
+
+  int rc;
+
+  aes_cmac_begin(ctx);
 
-  return aes_encrypt(mac, mac, &ctx->aes_ctx);
+  rc = aes_cmac_update(ctx, message, message_len);
+  if (rc) {
+    return rc;
+  }
+
+  return aes_cmac_final(ctx, mac);
 }
 
 int aes_cmac_init(uint8_t *key, uint16_t key_len, aes_cmac_context_t *ctx) {
 
+  uint8_t zero[AES_BLOCK_SIZE] = {0};
   uint8_t L[AES_BLOCK_SIZE];
   int rc;
 
-  insecure_memzero(zero, AES_BLOCK_SIZE);
-
   rc = aes_set_key(key, key_len, &ctx->aes_ctx);
   if (rc) {
     return rc;
@@ -154,6 +441,96 @@ int aes_cmac_init(uint8_t *key, uint16_t key_len, aes_cmac_context_t *ctx) {
   return aes_cmac_encrypt(ctx, zero, AES_BLOCK_SIZE, ctx->mac);
 }
 
+int aes_cmac_cbc_encrypt(aes_cmac_context_t *ctx, aes_context *enc_ctx,
+                         const uint8_t *in, uint8_t *out, size_t len,
+                         const uint8_t *iv) {
+
+  uint8_t chain[AES_BLOCK_SIZE];
+  int rc = 0;
+
+  if (len % AES_BLOCK_SIZE != 0) {
+    return -1;
+  }
+
+#ifdef AES_NI
+  if (ctx->aes_ctx.ni && enc_ctx->ni && len > 0) {
+    aes_ni_cbc_encrypt_cmac(ctx, enc_ctx, in, out, len / AES_BLOCK_SIZE, iv);
+    return 0;
+  }
+#endif
+
+  // Encrypt and MAC a chunk at a time, while it's still in cache
+  memcpy(chain, iv, AES_BLOCK_SIZE);
+  while (len > 0) {
+    size_t n = len < AES_CMAC_CHUNK_SIZE ? len : AES_CMAC_CHUNK_SIZE;
+
+    rc = aes_cbc_encrypt((uint8_t *) in, out, n, chain, enc_ctx);
+    if (rc) {
+      break;
+    }
+    rc = aes_cmac_update(ctx, out, n);
+    if (rc) {
+      break;
+    }
+    memcpy(chain, out + n - AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+
+    in += n;
+    out += n;
+    len -= n;
+  }
+
+  insecure_memzero(chain, sizeof(chain));
+
+  return rc;
+}
+
+int aes_cmac_cbc_decrypt(aes_cmac_context_t *ctx, aes_context *enc_ctx,
+                         const uint8_t *in, uint8_t *out, size_t len,
+                         const uint8_t *iv) {
+
+  uint8_t chain[AES_BLOCK_SIZE];
+  uint8_t next[AES_BLOCK_SIZE];
+  int rc = 0;
+
+  if (len % AES_BLOCK_SIZE != 0) {
+    return -1;
+  }
+
+#ifdef AES_NI
+  if (ctx->aes_ctx.ni && enc_ctx->ni && len > 0) {
+    aes_ni_cmac_cbc_decrypt(ctx, enc_ctx, in, out, len / AES_BLOCK_SIZE, iv);
+    return 0;
+  }
+#endif
+
+  memcpy(chain, iv, AES_BLOCK_SIZE);
+  while (len > 0) {
+    size_t n = len < AES_CMAC_CHUNK_SIZE ? len : AES_CMAC_CHUNK_SIZE;
+
+    // Save the next IV, the ciphertext is overwritten when used in place
+    memcpy(next, in + n - AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+
+    rc = aes_cmac_update(ctx, in, n);
+    if (rc) {
+      break;
+    }
+    rc = aes_cbc_decrypt((uint8_t *) in, out, n, chain, enc_ctx);
+    if (rc) {
+      break;
+    }
+    memcpy(chain, next, AES_BLOCK_SIZE);
+
+    in += n;
+    out += n;
+    len -= n;
+  }
+
+  insecure_memzero(chain, sizeof(chain));
+  insecure_memzero(next, sizeof(next));
+
+  return rc;
+}
+
 void aes_cmac_destroy(aes_cmac_context_t *ctx) {
   if (ctx) {
     aes_destroy(&(ctx->aes_ctx));
@@ -14,6 +14,11 @@
  * limitations under the License.
  */
 
+#ifndef _AESCMAC_AES_CMAC_H_
+#define _AESCMAC_AES_CMAC_H_
+
+#include <stddef.h>
+
 #include "aes.h"
 
 typedef struct {
@@ -21,6 +26,10 @@ typedef struct {
   uint8_t k1[AES_BLOCK_SIZE];
   uint8_t k2[AES_BLOCK_SIZE];
   uint8_t mac[AES_BLOCK_SIZE];
+  // Streaming state: chaining value and the held back last block
+  uint8_t x[AES_BLOCK_SIZE];
+  uint8_t buf[AES_BLOCK_SIZE];
+  uint8_t buf_len;
 } aes_cmac_context_t;
 
 #ifndef __WIN32
@@ -34,4 +43,28 @@ int YH_INTERNAL aes_cmac_init(uint8_t *key, uint16_t key_len,
 int YH_INTERNAL aes_cmac_encrypt(aes_cmac_context_t *ctx,
                                  const uint8_t *message,
                                  const uint16_t message_len, uint8_t *mac);
+
+// Streaming interface. A MAC over several discontiguous buffers is computed
+// with aes_cmac_begin(), any number of aes_cmac_update() calls and
+// aes_cmac_final(), which also resets the context for the next message.
+int YH_INTERNAL aes_cmac_begin(aes_cmac_context_t *ctx);
+int YH_INTERNAL aes_cmac_update(aes_cmac_context_t *ctx, const uint8_t *data,
+                                size_t data_len);
+int YH_INTERNAL aes_cmac_final(aes_cmac_context_t *ctx, uint8_t *mac);
+
+// Fused CBC encryption and MAC in a single pass over the data.
+// aes_cmac_cbc_encrypt() encrypts len bytes (a multiple of the block size)
+// from in to out and feeds the ciphertext to the MAC, aes_cmac_cbc_decrypt()
+// feeds the ciphertext in to the MAC and decrypts it to out. Both continue a
+// MAC started with aes_cmac_begin() and may be used in place.
+int YH_INTERNAL aes_cmac_cbc_encrypt(aes_cmac_context_t *ctx,
+                                     aes_context *enc_ctx, const uint8_t *in,
+                                     uint8_t *out, size_t len,
+                                     const uint8_t *iv);
+int YH_INTERNAL aes_cmac_cbc_decrypt(aes_cmac_context_t *ctx,
+                                     aes_context *enc_ctx, const uint8_t *in,
+                                     uint8_t *out, size_t len,
+                                     const uint8_t *iv);
 void YH_INTERNAL aes_cmac_destroy(aes_cmac_context_t *ctx);
+
+#endif /* _AESCMAC_AES_CMAC_H_ */
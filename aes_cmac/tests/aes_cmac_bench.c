@@ -0,0 +1,143 @@
+/*
+ * Copyright 2015-2018 Yubico AB
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Throughput benchmark for the AES-CMAC engine. Optionally takes the number
+// of iterations per message size as its only argument.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../aes_cmac.h"
+
+#define DEFAULT_ITERATIONS 20000
+
+static double now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+  aes_cmac_context_t ctx;
+
+  // Sizes of interest are the SCP03 MAC inputs: chaining value, header and a
+  // padded payload of up to YH_MSG_BUF_SIZE
+  static const uint16_t sizes[] = {36, 84, 276, 1044, 2068};
+  uint8_t key[16];
+  uint8_t msg[2068];
+  uint8_t mac[AES_BLOCK_SIZE];
+  long iterations = DEFAULT_ITERATIONS;
+  size_t i;
+  long n;
+
+  if (argc > 1) {
+    iterations = strtol(argv[1], NULL, 10);
+    if (iterations <= 0) {
+      fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  for (i = 0; i < sizeof(key); i++) {
+    key[i] = i;
+  }
+  for (i = 0; i < sizeof(msg); i++) {
+    msg[i] = i * 31;
+  }
+
+  memset(&ctx, 0, sizeof(ctx));
+  if (aes_cmac_init(key, sizeof(key), &ctx)) {
+    fprintf(stderr, "aes_cmac_init failed\n");
+    return EXIT_FAILURE;
+  }
+
+  printf("%8s %12s %12s %12s\n", "bytes", "one-shot", "two-part", "MB/s");
+  for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    double t0 = now();
+    for (n = 0; n < iterations; n++) {
+      if (aes_cmac_encrypt(&ctx, msg, sizes[i], mac)) {
+        fprintf(stderr, "aes_cmac_encrypt failed\n");
+        return EXIT_FAILURE;
+      }
+    }
+    double t1 = now();
+    for (n = 0; n < iterations; n++) {
+      aes_cmac_begin(&ctx);
+      aes_cmac_update(&ctx, msg, AES_BLOCK_SIZE);
+      aes_cmac_update(&ctx, msg + AES_BLOCK_SIZE, sizes[i] - AES_BLOCK_SIZE);
+      if (aes_cmac_final(&ctx, mac)) {
+        fprintf(stderr, "aes_cmac_final failed\n");
+        return EXIT_FAILURE;
+      }
+    }
+    double t2 = now();
+
+    printf("%8u %9.0f ns %9.0f ns %12.1f\n", sizes[i],
+           (t1 - t0) * 1e9 / iterations, (t2 - t1) * 1e9 / iterations,
+           sizes[i] * iterations / (t1 - t0) / 1e6);
+  }
+
+  // Secure messaging: CBC encryption of a padded payload and a MAC over a
+  // 20 byte prefix and the ciphertext, as separate passes and fused
+  aes_context enc_ctx;
+  uint8_t iv[AES_BLOCK_SIZE];
+  uint8_t out[sizeof(msg)];
+
+  memset(&enc_ctx, 0, sizeof(enc_ctx));
+  memset(iv, 0, sizeof(iv));
+  if (aes_set_key(key, sizeof(key), &enc_ctx)) {
+    fprintf(stderr, "aes_set_key failed\n");
+    return EXIT_FAILURE;
+  }
+
+  printf("\n%8s %12s %12s %12s\n", "bytes", "separate", "fused", "MB/s");
+  for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    uint16_t len = sizes[i] - 20;
+    double t0 = now();
+    for (n = 0; n < iterations; n++) {
+      aes_cbc_encrypt(msg + 20, out + 20, len, iv, &enc_ctx);
+      memcpy(out, msg, 20);
+      if (aes_cmac_encrypt(&ctx, out, sizes[i], mac)) {
+        fprintf(stderr, "aes_cmac_encrypt failed\n");
+        return EXIT_FAILURE;
+      }
+    }
+    double t1 = now();
+    for (n = 0; n < iterations; n++) {
+      aes_cmac_begin(&ctx);
+      aes_cmac_update(&ctx, msg, 20);
+      aes_cmac_cbc_encrypt(&ctx, &enc_ctx, msg + 20, out + 20, len, iv);
+      if (aes_cmac_final(&ctx, mac)) {
+        fprintf(stderr, "aes_cmac_final failed\n");
+        return EXIT_FAILURE;
+      }
+    }
+    double t2 = now();
+
+    printf("%8u %9.0f ns %9.0f ns %12.1f\n", len,
+           (t1 - t0) * 1e9 / iterations, (t2 - t1) * 1e9 / iterations,
+           len * iterations / (t2 - t1) / 1e6);
+  }
+
+  aes_destroy(&enc_ctx);
+  aes_cmac_destroy(&ctx);
+
+  return EXIT_SUCCESS;
+}
@@ -84,6 +84,7 @@ int main() {
   uint8_t mac12[] = {0xe1, 0x99, 0x21, 0x90, 0x54, 0x9f, 0x6e, 0xd5,
                      0x69, 0x6a, 0x2c, 0x05, 0x6c, 0x31, 0x54, 0x10};
 
+  memset(&ctx, 0, sizeof(ctx));
   aes_cmac_init(k_128, sizeof(k_128), &ctx);
   aes_cmac_encrypt(&ctx, m, 0, mac);
   asrt(memcmp(mac, mac1, 16), 0, (unsigned char *) "MAC1");
@@ -114,6 +115,109 @@ int main() {
   aes_cmac_encrypt(&ctx, m, 64, mac);
   asrt(memcmp(mac, mac12, 16), 0, (unsigned char *) "MAC12");
 
+  // Streaming tests, feeding the 64 byte message in pieces of varying size
+
+  uint8_t mac_oneshot[AES_BLOCK_SIZE];
+  uint16_t split;
+  uint16_t step;
+  uint16_t off;
+
+  aes_cmac_init(k_128, sizeof(k_128), &ctx);
+  for (step = 1; step <= 64; step++) {
+    for (split = 0; split <= 64; split += 8) {
+      aes_cmac_encrypt(&ctx, m, split, mac_oneshot);
+
+      aes_cmac_begin(&ctx);
+      for (off = 0; off < split; off += step) {
+        aes_cmac_update(&ctx, m + off, split - off < step ? split - off : step);
+      }
+      aes_cmac_final(&ctx, mac);
+      asrt(memcmp(mac, mac_oneshot, 16), 0, (unsigned char *) "STREAM1");
+    }
+  }
+
+  aes_cmac_begin(&ctx);
+  aes_cmac_update(&ctx, m, 16);
+  aes_cmac_update(&ctx, m + 16, 0);
+  aes_cmac_update(&ctx, m + 16, 24);
+  aes_cmac_final(&ctx, mac);
+  asrt(memcmp(mac, mac3, 16), 0, (unsigned char *) "STREAM2");
+
+  aes_cmac_begin(&ctx);
+  aes_cmac_final(&ctx, mac);
+  asrt(memcmp(mac, mac1, 16), 0, (unsigned char *) "STREAM3");
+
+  aes_cmac_begin(&ctx);
+  aes_cmac_update(&ctx, m, 15);
+  aes_cmac_update(&ctx, m + 15, 1);
+  aes_cmac_update(&ctx, m + 16, 47);
+  aes_cmac_update(&ctx, m + 63, 1);
+  aes_cmac_final(&ctx, mac);
+  asrt(memcmp(mac, mac4, 16), 0, (unsigned char *) "STREAM4");
+
+  // Fused CBC and MAC, compared with separate passes. The prefix shifts the
+  // ciphertext against the MAC block boundaries like the SCP03 header does.
+
+  aes_context enc_ctx;
+  uint8_t plain[48 * AES_BLOCK_SIZE];
+  uint8_t cipher[sizeof(plain)];
+  uint8_t fused[sizeof(plain)];
+  uint8_t mac_in[2 * AES_BLOCK_SIZE + sizeof(plain)];
+  uint8_t iv[AES_BLOCK_SIZE];
+  uint16_t len;
+  uint16_t prefix;
+  int pass;
+
+  for (off = 0; off < sizeof(plain); off++) {
+    plain[off] = off * 7 + 1;
+  }
+  for (off = 0; off < sizeof(mac_in); off++) {
+    mac_in[off] = off * 13 + 5;
+  }
+  memcpy(iv, m, AES_BLOCK_SIZE);
+
+  memset(&enc_ctx, 0, sizeof(enc_ctx));
+  aes_set_key(k_256, 16, &enc_ctx);
+
+  for (pass = 0; pass < 2; pass++) {
+#ifdef AES_NI
+    // Second pass forces the generic path, if the first one used AES-NI
+    if (pass == 1) {
+      ctx.aes_ctx.ni = 0;
+      enc_ctx.ni = 0;
+    }
+#endif
+    for (len = 0; len <= sizeof(plain); len += AES_BLOCK_SIZE) {
+      for (prefix = 0; prefix <= 2 * AES_BLOCK_SIZE; prefix += 4) {
+        aes_cbc_encrypt(plain, cipher, len, iv, &enc_ctx);
+        memcpy(mac_in + prefix, cipher, len);
+        aes_cmac_encrypt(&ctx, mac_in, prefix + len, mac_oneshot);
+
+        aes_cmac_begin(&ctx);
+        aes_cmac_update(&ctx, mac_in, prefix);
+        asrt(aes_cmac_cbc_encrypt(&ctx, &enc_ctx, plain, fused, len, iv), 0,
+             (unsigned char *) "FUSED1a");
+        aes_cmac_final(&ctx, mac);
+        asrt(memcmp(fused, cipher, len), 0, (unsigned char *) "FUSED1b");
+        asrt(memcmp(mac, mac_oneshot, 16), 0, (unsigned char *) "FUSED1c");
+
+        aes_cmac_begin(&ctx);
+        aes_cmac_update(&ctx, mac_in, prefix);
+        asrt(aes_cmac_cbc_decrypt(&ctx, &enc_ctx, fused, fused, len, iv), 0,
+             (unsigned char *) "FUSED2a");
+        aes_cmac_final(&ctx, mac);
+        asrt(memcmp(fused, plain, len), 0, (unsigned char *) "FUSED2b");
+        asrt(memcmp(mac, mac_oneshot, 16), 0, (unsigned char *) "FUSED2c");
+      }
+    }
+  }
+
+  asrt(aes_cmac_cbc_encrypt(&ctx, &enc_ctx, plain, fused, 15, iv), -1,
+       (unsigned char *) "FUSED3");
+
+  aes_destroy(&enc_ctx);
+  aes_cmac_destroy(&ctx);
+
   // Padding tests
 
   uint8_t a[48];
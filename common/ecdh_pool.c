@@ -0,0 +1,197 @@
+/*
+ * Copyright 2015-2018 Yubico AB
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ecdh_pool.h"
+#include "ecdh.h"
+#include "thread.h"
+#include "locked_mem.h"
+#include "insecure_memzero.h"
+
+#include <string.h>
+
+typedef struct {
+  uint8_t privkey[ECDH_POOL_PRIVKEY_LEN];
+  uint8_t pubkey[ECDH_POOL_PUBKEY_LEN];
+} ecdh_keypair;
+
+static struct {
+  bool ready;
+  thread_mutex lock;
+  // Signalled when a key pair is taken, or the thread is to stop
+  thread_cond taken;
+  ecdh_keypair *keys;
+  size_t size;
+  size_t count;
+  bool running;
+  bool stop;
+  thread_handle thread;
+} pool;
+
+static bool generate_keypair(ecdh_keypair *keypair) {
+
+  int curve = ecdh_curve_p256();
+
+  return curve != 0 &&
+         ecdh_generate_keypair(curve, keypair->privkey,
+                               sizeof(keypair->privkey), keypair->pubkey,
+                               sizeof(keypair->pubkey)) != 0;
+}
+
+static void refill_main(void *arg) {
+
+  ecdh_keypair keypair;
+
+  (void) arg;
+
+  thread_mutex_lock(&pool.lock);
+  while (!pool.stop) {
+    if (pool.count == pool.size) {
+      thread_cond_wait(&pool.taken, &pool.lock, -1);
+      continue;
+    }
+
+    // The key generation is what the pool is for, keep takers out of it
+    thread_mutex_unlock(&pool.lock);
+    bool generated = generate_keypair(&keypair);
+    thread_mutex_lock(&pool.lock);
+
+    if (!generated) {
+      // Don't spin, takers generate their own until the next attempt
+      thread_cond_wait(&pool.taken, &pool.lock, 1000);
+    } else if (pool.count < pool.size) {
+      memcpy(&pool.keys[pool.count++], &keypair, sizeof(keypair));
+    }
+    insecure_memzero(&keypair, sizeof(keypair));
+  }
+  thread_mutex_unlock(&pool.lock);
+}
+
+static void stop_refill(void) {
+
+  thread_mutex_lock(&pool.lock);
+  bool running = pool.running;
+  pool.stop = true;
+  thread_cond_signal(&pool.taken);
+  thread_mutex_unlock(&pool.lock);
+
+  if (running) {
+    thread_join(pool.thread);
+  }
+
+  thread_mutex_lock(&pool.lock);
+  ecdh_keypair *keys = pool.keys;
+  size_t size = pool.size;
+  pool.keys = NULL;
+  pool.size = 0;
+  pool.count = 0;
+  pool.running = false;
+  thread_mutex_unlock(&pool.lock);
+
+  locked_free(keys, size * sizeof(ecdh_keypair));
+}
+
+bool ecdh_pool_init(void) {
+
+  if (pool.ready) {
+    return true;
+  }
+
+  if (!thread_mutex_init(&pool.lock)) {
+    return false;
+  }
+  if (!thread_cond_init(&pool.taken)) {
+    thread_mutex_destroy(&pool.lock);
+    return false;
+  }
+  pool.ready = true;
+
+  return true;
+}
+
+void ecdh_pool_exit(void) {
+
+  if (!pool.ready) {
+    return;
+  }
+
+  stop_refill();
+  thread_cond_destroy(&pool.taken);
+  thread_mutex_destroy(&pool.lock);
+  pool.ready = false;
+}
+
+bool ecdh_pool_configure(size_t n_keys) {
+
+  if (!pool.ready) {
+    return false;
+  }
+
+  stop_refill();
+  if (n_keys == 0) {
+    return true;
+  }
+
+  if (n_keys > SIZE_MAX / sizeof(ecdh_keypair)) {
+    return false;
+  }
+  ecdh_keypair *keys = locked_alloc(n_keys * sizeof(ecdh_keypair));
+  if (keys == NULL) {
+    return false;
+  }
+
+  thread_mutex_lock(&pool.lock);
+  pool.keys = keys;
+  pool.size = n_keys;
+  pool.count = 0;
+  pool.stop = false;
+  pool.running = thread_create(&pool.thread, refill_main, NULL);
+  thread_mutex_unlock(&pool.lock);
+
+  if (!pool.running) {
+    stop_refill();
+    return false;
+  }
+
+  return true;
+}
+
+bool ecdh_pool_take(uint8_t *privkey, uint8_t *pubkey) {
+
+  ecdh_keypair keypair;
+  bool taken = false;
+
+  if (pool.ready) {
+    thread_mutex_lock(&pool.lock);
+    if (pool.count > 0) {
+      ecdh_keypair *last = &pool.keys[--pool.count];
+      memcpy(&keypair, last, sizeof(keypair));
+      insecure_memzero(last, sizeof(*last));
+      thread_cond_signal(&pool.taken);
+      taken = true;
+    }
+    thread_mutex_unlock(&pool.lock);
+  }
+
+  if (!taken && !generate_keypair(&keypair)) {
+    return false;
+  }
+
+  memcpy(privkey, keypair.privkey, ECDH_POOL_PRIVKEY_LEN);
+  memcpy(pubkey, keypair.pubkey, ECDH_POOL_PUBKEY_LEN);
+  insecure_memzero(&keypair, sizeof(keypair));
+
+  return true;
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright 2015-2018 Yubico AB
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* ecdh_pool.h
+**
+** Implements a pool of ephemeral EC P-256 key pairs, generated ahead of time
+** by a background thread
+*/
+
+#ifndef _YUBICOM_ECDH_POOL_H_
+#define _YUBICOM_ECDH_POOL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef __WIN32
+#define YH_INTERNAL __attribute__((visibility("hidden")))
+#else
+#define YH_INTERNAL
+#endif
+
+#define ECDH_POOL_PRIVKEY_LEN 32
+#define ECDH_POOL_PUBKEY_LEN 65
+
+bool YH_INTERNAL ecdh_pool_init(void);
+void YH_INTERNAL ecdh_pool_exit(void);
+
+// Keep n_keys key pairs generated ahead of time, 0 stops the background thread
+// and wipes the pool
+bool YH_INTERNAL ecdh_pool_configure(size_t n_keys);
+
+// Take a key pair from the pool, or generate one if the pool is empty or
+// disabled. Returns false if no key pair could be generated.
+bool YH_INTERNAL ecdh_pool_take(uint8_t *privkey, uint8_t *pubkey);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _YUBICOM_ECDH_POOL_H_ */
@@ -0,0 +1,238 @@
+/*
+ * Copyright 2015-2018 Yubico AB
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kdf_cache.h"
+#include "pkcs5.h"
+#include "rand.h"
+#include "thread.h"
+#include "locked_mem.h"
+#include "insecure_memzero.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define KDF_CACHE_TAG_LEN 32
+#define KDF_CACHE_SECRET_LEN 32
+
+typedef struct {
+  // Keyed hash of the derivation parameters, see compute_tag()
+  uint8_t tag[KDF_CACHE_TAG_LEN];
+  uint8_t key[KDF_CACHE_MAX_KEY_LEN];
+  size_t key_len;
+  // 0 if the entry is free
+  unsigned long long expires;
+} kdf_entry;
+
+typedef struct {
+  uint8_t secret[KDF_CACHE_SECRET_LEN];
+  kdf_entry entries[];
+} kdf_arena;
+
+static struct {
+  bool ready;
+  thread_mutex lock;
+  kdf_arena *arena;
+  size_t arena_size;
+  size_t n_entries;
+  unsigned int lifetime_ms;
+  // Bumped whenever the arena, and so the secret, is replaced
+  unsigned long generation;
+} cache;
+
+/*
+ * HMAC-SHA256 under the cache secret of everything the derived key depends on.
+ * PBKDF2 with a single iteration is HMAC(secret, data || INT(1)), which saves
+ * a second platform specific HMAC implementation.
+ */
+static bool compute_tag(const uint8_t *password, size_t cb_password,
+                        const uint8_t *salt, size_t cb_salt,
+                        uint64_t iterations, hash_t hash, size_t cb_key,
+                        uint8_t *tag) {
+
+  size_t cb_data = 8 + 1 + 2 + 4 + cb_salt + cb_password;
+  uint8_t *data = malloc(cb_data);
+  if (data == NULL) {
+    return false;
+  }
+
+  uint8_t *p = data;
+  for (int i = 7; i >= 0; i--) {
+    *p++ = (uint8_t)(iterations >> (8 * i));
+  }
+  *p++ = (uint8_t) hash;
+  *p++ = (uint8_t)(cb_key >> 8);
+  *p++ = (uint8_t) cb_key;
+  for (int i = 3; i >= 0; i--) {
+    *p++ = (uint8_t)(cb_salt >> (8 * i));
+  }
+  memcpy(p, salt, cb_salt);
+  memcpy(p + cb_salt, password, cb_password);
+
+  bool ret = pkcs5_pbkdf2_hmac(cache.arena->secret, KDF_CACHE_SECRET_LEN, data,
+                               cb_data, 1, _SHA256, tag, KDF_CACHE_TAG_LEN);
+
+  insecure_memzero(data, cb_data);
+  free(data);
+
+  return ret;
+}
+
+static bool tag_equal(const uint8_t *a, const uint8_t *b) {
+
+  uint8_t diff = 0;
+
+  for (size_t i = 0; i < KDF_CACHE_TAG_LEN; i++) {
+    diff |= a[i] ^ b[i];
+  }
+
+  return diff == 0;
+}
+
+static void wipe_entry(kdf_entry *entry) {
+
+  insecure_memzero(entry, sizeof(kdf_entry));
+}
+
+bool kdf_cache_init(void) {
+
+  if (cache.ready) {
+    return true;
+  }
+
+  if (!thread_mutex_init(&cache.lock)) {
+    return false;
+  }
+  cache.ready = true;
+
+  return true;
+}
+
+void kdf_cache_exit(void) {
+
+  if (!cache.ready) {
+    return;
+  }
+
+  kdf_cache_configure(0, 0);
+  thread_mutex_destroy(&cache.lock);
+  cache.ready = false;
+}
+
+bool kdf_cache_configure(unsigned int lifetime_ms, size_t n_entries) {
+
+  kdf_arena *arena = NULL;
+  size_t arena_size = 0;
+
+  if (!cache.ready) {
+    return false;
+  }
+
+  if (lifetime_ms != 0 && n_entries != 0) {
+    if (n_entries > (SIZE_MAX - sizeof(kdf_arena)) / sizeof(kdf_entry)) {
+      return false;
+    }
+    arena_size = sizeof(kdf_arena) + n_entries * sizeof(kdf_entry);
+    arena = locked_alloc(arena_size);
+    if (arena == NULL) {
+      return false;
+    }
+    if (!rand_generate(arena->secret, KDF_CACHE_SECRET_LEN)) {
+      locked_free(arena, arena_size);
+      return false;
+    }
+  }
+
+  thread_mutex_lock(&cache.lock);
+  kdf_arena *old_arena = cache.arena;
+  size_t old_arena_size = cache.arena_size;
+  cache.arena = arena;
+  cache.arena_size = arena_size;
+  cache.n_entries = arena != NULL ? n_entries : 0;
+  cache.lifetime_ms = lifetime_ms;
+  cache.generation++;
+  thread_mutex_unlock(&cache.lock);
+
+  locked_free(old_arena, old_arena_size);
+
+  return true;
+}
+
+bool kdf_cache_pbkdf2_hmac(const uint8_t *password, size_t cb_password,
+                           const uint8_t *salt, size_t cb_salt,
+                           uint64_t iterations, hash_t hash, uint8_t *key,
+                           size_t cb_key) {
+
+  uint8_t tag[KDF_CACHE_TAG_LEN];
+  unsigned long generation = 0;
+  bool cached = false;
+
+  if (!cache.ready || cb_key > KDF_CACHE_MAX_KEY_LEN) {
+    return pkcs5_pbkdf2_hmac(password, cb_password, salt, cb_salt, iterations,
+                             hash, key, cb_key);
+  }
+
+  thread_mutex_lock(&cache.lock);
+  if (cache.arena != NULL &&
+      compute_tag(password, cb_password, salt, cb_salt, iterations, hash,
+                  cb_key, tag)) {
+    unsigned long long now = thread_now_ms();
+    generation = cache.generation;
+    cached = true;
+    for (size_t i = 0; i < cache.n_entries; i++) {
+      kdf_entry *entry = &cache.arena->entries[i];
+      if (entry->expires == 0) {
+        continue;
+      } else if (entry->expires <= now) {
+        wipe_entry(entry);
+      } else if (entry->key_len == cb_key && tag_equal(entry->tag, tag)) {
+        memcpy(key, entry->key, cb_key);
+        thread_mutex_unlock(&cache.lock);
+        insecure_memzero(tag, sizeof(tag));
+        return true;
+      }
+    }
+  }
+  thread_mutex_unlock(&cache.lock);
+
+  // Derived without holding the lock, other logins need not wait for it
+  if (!pkcs5_pbkdf2_hmac(password, cb_password, salt, cb_salt, iterations,
+                         hash, key, cb_key)) {
+    insecure_memzero(tag, sizeof(tag));
+    return false;
+  }
+
+  thread_mutex_lock(&cache.lock);
+  // Unless the cache was reconfigured meanwhile, the tag is then stale
+  if (cached && cache.arena != NULL && cache.generation == generation) {
+    kdf_entry *slot = &cache.arena->entries[0];
+    for (size_t i = 0; i < cache.n_entries; i++) {
+      kdf_entry *entry = &cache.arena->entries[i];
+      if (entry->expires < slot->expires) {
+        slot = entry;
+      }
+    }
+    wipe_entry(slot);
+    memcpy(slot->tag, tag, KDF_CACHE_TAG_LEN);
+    memcpy(slot->key, key, cb_key);
+    slot->key_len = cb_key;
+    slot->expires = thread_now_ms() + cache.lifetime_ms;
+  }
+  thread_mutex_unlock(&cache.lock);
+
+  insecure_memzero(tag, sizeof(tag));
+
+  return true;
+}
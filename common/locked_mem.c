@@ -0,0 +1,71 @@
+/*
+ * Copyright 2015-2018 Yubico AB
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "locked_mem.h"
+#include "insecure_memzero.h"
+
+#ifdef __WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+void *locked_alloc(size_t size) {
+
+#ifdef __WIN32
+  void *ptr =
+    VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+  if (ptr == NULL) {
+    return NULL;
+  }
+  if (!VirtualLock(ptr, size)) {
+    VirtualFree(ptr, 0, MEM_RELEASE);
+    return NULL;
+  }
+#else
+  void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ptr == MAP_FAILED) {
+    return NULL;
+  }
+  if (mlock(ptr, size) != 0) {
+    munmap(ptr, size);
+    return NULL;
+  }
+#ifdef MADV_DONTDUMP
+  madvise(ptr, size, MADV_DONTDUMP);
+#endif
+#endif
+
+  // Fresh anonymous mappings are zeroed already
+  return ptr;
+}
+
+void locked_free(void *ptr, size_t size) {
+
+  if (ptr == NULL) {
+    return;
+  }
+
+  insecure_memzero(ptr, size);
+#ifdef __WIN32
+  VirtualUnlock(ptr, size);
+  VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+  munlock(ptr, size);
+  munmap(ptr, size);
+#endif
+}
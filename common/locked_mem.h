@@ -0,0 +1,47 @@
+/*
+ * Copyright 2015-2018 Yubico AB
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* locked_mem.h
+**
+** Implements platform specific allocation of memory for long lived secrets
+*/
+
+#ifndef _YUBICOM_LOCKED_MEM_H_
+#define _YUBICOM_LOCKED_MEM_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef __WIN32
+#define YH_INTERNAL __attribute__((visibility("hidden")))
+#else
+#define YH_INTERNAL
+#endif
+
+// Allocate zeroed memory that is kept out of swap, and core dumps where
+// supported. Returns NULL if the memory could not be locked.
+void YH_INTERNAL *locked_alloc(size_t size);
+// Wipe and release memory from locked_alloc()
+void YH_INTERNAL locked_free(void *ptr, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _YUBICOM_LOCKED_MEM_H_ */
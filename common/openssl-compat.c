@@ -104,6 +104,11 @@ ASN1_OCTET_STRING *X509_EXTENSION_get_data(X509_EXTENSION *ex) {
   return ex->value;
 }
 
+int EVP_PKEY_up_ref(EVP_PKEY *pkey) {
+  CRYPTO_add(&pkey->references, 1, CRYPTO_LOCK_EVP_PKEY);
+  return 1;
+}
+
 #endif /* OPENSSL_VERSION_NUMBER */
 
 int BN_bn2binpad(const BIGNUM *a, unsigned char *to, int tolen) {
@@ -43,6 +43,8 @@ const YH_INTERNAL STACK_OF(X509_EXTENSION) *
 ASN1_OBJECT YH_INTERNAL *X509_EXTENSION_get_object(X509_EXTENSION *ex);
 ASN1_OCTET_STRING YH_INTERNAL *X509_EXTENSION_get_data(X509_EXTENSION *ex);
 
+int YH_INTERNAL EVP_PKEY_up_ref(EVP_PKEY *pkey);
+
 #endif /* OPENSSL_VERSION_NUMBER */
 
 int YH_INTERNAL BN_bn2binpad(const BIGNUM *a, unsigned char *to, int tolen);
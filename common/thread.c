@@ -0,0 +1,238 @@
+/*
+ * Copyright 2015-2018 Yubico AB
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "thread.h"
+
+#include <stdlib.h>
+
+#ifndef __WIN32
+#include <errno.h>
+#include <time.h>
+#endif
+
+typedef struct {
+  thread_func func;
+  void *arg;
+} thread_start;
+
+#ifdef __WIN32
+static DWORD WINAPI thread_main(LPVOID param) {
+#else
+static void *thread_main(void *param) {
+#endif
+
+  thread_start start = *(thread_start *) param;
+
+  free(param);
+  start.func(start.arg);
+
+#ifdef __WIN32
+  return 0;
+#else
+  return NULL;
+#endif
+}
+
+bool thread_create(thread_handle *thread, thread_func func, void *arg) {
+
+  thread_start *start = malloc(sizeof(thread_start));
+  if (start == NULL) {
+    return false;
+  }
+  start->func = func;
+  start->arg = arg;
+
+#ifdef __WIN32
+  *thread = CreateThread(NULL, 0, thread_main, start, 0, NULL);
+  if (*thread == NULL) {
+#else
+  if (pthread_create(thread, NULL, thread_main, start) != 0) {
+#endif
+    free(start);
+    return false;
+  }
+
+  return true;
+}
+
+void thread_join(thread_handle thread) {
+
+#ifdef __WIN32
+  WaitForSingleObject(thread, INFINITE);
+  CloseHandle(thread);
+#else
+  pthread_join(thread, NULL);
+#endif
+}
+
+bool thread_mutex_init(thread_mutex *mutex) {
+
+#ifdef __WIN32
+  InitializeCriticalSection(mutex);
+  return true;
+#else
+  return pthread_mutex_init(mutex, NULL) == 0;
+#endif
+}
+
+void thread_mutex_destroy(thread_mutex *mutex) {
+
+#ifdef __WIN32
+  DeleteCriticalSection(mutex);
+#else
+  pthread_mutex_destroy(mutex);
+#endif
+}
+
+void thread_mutex_lock(thread_mutex *mutex) {
+
+#ifdef __WIN32
+  EnterCriticalSection(mutex);
+#else
+  pthread_mutex_lock(mutex);
+#endif
+}
+
+bool thread_mutex_trylock(thread_mutex *mutex) {
+
+#ifdef __WIN32
+  return TryEnterCriticalSection(mutex) != 0;
+#else
+  return pthread_mutex_trylock(mutex) == 0;
+#endif
+}
+
+void thread_mutex_unlock(thread_mutex *mutex) {
+
+#ifdef __WIN32
+  LeaveCriticalSection(mutex);
+#else
+  pthread_mutex_unlock(mutex);
+#endif
+}
+
+bool thread_cond_init(thread_cond *cond) {
+
+#ifdef __WIN32
+  InitializeConditionVariable(cond);
+  return true;
+#elif defined(__APPLE__)
+  return pthread_cond_init(cond, NULL) == 0;
+#else
+  pthread_condattr_t attr;
+  bool ret;
+
+  if (pthread_condattr_init(&attr) != 0) {
+    return false;
+  }
+  // Timed waits are against the monotonic clock, see thread_cond_wait()
+  ret = pthread_condattr_setclock(&attr, CLOCK_MONOTONIC) == 0 &&
+        pthread_cond_init(cond, &attr) == 0;
+  pthread_condattr_destroy(&attr);
+
+  return ret;
+#endif
+}
+
+void thread_cond_destroy(thread_cond *cond) {
+
+#ifdef __WIN32
+  (void) cond;
+#else
+  pthread_cond_destroy(cond);
+#endif
+}
+
+void thread_cond_signal(thread_cond *cond) {
+
+#ifdef __WIN32
+  WakeConditionVariable(cond);
+#else
+  pthread_cond_signal(cond);
+#endif
+}
+
+void thread_cond_broadcast(thread_cond *cond) {
+
+#ifdef __WIN32
+  WakeAllConditionVariable(cond);
+#else
+  pthread_cond_broadcast(cond);
+#endif
+}
+
+bool thread_cond_wait(thread_cond *cond, thread_mutex *mutex, int timeout_ms) {
+
+#ifdef __WIN32
+  return SleepConditionVariableCS(cond, mutex,
+                                  timeout_ms < 0 ? INFINITE : timeout_ms) != 0;
+#else
+  struct timespec ts;
+
+  if (timeout_ms < 0) {
+    return pthread_cond_wait(cond, mutex) == 0;
+  }
+
+#ifdef __APPLE__
+  ts.tv_sec = timeout_ms / 1000;
+  ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+  return pthread_cond_timedwait_relative_np(cond, mutex, &ts) != ETIMEDOUT;
+#else
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  ts.tv_sec += timeout_ms / 1000;
+  ts.tv_nsec += (timeout_ms % 1000) * 1000000L;
+  if (ts.tv_nsec >= 1000000000L) {
+    ts.tv_sec++;
+    ts.tv_nsec -= 1000000000L;
+  }
+  return pthread_cond_timedwait(cond, mutex, &ts) != ETIMEDOUT;
+#endif
+#endif
+}
+
+unsigned long long thread_now_ms(void) {
+
+#ifdef __WIN32
+  return GetTickCount64();
+#else
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (unsigned long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+}
+
+unsigned long long thread_now_us(void) {
+
+#ifdef __WIN32
+  LARGE_INTEGER counter, frequency;
+
+  QueryPerformanceCounter(&counter);
+  QueryPerformanceFrequency(&frequency);
+
+  return (unsigned long long) (counter.QuadPart / frequency.QuadPart) *
+           1000000 +
+         (unsigned long long) (counter.QuadPart % frequency.QuadPart) *
+           1000000 / frequency.QuadPart;
+#else
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (unsigned long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
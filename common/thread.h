@@ -0,0 +1,161 @@
+/*
+ * Copyright 2015-2018 Yubico AB
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* thread.h
+**
+** Implements platform specific threads, mutexes and condition variables
+*/
+
+#ifndef _YUBICOM_THREAD_H_
+#define _YUBICOM_THREAD_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "../common/platform-config.h"
+
+#ifdef __WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef __WIN32
+#define YH_INTERNAL __attribute__((visibility("hidden")))
+#else
+#define YH_INTERNAL
+#endif
+
+#ifdef __WIN32
+typedef CRITICAL_SECTION thread_mutex;
+typedef CONDITION_VARIABLE thread_cond;
+#else
+typedef pthread_mutex_t thread_mutex;
+typedef pthread_cond_t thread_cond;
+#endif
+
+#ifdef __WIN32
+typedef HANDLE thread_handle;
+#else
+typedef pthread_t thread_handle;
+#endif
+
+typedef void (*thread_func)(void *arg);
+
+bool YH_INTERNAL thread_create(thread_handle *thread, thread_func func,
+                               void *arg);
+void YH_INTERNAL thread_join(thread_handle thread);
+
+bool YH_INTERNAL thread_mutex_init(thread_mutex *mutex);
+void YH_INTERNAL thread_mutex_destroy(thread_mutex *mutex);
+void YH_INTERNAL thread_mutex_lock(thread_mutex *mutex);
+// Returns false without waiting if the mutex is held
+bool YH_INTERNAL thread_mutex_trylock(thread_mutex *mutex);
+void YH_INTERNAL thread_mutex_unlock(thread_mutex *mutex);
+
+bool YH_INTERNAL thread_cond_init(thread_cond *cond);
+void YH_INTERNAL thread_cond_destroy(thread_cond *cond);
+void YH_INTERNAL thread_cond_signal(thread_cond *cond);
+void YH_INTERNAL thread_cond_broadcast(thread_cond *cond);
+// Wait for the condition, for at most timeout_ms milliseconds unless it is
+// negative. Returns false on timeout.
+bool YH_INTERNAL thread_cond_wait(thread_cond *cond, thread_mutex *mutex,
+                                  int timeout_ms);
+
+// Milliseconds on a monotonic clock, for computing what is left of a timeout
+unsigned long long YH_INTERNAL thread_now_ms(void);
+// Microseconds on a monotonic clock, for measuring latencies
+unsigned long long YH_INTERNAL thread_now_us(void);
+
+// Relaxed atomic operations on 64-bit counters, which are updated by several
+// threads without a lock
+// Returns the new value
+static inline uint64_t thread_atomic_add(volatile uint64_t *value,
+                                         uint64_t n) {
+#ifdef __WIN32
+  return (uint64_t) InterlockedExchangeAdd64((volatile LONG64 *) value,
+                                             (LONG64) n) +
+         n;
+#else
+  return __atomic_add_fetch(value, n, __ATOMIC_RELAXED);
+#endif
+}
+
+static inline uint64_t thread_atomic_load(volatile uint64_t *value) {
+#ifdef __WIN32
+  return (uint64_t) InterlockedCompareExchange64((volatile LONG64 *) value, 0,
+                                                 0);
+#else
+  return __atomic_load_n(value, __ATOMIC_RELAXED);
+#endif
+}
+
+static inline void thread_atomic_store(volatile uint64_t *value, uint64_t n) {
+#ifdef __WIN32
+  InterlockedExchange64((volatile LONG64 *) value, (LONG64) n);
+#else
+  __atomic_store_n(value, n, __ATOMIC_RELAXED);
+#endif
+}
+
+// Like the above, but writes before a release store are seen by any thread
+// that acquire loads the value stored
+static inline uint64_t thread_atomic_load_acquire(volatile uint64_t *value) {
+#ifdef __WIN32
+  return thread_atomic_load(value);
+#else
+  return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static inline void thread_atomic_store_release(volatile uint64_t *value,
+                                               uint64_t n) {
+#ifdef __WIN32
+  thread_atomic_store(value, n);
+#else
+  __atomic_store_n(value, n, __ATOMIC_RELEASE);
+#endif
+}
+
+// Raise the value to n unless it is larger already
+static inline void thread_atomic_max(volatile uint64_t *value, uint64_t n) {
+  uint64_t current = thread_atomic_load(value);
+  while (current < n) {
+#ifdef __WIN32
+    uint64_t seen =
+      (uint64_t) InterlockedCompareExchange64((volatile LONG64 *) value,
+                                              (LONG64) n, (LONG64) current);
+    if (seen == current) {
+      break;
+    }
+    current = seen;
+#else
+    if (__atomic_compare_exchange_n(value, &current, n, true, __ATOMIC_RELAXED,
+                                    __ATOMIC_RELAXED)) {
+      break;
+    }
+#endif
+  }
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _YUBICOM_THREAD_H_ */
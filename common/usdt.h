@@ -0,0 +1,44 @@
+/*
+ * Copyright 2015-2018 Yubico AB
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* usdt.h
+**
+** Static probe points for bpftrace, perf and SystemTap. They are a single nop
+** each unless a tracer is attached, and expand to nothing without sys/sdt.h.
+** See resources/yubihsm.bt for the probes and their arguments.
+*/
+
+#ifndef _YUBICOM_USDT_H_
+#define _YUBICOM_USDT_H_
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define USDT_ENABLED 1
+#define USDT1(provider, name, a) DTRACE_PROBE1(provider, name, a)
+#define USDT2(provider, name, a, b) DTRACE_PROBE2(provider, name, a, b)
+#define USDT3(provider, name, a, b, c) DTRACE_PROBE3(provider, name, a, b, c)
+#define USDT4(provider, name, a, b, c, d)                                      \
+  DTRACE_PROBE4(provider, name, a, b, c, d)
+#else
+#define USDT1(provider, name, a) ((void) (a))
+#define USDT2(provider, name, a, b) ((void) (a), (void) (b))
+#define USDT3(provider, name, a, b, c) ((void) (a), (void) (b), (void) (c))
+#define USDT4(provider, name, a, b, c, d)                                      \
+  ((void) (a), (void) (b), (void) (c), (void) (d))
+#endif
+
+#endif /* _YUBICOM_USDT_H_ */
@@ -369,7 +369,7 @@ cleanup:
   return ret;
 }
 
-void format_digest(uint8_t *digest, char *str, uint16_t len) {
+void format_digest(const uint8_t *digest, char *str, uint16_t len) {
 
   for (uint32_t i = 0; i < len; i++) {
     sprintf(str + (2 * i), "%02x", digest[i]);
@@ -737,3 +737,58 @@ bool split_hmac_key(yh_algorithm algorithm, uint8_t *in, size_t in_len,
 
   return true;
 }
+
+static void print_latencies(FILE *fp, const yh_latency_histogram *histogram) {
+
+  if (histogram->count == 0) {
+    fprintf(fp, " %26s", "-");
+    return;
+  }
+
+  fprintf(fp, " %8llu %8llu %8llu",
+          (unsigned long long) yh_get_latency_percentile(histogram, 50),
+          (unsigned long long) yh_get_latency_percentile(histogram, 99),
+          (unsigned long long) histogram->max_us);
+}
+
+void print_connector_stats(FILE *fp, const yh_connector_stats *stats) {
+
+  fprintf(fp, "Statistics over %llu.%03llu s\n",
+          (unsigned long long) stats->elapsed_ms / 1000,
+          (unsigned long long) stats->elapsed_ms % 1000);
+  fprintf(fp,
+          "%-4s %8s %6s %10s %10s %26s %26s %26s\n"
+          "%-4s %8s %6s %10s %10s %26s %26s %26s\n",
+          "cmd", "calls", "errors", "bytes out", "bytes in",
+          "total (us)", "transport (us)", "crypto (us)", "", "", "", "", "",
+          "p50      p99      max", "p50      p99      max",
+          "p50      p99      max");
+  for (size_t i = 0; i < YH_STATS_COMMANDS; i++) {
+    const yh_command_stats *command = &stats->commands[i];
+    if (command->calls == 0) {
+      continue;
+    }
+    fprintf(fp, "0x%02zx %8llu %6llu %10llu %10llu", i,
+            (unsigned long long) command->calls,
+            (unsigned long long) command->errors,
+            (unsigned long long) command->bytes_out,
+            (unsigned long long) command->bytes_in);
+    print_latencies(fp, &command->total);
+    print_latencies(fp, &command->transport);
+    print_latencies(fp, &command->crypto);
+    fprintf(fp, "\n");
+  }
+
+  if (stats->connections != 0) {
+    fprintf(fp, "%8llu connections, %llu TLS handshakes\n",
+            (unsigned long long) stats->connections,
+            (unsigned long long) stats->tls_handshakes);
+  }
+
+  for (int i = 0; i < YH_STATS_RESULTS; i++) {
+    if (stats->results[i] != 0) {
+      fprintf(fp, "%8llu %s\n", (unsigned long long) stats->results[i],
+              yh_strerror(-i));
+    }
+  }
+}
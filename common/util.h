@@ -43,7 +43,8 @@ bool YH_INTERNAL set_component(uint8_t *in_ptr, const BIGNUM *bn,
 bool YH_INTERNAL read_private_key(uint8_t *buf, size_t len, yh_algorithm *algo,
                                   uint8_t *bytes, size_t *bytes_len,
                                   bool internal_repr);
-void YH_INTERNAL format_digest(uint8_t *digest, char *str, uint16_t len);
+void YH_INTERNAL format_digest(const uint8_t *digest, char *str,
+                               uint16_t len);
 int YH_INTERNAL algo2nid(yh_algorithm algo);
 bool YH_INTERNAL algo2type(yh_algorithm algorithm, yh_object_type *type);
 void YH_INTERNAL parse_NID(uint8_t *data, uint16_t data_len,
@@ -61,4 +62,7 @@ bool YH_INTERNAL base64_decode(const char *in, uint8_t *out, size_t *len);
 bool YH_INTERNAL split_hmac_key(yh_algorithm algorithm, uint8_t *in,
                                 size_t in_len, uint8_t *out, size_t *out_len);
 
+void YH_INTERNAL print_connector_stats(FILE *fp,
+                                       const yh_connector_stats *stats);
+
 #endif
@@ -0,0 +1,193 @@
+/*
+ * Copyright 2015-2018 Yubico AB
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <openssl/ec.h>
+#include <openssl/ecdsa.h>
+#include <openssl/evp.h>
+
+#include "util.h"
+
+#include <yubihsm.h>
+
+#ifndef DEFAULT_CONNECTOR_URL
+#define DEFAULT_CONNECTOR_URL "http://127.0.0.1:12345"
+#endif
+
+#define N_THREADS 2
+#define N_DIGESTS 16
+
+const char *key_label = "label";
+const uint8_t password[] = "password";
+
+struct batch {
+  yh_session_pool *pool;
+  uint16_t key_id;
+  uint8_t digests[N_DIGESTS][32];
+  uint8_t signatures[N_DIGESTS][128];
+  size_t signatures_len[N_DIGESTS];
+  yh_rc rcs[N_DIGESTS];
+  yh_rc yrc;
+};
+
+// Both threads run a batch on the same pool, and so on the same connector
+static void *sign_batch(void *arg) {
+  struct batch *batch = arg;
+  const uint8_t *in[N_DIGESTS];
+  size_t in_len[N_DIGESTS];
+  uint8_t *out[N_DIGESTS];
+
+  for (size_t i = 0; i < N_DIGESTS; i++) {
+    in[i] = batch->digests[i];
+    in_len[i] = sizeof(batch->digests[i]);
+    out[i] = batch->signatures[i];
+    batch->signatures_len[i] = sizeof(batch->signatures[i]);
+  }
+
+  batch->yrc =
+    yh_util_sign_ecdsa_batch(batch->pool, batch->key_id, in, in_len,
+                             N_DIGESTS, out, batch->signatures_len, batch->rcs);
+
+  return NULL;
+}
+
+int main(void) {
+  yh_connector *connector = NULL;
+  yh_session_pool *pool = NULL;
+  yh_session *session = NULL;
+  yh_rc yrc = YHR_GENERIC_ERROR;
+
+  uint16_t authkey = 1;
+
+  const char *connector_url;
+
+  connector_url = getenv("DEFAULT_CONNECTOR_URL");
+  if (connector_url == NULL) {
+    connector_url = DEFAULT_CONNECTOR_URL;
+  }
+
+  yrc = yh_init();
+  assert(yrc == YHR_SUCCESS);
+
+  yrc = yh_init_connector(connector_url, &connector);
+  assert(yrc == YHR_SUCCESS);
+
+  yrc = yh_connect(connector, 0);
+  assert(yrc == YHR_SUCCESS);
+
+  yrc = yh_create_session_pool_derived(connector, authkey, password,
+                                       sizeof(password) - 1, 4, &pool);
+  assert(yrc == YHR_SUCCESS);
+
+  yrc = yh_session_pool_checkout(pool, -1, &session);
+  assert(yrc == YHR_SUCCESS);
+
+  yh_capabilities capabilities = {{0}};
+  yrc = yh_string_to_capabilities("sign-ecdsa", &capabilities);
+  assert(yrc == YHR_SUCCESS);
+
+  uint16_t domain_five = 0;
+  yrc = yh_string_to_domains("5", &domain_five);
+  assert(yrc == YHR_SUCCESS);
+
+  uint16_t key_id = 0; // ID 0 lets the device generate an ID
+  yrc = yh_util_generate_ec_key(session, &key_id, key_label, domain_five,
+                                &capabilities, YH_ALGO_EC_P256);
+  assert(yrc == YHR_SUCCESS);
+
+  printf("Generated key with ID %04x\n", key_id);
+
+  uint8_t public_key[512];
+  size_t public_key_len = sizeof(public_key) - 1;
+  yrc = yh_util_get_public_key(session, key_id, public_key + 1,
+                               &public_key_len, NULL);
+  assert(yrc == YHR_SUCCESS);
+  public_key[0] = 0x04; // hack to make it a valid ec pubkey..
+  public_key_len++;
+
+  yrc = yh_session_pool_checkin(pool, session, YHR_SUCCESS);
+  assert(yrc == YHR_SUCCESS);
+
+  static struct batch batches[N_THREADS];
+  pthread_t threads[N_THREADS];
+
+  for (size_t i = 0; i < N_THREADS; i++) {
+    batches[i].pool = pool;
+    batches[i].key_id = key_id;
+    for (size_t j = 0; j < N_DIGESTS; j++) {
+      char data[64];
+      unsigned int digest_len = sizeof(batches[i].digests[j]);
+      snprintf(data, sizeof(data), "batch %zu item %zu", i, j);
+      EVP_Digest(data, strlen(data), batches[i].digests[j], &digest_len,
+                 EVP_sha256(), NULL);
+    }
+    assert(pthread_create(&threads[i], NULL, sign_batch, &batches[i]) == 0);
+  }
+
+  for (size_t i = 0; i < N_THREADS; i++) {
+    assert(pthread_join(threads[i], NULL) == 0);
+  }
+
+  EC_KEY *eckey = EC_KEY_new();
+  int nid = algo2nid(YH_ALGO_EC_P256);
+  EC_GROUP *group = EC_GROUP_new_by_curve_name(nid);
+  EC_POINT *point;
+
+  EC_GROUP_set_asn1_flag(group, nid);
+  EC_KEY_set_group(eckey, group);
+  point = EC_POINT_new(group);
+  EC_POINT_oct2point(group, point, public_key, public_key_len, NULL);
+  EC_KEY_set_public_key(eckey, point);
+
+  // Every signature has to match its own digest, not one of the other batch
+  for (size_t i = 0; i < N_THREADS; i++) {
+    assert(batches[i].yrc == YHR_SUCCESS);
+    for (size_t j = 0; j < N_DIGESTS; j++) {
+      assert(batches[i].rcs[j] == YHR_SUCCESS);
+      assert(ECDSA_verify(0, batches[i].digests[j],
+                          sizeof(batches[i].digests[j]),
+                          batches[i].signatures[j],
+                          batches[i].signatures_len[j], eckey) == 1);
+    }
+  }
+
+  printf("Verified %d signatures made by %d concurrent batches\n",
+         N_THREADS * N_DIGESTS, N_THREADS);
+
+  EC_POINT_free(point);
+  EC_KEY_free(eckey);
+  EC_GROUP_free(group);
+
+  yrc = yh_destroy_session_pool(&pool);
+  assert(yrc == YHR_SUCCESS);
+
+  yh_disconnect(connector);
+
+  yrc = yh_exit();
+  assert(yrc == YHR_SUCCESS);
+
+  return 0;
+}
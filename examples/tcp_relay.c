@@ -0,0 +1,223 @@
+/*
+ * Copyright 2015-2018 Yubico AB
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Reference relay for yhtcp:// connectors. It passes the frames of its
+ * clients on to a device reached through any other connector URL, such as
+ * yhusb:// or a connector in front of the emulator, e.g.
+ *
+ *   tcp_relay 12346 yhusb://
+ *   DEFAULT_CONNECTOR_URL=yhtcp://127.0.0.1:12346 ./echo
+ *
+ * It only listens on the loopback interface.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <yubihsm.h>
+#include "yubihsm_tcp.h"
+
+#ifndef DEFAULT_CONNECTOR_URL
+#define DEFAULT_CONNECTOR_URL "http://127.0.0.1:12345"
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+static yh_connector *connector;
+static uint16_t port = YH_TCP_DEFAULT_PORT;
+
+static int read_all(int fd, void *buf, size_t len) {
+  uint8_t *ptr = buf;
+
+  while (len > 0) {
+    ssize_t n = recv(fd, ptr, len, 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n <= 0) {
+      return -1;
+    }
+    ptr += n;
+    len -= n;
+  }
+
+  return 0;
+}
+
+static int send_frame(int fd, uint8_t type, uint32_t id, const uint8_t *data,
+                      size_t len) {
+  uint8_t buf[sizeof(struct yh_tcp_frame) + 3 + YH_MSG_BUF_SIZE];
+  struct yh_tcp_frame frame = {type, 0, htons(len), id};
+
+  memcpy(buf, &frame, sizeof(frame));
+  memcpy(buf + sizeof(frame), data, len);
+  len += sizeof(frame);
+
+  for (size_t sent = 0; sent < len;) {
+    ssize_t n = send(fd, buf + sent, len - sent, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n <= 0) {
+      return -1;
+    }
+    sent += n;
+  }
+
+  return 0;
+}
+
+static int relay_status(int fd, uint32_t id) {
+  uint8_t major = 0;
+  uint8_t minor = 0;
+  uint8_t patch = 0;
+  char status[YH_TCP_MAX_STATUS];
+
+  yh_get_connector_version(connector, &major, &minor, &patch);
+  int len = snprintf(status, sizeof(status),
+                     "status=OK\nserial=*\nversion=%u.%u.%u\npid=%u\n"
+                     "address=127.0.0.1\nport=%u",
+                     major, minor, patch, (unsigned) getpid(), port);
+
+  return send_frame(fd, YH_TCP_FRAME_STATUS, id, (uint8_t *) status, len);
+}
+
+static int relay_msg(int fd, uint32_t id, const uint8_t *msg, size_t len) {
+  uint8_t response[3 + YH_MSG_BUF_SIZE];
+  size_t response_len = sizeof(response) - 3;
+  yh_cmd response_cmd;
+
+  if (len < 3 || len != 3 + (size_t)((msg[1] << 8) | msg[2])) {
+    fprintf(stderr, "Malformed message %u\n", ntohl(id));
+    return send_frame(fd, YH_TCP_FRAME_ERROR, id, NULL, 0);
+  }
+
+  yh_rc yrc = yh_send_plain_msg(connector, msg[0], msg + 3, len - 3,
+                                &response_cmd, response + 3, &response_len);
+  if (yrc != YHR_SUCCESS) {
+    fprintf(stderr, "Failed to relay message %u: %s\n", ntohl(id),
+            yh_strerror(yrc));
+    return send_frame(fd, YH_TCP_FRAME_ERROR, id, NULL, 0);
+  }
+
+  response[0] = response_cmd;
+  response[1] = response_len >> 8;
+  response[2] = response_len & 0xff;
+
+  return send_frame(fd, YH_TCP_FRAME_MSG, id, response, 3 + response_len);
+}
+
+static void *serve_client(void *arg) {
+  int fd = (int) (intptr_t) arg;
+  uint8_t buf[YH_TCP_MAX_TAG + 3 + YH_MSG_BUF_SIZE];
+  struct yh_tcp_frame frame;
+
+  while (read_all(fd, &frame, sizeof(frame)) == 0) {
+    size_t len = ntohs(frame.len);
+    if (frame.tag_len > YH_TCP_MAX_TAG || len > sizeof(buf) - frame.tag_len ||
+        read_all(fd, buf, frame.tag_len + len) != 0) {
+      break;
+    }
+
+    // The session tag is only needed by connectors that track sessions
+    int rc;
+    if (frame.type == YH_TCP_FRAME_STATUS) {
+      rc = relay_status(fd, frame.id);
+    } else if (frame.type == YH_TCP_FRAME_MSG) {
+      rc = relay_msg(fd, frame.id, buf + frame.tag_len, len);
+    } else {
+      fprintf(stderr, "Unknown frame type %u\n", frame.type);
+      break;
+    }
+    if (rc != 0) {
+      break;
+    }
+  }
+
+  close(fd);
+  return NULL;
+}
+
+int main(int argc, char **argv) {
+  const char *connector_url = getenv("DEFAULT_CONNECTOR_URL");
+  if (connector_url == NULL) {
+    connector_url = DEFAULT_CONNECTOR_URL;
+  }
+
+  if (argc > 3) {
+    fprintf(stderr, "Usage: %s [port] [connector url]\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  if (argc > 1) {
+    port = atoi(argv[1]);
+  }
+  if (argc > 2) {
+    connector_url = argv[2];
+  }
+
+  yh_rc yrc = yh_init();
+  if (yrc == YHR_SUCCESS) {
+    yrc = yh_init_connector(connector_url, &connector);
+  }
+  if (yrc == YHR_SUCCESS) {
+    yrc = yh_connect(connector, 0);
+  }
+  if (yrc != YHR_SUCCESS) {
+    fprintf(stderr, "Unable to connect to %s: %s\n", connector_url,
+            yh_strerror(yrc));
+    exit(EXIT_FAILURE);
+  }
+
+  int one = 1;
+  struct sockaddr_in addr = {0};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  int s = socket(AF_INET, SOCK_STREAM, 0);
+  if (s < 0 || setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) ||
+      bind(s, (struct sockaddr *) &addr, sizeof(addr)) || listen(s, 16)) {
+    perror("Unable to listen");
+    exit(EXIT_FAILURE);
+  }
+  fprintf(stderr, "Relaying yhtcp://127.0.0.1:%u to %s\n", port,
+          connector_url);
+
+  for (;;) {
+    int fd = accept(s, NULL, NULL);
+    if (fd < 0) {
+      continue;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, serve_client, (void *) (intptr_t) fd)) {
+      close(fd);
+      continue;
+    }
+    pthread_detach(thread);
+  }
+}
@@ -0,0 +1,521 @@
+/*
+ * Copyright 2015-2018 Yubico AB
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "yubihsm.h"
+#include "internal.h"
+#include "debug_lib.h"
+
+#include "../common/rand.h"
+#include "../common/insecure_memzero.h"
+
+/*
+ * Envelopes are wrapped and unwrapped in rounds of a few chunks per session of
+ * the pool, each round being one batch. The format is described with
+ * yh_util_wrap_envelope().
+ */
+
+#define ENVELOPE_HEADER_LEN 32
+#define ENVELOPE_ID_OFFSET 16
+#define ENVELOPE_ID_LEN 8
+#define ENVELOPE_TRAILER_MAGIC "YHEI"
+#define ENVELOPE_TRAILER_LEN 24
+// Envelope ID and chunk number
+#define ENVELOPE_PREFIX_LEN (ENVELOPE_ID_LEN + 8)
+#define ENVELOPE_LAST_CHUNK 0x8000000000000000ULL
+// Nonce and MAC added by WRAP DATA
+#define ENVELOPE_WRAP_OVERHEAD (13 + 16)
+#define ENVELOPE_CHUNKS_PER_SESSION 4
+
+typedef struct {
+  uint16_t key_id;
+  size_t chunk_size;
+  uint8_t id[ENVELOPE_ID_LEN];
+  uint64_t n_chunks;
+  uint64_t index_offset;
+} envelope_info;
+
+// Buffers for one round of chunks
+typedef struct {
+  size_t size;
+  uint8_t *in_buf;
+  uint8_t *out_buf;
+  size_t in_size;
+  size_t out_size;
+  uint8_t **in;
+  size_t *in_len;
+  uint8_t **out;
+  size_t *out_len;
+  yh_rc *rcs;
+} envelope_round;
+
+static void put_be(uint8_t *p, uint64_t value, size_t len) {
+
+  for (size_t i = len; i > 0; i--) {
+    p[i - 1] = value & 0xff;
+    value >>= 8;
+  }
+}
+
+static uint64_t get_be(const uint8_t *p, size_t len) {
+
+  uint64_t value = 0;
+
+  for (size_t i = 0; i < len; i++) {
+    value = (value << 8) | p[i];
+  }
+
+  return value;
+}
+
+static void free_round(envelope_round *round) {
+
+  // The plaintext of the chunks is in either buffer, depending on direction
+  if (round->in_buf != NULL) {
+    insecure_memzero(round->in_buf, round->size * round->in_size);
+  }
+  if (round->out_buf != NULL) {
+    insecure_memzero(round->out_buf, round->size * round->out_size);
+  }
+  free(round->in_buf);
+  free(round->out_buf);
+  free(round->in);
+  free(round->in_len);
+  free(round->out);
+  free(round->out_len);
+  free(round->rcs);
+  memset(round, 0, sizeof(envelope_round));
+}
+
+static bool alloc_round(envelope_round *round, size_t size, size_t in_size,
+                        size_t out_size) {
+
+  memset(round, 0, sizeof(envelope_round));
+  round->size = size;
+  round->in_size = in_size;
+  round->out_size = out_size;
+  round->in_buf = calloc(size, in_size);
+  round->out_buf = calloc(size, out_size);
+  round->in = calloc(size, sizeof(uint8_t *));
+  round->in_len = calloc(size, sizeof(size_t));
+  round->out = calloc(size, sizeof(uint8_t *));
+  round->out_len = calloc(size, sizeof(size_t));
+  round->rcs = calloc(size, sizeof(yh_rc));
+  if (round->in_buf == NULL || round->out_buf == NULL || round->in == NULL ||
+      round->in_len == NULL || round->out == NULL || round->out_len == NULL ||
+      round->rcs == NULL) {
+    free_round(round);
+    return false;
+  }
+
+  for (size_t i = 0; i < size; i++) {
+    round->in[i] = round->in_buf + i * in_size;
+    round->out[i] = round->out_buf + i * out_size;
+  }
+
+  return true;
+}
+
+static size_t round_size(yh_session_pool *pool) {
+
+  return pool->n_sessions * ENVELOPE_CHUNKS_PER_SESSION;
+}
+
+// Read until the buffer is full or the data ends
+static yh_rc read_full(yh_envelope_read read, void *user, uint8_t *buf,
+                       size_t *len) {
+
+  size_t total = 0;
+
+  while (total < *len) {
+    size_t n = *len - total;
+    yh_rc yrc = read(user, buf + total, &n);
+    if (yrc != YHR_SUCCESS) {
+      return yrc;
+    }
+    if (n == 0) {
+      break;
+    }
+    total += n;
+  }
+  *len = total;
+
+  return YHR_SUCCESS;
+}
+
+static yh_rc write_index(yh_envelope_write write, void *user,
+                         const uint64_t *offsets, uint64_t n_chunks,
+                         uint64_t index_offset) {
+
+  uint8_t buf[64 * 8];
+  yh_rc yrc;
+
+  for (uint64_t i = 0; i < n_chunks;) {
+    size_t n = 0;
+    for (; n < sizeof(buf) / 8 && i < n_chunks; n++, i++) {
+      put_be(buf + n * 8, offsets[i], 8);
+    }
+    yrc = write(user, buf, n * 8);
+    if (yrc != YHR_SUCCESS) {
+      return yrc;
+    }
+  }
+
+  memset(buf, 0, ENVELOPE_TRAILER_LEN);
+  memcpy(buf, ENVELOPE_TRAILER_MAGIC, 4);
+  put_be(buf + 8, n_chunks, 8);
+  put_be(buf + 16, index_offset, 8);
+
+  return write(user, buf, ENVELOPE_TRAILER_LEN);
+}
+
+yh_rc yh_util_wrap_envelope(yh_session_pool *pool, uint16_t key_id,
+                            size_t chunk_size, yh_envelope_read read,
+                            yh_envelope_write write, void *user) {
+
+  if (pool == NULL || read == NULL || write == NULL ||
+      chunk_size > YH_ENVELOPE_MAX_CHUNK_SIZE) {
+    DBG_ERR("%s", yh_strerror(YHR_INVALID_PARAMETERS));
+    return YHR_INVALID_PARAMETERS;
+  }
+
+  if (chunk_size == 0) {
+    chunk_size = YH_ENVELOPE_MAX_CHUNK_SIZE;
+  }
+
+  uint8_t header[ENVELOPE_HEADER_LEN] = {0};
+  memcpy(header, YH_ENVELOPE_MAGIC, 4);
+  header[4] = YH_ENVELOPE_VERSION;
+  put_be(header + 6, key_id, 2);
+  put_be(header + 8, chunk_size, 4);
+  if (!rand_generate(header + ENVELOPE_ID_OFFSET, ENVELOPE_ID_LEN)) {
+    DBG_ERR("Failed to generate envelope ID");
+    return YHR_GENERIC_ERROR;
+  }
+
+  // One more chunk than is wrapped per round is read, to know which is last
+  envelope_round round;
+  if (!alloc_round(&round, round_size(pool) + 1,
+                   ENVELOPE_PREFIX_LEN + chunk_size,
+                   ENVELOPE_PREFIX_LEN + chunk_size +
+                     ENVELOPE_WRAP_OVERHEAD)) {
+    DBG_ERR("%s", yh_strerror(YHR_MEMORY_ERROR));
+    return YHR_MEMORY_ERROR;
+  }
+
+  uint64_t *offsets = NULL;
+  uint64_t n_chunks = 0;
+  uint64_t offset = sizeof(header);
+  size_t n = 0;
+  bool end = false;
+
+  yh_rc yrc = write(user, header, sizeof(header));
+  if (yrc != YHR_SUCCESS) {
+    goto cleanup;
+  }
+
+  for (;;) {
+    while (n < round.size && !end) {
+      size_t len = chunk_size;
+      yrc = read_full(read, user, round.in[n] + ENVELOPE_PREFIX_LEN, &len);
+      if (yrc != YHR_SUCCESS) {
+        goto cleanup;
+      }
+      end = len < chunk_size;
+      // Unless there is no data at all, the last chunk is not empty
+      if (len == 0 && n > 0) {
+        break;
+      }
+      round.in_len[n++] = ENVELOPE_PREFIX_LEN + len;
+    }
+
+    size_t count = end ? n : n - 1;
+    for (size_t i = 0; i < count; i++) {
+      uint64_t number = n_chunks + i;
+      if (end && i == count - 1) {
+        number |= ENVELOPE_LAST_CHUNK;
+      }
+      memcpy(round.in[i], header + ENVELOPE_ID_OFFSET, ENVELOPE_ID_LEN);
+      put_be(round.in[i] + ENVELOPE_ID_LEN, number, 8);
+      round.out_len[i] = round.out_size;
+    }
+
+    yrc = yh_util_wrap_data_batch(pool, key_id,
+                                  (const uint8_t *const *) round.in,
+                                  round.in_len, count, round.out,
+                                  round.out_len, round.rcs);
+    if (yrc != YHR_SUCCESS) {
+      DBG_ERR("Failed to wrap chunks: %s", yh_strerror(yrc));
+      goto cleanup;
+    }
+
+    uint64_t *more = realloc(offsets, (n_chunks + count) * sizeof(uint64_t));
+    if (more == NULL) {
+      yrc = YHR_MEMORY_ERROR;
+      goto cleanup;
+    }
+    offsets = more;
+
+    for (size_t i = 0; i < count; i++) {
+      offsets[n_chunks++] = offset;
+      yrc = write(user, round.out[i], round.out_len[i]);
+      if (yrc != YHR_SUCCESS) {
+        goto cleanup;
+      }
+      offset += round.out_len[i];
+    }
+
+    if (end) {
+      break;
+    }
+
+    // The chunk read ahead is the first of the next round
+    uint8_t *first = round.in[0];
+    round.in[0] = round.in[n - 1];
+    round.in[n - 1] = first;
+    round.in_len[0] = round.in_len[n - 1];
+    n = 1;
+  }
+
+  yrc = write_index(write, user, offsets, n_chunks, offset);
+
+cleanup:
+  free(offsets);
+  free_round(&round);
+
+  return yrc;
+}
+
+static yh_rc read_info(yh_envelope_read_at read_at, uint64_t size,
+                       void *user, envelope_info *info) {
+
+  uint8_t header[ENVELOPE_HEADER_LEN];
+  uint8_t trailer[ENVELOPE_TRAILER_LEN];
+
+  if (size < ENVELOPE_HEADER_LEN + 8 + ENVELOPE_TRAILER_LEN) {
+    DBG_ERR("Envelope too short");
+    return YHR_INVALID_PARAMETERS;
+  }
+
+  yh_rc yrc = read_at(user, 0, header, sizeof(header));
+  if (yrc != YHR_SUCCESS) {
+    return yrc;
+  }
+  yrc = read_at(user, size - sizeof(trailer), trailer, sizeof(trailer));
+  if (yrc != YHR_SUCCESS) {
+    return yrc;
+  }
+
+  if (memcmp(header, YH_ENVELOPE_MAGIC, 4) != 0 ||
+      header[4] != YH_ENVELOPE_VERSION ||
+      memcmp(trailer, ENVELOPE_TRAILER_MAGIC, 4) != 0) {
+    DBG_ERR("Not an envelope");
+    return YHR_INVALID_PARAMETERS;
+  }
+
+  info->key_id = get_be(header + 6, 2);
+  info->chunk_size = get_be(header + 8, 4);
+  memcpy(info->id, header + ENVELOPE_ID_OFFSET, ENVELOPE_ID_LEN);
+  info->n_chunks = get_be(trailer + 8, 8);
+  info->index_offset = get_be(trailer + 16, 8);
+
+  uint64_t index_end = size - sizeof(trailer);
+  if (info->chunk_size == 0 || info->chunk_size > YH_ENVELOPE_MAX_CHUNK_SIZE ||
+      info->n_chunks == 0 || info->index_offset < sizeof(header) ||
+      info->index_offset > index_end ||
+      info->n_chunks != (index_end - info->index_offset) / 8 ||
+      (index_end - info->index_offset) % 8 != 0) {
+    DBG_ERR("Malformed envelope");
+    return YHR_INVALID_PARAMETERS;
+  }
+
+  return YHR_SUCCESS;
+}
+
+yh_rc yh_get_envelope_info(yh_envelope_read_at read_at, uint64_t size,
+                           void *user, uint16_t *key_id, size_t *chunk_size,
+                           uint64_t *n_chunks) {
+
+  if (read_at == NULL) {
+    DBG_ERR("%s", yh_strerror(YHR_INVALID_PARAMETERS));
+    return YHR_INVALID_PARAMETERS;
+  }
+
+  envelope_info info;
+  yh_rc yrc = read_info(read_at, size, user, &info);
+  if (yrc != YHR_SUCCESS) {
+    return yrc;
+  }
+
+  if (key_id != NULL) {
+    *key_id = info.key_id;
+  }
+  if (chunk_size != NULL) {
+    *chunk_size = info.chunk_size;
+  }
+  if (n_chunks != NULL) {
+    *n_chunks = info.n_chunks;
+  }
+
+  return YHR_SUCCESS;
+}
+
+/*
+ * Read the wrapped chunks of a round, which are next to each other
+ */
+static yh_rc read_chunks(yh_envelope_read_at read_at, void *user,
+                         const envelope_info *info, uint64_t first,
+                         size_t count, envelope_round *round) {
+
+  uint8_t index[8 * 2];
+  uint64_t start = 0;
+  uint64_t end = 0;
+  yh_rc yrc;
+
+  for (size_t i = 0; i <= count; i++) {
+    if (first + i == info->n_chunks) {
+      end = info->index_offset;
+    } else {
+      yrc = read_at(user, info->index_offset + (first + i) * 8, index, 8);
+      if (yrc != YHR_SUCCESS) {
+        return yrc;
+      }
+      end = get_be(index, 8);
+    }
+
+    if (i == 0) {
+      start = end;
+      if (start < ENVELOPE_HEADER_LEN) {
+        DBG_ERR("Malformed envelope index");
+        return YHR_INVALID_PARAMETERS;
+      }
+    } else {
+      uint64_t chunk_start = i == 1 ? start : round->in_len[i - 2];
+      if (end < chunk_start + ENVELOPE_PREFIX_LEN + ENVELOPE_WRAP_OVERHEAD ||
+          end - chunk_start > round->in_size || end > info->index_offset) {
+        DBG_ERR("Malformed envelope index");
+        return YHR_INVALID_PARAMETERS;
+      }
+      // Offsets for now, turned into lengths below
+      round->in_len[i - 1] = end;
+    }
+  }
+
+  yrc = read_at(user, start, round->in_buf, end - start);
+  if (yrc != YHR_SUCCESS) {
+    return yrc;
+  }
+
+  uint64_t offset = start;
+  uint8_t *p = round->in_buf;
+  for (size_t i = 0; i < count; i++) {
+    uint64_t chunk_end = round->in_len[i];
+    round->in[i] = p;
+    round->in_len[i] = chunk_end - offset;
+    p += round->in_len[i];
+    offset = chunk_end;
+  }
+
+  return YHR_SUCCESS;
+}
+
+yh_rc yh_util_unwrap_envelope(yh_session_pool *pool,
+                              yh_envelope_read_at read_at, uint64_t size,
+                              uint64_t first_chunk, uint64_t n_chunks,
+                              yh_envelope_write write, void *user) {
+
+  if (pool == NULL || read_at == NULL || write == NULL) {
+    DBG_ERR("%s", yh_strerror(YHR_INVALID_PARAMETERS));
+    return YHR_INVALID_PARAMETERS;
+  }
+
+  envelope_info info;
+  yh_rc yrc = read_info(read_at, size, user, &info);
+  if (yrc != YHR_SUCCESS) {
+    return yrc;
+  }
+
+  if (first_chunk >= info.n_chunks) {
+    DBG_ERR("The envelope has %llu chunks",
+            (unsigned long long) info.n_chunks);
+    return YHR_INVALID_PARAMETERS;
+  }
+  if (n_chunks == 0 || n_chunks > info.n_chunks - first_chunk) {
+    n_chunks = info.n_chunks - first_chunk;
+  }
+
+  // The wrapped chunks of a round are read into in_buf as one piece
+  envelope_round round;
+  if (!alloc_round(&round, round_size(pool),
+                   ENVELOPE_PREFIX_LEN + info.chunk_size +
+                     ENVELOPE_WRAP_OVERHEAD,
+                   ENVELOPE_PREFIX_LEN + info.chunk_size)) {
+    DBG_ERR("%s", yh_strerror(YHR_MEMORY_ERROR));
+    return YHR_MEMORY_ERROR;
+  }
+
+  for (uint64_t chunk = first_chunk; chunk < first_chunk + n_chunks;) {
+    uint64_t left = first_chunk + n_chunks - chunk;
+    size_t count = left < round.size ? (size_t) left : round.size;
+
+    yrc = read_chunks(read_at, user, &info, chunk, count, &round);
+    if (yrc != YHR_SUCCESS) {
+      goto cleanup;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+      round.out_len[i] = round.out_size;
+    }
+    yrc = yh_util_unwrap_data_batch(pool, info.key_id,
+                                    (const uint8_t *const *) round.in,
+                                    round.in_len, count, round.out,
+                                    round.out_len, round.rcs);
+    if (yrc != YHR_SUCCESS) {
+      DBG_ERR("Failed to unwrap chunks: %s", yh_strerror(yrc));
+      goto cleanup;
+    }
+
+    for (size_t i = 0; i < count; i++, chunk++) {
+      uint64_t number = chunk;
+      if (chunk == info.n_chunks - 1) {
+        number |= ENVELOPE_LAST_CHUNK;
+      }
+      size_t len = round.out_len[i] >= ENVELOPE_PREFIX_LEN
+                     ? round.out_len[i] - ENVELOPE_PREFIX_LEN
+                     : 0;
+      if (round.out_len[i] < ENVELOPE_PREFIX_LEN ||
+          memcmp(round.out[i], info.id, ENVELOPE_ID_LEN) != 0 ||
+          get_be(round.out[i] + ENVELOPE_ID_LEN, 8) != number ||
+          (chunk != info.n_chunks - 1 && len != info.chunk_size)) {
+        DBG_ERR("Chunk %llu does not belong there", (unsigned long long) chunk);
+        yrc = YHR_GENERIC_ERROR;
+        goto cleanup;
+      }
+      yrc = write(user, round.out[i] + ENVELOPE_PREFIX_LEN, len);
+      if (yrc != YHR_SUCCESS) {
+        goto cleanup;
+      }
+    }
+    insecure_memzero(round.out_buf, round.size * round.out_size);
+  }
+
+cleanup:
+  free_round(&round);
+
+  return yrc;
+}
@@ -61,6 +61,8 @@ static const err_t errors[] = {
   ERR(YHR_CONNECTOR_ERROR, "Connector operation failed"),
   ERR(YHR_DEVICE_SSH_CA_CONSTRAINT_VIOLATION, "SSH CA constraint violation"),
   ERR(YHR_DEVICE_ALGORITHM_DISABLED, "Algorithm disabled"),
+  ERR(YHR_TIMEOUT, "Operation timed out"),
+  ERR(YHR_LOG_VERIFICATION_FAILED, "Audit log verification failed"),
 };
 
 const char *yh_strerror(yh_rc err) {
@@ -0,0 +1,398 @@
+/*
+ * Copyright 2015-2018 Yubico AB
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#ifndef __WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "yubihsm.h"
+#include "internal.h"
+
+/*
+ * Each thread records into a ring of its own, so recording takes no lock: the
+ * thread writes a record and then publishes it by advancing the head of its
+ * ring. A thread claims a ring under the lock when it first records, gives it
+ * back when it exits, and rings are freed only by flight_exit(). Dumps read the
+ * rings without the lock, which keeps them usable from signal handlers.
+ *
+ * The path to dump to is published the same way. Paths are never changed once
+ * published and are kept until flight_exit(), so a dump that loaded one can
+ * keep using it while the recorder is set up again.
+ */
+
+#define FLIGHT_MAX_RINGS 256
+#define FLIGHT_PATH_MAX 1024
+
+#ifdef _MSC_VER
+#define FLIGHT_THREAD_LOCAL __declspec(thread)
+#else
+#define FLIGHT_THREAD_LOCAL _Thread_local
+#endif
+
+typedef struct {
+  uint64_t size;
+  // Records written so far, the next one goes at head % size
+  volatile uint64_t head;
+  // 1 while a thread records into the ring
+  volatile uint64_t owned;
+  uint32_t index;
+  yh_flight_record records[];
+} flight_ring;
+
+typedef struct flight_path {
+  struct flight_path *next;
+  char name[];
+} flight_path;
+
+#ifdef __WIN32
+typedef HANDLE flight_file;
+#else
+typedef int flight_file;
+#endif
+
+static struct {
+  bool ready;
+  thread_mutex lock;
+#ifdef __WIN32
+  DWORD key;
+#else
+  pthread_key_t key;
+#endif
+  // Records per ring, 0 while the recorder is disabled
+  volatile uint64_t size;
+  // Bumped when the rings are freed, see flight_record()
+  volatile uint64_t epoch;
+  volatile uint64_t dump_on_error;
+  // Failed sends since the last one that went through, only the first of them
+  // dumps
+  volatile uint64_t failed_sends;
+  volatile uint64_t dumping;
+  volatile uint64_t n_rings;
+  flight_ring *rings[FLIGHT_MAX_RINGS];
+  // The flight_path dumps write to, 0 for none
+  volatile uint64_t path;
+  // Every path published so far
+  flight_path *paths;
+} flight;
+
+static FLIGHT_THREAD_LOCAL flight_ring *local_ring;
+static FLIGHT_THREAD_LOCAL uint64_t local_epoch;
+
+static void release_ring(void *ring) {
+
+  thread_atomic_store(&((flight_ring *) ring)->owned, 0);
+}
+
+#ifdef __WIN32
+static VOID WINAPI release_ring_fls(PVOID ring) {
+
+  if (ring != NULL) {
+    release_ring(ring);
+  }
+}
+#endif
+
+static flight_ring *claim_ring(uint64_t size) {
+
+  flight_ring *ring = NULL;
+
+  thread_mutex_lock(&flight.lock);
+  uint64_t n_rings = flight.n_rings;
+  for (uint64_t i = 0; i < n_rings; i++) {
+    if (flight.rings[i]->size == size &&
+        thread_atomic_load(&flight.rings[i]->owned) == 0) {
+      ring = flight.rings[i];
+      break;
+    }
+  }
+  if (ring == NULL && n_rings < FLIGHT_MAX_RINGS) {
+    ring = calloc(1, sizeof(flight_ring) + size * sizeof(yh_flight_record));
+    if (ring != NULL) {
+      ring->size = size;
+      ring->index = (uint32_t) n_rings;
+      flight.rings[n_rings] = ring;
+      thread_atomic_store_release(&flight.n_rings, n_rings + 1);
+    }
+  }
+  if (ring != NULL) {
+    thread_atomic_store(&ring->owned, 1);
+    // Given back when the thread exits
+#ifdef __WIN32
+    FlsSetValue(flight.key, ring);
+#else
+    pthread_setspecific(flight.key, ring);
+#endif
+  }
+  thread_mutex_unlock(&flight.lock);
+
+  return ring;
+}
+
+bool flight_init(void) {
+
+  if (flight.ready) {
+    return true;
+  }
+
+  if (!thread_mutex_init(&flight.lock)) {
+    return false;
+  }
+#ifdef __WIN32
+  flight.key = FlsAlloc(release_ring_fls);
+  if (flight.key == FLS_OUT_OF_INDEXES) {
+#else
+  if (pthread_key_create(&flight.key, release_ring) != 0) {
+#endif
+    thread_mutex_destroy(&flight.lock);
+    return false;
+  }
+  flight.ready = true;
+
+  return true;
+}
+
+void flight_exit(void) {
+
+  if (!flight.ready) {
+    return;
+  }
+
+  thread_atomic_store(&flight.size, 0);
+  // Rings are given back before they are freed, not after
+#ifdef __WIN32
+  FlsFree(flight.key);
+#else
+  pthread_key_delete(flight.key);
+#endif
+  for (uint64_t i = 0; i < flight.n_rings; i++) {
+    free(flight.rings[i]);
+    flight.rings[i] = NULL;
+  }
+  thread_atomic_store(&flight.n_rings, 0);
+  thread_atomic_add(&flight.epoch, 1);
+  thread_atomic_store(&flight.path, 0);
+  while (flight.paths != NULL) {
+    flight_path *next = flight.paths->next;
+    free(flight.paths);
+    flight.paths = next;
+  }
+  thread_mutex_destroy(&flight.lock);
+  flight.ready = false;
+}
+
+yh_rc flight_configure(size_t records, const char *path, bool dump_on_error) {
+
+  if (!flight.ready) {
+    return YHR_GENERIC_ERROR;
+  }
+
+  if ((path != NULL && strlen(path) >= FLIGHT_PATH_MAX) ||
+      records > (SIZE_MAX - sizeof(flight_ring)) / sizeof(yh_flight_record)) {
+    return YHR_INVALID_PARAMETERS;
+  }
+
+  thread_mutex_lock(&flight.lock);
+  flight_path *published = NULL;
+  if (path != NULL && path[0] != '\0') {
+    for (published = flight.paths; published != NULL;
+         published = published->next) {
+      if (strcmp(published->name, path) == 0) {
+        break;
+      }
+    }
+    if (published == NULL) {
+      size_t len = strlen(path) + 1;
+      published = malloc(sizeof(flight_path) + len);
+      if (published == NULL) {
+        thread_mutex_unlock(&flight.lock);
+        return YHR_GENERIC_ERROR;
+      }
+      memcpy(published->name, path, len);
+      published->next = flight.paths;
+      flight.paths = published;
+    }
+  }
+  thread_atomic_store_release(&flight.path, (uint64_t) (uintptr_t) published);
+  thread_atomic_store(&flight.failed_sends, 0);
+  thread_atomic_store(&flight.dump_on_error, dump_on_error);
+  thread_atomic_store(&flight.size, records);
+  thread_mutex_unlock(&flight.lock);
+
+  return YHR_SUCCESS;
+}
+
+bool flight_enabled(void) {
+
+  return thread_atomic_load(&flight.size) != 0;
+}
+
+void flight_record(const yh_trace_event *event) {
+
+  uint64_t size = thread_atomic_load(&flight.size);
+  if (size == 0) {
+    return;
+  }
+
+  // A ring from before flight_exit() is gone, one of another size is given
+  // back for the next thread recording with that size
+  flight_ring *ring = local_ring;
+  uint64_t epoch = thread_atomic_load(&flight.epoch);
+  if (ring != NULL && local_epoch != epoch) {
+    ring = NULL;
+  }
+  if (ring == NULL || ring->size != size) {
+    if (ring != NULL) {
+      release_ring(ring);
+    }
+    ring = claim_ring(size);
+    local_ring = ring;
+    local_epoch = epoch;
+    if (ring == NULL) {
+      return;
+    }
+  }
+
+  uint64_t head = ring->head;
+  uint64_t elapsed = event->end_us - event->begin_us;
+  yh_flight_record *record = &ring->records[head % size];
+  record->end_us = event->end_us;
+  record->elapsed_us = elapsed > UINT32_MAX ? UINT32_MAX : (uint32_t) elapsed;
+  record->ring = ring->index;
+  record->bytes_out = (uint32_t) event->bytes_out;
+  record->bytes_in = (uint32_t) event->bytes_in;
+  record->session_id = (int16_t) event->session_id;
+  record->point = (uint8_t) event->point;
+  record->cmd = (uint8_t) event->cmd;
+  record->result = (int8_t) event->result;
+  thread_atomic_store_release(&ring->head, head + 1);
+
+  // The backend failed to reach the device. The dump of the first failure is
+  // kept until a message goes through again
+  if (event->point == YH_TRACE_SEND &&
+      thread_atomic_load(&flight.dump_on_error) != 0) {
+    if (event->result != YHR_SUCCESS) {
+      if (thread_atomic_add(&flight.failed_sends, 1) == 1) {
+        flight_dump();
+      }
+    } else if (thread_atomic_load(&flight.failed_sends) != 0) {
+      thread_atomic_store(&flight.failed_sends, 0);
+    }
+  }
+}
+
+static bool write_all(flight_file file, const void *data, size_t len) {
+
+  const uint8_t *p = data;
+
+  while (len > 0) {
+#ifdef __WIN32
+    DWORD written = 0;
+    if (!WriteFile(file, p, len > MAXDWORD ? MAXDWORD : (DWORD) len, &written,
+                   NULL)) {
+      return false;
+    }
+#else
+    ssize_t written = write(file, p, len);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+#endif
+    p += written;
+    len -= (size_t) written;
+  }
+
+  return true;
+}
+
+static bool write_ring(flight_file file, flight_ring *ring) {
+
+  uint64_t head = thread_atomic_load_acquire(&ring->head);
+  uint64_t count = head < ring->size ? head : ring->size;
+  uint64_t first = (head - count) % ring->size;
+  uint64_t before_wrap =
+    count < ring->size - first ? count : ring->size - first;
+
+  return write_all(file, &ring->records[first],
+                   before_wrap * sizeof(yh_flight_record)) &&
+         write_all(file, ring->records,
+                   (count - before_wrap) * sizeof(yh_flight_record));
+}
+
+yh_rc flight_dump(void) {
+
+  yh_rc yrc = YHR_GENERIC_ERROR;
+  yh_flight_header header;
+
+  flight_path *path =
+    (flight_path *) (uintptr_t) thread_atomic_load_acquire(&flight.path);
+  if (path == NULL) {
+    return YHR_INVALID_PARAMETERS;
+  }
+
+  // One dump at a time, the file is replaced by each
+  if (thread_atomic_add(&flight.dumping, 1) != 1) {
+    thread_atomic_add(&flight.dumping, (uint64_t) -1);
+    return YHR_GENERIC_ERROR;
+  }
+
+#ifdef __WIN32
+  flight_file file = CreateFileA(path->name, GENERIC_WRITE, 0, NULL,
+                                 CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+#else
+  flight_file file = open(path->name, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (file < 0) {
+#endif
+    goto cleanup;
+  }
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, YH_FLIGHT_MAGIC, sizeof(header.magic));
+  header.version = YH_FLIGHT_VERSION;
+  header.record_size = sizeof(yh_flight_record);
+  header.now_us = thread_now_us();
+  if (!write_all(file, &header, sizeof(header))) {
+    goto close_file;
+  }
+
+  uint64_t n_rings = thread_atomic_load_acquire(&flight.n_rings);
+  for (uint64_t i = 0; i < n_rings; i++) {
+    if (!write_ring(file, flight.rings[i])) {
+      goto close_file;
+    }
+  }
+  yrc = YHR_SUCCESS;
+
+close_file:
+#ifdef __WIN32
+  CloseHandle(file);
+#else
+  close(file);
+#endif
+
+cleanup:
+  thread_atomic_add(&flight.dumping, (uint64_t) -1);
+
+  return yrc;
+}
@@ -18,6 +18,7 @@
 #define YUBIHSM_INTERNAL_H
 
 #include "../common/platform-config.h"
+#include "../common/thread.h"
 #include "scp.h"
 
 #include <stdlib.h>
@@ -27,6 +28,21 @@ struct yh_session {
   struct yh_connector *parent;
   uint16_t authkey_id;
   bool recreate;
+  // A command sent with yh_send_secure_msg_async() has not completed
+  bool in_flight;
+  // Held while the session state is used or changed
+  thread_mutex lock;
+  // When the device last answered a command over the session
+  unsigned long long last_used;
+  // Sessions created with recreate are listed in their connector once
+  // authenticated, for the keepalive thread
+  bool listed;
+  // The keepalive thread is using the session, it stays listed until unpinned
+  bool pinned;
+  struct yh_session *next;
+  // Object metadata cached for the session, see object_cache.c
+  struct object_cache_entry *objects;
+  size_t n_objects;
   uint8_t key_enc[SCP_KEY_LEN];
   uint8_t key_mac[SCP_KEY_LEN];
   Scp_ctx s;
@@ -35,12 +51,24 @@ struct yh_session {
 
 typedef struct state yh_backend;
 
+#define YH_ASYM_SECRETS 4
+
+struct asym_secret {
+  uint8_t privkey[YH_EC_P256_PRIVKEY_LEN];
+  uint8_t device_pubkey[YH_EC_P256_PUBKEY_LEN];
+  // ECDH of the two above
+  uint8_t secret[YH_EC_P256_PRIVKEY_LEN];
+  bool used;
+};
+
 struct yh_connector {
   void *backend;
   struct backend_functions *bf;
   yh_backend *connection;
   char *status_url;
   char *api_url;
+  // Path of the socket for yhunix:// URLs, otherwise NULL
+  char *unix_socket;
   bool has_device;
   uint8_t version_major;
   uint8_t version_minor;
@@ -48,6 +76,79 @@ struct yh_connector {
   uint8_t address[32];
   uint32_t port;
   uint32_t pid;
+  // Sessions created with recreate, and the keepalive thread looking after
+  // them, see yh_set_session_keepalive(). keepalive_wakeup is also signalled
+  // when a session is unpinned
+  thread_mutex sessions_lock;
+  thread_cond keepalive_wakeup;
+  yh_session *sessions;
+  thread_handle keepalive_thread;
+  int keepalive_ms;
+  bool keepalive_stop;
+  // Protects the caches below
+  thread_mutex cache_lock;
+  // Static ECDH secrets of asymmetric authentication, in locked memory, see
+  // yh_create_session_asym()
+  struct asym_secret *asym_secrets;
+  size_t next_asym_secret;
+  // Updated with atomic operations only, see stats.c
+  yh_connector_stats *stats;
+  uint64_t stats_since;
+  // See yh_set_trace_hooks()
+  yh_trace_callback trace_begin;
+  yh_trace_callback trace_end;
+  void *trace_user;
+  uint64_t trace_id;
+  // See yh_set_object_cache(), object_generation is bumped whenever objects
+  // are created or deleted through the connector
+  unsigned int object_cache_ms;
+  size_t object_cache_size;
+  uint64_t object_generation;
+  // See yh_set_public_key_cache() and pubkey_cache.c
+  struct pubkey_cache_entry *pubkeys;
+  size_t n_pubkeys;
+  yh_public_key_parser pubkey_parser;
+  // See yh_set_random_pool() and random_pool.c
+  thread_mutex random_lock;
+  thread_cond random_wakeup;
+  yh_session_pool *random_sessions;
+  uint8_t *random;
+  size_t random_size;
+  size_t random_level;
+  size_t random_low;
+  thread_handle random_thread;
+  bool random_stop;
+  // See yh_set_log_drain() and log_drain.c
+  thread_mutex drain_lock;
+  thread_cond drain_wakeup;
+  thread_handle drain_thread;
+  int drain_ms;
+  bool drain_stop;
+  bool drain_now;
+  yh_session *drain_session;
+  yh_log_chain *drain_chain;
+  yh_log_store drain_store;
+  void *drain_user;
+};
+
+typedef enum {
+  POOL_AUTH_SYMMETRIC,
+  POOL_AUTH_ASYMMETRIC,
+} pool_auth;
+
+struct yh_session_pool {
+  yh_connector *connector;
+  thread_mutex lock;
+  thread_cond available;
+  pool_auth auth;
+  uint16_t authkey_id;
+  uint8_t key_enc[SCP_KEY_LEN];
+  uint8_t key_mac[SCP_KEY_LEN];
+  uint8_t privkey[YH_EC_P256_PRIVKEY_LEN];
+  uint8_t device_pubkey[YH_EC_P256_PUBKEY_LEN];
+  size_t n_sessions;
+  yh_session *sessions[YH_MAX_SESSIONS];
+  yh_session_health health[YH_MAX_SESSIONS];
 };
 
 #ifndef __WIN32
@@ -61,7 +162,109 @@ void YH_INTERNAL dump_msg(FILE *file, const Msg *msg);
 void YH_INTERNAL dump_response(FILE *file, const Msg *msg);
 
 void YH_INTERNAL parse_status_data(char *data, yh_connector *connector);
+
+// Count a command and its latencies in the statistics of a connector. The
+// crypto latency is what is left of total_us after transport_us, for commands
+// sent in session messages.
+void YH_INTERNAL stats_record(yh_connector *connector, yh_cmd cmd, yh_rc rc,
+                              size_t bytes_out, size_t bytes_in,
+                              unsigned long long transport_us,
+                              unsigned long long total_us, bool secure);
+void YH_INTERNAL stats_read(yh_connector *connector, yh_connector_stats *stats);
+void YH_INTERNAL stats_reset(yh_connector *connector);
+
+bool YH_INTERNAL flight_init(void);
+void YH_INTERNAL flight_exit(void);
+yh_rc YH_INTERNAL flight_configure(size_t records, const char *path,
+                                   bool dump_on_error);
+bool YH_INTERNAL flight_enabled(void);
+// Record an operation that has ended in the ring of the calling thread
+void YH_INTERNAL flight_record(const yh_trace_event *event);
+yh_rc YH_INTERNAL flight_dump(void);
+
+void YH_INTERNAL object_cache_configure(yh_connector *connector,
+                                        unsigned int lifetime_ms,
+                                        size_t max_objects);
+// Taken before a command whose result is cached, see object_cache_put()
+uint64_t YH_INTERNAL object_cache_generation(yh_connector *connector);
+// Called for every command sent in a session
+void YH_INTERNAL object_cache_command(yh_connector *connector, yh_cmd cmd);
+bool YH_INTERNAL object_cache_get(yh_session *session, uint16_t id,
+                                  yh_object_type type,
+                                  yh_object_descriptor *object);
+void YH_INTERNAL object_cache_put(yh_session *session,
+                                  const yh_object_descriptor *object,
+                                  uint64_t generation);
+// Confirm or drop the cached objects that were listed
+void YH_INTERNAL object_cache_validate(yh_session *session,
+                                       const yh_object_descriptor *objects,
+                                       size_t n_objects, uint64_t generation);
+void YH_INTERNAL object_cache_free(yh_session *session);
+
+bool YH_INTERNAL status_cache_init(void);
+void YH_INTERNAL status_cache_exit(void);
+void YH_INTERNAL status_cache_configure(unsigned int lifetime_ms);
+// Fill in the status of the connector if a fresh one is cached
+bool YH_INTERNAL status_cache_get(yh_connector *connector);
+void YH_INTERNAL status_cache_put(yh_connector *connector);
+// Called with the result of every message sent
+void YH_INTERNAL status_cache_failed(yh_connector *connector, yh_rc yrc);
+
+// Longer public keys are not cached
+#define PUBKEY_CACHE_MAX_KEY_LEN 512
+
+bool YH_INTERNAL pubkey_cache_configure(yh_connector *connector,
+                                        size_t max_keys,
+                                        const yh_public_key_parser *parser);
+bool YH_INTERNAL pubkey_cache_enabled(yh_connector *connector);
+// Sets *parsed to a new reference, or to NULL if the key was not parsed yet
+bool YH_INTERNAL pubkey_cache_get(yh_connector *connector, uint16_t id,
+                                  uint8_t sequence, uint8_t *key,
+                                  size_t *key_len, yh_algorithm *algorithm,
+                                  void **parsed);
+void YH_INTERNAL *pubkey_cache_parse(yh_connector *connector,
+                                     const uint8_t *key, size_t key_len,
+                                     yh_algorithm algorithm);
+// Takes a reference of parsed, unless it is NULL
+void YH_INTERNAL pubkey_cache_put(yh_connector *connector, uint16_t id,
+                                  uint8_t sequence, uint64_t generation,
+                                  const uint8_t *key, size_t key_len,
+                                  yh_algorithm algorithm, void *parsed);
+void YH_INTERNAL pubkey_cache_free(yh_connector *connector);
+
+// Most pseudo-random bytes one response can hold
+#define RANDOM_MAX_CHUNK (YH_MSG_BUF_SIZE - 20)
+
+yh_rc YH_INTERNAL random_pool_configure(yh_connector *connector,
+                                        yh_session_pool *pool,
+                                        size_t low_watermark,
+                                        size_t high_watermark);
+// Copy up to len bytes to out if the random pool is filled from pool, and
+// return how many
+size_t YH_INTERNAL random_pool_take(yh_connector *connector,
+                                    yh_session_pool *pool, uint8_t *out,
+                                    size_t len);
+// Keep what fits of bytes fetched with pool, the caller wipes them
+void YH_INTERNAL random_pool_put(yh_connector *connector,
+                                 yh_session_pool *pool, const uint8_t *data,
+                                 size_t len);
+void YH_INTERNAL random_pool_free(yh_connector *connector);
+
+yh_rc YH_INTERNAL log_drain_configure(yh_connector *connector,
+                                      yh_session *session, int interval_ms,
+                                      yh_log_chain *chain, yh_log_store store,
+                                      void *user);
+// Called when the device refused a command because its log is full
+void YH_INTERNAL log_drain_wakeup(yh_connector *connector);
+void YH_INTERNAL log_drain_stop(yh_connector *connector);
 bool YH_INTERNAL parse_usb_url(const char *url, unsigned long *serial);
+bool YH_INTERNAL parse_unix_url(const char *url, const char **path);
+bool YH_INTERNAL parse_tcp_url(const char *url, char *host, size_t host_len,
+                               uint16_t *port);
+
+// Called by backend_process() when a message sent with
+// backend_send_msg_async() completes
+typedef void (*backend_done_cb)(void *ctx, yh_rc yrc);
 
 struct backend_functions {
   yh_rc (*backend_init)(uint8_t verbosity, FILE *output);
@@ -74,11 +277,23 @@ struct backend_functions {
   yh_rc (*backend_option)(yh_backend *connection, yh_connector_option opt,
                           const void *val);
   void (*backend_set_verbosity)(uint8_t verbosity, FILE *output);
+  // Optional, for backends that can have several messages in flight
+  yh_rc (*backend_send_msg_async)(yh_backend *connection, Msg *msg,
+                                  Msg *response, const char *identifier,
+                                  backend_done_cb done, void *ctx);
+  yh_rc (*backend_get_pollfds)(yh_backend *connection, yh_pollfd *fds,
+                               size_t *n_fds, int *timeout_ms);
+  yh_rc (*backend_process)(yh_backend *connection, const yh_pollfd *fds,
+                           size_t n_fds);
+  // Optional, connects without asking the connector for its status, which
+  // the caller already knows
+  yh_rc (*backend_reconnect)(yh_connector *connector, int timeout);
 };
 
 #ifdef STATIC
 struct backend_functions YH_INTERNAL *usb_backend_functions(void);
 struct backend_functions YH_INTERNAL *http_backend_functions(void);
+struct backend_functions YH_INTERNAL *tcp_backend_functions(void);
 #endif
 
 #endif
@@ -23,6 +23,7 @@
 #include "yubihsm.h"
 #include "internal.h"
 #include "debug_lib.h"
+#include "yubihsm_tcp.h"
 
 #ifdef __WIN32
 #include <winsock.h>
@@ -180,3 +181,73 @@ bool parse_usb_url(const char *url, unsigned long *serial) {
   }
   return false;
 }
+
+bool parse_unix_url(const char *url, const char **path) {
+  if (strncmp(url, YH_UNIX_URL_SCHEME, strlen(YH_UNIX_URL_SCHEME)) == 0) {
+    url += strlen(YH_UNIX_URL_SCHEME);
+    // There is no host part, only an absolute path
+    if (url[0] != '/' || url[1] == '\0') {
+      DBG_ERR("Expected an absolute socket path: '%s'.", url);
+      return false;
+    }
+    *path = url;
+    return true;
+  }
+  return false;
+}
+
+bool parse_tcp_url(const char *url, char *host, size_t host_len,
+                   uint16_t *port) {
+  if (strncmp(url, YH_TCP_URL_SCHEME, strlen(YH_TCP_URL_SCHEME)) != 0) {
+    return false;
+  }
+  url += strlen(YH_TCP_URL_SCHEME);
+
+  // IPv6 addresses are in brackets, since they contain colons
+  const char *end;
+  const char *port_str;
+  if (*url == '[') {
+    url++;
+    end = strchr(url, ']');
+    if (end == NULL) {
+      DBG_ERR("Unterminated address: '%s'.", url);
+      return false;
+    }
+    port_str = end + 1;
+  } else {
+    end = strchr(url, ':');
+    if (end == NULL) {
+      end = url + strlen(url);
+    }
+    port_str = end;
+  }
+
+  size_t len = end - url;
+  if (len == 0 || len >= host_len) {
+    DBG_ERR("Failed to parse host: '%s'.", url);
+    return false;
+  }
+  memcpy(host, url, len);
+  host[len] = '\0';
+
+  *port = YH_TCP_DEFAULT_PORT;
+  if (*port_str == '\0') {
+    return true;
+  }
+  if (port_str[0] != ':' || port_str[1] < '0' || port_str[1] > '9') {
+    DBG_ERR("Failed to parse port: '%s'.", port_str);
+    return false;
+  }
+  port_str++;
+
+  char *endptr;
+  errno = 0;
+  unsigned long value = strtoul(port_str, &endptr, 10);
+  if (errno != 0 || *endptr != '\0' || value == 0 || value > UINT16_MAX) {
+    DBG_ERR("Failed to parse port: '%s'.", port_str);
+    return false;
+  }
+  *port = value;
+
+  return true;
+}
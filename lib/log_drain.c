@@ -0,0 +1,185 @@
+/*
+ * Copyright 2015-2018 Yubico AB
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "yubihsm.h"
+#include "internal.h"
+#include "debug_lib.h"
+
+/*
+ * Entries are only acknowledged to the device once they are stored, so a
+ * failure anywhere leaves them on the device for the next drain. The device
+ * may still hold entries that were stored when setting the log index failed,
+ * those are recognized by their number and skipped.
+ */
+
+// Drain again right away when at least this many entries were found
+#define LOG_DRAIN_AGAIN (YH_MAX_LOG_ENTRIES / 2)
+
+static bool is_newer(const yh_log_entry *entry, const yh_log_entry *last) {
+
+  uint16_t distance = (uint16_t) (entry->number - last->number);
+
+  return distance != 0 && distance < 0x8000;
+}
+
+yh_rc yh_util_drain_log_entries(yh_session *session, yh_log_chain *chain,
+                                yh_log_store store, void *user,
+                                size_t *n_drained) {
+
+  yh_log_entry logs[YH_MAX_LOG_ENTRIES];
+  size_t n_logs = sizeof(logs) / sizeof(logs[0]);
+  size_t first = 0;
+
+  if (session == NULL || chain == NULL || store == NULL) {
+    DBG_ERR("%s", yh_strerror(YHR_INVALID_PARAMETERS));
+    return YHR_INVALID_PARAMETERS;
+  }
+
+  if (n_drained != NULL) {
+    *n_drained = 0;
+  }
+
+  yh_rc yrc = yh_util_get_log_entries(session, NULL, NULL, logs, &n_logs);
+  if (yrc != YHR_SUCCESS) {
+    return yrc;
+  }
+
+  if (chain->started) {
+    while (first < n_logs && !is_newer(&logs[first], &chain->last)) {
+      first++;
+    }
+  }
+  size_t n_new = n_logs - first;
+  if (n_new == 0) {
+    return YHR_SUCCESS;
+  }
+
+  // Without an entry before them, a single entry has nothing to verify
+  if ((chain->started || n_new > 1) &&
+      !yh_verify_logs(&logs[first], n_new,
+                      chain->started ? &chain->last : NULL)) {
+    DBG_ERR("Log entries %u to %u do not continue the log",
+            logs[first].number, logs[n_logs - 1].number);
+    return YHR_LOG_VERIFICATION_FAILED;
+  }
+
+  if (!store(user, &logs[first], n_new)) {
+    DBG_ERR("Failed to store log entries");
+    return YHR_GENERIC_ERROR;
+  }
+  chain->last = logs[n_logs - 1];
+  chain->started = true;
+  if (n_drained != NULL) {
+    *n_drained = n_new;
+  }
+
+  yrc = yh_util_set_log_index(session, chain->last.number);
+  if (yrc != YHR_SUCCESS) {
+    DBG_ERR("Failed to set the log index: %s", yh_strerror(yrc));
+    return yrc;
+  }
+
+  return YHR_SUCCESS;
+}
+
+static void drain_main(void *arg) {
+
+  yh_connector *connector = (yh_connector *) arg;
+
+  thread_mutex_lock(&connector->drain_lock);
+  while (!connector->drain_stop) {
+    connector->drain_now = false;
+    thread_mutex_unlock(&connector->drain_lock);
+
+    size_t n_drained = 0;
+    yh_rc yrc = yh_util_drain_log_entries(connector->drain_session,
+                                          connector->drain_chain,
+                                          connector->drain_store,
+                                          connector->drain_user, &n_drained);
+    if (yrc != YHR_SUCCESS) {
+      DBG_ERR("Failed to drain the log: %s", yh_strerror(yrc));
+    }
+
+    thread_mutex_lock(&connector->drain_lock);
+    if (!connector->drain_stop && !connector->drain_now &&
+        n_drained < LOG_DRAIN_AGAIN) {
+      thread_cond_wait(&connector->drain_wakeup, &connector->drain_lock,
+                       connector->drain_ms);
+    }
+  }
+  thread_mutex_unlock(&connector->drain_lock);
+}
+
+void log_drain_stop(yh_connector *connector) {
+
+  if (connector->drain_ms == 0) {
+    return;
+  }
+
+  thread_mutex_lock(&connector->drain_lock);
+  connector->drain_stop = true;
+  thread_cond_signal(&connector->drain_wakeup);
+  thread_mutex_unlock(&connector->drain_lock);
+
+  thread_join(connector->drain_thread);
+
+  thread_mutex_lock(&connector->drain_lock);
+  connector->drain_ms = 0;
+  thread_mutex_unlock(&connector->drain_lock);
+}
+
+yh_rc log_drain_configure(yh_connector *connector, yh_session *session,
+                          int interval_ms, yh_log_chain *chain,
+                          yh_log_store store, void *user) {
+
+  log_drain_stop(connector);
+  if (interval_ms == 0) {
+    return YHR_SUCCESS;
+  }
+
+  thread_mutex_lock(&connector->drain_lock);
+  connector->drain_session = session;
+  connector->drain_chain = chain;
+  connector->drain_store = store;
+  connector->drain_user = user;
+  connector->drain_ms = interval_ms;
+  connector->drain_stop = false;
+  connector->drain_now = false;
+  thread_mutex_unlock(&connector->drain_lock);
+
+  if (!thread_create(&connector->drain_thread, drain_main, connector)) {
+    DBG_ERR("Failed to start the log drain thread");
+    thread_mutex_lock(&connector->drain_lock);
+    connector->drain_ms = 0;
+    thread_mutex_unlock(&connector->drain_lock);
+    return YHR_GENERIC_ERROR;
+  }
+
+  return YHR_SUCCESS;
+}
+
+void log_drain_wakeup(yh_connector *connector) {
+
+  thread_mutex_lock(&connector->drain_lock);
+  if (connector->drain_ms != 0) {
+    connector->drain_now = true;
+    thread_cond_signal(&connector->drain_wakeup);
+  }
+  thread_mutex_unlock(&connector->drain_lock);
+}
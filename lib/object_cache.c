@@ -0,0 +1,187 @@
+/*
+ * Copyright 2015-2018 Yubico AB
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+
+#include "yubihsm.h"
+#include "internal.h"
+
+/*
+ * Object metadata is cached per session, since what a session may see depends
+ * on its authentication key. An object's metadata never changes, but the
+ * object may be deleted and another one created with the same ID and type, and
+ * a higher sequence. So an entry is valid until it expires, or until a command
+ * creating or deleting objects is sent on the connector, which bumps the
+ * connector generation. A listing of objects confirms the entries whose
+ * sequence it shows unchanged. All of it is protected by the connector cache
+ * lock.
+ */
+
+struct object_cache_entry {
+  yh_object_descriptor object;
+  uint64_t generation;
+  // 0 if the entry is free
+  unsigned long long expires;
+};
+
+void object_cache_configure(yh_connector *connector, unsigned int lifetime_ms,
+                            size_t max_objects) {
+
+  thread_mutex_lock(&connector->cache_lock);
+  connector->object_cache_ms = max_objects != 0 ? lifetime_ms : 0;
+  connector->object_cache_size = lifetime_ms != 0 ? max_objects : 0;
+  // Nothing cached before is used again
+  thread_atomic_add(&connector->object_generation, 1);
+  thread_mutex_unlock(&connector->cache_lock);
+}
+
+uint64_t object_cache_generation(yh_connector *connector) {
+
+  return thread_atomic_load(&connector->object_generation);
+}
+
+void object_cache_command(yh_connector *connector, yh_cmd cmd) {
+
+  switch (cmd) {
+    case YHC_RESET_DEVICE:
+    case YHC_PUT_OPAQUE:
+    case YHC_PUT_AUTHENTICATION_KEY:
+    case YHC_PUT_ASYMMETRIC_KEY:
+    case YHC_GENERATE_ASYMMETRIC_KEY:
+    case YHC_IMPORT_WRAPPED:
+    case YHC_PUT_WRAP_KEY:
+    case YHC_PUT_HMAC_KEY:
+    case YHC_DELETE_OBJECT:
+    case YHC_GENERATE_HMAC_KEY:
+    case YHC_GENERATE_WRAP_KEY:
+    case YHC_PUT_TEMPLATE:
+    case YHC_PUT_OTP_AEAD_KEY:
+    case YHC_GENERATE_OTP_AEAD_KEY:
+      thread_atomic_add(&connector->object_generation, 1);
+      break;
+    default:
+      break;
+  }
+}
+
+bool object_cache_get(yh_session *session, uint16_t id, yh_object_type type,
+                      yh_object_descriptor *object) {
+
+  yh_connector *connector = session->parent;
+  bool found = false;
+
+  thread_mutex_lock(&connector->cache_lock);
+  if (session->objects != NULL && connector->object_cache_ms != 0) {
+    uint64_t generation = object_cache_generation(connector);
+    unsigned long long now = thread_now_ms();
+    for (size_t i = 0; i < session->n_objects; i++) {
+      struct object_cache_entry *entry = &session->objects[i];
+      if (entry->expires > now && entry->generation == generation &&
+          entry->object.id == id && entry->object.type == type) {
+        *object = entry->object;
+        found = true;
+        break;
+      }
+    }
+  }
+  thread_mutex_unlock(&connector->cache_lock);
+
+  return found;
+}
+
+void object_cache_put(yh_session *session, const yh_object_descriptor *object,
+                      uint64_t generation) {
+
+  yh_connector *connector = session->parent;
+
+  thread_mutex_lock(&connector->cache_lock);
+  if (connector->object_cache_ms == 0) {
+    goto cleanup;
+  }
+
+  if (session->n_objects != connector->object_cache_size) {
+    free(session->objects);
+    session->objects = calloc(connector->object_cache_size,
+                              sizeof(struct object_cache_entry));
+    session->n_objects =
+      session->objects != NULL ? connector->object_cache_size : 0;
+    if (session->objects == NULL) {
+      goto cleanup;
+    }
+  }
+
+  // The entry of the same object, or else the one closest to expiring
+  struct object_cache_entry *slot = &session->objects[0];
+  for (size_t i = 0; i < session->n_objects; i++) {
+    struct object_cache_entry *entry = &session->objects[i];
+    if (entry->expires != 0 && entry->object.id == object->id &&
+        entry->object.type == object->type) {
+      slot = entry;
+      break;
+    } else if (entry->expires < slot->expires) {
+      slot = entry;
+    }
+  }
+  slot->object = *object;
+  slot->generation = generation;
+  slot->expires = thread_now_ms() + connector->object_cache_ms;
+
+cleanup:
+  thread_mutex_unlock(&connector->cache_lock);
+}
+
+void object_cache_validate(yh_session *session,
+                           const yh_object_descriptor *objects,
+                           size_t n_objects, uint64_t generation) {
+
+  yh_connector *connector = session->parent;
+
+  thread_mutex_lock(&connector->cache_lock);
+  // Objects may have been created or deleted since they were listed
+  if (session->objects == NULL || connector->object_cache_ms == 0 ||
+      generation != object_cache_generation(connector)) {
+    thread_mutex_unlock(&connector->cache_lock);
+    return;
+  }
+
+  unsigned long long now = thread_now_ms();
+  for (size_t i = 0; i < session->n_objects; i++) {
+    struct object_cache_entry *entry = &session->objects[i];
+    if (entry->expires == 0) {
+      continue;
+    }
+    for (size_t j = 0; j < n_objects; j++) {
+      if (objects[j].id == entry->object.id &&
+          objects[j].type == entry->object.type) {
+        if (objects[j].sequence == entry->object.sequence) {
+          entry->generation = generation;
+          entry->expires = now + connector->object_cache_ms;
+        } else {
+          entry->expires = 0;
+        }
+        break;
+      }
+    }
+  }
+  thread_mutex_unlock(&connector->cache_lock);
+}
+
+void object_cache_free(yh_session *session) {
+
+  free(session->objects);
+  session->objects = NULL;
+  session->n_objects = 0;
+}
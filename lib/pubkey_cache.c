@@ -0,0 +1,190 @@
+/*
+ * Copyright 2015-2018 Yubico AB
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "yubihsm.h"
+#include "internal.h"
+
+/*
+ * A public key never changes for a given ID and sequence, so the cache is
+ * shared by all sessions on a connector and entries do not expire. Whether a
+ * session may see a key, and what its sequence is now, is up to the session's
+ * own yh_util_get_object_info(), see yh_util_get_public_key(). All of it is
+ * protected by the connector cache lock.
+ */
+
+struct pubkey_cache_entry {
+  uint16_t id;
+  uint8_t sequence;
+  yh_algorithm algorithm;
+  uint8_t key[PUBKEY_CACHE_MAX_KEY_LEN];
+  size_t key_len;
+  // Owns a reference, or NULL until the key is first parsed
+  void *parsed;
+  // 0 if the entry is free, otherwise when it was last used
+  uint64_t used;
+};
+
+static void free_entries(yh_connector *connector) {
+
+  for (size_t i = 0; i < connector->n_pubkeys; i++) {
+    if (connector->pubkeys[i].parsed != NULL) {
+      connector->pubkey_parser.unref(connector->pubkeys[i].parsed);
+    }
+  }
+  free(connector->pubkeys);
+  connector->pubkeys = NULL;
+  connector->n_pubkeys = 0;
+}
+
+bool pubkey_cache_configure(yh_connector *connector, size_t max_keys,
+                            const yh_public_key_parser *parser) {
+
+  struct pubkey_cache_entry *pubkeys = NULL;
+
+  if (max_keys != 0) {
+    pubkeys = calloc(max_keys, sizeof(struct pubkey_cache_entry));
+    if (pubkeys == NULL) {
+      return false;
+    }
+  }
+
+  thread_mutex_lock(&connector->cache_lock);
+  free_entries(connector);
+  connector->pubkeys = pubkeys;
+  connector->n_pubkeys = max_keys;
+  if (parser != NULL) {
+    connector->pubkey_parser = *parser;
+  } else {
+    memset(&connector->pubkey_parser, 0, sizeof(yh_public_key_parser));
+  }
+  thread_mutex_unlock(&connector->cache_lock);
+
+  return true;
+}
+
+bool pubkey_cache_enabled(yh_connector *connector) {
+
+  thread_mutex_lock(&connector->cache_lock);
+  bool enabled = connector->n_pubkeys != 0;
+  thread_mutex_unlock(&connector->cache_lock);
+
+  return enabled;
+}
+
+static struct pubkey_cache_entry *find_entry(yh_connector *connector,
+                                             uint16_t id, uint8_t sequence) {
+
+  for (size_t i = 0; i < connector->n_pubkeys; i++) {
+    struct pubkey_cache_entry *entry = &connector->pubkeys[i];
+    if (entry->used != 0 && entry->id == id && entry->sequence == sequence) {
+      return entry;
+    }
+  }
+
+  return NULL;
+}
+
+bool pubkey_cache_get(yh_connector *connector, uint16_t id, uint8_t sequence,
+                      uint8_t *key, size_t *key_len, yh_algorithm *algorithm,
+                      void **parsed) {
+
+  bool found = false;
+
+  thread_mutex_lock(&connector->cache_lock);
+  struct pubkey_cache_entry *entry = find_entry(connector, id, sequence);
+  if (entry != NULL) {
+    if (key != NULL) {
+      memcpy(key, entry->key, entry->key_len);
+      *key_len = entry->key_len;
+    }
+    if (algorithm != NULL) {
+      *algorithm = entry->algorithm;
+    }
+    if (parsed != NULL) {
+      *parsed = entry->parsed != NULL
+                  ? connector->pubkey_parser.ref(entry->parsed)
+                  : NULL;
+    }
+    entry->used = thread_now_us();
+    found = true;
+  }
+  thread_mutex_unlock(&connector->cache_lock);
+
+  return found;
+}
+
+void *pubkey_cache_parse(yh_connector *connector, const uint8_t *key,
+                         size_t key_len, yh_algorithm algorithm) {
+
+  // Parsers must not be changed while they are in use, see
+  // yh_set_public_key_cache()
+  if (connector->pubkey_parser.parse == NULL) {
+    return NULL;
+  }
+
+  return connector->pubkey_parser.parse(key, key_len, algorithm);
+}
+
+void pubkey_cache_put(yh_connector *connector, uint16_t id, uint8_t sequence,
+                      uint64_t generation, const uint8_t *key, size_t key_len,
+                      yh_algorithm algorithm, void *parsed) {
+
+  if (key_len > PUBKEY_CACHE_MAX_KEY_LEN) {
+    return;
+  }
+
+  thread_mutex_lock(&connector->cache_lock);
+  // Unless the key may have been replaced since its sequence was read
+  if (connector->n_pubkeys == 0 ||
+      generation != object_cache_generation(connector)) {
+    goto cleanup;
+  }
+
+  struct pubkey_cache_entry *slot = find_entry(connector, id, sequence);
+  if (slot == NULL) {
+    // The least recently used entry, free ones first
+    slot = &connector->pubkeys[0];
+    for (size_t i = 1; i < connector->n_pubkeys; i++) {
+      if (connector->pubkeys[i].used < slot->used) {
+        slot = &connector->pubkeys[i];
+      }
+    }
+    if (slot->parsed != NULL) {
+      connector->pubkey_parser.unref(slot->parsed);
+    }
+    memset(slot, 0, sizeof(struct pubkey_cache_entry));
+    slot->id = id;
+    slot->sequence = sequence;
+    slot->algorithm = algorithm;
+    memcpy(slot->key, key, key_len);
+    slot->key_len = key_len;
+  }
+  if (slot->parsed == NULL && parsed != NULL) {
+    slot->parsed = connector->pubkey_parser.ref(parsed);
+  }
+  slot->used = thread_now_us();
+
+cleanup:
+  thread_mutex_unlock(&connector->cache_lock);
+}
+
+void pubkey_cache_free(yh_connector *connector) {
+
+  free_entries(connector);
+}
@@ -0,0 +1,200 @@
+/*
+ * Copyright 2015-2018 Yubico AB
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "yubihsm.h"
+#include "internal.h"
+#include "debug_lib.h"
+
+#include "../common/insecure_memzero.h"
+#include "../common/locked_mem.h"
+
+/*
+ * The random pool is a buffer in locked memory holding random_level bytes.
+ * Bytes are handed out from the end of it and wiped, and appended there when
+ * fetched. Only callers using the session pool the bytes were fetched with
+ * are served, so that no authentication key gets random bytes it is not
+ * allowed to ask for. All of it is protected by the connector random lock.
+ */
+
+// How long the thread waits for a session before checking whether to stop
+#define RANDOM_CHECKOUT_MS 250
+// How long the thread waits after the device failed to give random bytes
+#define RANDOM_RETRY_MS 1000
+
+static yh_rc fetch_random(yh_session_pool *pool, uint8_t *out, size_t *len) {
+
+  yh_session *session = NULL;
+  uint8_t length[2] = {*len >> 8, *len & 0xff};
+  yh_iovec iov = {length, sizeof(length)};
+  yh_cmd response_cmd;
+
+  yh_rc yrc = yh_session_pool_checkout(pool, RANDOM_CHECKOUT_MS, &session);
+  if (yrc != YHR_SUCCESS) {
+    return yrc;
+  }
+
+  yrc = yh_send_secure_msgv(session, YHC_GET_PSEUDO_RANDOM, &iov, 1,
+                            &response_cmd, out, len);
+  yh_session_pool_checkin(pool, session, yrc);
+
+  return yrc;
+}
+
+static void append_random(yh_connector *connector, const uint8_t *data,
+                          size_t len) {
+
+  size_t room = connector->random_size - connector->random_level;
+  if (len > room) {
+    len = room;
+  }
+
+  memcpy(connector->random + connector->random_level, data, len);
+  connector->random_level += len;
+}
+
+static void random_main(void *arg) {
+
+  yh_connector *connector = (yh_connector *) arg;
+  uint8_t chunk[RANDOM_MAX_CHUNK];
+
+  thread_mutex_lock(&connector->random_lock);
+  while (!connector->random_stop) {
+    if (connector->random_level > connector->random_low) {
+      thread_cond_wait(&connector->random_wakeup, &connector->random_lock, -1);
+      continue;
+    }
+
+    // Once at the low watermark, fill up to the high one
+    while (!connector->random_stop &&
+           connector->random_level < connector->random_size) {
+      size_t len = connector->random_size - connector->random_level;
+      if (len > sizeof(chunk)) {
+        len = sizeof(chunk);
+      }
+      thread_mutex_unlock(&connector->random_lock);
+      yh_rc yrc = fetch_random(connector->random_sessions, chunk, &len);
+      thread_mutex_lock(&connector->random_lock);
+
+      if (yrc == YHR_SUCCESS) {
+        append_random(connector, chunk, len);
+        insecure_memzero(chunk, len);
+      } else if (yrc != YHR_TIMEOUT) {
+        DBG_ERR("Failed to fill the random pool: %s", yh_strerror(yrc));
+        thread_cond_wait(&connector->random_wakeup, &connector->random_lock,
+                         RANDOM_RETRY_MS);
+      }
+    }
+  }
+  thread_mutex_unlock(&connector->random_lock);
+}
+
+static void stop_filling(yh_connector *connector) {
+
+  if (connector->random_size == 0) {
+    return;
+  }
+
+  thread_mutex_lock(&connector->random_lock);
+  connector->random_stop = true;
+  thread_cond_signal(&connector->random_wakeup);
+  thread_mutex_unlock(&connector->random_lock);
+
+  thread_join(connector->random_thread);
+}
+
+static void swap_random(yh_connector *connector, yh_session_pool *pool,
+                        uint8_t *random, size_t size, size_t low) {
+
+  thread_mutex_lock(&connector->random_lock);
+  uint8_t *old = connector->random;
+  size_t old_size = connector->random_size;
+  connector->random_sessions = pool;
+  connector->random = random;
+  connector->random_size = size;
+  connector->random_level = 0;
+  connector->random_low = low;
+  connector->random_stop = false;
+  thread_mutex_unlock(&connector->random_lock);
+
+  locked_free(old, old_size);
+}
+
+yh_rc random_pool_configure(yh_connector *connector, yh_session_pool *pool,
+                            size_t low_watermark, size_t high_watermark) {
+
+  uint8_t *random = NULL;
+
+  if (high_watermark != 0) {
+    random = locked_alloc(high_watermark);
+    if (random == NULL) {
+      DBG_ERR("Failed to allocate locked memory for the random pool");
+      return YHR_MEMORY_ERROR;
+    }
+  }
+
+  stop_filling(connector);
+  swap_random(connector, pool, random, high_watermark, low_watermark);
+  if (high_watermark == 0) {
+    return YHR_SUCCESS;
+  }
+
+  if (!thread_create(&connector->random_thread, random_main, connector)) {
+    DBG_ERR("Failed to start the random pool thread");
+    swap_random(connector, NULL, NULL, 0, 0);
+    return YHR_GENERIC_ERROR;
+  }
+
+  return YHR_SUCCESS;
+}
+
+size_t random_pool_take(yh_connector *connector, yh_session_pool *pool,
+                        uint8_t *out, size_t len) {
+
+  size_t n = 0;
+
+  thread_mutex_lock(&connector->random_lock);
+  if (connector->random_size != 0 && connector->random_sessions == pool) {
+    n = len < connector->random_level ? len : connector->random_level;
+    connector->random_level -= n;
+    memcpy(out, connector->random + connector->random_level, n);
+    insecure_memzero(connector->random + connector->random_level, n);
+    if (connector->random_level <= connector->random_low) {
+      thread_cond_signal(&connector->random_wakeup);
+    }
+  }
+  thread_mutex_unlock(&connector->random_lock);
+
+  return n;
+}
+
+void random_pool_put(yh_connector *connector, yh_session_pool *pool,
+                     const uint8_t *data, size_t len) {
+
+  thread_mutex_lock(&connector->random_lock);
+  if (connector->random_size != 0 && connector->random_sessions == pool) {
+    append_random(connector, data, len);
+  }
+  thread_mutex_unlock(&connector->random_lock);
+}
+
+void random_pool_free(yh_connector *connector) {
+
+  stop_filling(connector);
+  swap_random(connector, NULL, NULL, 0, 0);
+}
@@ -20,6 +20,8 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "../aes_cmac/aes_cmac.h"
+
 // Data derivation constants
 #define SCP_CARD_CRYPTOGRAM 0x00
 #define SCP_HOST_CRYPTOGRAM 0x01
@@ -65,11 +67,26 @@ union _Msg {
 
 typedef union _Msg Msg;
 
+// Session message, with the inner message in place of the encrypted data so
+// that it can be encrypted and decrypted in place
+#pragma pack(push, 1)
+typedef struct {
+  uint8_t cmd;
+  uint16_t len;
+  uint8_t sid;
+  Msg inner;
+} Scp_msg;
+#pragma pack(pop)
+
 typedef struct {
   uint8_t sid;
   uint8_t s_enc[SCP_KEY_LEN];
   uint8_t s_mac[SCP_KEY_LEN];
   uint8_t s_rmac[SCP_KEY_LEN];
+  // Keyed contexts for the session keys above, kept for the session lifetime
+  aes_context s_enc_ctx;
+  aes_cmac_context_t s_mac_ctx;
+  aes_cmac_context_t s_rmac_ctx;
   uint8_t mac_chaining_value[SCP_PRF_LEN];
   uint8_t ctr[SCP_PRF_LEN];
   char identifier[17];
@@ -0,0 +1,150 @@
+/*
+ * Copyright 2015-2018 Yubico AB
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+
+#include "yubihsm.h"
+#include "internal.h"
+
+/*
+ * The statistics are written by whichever thread completes a command and read
+ * while being written, so every field is accessed atomically. There is no lock
+ * and a read is not a consistent snapshot, which is fine for counters.
+ */
+
+static size_t bucket_index(unsigned long long us) {
+
+  if (us < 2) {
+    return (size_t) us;
+  }
+
+  size_t octave = 0;
+  while ((us >> octave) > 1) {
+    octave++;
+  }
+  // The bit below the leading one picks the half of the octave
+  size_t index = 2 * octave + ((us >> (octave - 1)) & 1);
+
+  return index < YH_STATS_BUCKETS ? index : YH_STATS_BUCKETS - 1;
+}
+
+static uint64_t bucket_limit(size_t index) {
+
+  // The first latency of the next bucket
+  index++;
+  if (index < 2) {
+    return index;
+  }
+  return (uint64_t)(2 + index % 2) << (index / 2 - 1);
+}
+
+static void record_latency(yh_latency_histogram *histogram,
+                           unsigned long long us) {
+
+  thread_atomic_add(&histogram->count, 1);
+  thread_atomic_add(&histogram->sum_us, us);
+  thread_atomic_max(&histogram->max_us, us);
+  thread_atomic_add(&histogram->buckets[bucket_index(us)], 1);
+}
+
+static void copy_counters(uint64_t *dst, uint64_t *src, size_t n) {
+
+  for (size_t i = 0; i < n; i++) {
+    dst[i] = thread_atomic_load(&src[i]);
+  }
+}
+
+static void clear_counters(uint64_t *counters, size_t n) {
+
+  for (size_t i = 0; i < n; i++) {
+    thread_atomic_store(&counters[i], 0);
+  }
+}
+
+void stats_record(yh_connector *connector, yh_cmd cmd, yh_rc rc,
+                  size_t bytes_out, size_t bytes_in,
+                  unsigned long long transport_us, unsigned long long total_us,
+                  bool secure) {
+
+  yh_connector_stats *stats = connector->stats;
+  if (stats == NULL) {
+    return;
+  }
+
+  if (rc <= 0 && -rc < YH_STATS_RESULTS) {
+    thread_atomic_add(&stats->results[-rc], 1);
+  }
+
+  yh_command_stats *command = &stats->commands[cmd & ~YH_CMD_RESP_FLAG];
+  thread_atomic_add(&command->calls, 1);
+  if (rc != YHR_SUCCESS) {
+    thread_atomic_add(&command->errors, 1);
+  }
+  thread_atomic_add(&command->bytes_out, bytes_out);
+  thread_atomic_add(&command->bytes_in, bytes_in);
+
+  if (total_us < transport_us) {
+    total_us = transport_us;
+  }
+  record_latency(&command->transport, transport_us);
+  record_latency(&command->total, total_us);
+  if (secure) {
+    record_latency(&command->crypto, total_us - transport_us);
+  }
+}
+
+void stats_read(yh_connector *connector, yh_connector_stats *stats) {
+
+  // The structure is nothing but counters, read one at a time
+  copy_counters((uint64_t *) stats, (uint64_t *) connector->stats,
+                sizeof(yh_connector_stats) / sizeof(uint64_t));
+  stats->elapsed_ms =
+    thread_now_ms() - thread_atomic_load(&connector->stats_since);
+}
+
+void stats_reset(yh_connector *connector) {
+
+  clear_counters((uint64_t *) connector->stats,
+                 sizeof(yh_connector_stats) / sizeof(uint64_t));
+  thread_atomic_store(&connector->stats_since, thread_now_ms());
+}
+
+uint64_t yh_get_latency_percentile(const yh_latency_histogram *histogram,
+                                   double percentile) {
+
+  if (histogram == NULL || histogram->count == 0) {
+    return 0;
+  }
+
+  // Number of latencies at or below the percentile, at least one
+  uint64_t rank = (uint64_t)(percentile / 100.0 * histogram->count + 0.5);
+  if (rank == 0) {
+    rank = 1;
+  }
+
+  uint64_t seen = 0;
+  for (size_t i = 0; i < YH_STATS_BUCKETS; i++) {
+    seen += histogram->buckets[i];
+    if (seen >= rank) {
+      uint64_t limit = bucket_limit(i) - 1;
+      return limit < histogram->max_us && i < YH_STATS_BUCKETS - 1
+               ? limit
+               : histogram->max_us;
+    }
+  }
+
+  return histogram->max_us;
+}
@@ -0,0 +1,197 @@
+/*
+ * Copyright 2015-2018 Yubico AB
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "yubihsm.h"
+#include "internal.h"
+#include "debug_lib.h"
+
+/*
+ * The status of connectors that had a device, as parsed by parse_status_data(),
+ * shared by all connectors of the process. Entries are keyed by status URL, or
+ * by socket path for yhunix:// connectors, which all have the same status URL.
+ * yh_connect() uses a fresh entry instead of asking the connector again. An
+ * entry is forgotten when it expires, or as soon as a message to its connector
+ * fails, so that the next yh_connect() checks the status again.
+ */
+
+#define STATUS_CACHE_SIZE 16
+
+struct status_entry {
+  char *url;
+  uint8_t version_major;
+  uint8_t version_minor;
+  uint8_t version_patch;
+  uint8_t address[32];
+  uint32_t port;
+  uint32_t pid;
+  unsigned long long expires;
+};
+
+static struct {
+  bool ready;
+  thread_mutex lock;
+  unsigned int lifetime_ms;
+  struct status_entry entries[STATUS_CACHE_SIZE];
+} cache;
+
+static void free_entry(struct status_entry *entry) {
+
+  free(entry->url);
+  memset(entry, 0, sizeof(*entry));
+}
+
+// The status URL of yhunix:// connectors is the same for every socket
+static const char *entry_key(yh_connector *connector) {
+
+  return connector->unix_socket != NULL ? connector->unix_socket
+                                        : connector->status_url;
+}
+
+// Called with the lock held
+static struct status_entry *find_entry(const char *url) {
+
+  for (size_t i = 0; i < STATUS_CACHE_SIZE; i++) {
+    if (cache.entries[i].url != NULL &&
+        strcmp(cache.entries[i].url, url) == 0) {
+      return &cache.entries[i];
+    }
+  }
+
+  return NULL;
+}
+
+bool status_cache_init(void) {
+
+  if (cache.ready) {
+    return true;
+  }
+
+  if (!thread_mutex_init(&cache.lock)) {
+    return false;
+  }
+  cache.ready = true;
+
+  return true;
+}
+
+void status_cache_exit(void) {
+
+  if (!cache.ready) {
+    return;
+  }
+
+  status_cache_configure(0);
+  thread_mutex_destroy(&cache.lock);
+  cache.ready = false;
+}
+
+void status_cache_configure(unsigned int lifetime_ms) {
+
+  thread_mutex_lock(&cache.lock);
+  cache.lifetime_ms = lifetime_ms;
+  for (size_t i = 0; i < STATUS_CACHE_SIZE; i++) {
+    free_entry(&cache.entries[i]);
+  }
+  thread_mutex_unlock(&cache.lock);
+}
+
+bool status_cache_get(yh_connector *connector) {
+
+  bool found = false;
+
+  if (!cache.ready || connector->status_url == NULL) {
+    return false;
+  }
+
+  thread_mutex_lock(&cache.lock);
+  struct status_entry *entry = find_entry(entry_key(connector));
+  if (entry != NULL && entry->expires <= thread_now_ms()) {
+    free_entry(entry);
+  } else if (entry != NULL) {
+    connector->has_device = true;
+    connector->version_major = entry->version_major;
+    connector->version_minor = entry->version_minor;
+    connector->version_patch = entry->version_patch;
+    memcpy(connector->address, entry->address, sizeof(connector->address));
+    connector->port = entry->port;
+    connector->pid = entry->pid;
+    found = true;
+  }
+  thread_mutex_unlock(&cache.lock);
+
+  return found;
+}
+
+void status_cache_put(yh_connector *connector) {
+
+  if (!cache.ready || connector->status_url == NULL ||
+      !connector->has_device) {
+    return;
+  }
+
+  thread_mutex_lock(&cache.lock);
+  if (cache.lifetime_ms == 0) {
+    thread_mutex_unlock(&cache.lock);
+    return;
+  }
+
+  unsigned long long now = thread_now_ms();
+  struct status_entry *entry = find_entry(entry_key(connector));
+  if (entry == NULL) {
+    // Take a free entry, or the one closest to expiring
+    entry = &cache.entries[0];
+    for (size_t i = 0; i < STATUS_CACHE_SIZE && entry->url != NULL; i++) {
+      if (cache.entries[i].url == NULL ||
+          cache.entries[i].expires < entry->expires) {
+        entry = &cache.entries[i];
+      }
+    }
+    free_entry(entry);
+    entry->url = strdup(entry_key(connector));
+    if (entry->url == NULL) {
+      thread_mutex_unlock(&cache.lock);
+      return;
+    }
+  }
+
+  entry->version_major = connector->version_major;
+  entry->version_minor = connector->version_minor;
+  entry->version_patch = connector->version_patch;
+  memcpy(entry->address, connector->address, sizeof(entry->address));
+  entry->port = connector->port;
+  entry->pid = connector->pid;
+  entry->expires = now + cache.lifetime_ms;
+  thread_mutex_unlock(&cache.lock);
+}
+
+void status_cache_failed(yh_connector *connector, yh_rc yrc) {
+
+  if (!cache.ready || connector->status_url == NULL ||
+      (yrc != YHR_CONNECTION_ERROR && yrc != YHR_CONNECTOR_NOT_FOUND)) {
+    return;
+  }
+
+  thread_mutex_lock(&cache.lock);
+  struct status_entry *entry = find_entry(entry_key(connector));
+  if (entry != NULL) {
+    DBG_INFO("Forgetting the status of %s", entry_key(connector));
+    free_entry(entry);
+  }
+  thread_mutex_unlock(&cache.lock);
+}
@@ -22,6 +22,7 @@
 #include <string.h>
 
 #include "../../common/pkcs5.h"
+#include "../../common/kdf_cache.h"
 
 static void test_pbkdf2_vectors(void) {
   struct vector {
@@ -71,6 +72,29 @@ static void test_pbkdf2_vectors(void) {
     assert(res == true);
     assert(memcmp(key, vectors[i].output, vectors[i].size) == 0);
   }
+
+  // The same vectors through the derived key cache, with fewer entries than
+  // vectors so that some are evicted, and then with the cache disabled
+  assert(kdf_cache_init() == true);
+  assert(kdf_cache_configure(60000, 2) == true);
+  for (int round = 0; round < 3; round++) {
+    if (round == 2) {
+      assert(kdf_cache_configure(0, 0) == true);
+    }
+    for (size_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+      for (int repeat = 0; repeat < 2; repeat++) {
+        uint8_t key[256];
+        bool res =
+          kdf_cache_pbkdf2_hmac(vectors[i].password, vectors[i].password_len,
+                                vectors[i].salt, vectors[i].salt_len,
+                                vectors[i].iterations, vectors[i].hash, key,
+                                vectors[i].size);
+        assert(res == true);
+        assert(memcmp(key, vectors[i].output, vectors[i].size) == 0);
+      }
+    }
+  }
+  kdf_cache_exit();
 }
 
 int main(void) { test_pbkdf2_vectors(); }
@@ -0,0 +1,388 @@
+/*
+ * Copyright 2015-2018 Yubico AB
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#include <assert.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "yubihsm.h"
+#include "internal.h"
+#include "yubihsm_tcp.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/*
+ * The test plays the relay itself, on the other end of the connection, so
+ * that it decides when, in which order and in how many pieces responses
+ * arrive. Messages are answered by echoing them with the response flag set.
+ */
+
+static const char status[] = "status=OK\n"
+                             "serial=*\n"
+                             "version=2.0.0\n"
+                             "pid=1\n"
+                             "address=\n"
+                             "port=0\n";
+
+static struct backend_functions *bf;
+static yh_backend *connection;
+static int listener;
+
+struct request {
+  uint32_t id;
+  uint8_t msg[64];
+  uint16_t len;
+};
+
+static void read_all(int fd, void *buf, size_t len) {
+
+  uint8_t *ptr = buf;
+
+  while (len > 0) {
+    ssize_t n = recv(fd, ptr, len, 0);
+    assert(n > 0);
+    ptr += n;
+    len -= n;
+  }
+}
+
+static void write_all(int fd, const void *buf, size_t len) {
+
+  assert(send(fd, buf, len, MSG_NOSIGNAL) == (ssize_t) len);
+}
+
+static void read_request(int fd, uint8_t type, struct request *req) {
+
+  struct yh_tcp_frame frame;
+  uint8_t tag[YH_TCP_MAX_TAG];
+
+  read_all(fd, &frame, sizeof(frame));
+  assert(frame.type == type);
+  req->id = ntohl(frame.id);
+  req->len = ntohs(frame.len);
+  assert(req->len <= sizeof(req->msg));
+  read_all(fd, tag, frame.tag_len);
+  read_all(fd, req->msg, req->len);
+}
+
+// The echo of a request, as the relay would frame it
+static size_t response_frame(const struct request *req, uint8_t *buf) {
+
+  struct yh_tcp_frame frame = {YH_TCP_FRAME_MSG, 0, htons(req->len),
+                               htonl(req->id)};
+
+  memcpy(buf, &frame, sizeof(frame));
+  memcpy(buf + sizeof(frame), req->msg, req->len);
+  buf[sizeof(frame)] |= YH_CMD_RESP_FLAG;
+
+  return sizeof(frame) + req->len;
+}
+
+static void respond(int fd, const struct request *req) {
+
+  uint8_t buf[sizeof(struct yh_tcp_frame) + sizeof(req->msg)];
+
+  write_all(fd, buf, response_frame(req, buf));
+}
+
+static void *serve_status(void *arg) {
+
+  int *fd = arg;
+  struct request req;
+  struct yh_tcp_frame frame = {YH_TCP_FRAME_STATUS, 0, htons(strlen(status)),
+                               0};
+
+  *fd = accept(listener, NULL, NULL);
+  assert(*fd >= 0);
+  read_request(*fd, YH_TCP_FRAME_STATUS, &req);
+  write_all(*fd, &frame, sizeof(frame));
+  write_all(*fd, status, strlen(status));
+
+  return NULL;
+}
+
+static void make_msg(Msg *msg, uint8_t fill, uint16_t len) {
+
+  msg->st.cmd = YHC_ECHO;
+  msg->st.len = htons(len);
+  memset(msg->st.data, fill, len);
+}
+
+static void check_echo(const Msg *msg, const Msg *response) {
+
+  assert(response->st.cmd == YHC_ECHO_R);
+  assert(response->st.len == msg->st.len);
+  assert(memcmp(response->st.data, msg->st.data, ntohs(msg->st.len)) == 0);
+}
+
+struct async {
+  Msg msg;
+  Msg response;
+  yh_rc yrc;
+  bool done;
+};
+
+static void async_done(void *ctx, yh_rc yrc) {
+
+  struct async *a = ctx;
+
+  assert(!a->done);
+  a->yrc = yrc;
+  a->done = true;
+}
+
+static void send_async(struct async *a, uint8_t fill) {
+
+  memset(a, 0, sizeof(*a));
+  make_msg(&a->msg, fill, 8);
+  assert(bf->backend_send_msg_async(connection, &a->msg, &a->response,
+                                    "session", async_done, a) == YHR_SUCCESS);
+}
+
+// Drives the backend like a poll loop would, until n messages are done
+static void process_until(struct async *a, size_t n) {
+
+  for (int round = 0; round < 100; round++) {
+    yh_pollfd fds[4];
+    struct pollfd pfds[4];
+    size_t n_fds = 4;
+    int timeout_ms;
+    size_t done = 0;
+
+    for (size_t i = 0; i < n; i++) {
+      done += a[i].done;
+    }
+    if (done == n) {
+      return;
+    }
+
+    assert(bf->backend_get_pollfds(connection, fds, &n_fds, &timeout_ms) ==
+           YHR_SUCCESS);
+    for (size_t i = 0; i < n_fds; i++) {
+      pfds[i].fd = fds[i].fd;
+      pfds[i].events = fds[i].events;
+      pfds[i].revents = 0;
+    }
+    poll(pfds, n_fds, timeout_ms < 0 || timeout_ms > 100 ? 100 : timeout_ms);
+    for (size_t i = 0; i < n_fds; i++) {
+      fds[i].revents = pfds[i].revents;
+    }
+    assert(bf->backend_process(connection, fds, n_fds) == YHR_SUCCESS);
+  }
+
+  assert(false);
+}
+
+// Processes once, which must not wait for the rest of a frame
+static void process_once(void) {
+
+  assert(bf->backend_process(connection, NULL, 0) == YHR_SUCCESS);
+}
+
+struct sync {
+  Msg msg;
+  Msg response;
+  yh_rc yrc;
+};
+
+static void *send_sync(void *arg) {
+
+  struct sync *s = arg;
+
+  s->yrc = bf->backend_send_msg(connection, &s->msg, &s->response, NULL);
+
+  return NULL;
+}
+
+static void test_out_of_order(int fd) {
+
+  struct async a[3];
+  struct request req[3];
+
+  for (int i = 0; i < 3; i++) {
+    send_async(&a[i], 0x10 + i);
+    read_request(fd, YH_TCP_FRAME_MSG, &req[i]);
+  }
+  assert(req[0].id != req[1].id && req[1].id != req[2].id);
+
+  respond(fd, &req[2]);
+  respond(fd, &req[0]);
+  respond(fd, &req[1]);
+  process_until(a, 3);
+
+  for (int i = 0; i < 3; i++) {
+    assert(a[i].yrc == YHR_SUCCESS);
+    check_echo(&a[i].msg, &a[i].response);
+  }
+}
+
+static void test_partial_async(int fd) {
+
+  struct async a;
+  struct request req;
+  uint8_t buf[sizeof(struct yh_tcp_frame) + sizeof(req.msg)];
+
+  send_async(&a, 0x20);
+  read_request(fd, YH_TCP_FRAME_MSG, &req);
+  size_t len = response_frame(&req, buf);
+
+  // Half a header, then the rest of it and part of the payload
+  write_all(fd, buf, 3);
+  process_once();
+  assert(!a.done);
+  write_all(fd, buf + 3, sizeof(struct yh_tcp_frame) + 2);
+  process_once();
+  assert(!a.done);
+  write_all(fd, buf + 3 + sizeof(struct yh_tcp_frame) + 2,
+            len - 3 - sizeof(struct yh_tcp_frame) - 2);
+  process_until(&a, 1);
+
+  assert(a.yrc == YHR_SUCCESS);
+  check_echo(&a.msg, &a.response);
+}
+
+static void test_sync_and_async(int fd) {
+
+  struct sync s;
+  struct async a;
+  struct request sync_req;
+  struct request async_req;
+  uint8_t buf[sizeof(struct yh_tcp_frame) + sizeof(sync_req.msg)];
+  pthread_t thread;
+
+  make_msg(&s.msg, 0x30, 16);
+  assert(pthread_create(&thread, NULL, send_sync, &s) == 0);
+  read_request(fd, YH_TCP_FRAME_MSG, &sync_req);
+  send_async(&a, 0x31);
+  read_request(fd, YH_TCP_FRAME_MSG, &async_req);
+
+  // The synchronous sender reads the asynchronous response on the way to its
+  // own, which comes in two pieces
+  respond(fd, &async_req);
+  size_t len = response_frame(&sync_req, buf);
+  write_all(fd, buf, 5);
+  usleep(10000);
+  write_all(fd, buf + 5, len - 5);
+
+  assert(pthread_join(thread, NULL) == 0);
+  assert(s.yrc == YHR_SUCCESS);
+  check_echo(&s.msg, &s.response);
+
+  process_until(&a, 1);
+  assert(a.yrc == YHR_SUCCESS);
+  check_echo(&a.msg, &a.response);
+}
+
+// The relay goes away in the middle of a response, both kinds of senders are
+// failed and the next message goes over a new connection
+static int test_close_mid_frame(int fd) {
+
+  struct sync s;
+  struct async a;
+  struct request sync_req;
+  struct request async_req;
+  uint8_t buf[sizeof(struct yh_tcp_frame) + sizeof(sync_req.msg)];
+  pthread_t thread;
+
+  send_async(&a, 0x40);
+  read_request(fd, YH_TCP_FRAME_MSG, &async_req);
+  write_all(fd, buf, response_frame(&async_req, buf) - 4);
+  process_once();
+  assert(!a.done);
+
+  make_msg(&s.msg, 0x41, 8);
+  assert(pthread_create(&thread, NULL, send_sync, &s) == 0);
+  read_request(fd, YH_TCP_FRAME_MSG, &sync_req);
+  close(fd);
+
+  assert(pthread_join(thread, NULL) == 0);
+  process_until(&a, 1);
+  assert(s.yrc == YHR_CONNECTION_ERROR);
+  assert(a.yrc == YHR_CONNECTION_ERROR);
+
+  make_msg(&s.msg, 0x42, 8);
+  assert(pthread_create(&thread, NULL, send_sync, &s) == 0);
+  fd = accept(listener, NULL, NULL);
+  assert(fd >= 0);
+  read_request(fd, YH_TCP_FRAME_MSG, &sync_req);
+  respond(fd, &sync_req);
+  assert(pthread_join(thread, NULL) == 0);
+  assert(s.yrc == YHR_SUCCESS);
+  check_echo(&s.msg, &s.response);
+
+  return fd;
+}
+
+int main(void) {
+
+  struct sockaddr_in addr = {0};
+  socklen_t addr_len = sizeof(addr);
+  char url[64];
+  yh_connector connector;
+  pthread_t relay;
+  int fd;
+
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  listener = socket(AF_INET, SOCK_STREAM, 0);
+  assert(listener >= 0);
+  assert(bind(listener, (struct sockaddr *) &addr, sizeof(addr)) == 0);
+  assert(getsockname(listener, (struct sockaddr *) &addr, &addr_len) == 0);
+  assert(listen(listener, 4) == 0);
+  snprintf(url, sizeof(url), "%s127.0.0.1:%u", YH_TCP_URL_SCHEME,
+           ntohs(addr.sin_port));
+
+  bf = tcp_backend_functions();
+  assert(bf->backend_init(0, stderr) == YHR_SUCCESS);
+  connection = bf->backend_create();
+  assert(connection != NULL);
+
+  memset(&connector, 0, sizeof(connector));
+  connector.api_url = url;
+  connector.status_url = url;
+  connector.connection = connection;
+
+  assert(pthread_create(&relay, NULL, serve_status, &fd) == 0);
+  assert(bf->backend_connect(&connector, 5) == YHR_SUCCESS);
+  assert(pthread_join(relay, NULL) == 0);
+  assert(connector.has_device);
+  assert(connector.version_major == 2);
+
+  test_out_of_order(fd);
+  test_partial_async(fd);
+  test_sync_and_async(fd);
+  fd = test_close_mid_frame(fd);
+
+  bf->backend_disconnect(connection);
+  close(fd);
+  close(listener);
+
+  return 0;
+}
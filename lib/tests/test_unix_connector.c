@@ -0,0 +1,200 @@
+/*
+ * Copyright 2015-2018 Yubico AB
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "yubihsm.h"
+
+/*
+ * A stand-in for the connector on a Unix socket. It answers
+ * /connector/status, and echoes the messages posted to /connector/api as if
+ * the device had answered them
+ */
+
+static const char status[] = "status=OK\n"
+                             "serial=*\n"
+                             "version=2.0.0\n"
+                             "pid=1\n"
+                             "address=\n"
+                             "port=0\n";
+
+static volatile int status_requests;
+static volatile int api_requests;
+
+static int read_request(int fd, char *buf, size_t size, char **body,
+                        size_t *body_len) {
+
+  size_t len = 0;
+  char *end = NULL;
+
+  while (end == NULL) {
+    if (len == size - 1) {
+      return -1;
+    }
+    ssize_t n = recv(fd, buf + len, size - 1 - len, 0);
+    if (n <= 0) {
+      return -1;
+    }
+    len += n;
+    buf[len] = '\0';
+    end = strstr(buf, "\r\n\r\n");
+  }
+
+  *body = end + 4;
+  *body_len = 0;
+  for (char *line = strstr(buf, "\r\n"); line != NULL && line < end;
+       line = strstr(line + 2, "\r\n")) {
+    if (strncasecmp(line + 2, "Content-Length:", 15) == 0) {
+      *body_len = strtoul(line + 17, NULL, 10);
+    }
+  }
+  if (*body + *body_len > buf + size) {
+    return -1;
+  }
+
+  while ((size_t)(buf + len - *body) < *body_len) {
+    ssize_t n = recv(fd, buf + len, size - len, 0);
+    if (n <= 0) {
+      return -1;
+    }
+    len += n;
+  }
+
+  return 0;
+}
+
+static void write_response(int fd, const void *body, size_t body_len) {
+
+  char head[128];
+  int head_len = snprintf(head, sizeof(head),
+                          "HTTP/1.1 200 OK\r\n"
+                          "Content-Length: %zu\r\n"
+                          "\r\n",
+                          body_len);
+
+  assert(send(fd, head, head_len, 0) == head_len);
+  assert(send(fd, body, body_len, 0) == (ssize_t) body_len);
+}
+
+// Serves the requests of a connection until the client closes it
+static void *serve_connection(void *arg) {
+
+  int fd = (int) (intptr_t) arg;
+  char buf[4096];
+  char *body;
+  size_t body_len;
+
+  while (read_request(fd, buf, sizeof(buf), &body, &body_len) == 0) {
+    if (strncmp(buf, "GET /connector/status ", 22) == 0) {
+      status_requests++;
+      write_response(fd, status, strlen(status));
+    } else if (strncmp(buf, "POST /connector/api ", 20) == 0 &&
+               body_len >= 3) {
+      api_requests++;
+      body[0] |= YH_CMD_RESP_FLAG;
+      write_response(fd, body, body_len);
+    } else {
+      break;
+    }
+  }
+  close(fd);
+
+  return NULL;
+}
+
+// Connections may be kept open, so each one gets a thread
+static void *serve(void *arg) {
+
+  int listener = *(int *) arg;
+  pthread_t thread;
+
+  for (;;) {
+    int fd = accept(listener, NULL, NULL);
+    if (fd < 0) {
+      return NULL;
+    }
+    assert(pthread_create(&thread, NULL, serve_connection,
+                          (void *) (intptr_t) fd) == 0);
+    pthread_detach(thread);
+  }
+}
+
+int main(void) {
+
+  struct sockaddr_un addr = {0};
+  char url[sizeof(YH_UNIX_URL_SCHEME) + sizeof(addr.sun_path)];
+  pthread_t server;
+
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "/tmp/yubihsm-test-%d.sock",
+           (int) getpid());
+  snprintf(url, sizeof(url), "%s%s", YH_UNIX_URL_SCHEME, addr.sun_path);
+  unlink(addr.sun_path);
+
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  assert(listener >= 0);
+  assert(bind(listener, (struct sockaddr *) &addr, sizeof(addr)) == 0);
+  assert(listen(listener, 4) == 0);
+  assert(pthread_create(&server, NULL, serve, &listener) == 0);
+
+  yh_connector *connector = NULL;
+  yh_rc yrc = yh_init();
+  assert(yrc == YHR_SUCCESS);
+
+  yrc = yh_init_connector(url, &connector);
+  assert(yrc == YHR_SUCCESS);
+
+  yrc = yh_connect(connector, 5);
+  assert(yrc == YHR_SUCCESS);
+  assert(status_requests == 1);
+
+  const uint8_t data[] = "unix socket";
+  uint8_t response[64];
+  size_t response_len = sizeof(response);
+  yh_cmd response_cmd;
+
+  yrc = yh_send_plain_msg(connector, YHC_ECHO, data, sizeof(data),
+                          &response_cmd, response, &response_len);
+  assert(yrc == YHR_SUCCESS);
+  assert(response_cmd == YHC_ECHO_R);
+  assert(response_len == sizeof(data));
+  assert(memcmp(response, data, sizeof(data)) == 0);
+  assert(api_requests == 1);
+
+  yh_disconnect(connector);
+
+  yrc = yh_exit();
+  assert(yrc == YHR_SUCCESS);
+
+  shutdown(listener, SHUT_RDWR);
+  close(listener);
+  unlink(addr.sun_path);
+
+  return 0;
+}
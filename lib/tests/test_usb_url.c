@@ -53,7 +53,66 @@ static void test_urls(void) {
   }
 }
 
+static void test_unix_urls(void) {
+  struct {
+    const char *string;
+    const char *path;
+    bool ret;
+  } tests[] = {
+    {"yhunix:///run/yubihsm.sock", "/run/yubihsm.sock", true},
+    {"yhunix://", NULL, false},
+    {"yhunix:///", NULL, false},
+    {"yhunix://run/yubihsm.sock", NULL, false},
+    {"yhusb:///run/yubihsm.sock", NULL, false},
+    {"", NULL, false},
+  };
+
+  for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+    const char *path = NULL;
+    assert(parse_unix_url(tests[i].string, &path) == tests[i].ret);
+    if (tests[i].ret) {
+      assert(strcmp(path, tests[i].path) == 0);
+    }
+  }
+}
+
+static void test_tcp_urls(void) {
+  struct {
+    const char *string;
+    const char *host;
+    uint16_t port;
+    bool ret;
+  } tests[] = {
+    {"yhtcp://127.0.0.1:4711", "127.0.0.1", 4711, true},
+    {"yhtcp://localhost", "localhost", 12346, true},
+    {"yhtcp://[::1]:4711", "::1", 4711, true},
+    {"yhtcp://[::1]", "::1", 12346, true},
+    {"yhtcp://", NULL, 0, false},
+    {"yhtcp://:4711", NULL, 0, false},
+    {"yhtcp://[::1", NULL, 0, false},
+    {"yhtcp://localhost:", NULL, 0, false},
+    {"yhtcp://localhost:0", NULL, 0, false},
+    {"yhtcp://localhost:65536", NULL, 0, false},
+    {"yhtcp://localhost:-1", NULL, 0, false},
+    {"yhtcp://localhost:12x", NULL, 0, false},
+    {"http://localhost:4711", NULL, 0, false},
+  };
+
+  for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+    char host[64] = {0};
+    uint16_t port = 0;
+    assert(parse_tcp_url(tests[i].string, host, sizeof(host), &port) ==
+           tests[i].ret);
+    if (tests[i].ret) {
+      assert(strcmp(host, tests[i].host) == 0);
+      assert(port == tests[i].port);
+    }
+  }
+}
+
 int main(void) {
   _yh_output = stderr;
   test_urls();
+  test_unix_urls();
+  test_tcp_urls();
 }
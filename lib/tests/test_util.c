@@ -21,6 +21,7 @@
 #include <assert.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "yubihsm.h"
@@ -32,30 +33,218 @@ FILE *_yh_output;
 static void test_status(void) {
   struct {
     const char *data;
-    yh_connector c;
+    bool has_device;
+    uint8_t version_major;
+    uint8_t version_minor;
+    uint8_t version_patch;
+    uint32_t port;
+    uint32_t pid;
   } tests[] = {
-    {"status=OK\nversion=1.2.3\n",
-     {NULL, NULL, NULL, NULL, NULL, true, 1, 2, 3, "", 0, 0}},
-    {"", {NULL, NULL, NULL, NULL, NULL, false, 0, 0, 0, "", 0, 0}},
-    {"foobar", {NULL, NULL, NULL, NULL, NULL, false, 0, 0, 0, "", 0, 0}},
-    {"\n\n\n\n\n\n", {NULL, NULL, NULL, NULL, NULL, false, 0, 0, 0, "", 0, 0}},
+    {"status=OK\nversion=1.2.3\n", true, 1, 2, 3, 0, 0},
+    {"", false, 0, 0, 0, 0, 0},
+    {"foobar", false, 0, 0, 0, 0, 0},
+    {"\n\n\n\n\n\n", false, 0, 0, 0, 0, 0},
     {"status=NO_DEVICE\nserial=*\nversion=1.0.2\npid=412\naddress=\nport=12345",
-     {NULL, NULL, NULL, NULL, NULL, false, 1, 0, 2, "", 12345, 412}},
-    {"version=1.2", {NULL, NULL, NULL, NULL, NULL, false, 1, 2, 0, "", 0, 0}},
-    {"version=foobar",
-     {NULL, NULL, NULL, NULL, NULL, false, 0, 0, 0, "", 0, 0}},
-    {"version=2..\nstatus=OK",
-     {NULL, NULL, NULL, NULL, NULL, true, 2, 0, 0, "", 0, 0}},
+     false, 1, 0, 2, 12345, 412},
+    {"version=1.2", false, 1, 2, 0, 0, 0},
+    {"version=foobar", false, 0, 0, 0, 0, 0},
+    {"version=2..\nstatus=OK", true, 2, 0, 0, 0, 0},
   };
 
   for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
-    yh_connector c = {NULL, NULL, NULL, NULL, NULL, false, 0, 0, 0, "", 0, 0};
+    yh_connector c;
     char *data = strdup(tests[i].data);
 
+    memset(&c, 0, sizeof(c));
     parse_status_data(data, &c);
     free(data);
-    assert(memcmp(&c, &tests[i].c, sizeof(c)) == 0);
+    assert(c.has_device == tests[i].has_device);
+    assert(c.version_major == tests[i].version_major);
+    assert(c.version_minor == tests[i].version_minor);
+    assert(c.version_patch == tests[i].version_patch);
+    assert(c.address[0] == '\0');
+    assert(c.port == tests[i].port);
+    assert(c.pid == tests[i].pid);
+  }
+}
+
+static void test_latency_buckets(void) {
+  struct {
+    unsigned long long us;
+    size_t bucket;
+  } tests[] = {
+    {0, 0},
+    {1, 1},
+    {2, 2},
+    {3, 3},
+    {4, 4},
+    {5, 4},
+    {6, 5},
+    {7, 5},
+    {8, 6},
+    {11, 6},
+    {12, 7},
+    {1024, 20},
+    {1535, 20},
+    {1536, 21},
+    {1ULL << 23, 46},
+    {3ULL << 22, 47},
+    {1ULL << 24, 47},
+    {~0ULL, 47},
+  };
+
+  yh_connector c;
+  memset(&c, 0, sizeof(c));
+  c.stats = calloc(1, sizeof(yh_connector_stats));
+  assert(c.stats != NULL);
+
+  for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+    memset(c.stats, 0, sizeof(yh_connector_stats));
+    stats_record(&c, YHC_ECHO, YHR_SUCCESS, 0, 0, tests[i].us, tests[i].us,
+                 false);
+    yh_latency_histogram *histogram = &c.stats->commands[YHC_ECHO].transport;
+    assert(histogram->count == 1);
+    assert(histogram->max_us == tests[i].us);
+    for (size_t j = 0; j < YH_STATS_BUCKETS; j++) {
+      assert(histogram->buckets[j] == (j == tests[i].bucket ? 1 : 0));
+    }
   }
+
+  free(c.stats);
+}
+
+static void test_latency_percentile(void) {
+  yh_latency_histogram histogram;
+
+  assert(yh_get_latency_percentile(NULL, 50) == 0);
+  memset(&histogram, 0, sizeof(histogram));
+  assert(yh_get_latency_percentile(&histogram, 50) == 0);
+
+  // Five latencies of 2, four of 4 or 5 and one of 40
+  histogram.count = 10;
+  histogram.max_us = 40;
+  histogram.buckets[2] = 5;
+  histogram.buckets[4] = 4;
+  histogram.buckets[10] = 1;
+
+  struct {
+    double percentile;
+    uint64_t us;
+  } tests[] = {
+    {0, 2}, {10, 2}, {50, 2}, {60, 5}, {90, 5}, {95, 40}, {100, 40},
+  };
+
+  for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+    assert(yh_get_latency_percentile(&histogram, tests[i].percentile) ==
+           tests[i].us);
+  }
+
+  // The first buckets hold a single latency each
+  memset(&histogram, 0, sizeof(histogram));
+  histogram.count = 2;
+  histogram.max_us = 1;
+  histogram.buckets[0] = 1;
+  histogram.buckets[1] = 1;
+  assert(yh_get_latency_percentile(&histogram, 50) == 0);
+  assert(yh_get_latency_percentile(&histogram, 100) == 1);
+
+  // The last bucket has no upper limit
+  memset(&histogram, 0, sizeof(histogram));
+  histogram.count = 1;
+  histogram.max_us = 1000000000;
+  histogram.buckets[YH_STATS_BUCKETS - 1] = 1;
+  assert(yh_get_latency_percentile(&histogram, 50) == 1000000000);
+}
+
+static void test_status_cache(void) {
+  yh_connector c;
+  yh_connector cached;
+  char url[64];
+
+  memset(&c, 0, sizeof(c));
+  c.status_url = url;
+  c.has_device = true;
+  c.version_major = 2;
+  c.version_minor = 3;
+  c.version_patch = 4;
+  c.port = 12345;
+  c.pid = 412;
+  strcpy(url, "http://127.0.0.1:12345/connector/status");
+
+  assert(status_cache_init());
+
+  // Nothing is kept without a lifetime
+  status_cache_put(&c);
+  memset(&cached, 0, sizeof(cached));
+  cached.status_url = url;
+  assert(!status_cache_get(&cached));
+
+  status_cache_configure(60000);
+  status_cache_put(&c);
+  assert(status_cache_get(&cached));
+  assert(cached.has_device);
+  assert(cached.version_major == 2);
+  assert(cached.version_minor == 3);
+  assert(cached.version_patch == 4);
+  assert(cached.port == 12345);
+  assert(cached.pid == 412);
+
+  // Only failures to reach the connector drop the entry
+  status_cache_failed(&c, YHR_DEVICE_INVALID_SESSION);
+  assert(status_cache_get(&cached));
+  status_cache_failed(&c, YHR_CONNECTION_ERROR);
+  assert(!status_cache_get(&cached));
+
+  // A connector without a device is not cached
+  c.has_device = false;
+  status_cache_put(&c);
+  assert(!status_cache_get(&cached));
+  c.has_device = true;
+
+  status_cache_configure(1);
+  status_cache_put(&c);
+  unsigned long long start = thread_now_ms();
+  while (thread_now_ms() < start + 2) {
+  }
+  assert(!status_cache_get(&cached));
+
+  // A full cache replaces the entry closest to expiring
+  status_cache_configure(60000);
+  for (int i = 0; i <= 16; i++) {
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/connector/status",
+             12345 + i);
+    status_cache_put(&c);
+  }
+  snprintf(url, sizeof(url), "http://127.0.0.1:%d/connector/status", 12345);
+  assert(!status_cache_get(&cached));
+  for (int i = 1; i <= 16; i++) {
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/connector/status",
+             12345 + i);
+    assert(status_cache_get(&cached));
+  }
+
+  // yhunix:// connectors share a status URL, but not their status
+  yh_connector other;
+  char unix_url[] = "http://localhost/connector/status";
+  char socket_a[] = "/run/a.sock";
+  char socket_b[] = "/run/b.sock";
+
+  status_cache_configure(60000);
+  c.status_url = unix_url;
+  c.unix_socket = socket_a;
+  status_cache_put(&c);
+  memset(&other, 0, sizeof(other));
+  other.status_url = unix_url;
+  other.unix_socket = socket_b;
+  assert(!status_cache_get(&other));
+  other.unix_socket = NULL;
+  assert(!status_cache_get(&other));
+  other.unix_socket = socket_a;
+  assert(status_cache_get(&other));
+  assert(other.pid == 412);
+
+  status_cache_exit();
+  assert(!status_cache_get(&cached));
 }
 
 int main(void) {
@@ -63,4 +252,7 @@ int main(void) {
   _yh_verbosity = 0;
 
   test_status();
+  test_latency_buckets();
+  test_latency_percentile();
+  test_status_cache();
 }
@@ -22,7 +22,10 @@
 #else
 #include <arpa/inet.h>
 #include <dlfcn.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <strings.h>
+#include <unistd.h>
 #endif
 #include <errno.h>
 #include <stdlib.h>
@@ -31,7 +34,10 @@
 #include <limits.h>
 
 #include "../common/rand.h"
-#include "../common/pkcs5.h"
+#include "../common/kdf_cache.h"
+#include "../common/ecdh_pool.h"
+#include "../common/locked_mem.h"
+#include "../common/usdt.h"
 #include "../common/hash.h"
 #include "../common/ecdh.h"
 
@@ -43,6 +49,7 @@
 
 #define STATIC_USB_BACKEND "usb"
 #define STATIC_HTTP_BACKEND "http"
+#define STATIC_TCP_BACKEND "tcp"
 
 // If any of the values in scp.h are changed
 // they should be mirrored in yubihsm.h
@@ -91,6 +98,234 @@ static yh_rc compute_full_mac(uint8_t *data, uint16_t data_len, uint8_t *key,
   return YHR_SUCCESS;
 }
 
+/*
+ * Compute the MAC over a chaining value followed by a message, without
+ * having to lay them out next to each other in memory
+ */
+static yh_rc compute_session_mac(aes_cmac_context_t *ctx,
+                                 const uint8_t *chaining_value,
+                                 const uint8_t *data, uint16_t data_len,
+                                 uint8_t *mac) {
+
+  DBG_CRYPTO(chaining_value, SCP_PRF_LEN, "MAC chaining value: ");
+  DBG_CRYPTO(data, data_len, "Compute MAC (%3d Bytes): ", data_len);
+
+  if (aes_cmac_begin(ctx) ||
+      aes_cmac_update(ctx, chaining_value, SCP_PRF_LEN) ||
+      aes_cmac_update(ctx, data, data_len) || aes_cmac_final(ctx, mac)) {
+    DBG_ERR("aes_cmac failed");
+    return YHR_GENERIC_ERROR;
+  }
+
+  DBG_CRYPTO(mac, SCP_PRF_LEN, "Full result is: ");
+
+  return YHR_SUCCESS;
+}
+
+/*
+ * Encrypt a padded command into enc_msg, whose header and session id must
+ * already be set, and MAC the result in the same pass. The MAC becomes the
+ * new chaining value.
+ */
+static yh_rc encrypt_session_msg(Scp_ctx *s, const uint8_t *iv,
+                                 const uint8_t *data, uint16_t len,
+                                 Msg *enc_msg) {
+
+  DBG_CRYPTO(s->mac_chaining_value, SCP_PRF_LEN, "MAC chaining value: ");
+
+  if (aes_cmac_begin(&s->s_mac_ctx) ||
+      aes_cmac_update(&s->s_mac_ctx, s->mac_chaining_value, SCP_PRF_LEN) ||
+      aes_cmac_update(&s->s_mac_ctx, enc_msg->raw, 3 + 1) ||
+      aes_cmac_cbc_encrypt(&s->s_mac_ctx, &s->s_enc_ctx, data,
+                           enc_msg->st.data + 1, len, iv) ||
+      aes_cmac_final(&s->s_mac_ctx, s->mac_chaining_value)) {
+    DBG_ERR("aes_cmac_cbc_encrypt failed");
+    return YHR_GENERIC_ERROR;
+  }
+
+  DBG_CRYPTO(s->mac_chaining_value, SCP_PRF_LEN, "Full result is: ");
+
+  return YHR_SUCCESS;
+}
+
+/*
+ * MAC a session message response and decrypt its len bytes of ciphertext to
+ * data in the same pass. The caller must check the MAC before using data.
+ */
+static yh_rc decrypt_session_msg(Scp_ctx *s, const uint8_t *iv, Msg *msg,
+                                 uint16_t len, uint8_t *data, uint8_t *mac) {
+
+  if (len % AES_BLOCK_SIZE != 0) {
+    DBG_ERR("%s", yh_strerror(YHR_WRONG_LENGTH));
+    return YHR_WRONG_LENGTH;
+  }
+
+  if (aes_cmac_begin(&s->s_rmac_ctx) ||
+      aes_cmac_update(&s->s_rmac_ctx, s->mac_chaining_value, SCP_PRF_LEN) ||
+      aes_cmac_update(&s->s_rmac_ctx, msg->raw, 3 + 1) ||
+      aes_cmac_cbc_decrypt(&s->s_rmac_ctx, &s->s_enc_ctx, msg->st.data + 1,
+                           data, len, iv) ||
+      aes_cmac_final(&s->s_rmac_ctx, mac)) {
+    DBG_ERR("aes_cmac_cbc_decrypt failed");
+    return YHR_GENERIC_ERROR;
+  }
+
+  DBG_CRYPTO(mac, SCP_PRF_LEN, "Response MAC is: ");
+
+  return YHR_SUCCESS;
+}
+
+static void destroy_session_ctx(Scp_ctx *ctx) {
+
+  aes_destroy(&ctx->s_enc_ctx);
+  aes_cmac_destroy(&ctx->s_mac_ctx);
+  aes_cmac_destroy(&ctx->s_rmac_ctx);
+}
+
+static yh_session *alloc_session(void) {
+
+  yh_session *session = calloc(1, sizeof(yh_session));
+  if (session != NULL && !thread_mutex_init(&session->lock)) {
+    free(session);
+    session = NULL;
+  }
+
+  return session;
+}
+
+static void free_session(yh_session *session) {
+
+  destroy_session_ctx(&session->s);
+  thread_mutex_destroy(&session->lock);
+  object_cache_free(session);
+  insecure_memzero(session, sizeof(yh_session));
+  free(session);
+}
+
+/*
+ * List a session created with recreate in its connector, for the keepalive
+ * thread
+ */
+static void list_session(yh_session *session) {
+
+  yh_connector *connector = session->parent;
+
+  thread_mutex_lock(&connector->sessions_lock);
+  session->next = connector->sessions;
+  connector->sessions = session;
+  session->listed = true;
+  thread_mutex_unlock(&connector->sessions_lock);
+}
+
+static void unlist_session(yh_session *session) {
+
+  if (!session->listed) {
+    return;
+  }
+
+  yh_connector *connector = session->parent;
+
+  thread_mutex_lock(&connector->sessions_lock);
+  // The keepalive thread may be sending over the session
+  while (session->pinned) {
+    thread_cond_wait(&connector->keepalive_wakeup, &connector->sessions_lock,
+                     -1);
+  }
+  for (yh_session **p = &connector->sessions; *p != NULL; p = &(*p)->next) {
+    if (*p == session) {
+      *p = session->next;
+      break;
+    }
+  }
+  session->next = NULL;
+  session->listed = false;
+  thread_mutex_unlock(&connector->sessions_lock);
+}
+
+/*
+ * Key the cipher and CMAC contexts from the current session keys. This is
+ * done once per session (re)creation so that secure messages don't have to
+ * redo the key setup and subkey generation for every command.
+ */
+static yh_rc init_session_ctx(Scp_ctx *ctx) {
+
+  if (aes_set_key(ctx->s_enc, SCP_KEY_LEN, &ctx->s_enc_ctx)) {
+    DBG_ERR("aes_set_key %s", yh_strerror(YHR_GENERIC_ERROR));
+    goto isc_failure;
+  }
+
+  if (aes_cmac_init(ctx->s_mac, SCP_KEY_LEN, &ctx->s_mac_ctx)) {
+    DBG_ERR("aes_cmac_init (S-MAC) %s", yh_strerror(YHR_GENERIC_ERROR));
+    goto isc_failure;
+  }
+
+  if (aes_cmac_init(ctx->s_rmac, SCP_KEY_LEN, &ctx->s_rmac_ctx)) {
+    DBG_ERR("aes_cmac_init (S-RMAC) %s", yh_strerror(YHR_GENERIC_ERROR));
+    goto isc_failure;
+  }
+
+  return YHR_SUCCESS;
+
+isc_failure:
+  destroy_session_ctx(ctx);
+  return YHR_GENERIC_ERROR;
+}
+
+/*
+ * Report the beginning of an operation to the trace hooks and the flight
+ * recorder, if there are any. Operations that begin without either are not
+ * reported when they end.
+ */
+static void trace_begin(yh_connector *connector, yh_trace_event *event,
+                        yh_trace_point point, yh_cmd cmd, int session_id,
+                        size_t bytes_out) {
+
+  memset(event, 0, sizeof(yh_trace_event));
+  if (connector == NULL ||
+      (connector->trace_begin == NULL && connector->trace_end == NULL &&
+       !flight_enabled())) {
+    return;
+  }
+
+  event->id = thread_atomic_add(&connector->trace_id, 1);
+  event->point = point;
+  event->cmd = cmd;
+  event->session_id = session_id;
+  event->bytes_out = bytes_out;
+  event->begin_us = thread_now_us();
+  if (connector->trace_begin != NULL) {
+    connector->trace_begin(connector, event, connector->trace_user);
+  }
+}
+
+static void trace_end(yh_connector *connector, yh_trace_event *event,
+                      int session_id, yh_rc result, size_t bytes_in) {
+
+  if (connector == NULL || event->id == 0) {
+    return;
+  }
+
+  event->session_id = session_id;
+  event->bytes_in = bytes_in;
+  event->result = result;
+  event->end_us = thread_now_us();
+  flight_record(event);
+  if (connector->trace_end != NULL) {
+    connector->trace_end(connector, event, connector->trace_user);
+  }
+}
+
+static size_t iov_len(const yh_iovec *iov, size_t iovcnt) {
+
+  size_t len = 0;
+
+  for (size_t i = 0; i < iovcnt; i++) {
+    len += iov[i].len;
+  }
+
+  return len;
+}
+
 static yh_rc send_msg(yh_connector *connector, Msg *msg, Msg *response,
                       const char *identifier) {
 
@@ -100,11 +335,28 @@ static yh_rc send_msg(yh_connector *connector, Msg *msg, Msg *response,
     return YHR_INVALID_PARAMETERS;
   }
   DBG_NET(msg, dump_msg);
+  // Messages in a session start with the session id
+  int session_id = msg->st.cmd == YHC_SESSION_MESSAGE ||
+                       msg->st.cmd == YHC_AUTHENTICATE_SESSION
+                     ? msg->st.data[0]
+                     : -1;
+  yh_trace_event event;
+  trace_begin(connector, &event, YH_TRACE_SEND, msg->st.cmd, session_id,
+              3 + ntohs(msg->st.len));
+  USDT3(yubihsm, send_start, msg->st.cmd, 3 + ntohs(msg->st.len), session_id);
+  unsigned long long start = thread_now_us();
   yrc = connector->bf->backend_send_msg(connector->connection, msg, response,
                                         identifier);
+  unsigned long long elapsed = thread_now_us() - start;
+  size_t received = yrc == YHR_SUCCESS ? 3 + ntohs(response->st.len) : 0;
   if (yrc == YHR_SUCCESS) {
     DBG_NET(response, dump_response);
   }
+  stats_record(connector, msg->st.cmd, yrc, 3 + ntohs(msg->st.len), received,
+               elapsed, elapsed, false);
+  status_cache_failed(connector, yrc);
+  trace_end(connector, &event, session_id, yrc, received);
+  USDT4(yubihsm, send_done, msg->st.cmd, received, session_id, yrc);
   return yrc;
 }
 
@@ -256,16 +508,26 @@ yh_rc yh_send_plain_msg(yh_connector *connector, yh_cmd cmd,
                                       : YHR_SUCCESS;
 }
 
-static yh_rc _send_secure_msg(yh_session *session, yh_cmd cmd,
-                              const uint8_t *data, size_t data_len,
-                              yh_cmd *response_cmd, uint8_t *response,
-                              size_t *response_len) {
+/*
+ * Build an encrypted and MAC'd session message from the scattered inner
+ * message. The inner message is gathered straight into the outer one, behind
+ * the session id, and encrypted in place. The encrypted counter is kept for
+ * decrypting the response
+ */
+static yh_rc seal_session_msg(yh_session *session, yh_cmd cmd,
+                              const yh_iovec *iov, size_t iovcnt, Scp_msg *tx,
+                              uint8_t *encrypted_ctr) {
 
-  if (session == NULL || (data_len != 0 && data == NULL) ||
-      data_len > SCP_MSG_BUF_SIZE || response_cmd == NULL || response == NULL ||
-      response_len == NULL) {
-    DBG_ERR("%s", yh_strerror(YHR_INVALID_PARAMETERS));
-    return YHR_INVALID_PARAMETERS;
+  size_t data_len = 0;
+  size_t i;
+
+  for (i = 0; i < iovcnt; i++) {
+    if ((iov[i].len != 0 && iov[i].data == NULL) ||
+        iov[i].len > SCP_MSG_BUF_SIZE - data_len) {
+      DBG_ERR("%s", yh_strerror(YHR_INVALID_PARAMETERS));
+      return YHR_INVALID_PARAMETERS;
+    }
+    data_len += iov[i].len;
   }
 
   uint16_t len = 3 + data_len;
@@ -277,231 +539,482 @@ static yh_rc _send_secure_msg(yh_session *session, yh_cmd cmd,
     return YHR_BUFFER_TOO_SMALL;
   }
 
-#pragma pack(push, 1)
-  struct {
-    uint8_t mac_chaining_value[SCP_PRF_LEN];
-    Msg msg;
-  } msg, enc_msg;
-#pragma pack(pop)
+  uint8_t *ptr = tx->inner.st.data;
 
-  msg.msg.st.cmd = cmd;
-  msg.msg.st.len = htons(data_len);
-  memcpy(msg.msg.st.data, data, data_len);
+  tx->inner.st.cmd = cmd;
+  tx->inner.st.len = htons(data_len);
+  for (i = 0; i < iovcnt; i++) {
+    if (iov[i].len != 0) {
+      memcpy(ptr, iov[i].data, iov[i].len);
+      ptr += iov[i].len;
+    }
+  }
 
-  DBG_NET(&msg.msg, dump_msg);
+  DBG_NET(&tx->inner, dump_msg);
 
   len = 3 + data_len;
-  aes_add_padding(msg.msg.raw, &len);
+  aes_add_padding(tx->inner.raw, &len);
 
-  aes_context aes_ctx;
-  insecure_memzero(&aes_ctx, sizeof(aes_ctx));
-  if (aes_set_key(session->s.s_enc, SCP_KEY_LEN, &aes_ctx)) {
-    DBG_ERR("aes_set_key %s", yh_strerror(YHR_GENERIC_ERROR));
-    return YHR_GENERIC_ERROR;
-  }
-
-  yh_rc yrc = YHR_SUCCESS;
-  uint8_t encrypted_ctr[AES_BLOCK_SIZE];
-  if (aes_encrypt(session->s.ctr, encrypted_ctr, &aes_ctx)) {
+  if (aes_encrypt(session->s.ctr, encrypted_ctr, &session->s.s_enc_ctx)) {
     DBG_ERR("aes_encrypt %s", yh_strerror(YHR_GENERIC_ERROR));
-    yrc = YHR_GENERIC_ERROR;
-    goto cleanup;
+    return YHR_GENERIC_ERROR;
   }
 
-  memcpy(enc_msg.mac_chaining_value, session->s.mac_chaining_value,
-         SCP_PRF_LEN);
-  enc_msg.msg.st.cmd = YHC_SESSION_MESSAGE;
-  enc_msg.msg.st.len = htons(len + SCP_MAC_LEN + 1);
-  enc_msg.msg.st.data[0] = session->s.sid;
-
-  if (aes_cbc_encrypt(msg.msg.raw, enc_msg.msg.st.data + 1, len, encrypted_ctr,
-                      &aes_ctx)) {
-    DBG_ERR("aes_cbc_encrypt %s", yh_strerror(YHR_GENERIC_ERROR));
-    yrc = YHR_GENERIC_ERROR;
-    goto cleanup;
-  }
+  tx->cmd = YHC_SESSION_MESSAGE;
+  tx->len = htons(len + SCP_MAC_LEN + 1);
+  tx->sid = session->s.sid;
 
-  yrc = compute_full_mac(enc_msg.mac_chaining_value, len + SCP_PRF_LEN + 4,
-                         session->s.s_mac, SCP_KEY_LEN,
-                         session->s.mac_chaining_value);
+  yh_rc yrc =
+    encrypt_session_msg(&session->s, encrypted_ctr, tx->inner.raw, len,
+                        (Msg *) tx);
   if (yrc != YHR_SUCCESS) {
-    DBG_ERR("compute_full_mac %s", yh_strerror(yrc));
-    goto cleanup;
+    DBG_ERR("encrypt_session_msg %s", yh_strerror(yrc));
+    return yrc;
   }
 
-  memcpy(enc_msg.msg.st.data + len + 1, session->s.mac_chaining_value,
+  // The MAC follows the padded inner message, header included
+  memcpy(tx->inner.st.data + len - 3, session->s.mac_chaining_value,
          SCP_MAC_LEN);
 
-  yrc =
-    send_msg(session->parent, &enc_msg.msg, &msg.msg, session->s.identifier);
-  if (yrc != YHR_SUCCESS) {
-    DBG_ERR("send_msg %s", yh_strerror(yrc));
-    goto cleanup;
-  }
+  return YHR_SUCCESS;
+}
 
-  if (msg.msg.st.cmd == YHC_ERROR) {
-    yrc = translate_device_error(msg.msg.st.data[0]);
-    DBG_ERR("%s", yh_strerror(yrc));
+/*
+ * Verify and decrypt a session message response in place. On success the
+ * response command and data, which points into rx, are returned. This is
+ * either the inner message or, if the device rejected the session message,
+ * the error code it sent.
+ */
+static yh_rc open_session_msg(yh_session *session, const uint8_t *encrypted_ctr,
+                              Scp_msg *rx, yh_cmd *response_cmd,
+                              const uint8_t **data, size_t *data_len) {
 
+  if (rx->cmd == YHC_ERROR) {
     *response_cmd = YHC_ERROR;
-    response[0] = msg.msg.st.data[0];
-    *response_len = 1;
-
-    goto cleanup;
+    *data = &rx->sid;
+    *data_len = 1;
+    return YHR_SUCCESS;
   }
 
   // The minimum message is { sid | 1 aes block | mac }
-  if (ntohs(msg.msg.st.len) < 1 + AES_BLOCK_SIZE + SCP_MAC_LEN) {
+  if (ntohs(rx->len) < 1 + AES_BLOCK_SIZE + SCP_MAC_LEN) {
     DBG_ERR("%s", yh_strerror(YHR_BUFFER_TOO_SMALL));
-    yrc = YHR_BUFFER_TOO_SMALL;
-    goto cleanup;
+    return YHR_BUFFER_TOO_SMALL;
   }
 
+  uint16_t len = ntohs(rx->len) - 1 - SCP_MAC_LEN;
+
   uint8_t mac[SCP_PRF_LEN];
-  memcpy(msg.mac_chaining_value, session->s.mac_chaining_value, SCP_PRF_LEN);
-  yrc =
-    compute_full_mac(msg.mac_chaining_value,
-                     ntohs(msg.msg.st.len) + (SCP_PRF_LEN + 3 - SCP_MAC_LEN),
-                     session->s.s_rmac, SCP_KEY_LEN, mac);
+  yh_rc yrc = decrypt_session_msg(&session->s, encrypted_ctr, (Msg *) rx, len,
+                                  rx->inner.raw, mac);
   if (yrc != YHR_SUCCESS) {
-    DBG_ERR("compute_full_mac %s", yh_strerror(yrc));
-    goto cleanup;
+    DBG_ERR("decrypt_session_msg %s", yh_strerror(yrc));
+    return yrc;
   }
 
-  len = ntohs(msg.msg.st.len) - SCP_MAC_LEN;
-
-  if (memcmp(msg.msg.st.data + len, mac, SCP_MAC_LEN)) {
+  if (memcmp(rx->inner.raw + len, mac, SCP_MAC_LEN)) {
     DBG_DUMPERR(mac, SCP_MAC_LEN,
                 "%s, expected: ", yh_strerror(YHR_MAC_MISMATCH));
-    yrc = YHR_MAC_MISMATCH;
-    goto cleanup;
+    return YHR_MAC_MISMATCH;
   }
 
-  if (session->s.sid != msg.msg.st.data[0]) {
+  if (session->s.sid != rx->sid) {
     DBG_ERR("Session ID mismatch, expected %d, got %d", session->s.sid,
-            msg.msg.st.data[0]);
-    yrc = YHR_DEVICE_INVALID_SESSION;
-    goto cleanup;
+            rx->sid);
+    return YHR_DEVICE_INVALID_SESSION;
+  }
+
+  aes_remove_padding(rx->inner.raw, &len);
+  if (len < 3 || len - 3 != ntohs(rx->inner.st.len)) {
+    DBG_ERR("aes_remove_padding %s", yh_strerror(YHR_WRONG_LENGTH));
+    return YHR_WRONG_LENGTH;
   }
 
-  len -= 1;
+  increment_ctr(session->s.ctr, SCP_PRF_LEN);
+
+  DBG_NET(&rx->inner, dump_response);
 
-  if (aes_cbc_decrypt(msg.msg.st.data + 1, enc_msg.msg.raw, len, encrypted_ctr,
-                      &aes_ctx)) {
-    DBG_ERR("aes_cbc_decrypt %s", yh_strerror(YHR_GENERIC_ERROR));
-    yrc = YHR_GENERIC_ERROR;
-    goto cleanup;
+  *response_cmd = rx->inner.st.cmd;
+  *data = rx->inner.st.data;
+  *data_len = len - 3;
+
+  return YHR_SUCCESS;
+}
+
+static yh_rc _send_secure_msgv(yh_session *session, yh_cmd cmd,
+                               const yh_iovec *iov, size_t iovcnt,
+                               yh_cmd *response_cmd, uint8_t *response,
+                               size_t *response_len) {
+
+  if (session == NULL || (iovcnt != 0 && iov == NULL) ||
+      response_cmd == NULL || response == NULL || response_len == NULL) {
+    DBG_ERR("%s", yh_strerror(YHR_INVALID_PARAMETERS));
+    return YHR_INVALID_PARAMETERS;
   }
 
-  aes_remove_padding(enc_msg.msg.raw, &len);
-  if (len < 3 || len - 3 != ntohs(enc_msg.msg.st.len)) {
-    DBG_ERR("aes_remove_padding %s", yh_strerror(YHR_WRONG_LENGTH));
-    yrc = YHR_WRONG_LENGTH;
-    goto cleanup;
+  if (session->in_flight) {
+    DBG_ERR("Session has a command in flight");
+    return YHR_INVALID_PARAMETERS;
   }
 
-  increment_ctr(session->s.ctr, SCP_PRF_LEN);
+  // Only the parts of the two messages that were used are wiped
+  Scp_msg tx, rx;
+  size_t tx_used = sizeof(Msg);
+  size_t rx_used = 0;
+  uint8_t encrypted_ctr[AES_BLOCK_SIZE];
+  const uint8_t *data;
+  size_t data_len = 0;
+  unsigned long long start = thread_now_us();
+  unsigned long long transport = 0;
+  bool sent = false;
+  yh_trace_event event;
+
+  trace_begin(session->parent, &event, YH_TRACE_SECURE_MSG, cmd,
+              session->s.sid, iov_len(iov, iovcnt));
+
+  yh_rc yrc = seal_session_msg(session, cmd, iov, iovcnt, &tx, encrypted_ctr);
+  if (yrc != YHR_SUCCESS) {
+    goto cleanup;
+  }
+  tx_used = 3 + ntohs(tx.len);
 
-  DBG_NET(&enc_msg.msg, dump_response);
+  rx.len = 0;
+  transport = thread_now_us();
+  yrc = send_msg(session->parent, (Msg *) &tx, (Msg *) &rx,
+                 session->s.identifier);
+  transport = thread_now_us() - transport;
+  sent = true;
+  rx_used = 3 + ntohs(rx.len);
+  if (rx_used > sizeof(Msg)) {
+    rx_used = sizeof(Msg);
+  }
+  if (yrc != YHR_SUCCESS) {
+    DBG_ERR("send_msg %s", yh_strerror(yrc));
+    goto cleanup;
+  }
 
-  *response_cmd = enc_msg.msg.st.cmd;
-  len -= 3;
+  yrc = open_session_msg(session, encrypted_ctr, &rx, response_cmd, &data,
+                         &data_len);
+  if (yrc != YHR_SUCCESS) {
+    goto cleanup;
+  }
+  session->last_used = thread_now_ms();
 
-  if (*response_len < len) {
-    DBG_ERR("%s (received %u Bytes, can fit %zu Bytes) ",
-            yh_strerror(YHR_BUFFER_TOO_SMALL), len, *response_len);
-    *response_len = len;
+  if (*response_len < data_len) {
+    DBG_ERR("%s (received %zu Bytes, can fit %zu Bytes) ",
+            yh_strerror(YHR_BUFFER_TOO_SMALL), data_len, *response_len);
+    *response_len = data_len;
     yrc = YHR_BUFFER_TOO_SMALL;
     goto cleanup;
   }
 
-  memcpy(response, enc_msg.msg.st.data, len);
-  *response_len = len;
+  memcpy(response, data, data_len);
+  *response_len = data_len;
 
   if (*response_cmd == YHC_ERROR) {
     yrc = translate_device_error(response[0]);
+    DBG_ERR("%s", yh_strerror(yrc));
   }
 
 cleanup:
-  aes_destroy(&aes_ctx);
-  insecure_memzero(&msg, sizeof(msg));
-  insecure_memzero(&enc_msg, sizeof(enc_msg));
+  if (sent) {
+    stats_record(session->parent, cmd, yrc, tx_used,
+                 yrc == YHR_SUCCESS ? rx_used : 0, transport,
+                 thread_now_us() - start, true);
+  }
+  trace_end(session->parent, &event, session->s.sid, yrc,
+            yrc == YHR_SUCCESS ? data_len : 0);
+  insecure_memzero(encrypted_ctr, sizeof(encrypted_ctr));
+  insecure_memzero(&tx, tx_used);
+  insecure_memzero(&rx, rx_used);
   return yrc;
 }
 
-yh_rc yh_send_secure_msg(yh_session *session, yh_cmd cmd, const uint8_t *data,
-                         size_t data_len, yh_cmd *response_cmd,
-                         uint8_t *response, size_t *response_len) {
+static yh_rc create_session(yh_connector *connector, uint16_t authkey_id,
+                            const uint8_t *key_enc, size_t key_enc_len,
+                            const uint8_t *key_mac, size_t key_mac_len,
+                            bool recreate, yh_session **session);
+static yh_rc authenticate_session(yh_session *session);
+
+yh_rc yh_send_secure_msgv(yh_session *session, yh_cmd cmd, const yh_iovec *iov,
+                          size_t iovcnt, yh_cmd *response_cmd,
+                          uint8_t *response, size_t *response_len) {
+
+  if (session == NULL || response_len == NULL) {
+    DBG_ERR("%s", yh_strerror(YHR_INVALID_PARAMETERS));
+    return YHR_INVALID_PARAMETERS;
+  }
 
   size_t saved_len = *response_len;
 
-  yh_rc yrc = _send_secure_msg(session, cmd, data, data_len, response_cmd,
-                               response, response_len);
+  thread_mutex_lock(&session->lock);
+
+  yh_rc yrc = _send_secure_msgv(session, cmd, iov, iovcnt, response_cmd,
+                                response, response_len);
   if ((yrc == YHR_DEVICE_INVALID_SESSION ||
        yrc == YHR_DEVICE_AUTHENTICATION_FAILED) &&
       session->recreate) {
     DBG_INFO("Recreating session");
-    yrc = yh_create_session(session->parent, session->authkey_id,
-                            session->key_enc, SCP_KEY_LEN, session->key_mac,
-                            SCP_KEY_LEN, true, &session);
+    USDT1(yubihsm, session_recreate_start, session->s.sid);
+    yrc = create_session(session->parent, session->authkey_id,
+                         session->key_enc, SCP_KEY_LEN, session->key_mac,
+                         SCP_KEY_LEN, true, &session);
     if (yrc != YHR_SUCCESS) {
-      return yrc;
+      goto cleanup;
     }
-    yrc = yh_authenticate_session(session);
+    yrc = authenticate_session(session);
+    USDT2(yubihsm, session_recreate_done, session->s.sid, yrc);
     if (yrc != YHR_SUCCESS) {
-      return yrc;
+      goto cleanup;
     }
     *response_len = saved_len;
-    yrc = _send_secure_msg(session, cmd, data, data_len, response_cmd, response,
-                           response_len);
+    yrc = _send_secure_msgv(session, cmd, iov, iovcnt, response_cmd, response,
+                            response_len);
+  }
+
+cleanup:
+  thread_mutex_unlock(&session->lock);
+  // Even if it failed, the command may have reached the device
+  object_cache_command(session->parent, cmd);
+  if (yrc == YHR_DEVICE_LOG_FULL) {
+    log_drain_wakeup(session->parent);
   }
   return yrc;
 }
 
-static yh_rc compute_cryptogram(const uint8_t *key, uint16_t key_len,
-                                uint8_t type, uint8_t context[SCP_CONTEXT_LEN],
-                                uint16_t L, uint8_t *key_out) {
+yh_rc yh_send_secure_msg(yh_session *session, yh_cmd cmd, const uint8_t *data,
+                         size_t data_len, yh_cmd *response_cmd,
+                         uint8_t *response, size_t *response_len) {
 
-  uint8_t n_iterations;
-  uint8_t i;
-  uint8_t result[SCP_KEY_LEN];
-  uint8_t input[16 + SCP_CONTEXT_LEN];
-  uint8_t *ptr = input;
+  yh_iovec iov = {data, data_len};
 
-  aes_cmac_context_t ctx;
+  return yh_send_secure_msgv(session, cmd, &iov, 1, response_cmd, response,
+                             response_len);
+}
 
-  if (L == 0x40 || L == 0x80)
-    n_iterations = 1;
-  else if (L == 0xc0 || L == 0x100)
-    n_iterations = 2;
-  else
-    return YHR_INVALID_PARAMETERS;
+typedef struct {
+  yh_session *session;
+  yh_async_callback callback;
+  void *user;
+  uint8_t encrypted_ctr[AES_BLOCK_SIZE];
+  Scp_msg tx;
+  Scp_msg rx;
+  // For the statistics, see stats_record()
+  yh_cmd cmd;
+  unsigned long long start;
+  unsigned long long sent;
+  yh_trace_event event;
+} async_msg;
+
+static void async_msg_done(void *ctx, yh_rc yrc) {
+
+  async_msg *msg = (async_msg *) ctx;
+  yh_session *session = msg->session;
+  yh_connector *connector = session->parent;
+  yh_cmd response_cmd = YHC_ERROR;
+  const uint8_t *data = NULL;
+  size_t data_len = 0;
+  unsigned long long transport = thread_now_us() - msg->sent;
+  size_t tx_len = 3 + ntohs(msg->tx.len);
+  size_t rx_len = yrc == YHR_SUCCESS ? 3 + ntohs(msg->rx.len) : 0;
+
+  stats_record(connector, YHC_SESSION_MESSAGE, yrc, tx_len, rx_len, transport,
+               transport, false);
+  status_cache_failed(connector, yrc);
+
+  thread_mutex_lock(&session->lock);
+  if (yrc == YHR_SUCCESS) {
+    DBG_NET((Msg *) &msg->rx, dump_response);
+    yrc = open_session_msg(session, msg->encrypted_ctr, &msg->rx,
+                           &response_cmd, &data, &data_len);
+    if (yrc == YHR_SUCCESS) {
+      session->last_used = thread_now_ms();
+      if (response_cmd == YHC_ERROR && data_len > 0) {
+        yrc = translate_device_error(data[0]);
+      }
+    }
+  }
+  session->in_flight = false;
+  thread_mutex_unlock(&session->lock);
 
-  // Label
-  memset(ptr, 0, 11);
-  ptr += 11;
-  *ptr++ = type;
+  if (yrc != YHR_SUCCESS) {
+    DBG_ERR("%s", yh_strerror(yrc));
+  }
+  stats_record(connector, msg->cmd, yrc, tx_len,
+               yrc == YHR_SUCCESS ? rx_len : 0, transport,
+               thread_now_us() - msg->start, true);
+  object_cache_command(connector, msg->cmd);
+  if (yrc == YHR_DEVICE_LOG_FULL) {
+    log_drain_wakeup(connector);
+  }
+  trace_end(connector, &msg->event, session->s.sid, yrc,
+            yrc == YHR_SUCCESS ? data_len : 0);
 
-  // Delimiter byte
-  *ptr++ = 0;
+  msg->callback(session, yrc, response_cmd, data, data_len, msg->user);
 
-  // L
-  *ptr++ = (L & 0xff00) >> 8;
-  *ptr++ = (L & 0x00ff);
+  insecure_memzero(msg, sizeof(async_msg));
+  free(msg);
+}
 
-  // i
-  *ptr++ = 0x01;
+static yh_rc send_secure_msgv_async(yh_session *session, yh_cmd cmd,
+                                    const yh_iovec *iov, size_t iovcnt,
+                                    yh_async_callback callback, void *user) {
 
-  // Context
-  memcpy(ptr, context, SCP_CONTEXT_LEN);
-  ptr += SCP_CONTEXT_LEN;
+  if (session == NULL || session->parent == NULL ||
+      (iovcnt != 0 && iov == NULL) || callback == NULL) {
+    DBG_ERR("%s", yh_strerror(YHR_INVALID_PARAMETERS));
+    return YHR_INVALID_PARAMETERS;
+  }
 
-  insecure_memzero(&ctx, sizeof(ctx));
-  if (aes_cmac_init((uint8_t *) key, key_len, &ctx)) {
-    return YHR_GENERIC_ERROR;
+  yh_connector *connector = session->parent;
+  if (connector->bf == NULL || connector->bf->backend_send_msg_async == NULL) {
+    DBG_ERR("Asynchronous messages are not supported by the backend");
+    return YHR_CONNECTOR_ERROR;
   }
 
-  for (i = 0; i < n_iterations; i++) {
+  async_msg *msg = calloc(1, sizeof(async_msg));
+  if (msg == NULL) {
+    DBG_ERR("%s", yh_strerror(YHR_MEMORY_ERROR));
+    return YHR_MEMORY_ERROR;
+  }
+
+  // Held until in_flight is set, the response may be processed by another
+  // thread as soon as the message is handed to the backend
+  thread_mutex_lock(&session->lock);
+
+  yh_rc yrc;
+  if (session->in_flight) {
+    DBG_ERR("Session has a command in flight");
+    yrc = YHR_INVALID_PARAMETERS;
+    goto cleanup;
+  }
+
+  msg->start = thread_now_us();
+  trace_begin(connector, &msg->event, YH_TRACE_SECURE_MSG, cmd,
+              session->s.sid, iov_len(iov, iovcnt));
+  yrc =
+    seal_session_msg(session, cmd, iov, iovcnt, &msg->tx, msg->encrypted_ctr);
+  if (yrc != YHR_SUCCESS) {
+    goto cleanup;
+  }
+
+  msg->session = session;
+  msg->callback = callback;
+  msg->user = user;
+  msg->cmd = cmd;
+
+  DBG_NET((Msg *) &msg->tx, dump_msg);
+  msg->sent = thread_now_us();
+  yrc = connector->bf->backend_send_msg_async(connector->connection,
+                                              (Msg *) &msg->tx,
+                                              (Msg *) &msg->rx,
+                                              session->s.identifier,
+                                              async_msg_done, msg);
+  if (yrc != YHR_SUCCESS) {
+    DBG_ERR("backend_send_msg_async %s", yh_strerror(yrc));
+    goto cleanup;
+  }
+
+  session->in_flight = true;
+  thread_mutex_unlock(&session->lock);
+
+  return YHR_SUCCESS;
+
+cleanup:
+  thread_mutex_unlock(&session->lock);
+  trace_end(connector, &msg->event, session->s.sid, yrc, 0);
+  insecure_memzero(msg, sizeof(async_msg));
+  free(msg);
+  return yrc;
+}
+
+yh_rc yh_send_secure_msg_async(yh_session *session, yh_cmd cmd,
+                               const uint8_t *data, size_t data_len,
+                               yh_async_callback callback, void *user) {
+
+  yh_iovec iov = {data, data_len};
+
+  return send_secure_msgv_async(session, cmd, &iov, 1, callback, user);
+}
+
+yh_rc yh_connector_get_pollfds(yh_connector *connector, yh_pollfd *fds,
+                               size_t *n_fds, int *timeout_ms) {
+
+  if (connector == NULL || n_fds == NULL || (fds == NULL && *n_fds != 0) ||
+      timeout_ms == NULL) {
+    DBG_ERR("%s", yh_strerror(YHR_INVALID_PARAMETERS));
+    return YHR_INVALID_PARAMETERS;
+  }
+
+  if (connector->bf == NULL || connector->bf->backend_get_pollfds == NULL) {
+    DBG_ERR("Asynchronous messages are not supported by the backend");
+    return YHR_CONNECTOR_ERROR;
+  }
+
+  return connector->bf->backend_get_pollfds(connector->connection, fds, n_fds,
+                                            timeout_ms);
+}
+
+yh_rc yh_connector_process(yh_connector *connector, const yh_pollfd *fds,
+                           size_t n_fds) {
+
+  if (connector == NULL || (fds == NULL && n_fds != 0)) {
+    DBG_ERR("%s", yh_strerror(YHR_INVALID_PARAMETERS));
+    return YHR_INVALID_PARAMETERS;
+  }
+
+  if (connector->bf == NULL || connector->bf->backend_process == NULL) {
+    DBG_ERR("Asynchronous messages are not supported by the backend");
+    return YHR_CONNECTOR_ERROR;
+  }
+
+  return connector->bf->backend_process(connector->connection, fds, n_fds);
+}
+
+static yh_rc compute_cryptogram(const uint8_t *key, uint16_t key_len,
+                                uint8_t type, uint8_t context[SCP_CONTEXT_LEN],
+                                uint16_t L, uint8_t *key_out) {
+
+  uint8_t n_iterations;
+  uint8_t i;
+  uint8_t result[SCP_KEY_LEN];
+  uint8_t input[16 + SCP_CONTEXT_LEN];
+  uint8_t *ptr = input;
+
+  aes_cmac_context_t ctx;
+
+  if (L == 0x40 || L == 0x80)
+    n_iterations = 1;
+  else if (L == 0xc0 || L == 0x100)
+    n_iterations = 2;
+  else
+    return YHR_INVALID_PARAMETERS;
+
+  // Label
+  memset(ptr, 0, 11);
+  ptr += 11;
+  *ptr++ = type;
+
+  // Delimiter byte
+  *ptr++ = 0;
+
+  // L
+  *ptr++ = (L & 0xff00) >> 8;
+  *ptr++ = (L & 0x00ff);
+
+  // i
+  *ptr++ = 0x01;
+
+  // Context
+  memcpy(ptr, context, SCP_CONTEXT_LEN);
+  ptr += SCP_CONTEXT_LEN;
+
+  insecure_memzero(&ctx, sizeof(ctx));
+  if (aes_cmac_init((uint8_t *) key, key_len, &ctx)) {
+    return YHR_GENERIC_ERROR;
+  }
+
+  for (i = 0; i < n_iterations; i++) {
     if (aes_cmac_encrypt(&ctx, input, ptr - input,
                          result + (i * SCP_PRF_LEN))) {
       aes_cmac_destroy(&ctx);
@@ -596,10 +1109,10 @@ static yh_rc compute_host_cryptogram(yh_session *session,
 static yh_rc derive_key(const uint8_t *password, size_t password_len,
                         uint8_t *key, size_t key_len) {
 
-  if (!pkcs5_pbkdf2_hmac(password, password_len,
-                         (const uint8_t *) YH_DEFAULT_SALT,
-                         strlen(YH_DEFAULT_SALT), YH_DEFAULT_ITERS, _SHA256,
-                         key, key_len)) {
+  if (!kdf_cache_pbkdf2_hmac(password, password_len,
+                             (const uint8_t *) YH_DEFAULT_SALT,
+                             strlen(YH_DEFAULT_SALT), YH_DEFAULT_ITERS, _SHA256,
+                             key, key_len)) {
     return YHR_GENERIC_ERROR;
   }
 
@@ -626,10 +1139,10 @@ yh_rc yh_create_session_derived(yh_connector *connector, uint16_t authkey_id,
   return yrc;
 }
 
-yh_rc yh_create_session(yh_connector *connector, uint16_t authkey_id,
-                        const uint8_t *key_enc, size_t key_enc_len,
-                        const uint8_t *key_mac, size_t key_mac_len,
-                        bool recreate, yh_session **session) {
+static yh_rc _create_session(yh_connector *connector, uint16_t authkey_id,
+                             const uint8_t *key_enc, size_t key_enc_len,
+                             const uint8_t *key_mac, size_t key_mac_len,
+                             bool recreate, yh_session **session) {
 
   Msg msg;
   Msg response_msg;
@@ -651,7 +1164,7 @@ yh_rc yh_create_session(yh_connector *connector, uint16_t authkey_id,
   }
 
   if (!*session) {
-    new_session = calloc(1, sizeof(yh_session));
+    new_session = alloc_session();
     if (new_session == NULL) {
       DBG_ERR("%s", yh_strerror(YHR_MEMORY_ERROR));
       return YHR_MEMORY_ERROR;
@@ -661,6 +1174,7 @@ yh_rc yh_create_session(yh_connector *connector, uint16_t authkey_id,
   }
 
   new_session->authkey_id = authkey_id;
+  new_session->s.authenticated = false;
 
   if (recreate) {
     new_session->recreate = true;
@@ -752,6 +1266,11 @@ yh_rc yh_create_session(yh_connector *connector, uint16_t authkey_id,
     goto cs_failure;
   }
 
+  yrc = init_session_ctx(&new_session->s);
+  if (yrc != YHR_SUCCESS) {
+    goto cs_failure;
+  }
+
   DBG_INFO("Card cryptogram successfully verified");
 
   // Save link back to connector
@@ -764,8 +1283,7 @@ yh_rc yh_create_session(yh_connector *connector, uint16_t authkey_id,
 cs_failure:
   // Only clear and free if we didn't reuse the session
   if (new_session != *session) {
-    insecure_memzero(new_session, sizeof(yh_session));
-    free(new_session);
+    free_session(new_session);
     new_session = NULL;
   }
 
@@ -774,6 +1292,46 @@ cs_failure:
   return yrc;
 }
 
+static yh_rc create_session(yh_connector *connector, uint16_t authkey_id,
+                            const uint8_t *key_enc, size_t key_enc_len,
+                            const uint8_t *key_mac, size_t key_mac_len,
+                            bool recreate, yh_session **session) {
+
+  yh_trace_event event;
+
+  trace_begin(connector, &event, YH_TRACE_CREATE_SESSION, YHC_CREATE_SESSION,
+              -1, 0);
+  USDT1(yubihsm, session_create_start, authkey_id);
+  yh_rc yrc = _create_session(connector, authkey_id, key_enc, key_enc_len,
+                              key_mac, key_mac_len, recreate, session);
+  trace_end(connector, &event, yrc == YHR_SUCCESS ? (*session)->s.sid : -1, yrc,
+            0);
+  USDT3(yubihsm, session_create_done, authkey_id,
+        yrc == YHR_SUCCESS ? (*session)->s.sid : -1, yrc);
+
+  return yrc;
+}
+
+yh_rc yh_create_session(yh_connector *connector, uint16_t authkey_id,
+                        const uint8_t *key_enc, size_t key_enc_len,
+                        const uint8_t *key_mac, size_t key_mac_len,
+                        bool recreate, yh_session **session) {
+
+  if (session == NULL || *session == NULL) {
+    return create_session(connector, authkey_id, key_enc, key_enc_len, key_mac,
+                          key_mac_len, recreate, session);
+  }
+
+  // Re-created in place, keep the keepalive thread off the session meanwhile
+  yh_session *existing = *session;
+  thread_mutex_lock(&existing->lock);
+  yh_rc yrc = create_session(connector, authkey_id, key_enc, key_enc_len,
+                             key_mac, key_mac_len, recreate, session);
+  thread_mutex_unlock(&existing->lock);
+
+  return yrc;
+}
+
 yh_rc yh_begin_create_session_ext(yh_connector *connector, uint16_t authkey_id,
                                   uint8_t **context, uint8_t *card_cryptogram,
                                   size_t card_cryptogram_len,
@@ -801,7 +1359,7 @@ yh_rc yh_begin_create_session_ext(yh_connector *connector, uint16_t authkey_id,
   /**********/
   // TODO(adma): replace with func
   if (!*session) {
-    new_session = calloc(1, sizeof(yh_session));
+    new_session = alloc_session();
     if (new_session == NULL) {
       DBG_ERR("%s", yh_strerror(YHR_MEMORY_ERROR));
       return YHR_MEMORY_ERROR;
@@ -877,8 +1435,7 @@ yh_rc yh_begin_create_session_ext(yh_connector *connector, uint16_t authkey_id,
 bcse_failure:
   // Only clear and free if we didn't reuse the session
   if (new_session != *session) {
-    insecure_memzero(new_session, sizeof(yh_session));
-    free(new_session);
+    free_session(new_session);
     new_session = NULL;
   }
 
@@ -914,10 +1471,13 @@ yh_rc yh_finish_create_session_ext(
 
   // Verify card cryptogram
   yrc = verify_card_cryptogram(&session->s, session->context, card_cryptogram);
+  if (yrc == YHR_SUCCESS) {
+    yrc = init_session_ctx(&session->s);
+  }
   if (yrc != YHR_SUCCESS) {
     DBG_ERR("%s", yh_strerror(yrc));
 
-    free(session);
+    free_session(session);
     session = NULL;
 
     DBG_ERR("%s", yh_strerror(yrc));
@@ -1058,10 +1618,73 @@ yh_rc yh_util_generate_ec_p256_key(uint8_t *privkey, size_t privkey_len,
   return YHR_SUCCESS;
 }
 
-yh_rc yh_create_session_asym(yh_connector *connector, uint16_t authkey_id,
-                             const uint8_t *privkey, size_t privkey_len,
-                             const uint8_t *device_pubkey,
-                             size_t device_pubkey_len, yh_session **session) {
+static bool equal_secret(const uint8_t *a, const uint8_t *b, size_t len) {
+
+  uint8_t diff = 0;
+
+  for (size_t i = 0; i < len; i++) {
+    diff |= a[i] ^ b[i];
+  }
+
+  return diff == 0;
+}
+
+/*
+ * The ECDH secret between the static authentication key and the device key is
+ * the same for every session, so it is kept in the connector once a session
+ * using it was established
+ */
+static bool get_asym_secret(yh_connector *connector, const uint8_t *privkey,
+                            const uint8_t *device_pubkey, uint8_t *secret) {
+
+  bool found = false;
+
+  thread_mutex_lock(&connector->cache_lock);
+  for (size_t i = 0; connector->asym_secrets != NULL && i < YH_ASYM_SECRETS;
+       i++) {
+    struct asym_secret *entry = &connector->asym_secrets[i];
+    if (entry->used &&
+        equal_secret(entry->privkey, privkey, YH_EC_P256_PRIVKEY_LEN) &&
+        equal_secret(entry->device_pubkey, device_pubkey,
+                     YH_EC_P256_PUBKEY_LEN)) {
+      memcpy(secret, entry->secret, YH_EC_P256_PRIVKEY_LEN);
+      found = true;
+      break;
+    }
+  }
+  thread_mutex_unlock(&connector->cache_lock);
+
+  return found;
+}
+
+static void put_asym_secret(yh_connector *connector, const uint8_t *privkey,
+                            const uint8_t *device_pubkey,
+                            const uint8_t *secret) {
+
+  thread_mutex_lock(&connector->cache_lock);
+  if (connector->asym_secrets == NULL) {
+    connector->asym_secrets =
+      locked_alloc(YH_ASYM_SECRETS * sizeof(struct asym_secret));
+  }
+  if (connector->asym_secrets != NULL) {
+    struct asym_secret *entry =
+      &connector->asym_secrets[connector->next_asym_secret];
+    connector->next_asym_secret =
+      (connector->next_asym_secret + 1) % YH_ASYM_SECRETS;
+    memcpy(entry->privkey, privkey, YH_EC_P256_PRIVKEY_LEN);
+    memcpy(entry->device_pubkey, device_pubkey, YH_EC_P256_PUBKEY_LEN);
+    memcpy(entry->secret, secret, YH_EC_P256_PRIVKEY_LEN);
+    entry->used = true;
+  }
+  thread_mutex_unlock(&connector->cache_lock);
+}
+
+static yh_rc _create_session_asym(yh_connector *connector,
+                                  uint16_t authkey_id, const uint8_t *privkey,
+                                  size_t privkey_len,
+                                  const uint8_t *device_pubkey,
+                                  size_t device_pubkey_len,
+                                  yh_session **session) {
 
   if (connector == NULL || privkey == NULL || device_pubkey == NULL ||
       session == NULL) {
@@ -1079,7 +1702,7 @@ yh_rc yh_create_session_asym(yh_connector *connector, uint16_t authkey_id,
   yh_session *new_session;
   yh_rc rc = YHR_SUCCESS;
   if (!*session) {
-    new_session = calloc(1, sizeof(yh_session));
+    new_session = alloc_session();
     if (new_session == NULL) {
       DBG_ERR("%s", yh_strerror(YHR_MEMORY_ERROR));
       return YHR_MEMORY_ERROR;
@@ -1091,10 +1714,10 @@ yh_rc yh_create_session_asym(yh_connector *connector, uint16_t authkey_id,
   uint8_t esk_oce[YH_EC_P256_PRIVKEY_LEN];
   uint8_t epk_oce[YH_EC_P256_PUBKEY_LEN];
 
-  if (!ecdh_generate_keypair(curve, esk_oce, sizeof(esk_oce), epk_oce,
-                             sizeof(epk_oce))) {
-    DBG_ERR("ecdh_generate_keypair %s", yh_strerror(YHR_INVALID_PARAMETERS));
-    rc = YHR_INVALID_PARAMETERS;
+  // Usually generated ahead of time, see yh_set_ephemeral_key_pool()
+  if (!ecdh_pool_take(esk_oce, epk_oce)) {
+    DBG_ERR("Failed to get an ephemeral key pair");
+    rc = YHR_GENERIC_ERROR;
     goto err;
   }
 
@@ -1148,7 +1771,12 @@ yh_rc yh_create_session_asym(yh_connector *connector, uint16_t authkey_id,
   }
 
   uint8_t shsss[YH_EC_P256_PRIVKEY_LEN];
-  if (!ecdh_calculate_secret(curve, privkey, privkey_len, device_pubkey,
+  bool cacheable = privkey_len == YH_EC_P256_PRIVKEY_LEN &&
+                   device_pubkey_len == YH_EC_P256_PUBKEY_LEN;
+  bool cached = cacheable &&
+                get_asym_secret(connector, privkey, device_pubkey, shsss);
+  if (!cached &&
+      !ecdh_calculate_secret(curve, privkey, privkey_len, device_pubkey,
                              device_pubkey_len, shsss, sizeof(shsss))) {
     DBG_ERR("ecdh_calculate_secret(shsss) %s",
             yh_strerror(YHR_INVALID_PARAMETERS));
@@ -1180,11 +1808,20 @@ yh_rc yh_create_session_asym(yh_connector *connector, uint16_t authkey_id,
     goto err;
   }
 
+  if (cacheable && !cached) {
+    put_asym_secret(connector, privkey, device_pubkey, shsss);
+  }
+
   memcpy(new_session->s.s_enc, shs + SCP_KEY_LEN, SCP_KEY_LEN);
   memcpy(new_session->s.s_mac, shs + 2 * SCP_KEY_LEN, SCP_KEY_LEN);
   memcpy(new_session->s.s_rmac, shs + 3 * SCP_KEY_LEN, SCP_KEY_LEN);
   memcpy(new_session->s.mac_chaining_value, mac, SCP_PRF_LEN);
 
+  rc = init_session_ctx(&new_session->s);
+  if (rc != YHR_SUCCESS) {
+    goto err;
+  }
+
   memset(new_session->s.ctr, 0, SCP_PRF_LEN);
   increment_ctr(new_session->s.ctr, SCP_PRF_LEN);
 
@@ -1201,14 +1838,34 @@ err:
   insecure_memzero(shs, sizeof(shs));
 
   if (new_session != *session) {
-    insecure_memzero(new_session, sizeof(yh_session));
-    free(new_session);
+    free_session(new_session);
     new_session = NULL;
   }
 
   return rc;
 }
 
+yh_rc yh_create_session_asym(yh_connector *connector, uint16_t authkey_id,
+                             const uint8_t *privkey, size_t privkey_len,
+                             const uint8_t *device_pubkey,
+                             size_t device_pubkey_len, yh_session **session) {
+
+  yh_trace_event event;
+
+  trace_begin(connector, &event, YH_TRACE_CREATE_SESSION, YHC_CREATE_SESSION,
+              -1, 0);
+  USDT1(yubihsm, session_create_start, authkey_id);
+  yh_rc yrc =
+    _create_session_asym(connector, authkey_id, privkey, privkey_len,
+                         device_pubkey, device_pubkey_len, session);
+  trace_end(connector, &event, yrc == YHR_SUCCESS ? (*session)->s.sid : -1, yrc,
+            0);
+  USDT3(yubihsm, session_create_done, authkey_id,
+        yrc == YHR_SUCCESS ? (*session)->s.sid : -1, yrc);
+
+  return yrc;
+}
+
 yh_rc yh_destroy_session(yh_session **session) {
 
   if (session == NULL) {
@@ -1218,91 +1875,646 @@ yh_rc yh_destroy_session(yh_session **session) {
     return YHR_SUCCESS;
   }
 
-  insecure_memzero(*session, sizeof(yh_session));
-  free(*session);
+  unlist_session(*session);
+  free_session(*session);
   *session = NULL;
 
   return YHR_SUCCESS;
 }
 
-bool yh_connector_has_device(yh_connector *connector) {
+/*
+ * Replace a session the device no longer knows with a new one, established on
+ * the side so that the owner of the session never waits for the handshake
+ */
+static void refresh_session(yh_connector *connector, yh_session *session,
+                            uint16_t authkey_id, const uint8_t *key,
+                            const char *identifier) {
 
-  return connector && connector->has_device;
-}
+  yh_session *fresh = NULL;
+  bool replaced = false;
 
-yh_rc yh_get_connector_version(yh_connector *connector, uint8_t *major,
-                               uint8_t *minor, uint8_t *patch) {
+  yh_rc yrc = create_session(connector, authkey_id, key, SCP_KEY_LEN,
+                             key + SCP_KEY_LEN, SCP_KEY_LEN, false, &fresh);
+  if (yrc == YHR_SUCCESS) {
+    yrc = authenticate_session(fresh);
+  }
+  USDT2(yubihsm, session_recreate_done,
+        yrc == YHR_SUCCESS ? fresh->s.sid : -1, yrc);
+  if (yrc != YHR_SUCCESS) {
+    DBG_ERR("Failed to recreate session: %s", yh_strerror(yrc));
+    yh_destroy_session(&fresh);
+    return;
+  }
 
-  if (connector == NULL || major == NULL || minor == NULL || patch == NULL) {
-    DBG_ERR("%s", yh_strerror(YHR_INVALID_PARAMETERS));
-    return YHR_INVALID_PARAMETERS;
+  // Unless the owner is using the session, or has re-created it meanwhile
+  if (thread_mutex_trylock(&session->lock)) {
+    if (!session->in_flight &&
+        strcmp(session->s.identifier, identifier) == 0) {
+      Scp_ctx s = session->s;
+      session->s = fresh->s;
+      fresh->s = s;
+      insecure_memzero(&s, sizeof(s));
+
+      uint8_t context[SCP_CONTEXT_LEN];
+      memcpy(context, session->context, SCP_CONTEXT_LEN);
+      memcpy(session->context, fresh->context, SCP_CONTEXT_LEN);
+      memcpy(fresh->context, context, SCP_CONTEXT_LEN);
+      insecure_memzero(context, sizeof(context));
+
+      session->last_used = fresh->last_used;
+      replaced = true;
+    }
+    thread_mutex_unlock(&session->lock);
   }
 
-  *major = connector->version_major;
-  *minor = connector->version_minor;
-  *patch = connector->version_patch;
+  if (!replaced) {
+    yh_util_close_session(fresh);
+  }
+  yh_destroy_session(&fresh);
+}
 
-  return YHR_SUCCESS;
+/*
+ * Send a keepalive over a session that has been idle for interval_ms, and
+ * return when it is next due
+ */
+static unsigned long long keep_session_alive(yh_connector *connector,
+                                             yh_session *session,
+                                             unsigned long long now,
+                                             int interval_ms) {
+
+  uint8_t data = 0xff;
+  yh_iovec iov = {&data, 1};
+  uint8_t response[8];
+  size_t response_len = sizeof(response);
+  yh_cmd response_cmd;
+  uint16_t authkey_id;
+  uint8_t key[2 * SCP_KEY_LEN];
+  char identifier[sizeof(session->s.identifier)];
+
+  // A session that is in use does not need a keepalive
+  if (!thread_mutex_trylock(&session->lock)) {
+    return now + interval_ms;
+  }
+  if (session->in_flight || !session->s.authenticated) {
+    thread_mutex_unlock(&session->lock);
+    return now + interval_ms;
+  }
+  unsigned long long due = session->last_used + interval_ms;
+  if (due > now) {
+    thread_mutex_unlock(&session->lock);
+    return due;
+  }
+
+  yh_rc yrc = _send_secure_msgv(session, YHC_ECHO, &iov, 1, &response_cmd,
+                                response, &response_len);
+  authkey_id = session->authkey_id;
+  memcpy(key, session->key_enc, SCP_KEY_LEN);
+  memcpy(key + SCP_KEY_LEN, session->key_mac, SCP_KEY_LEN);
+  memcpy(identifier, session->s.identifier, sizeof(identifier));
+  uint8_t sid = session->s.sid;
+  thread_mutex_unlock(&session->lock);
+
+  if (yrc == YHR_DEVICE_INVALID_SESSION ||
+      yrc == YHR_DEVICE_AUTHENTICATION_FAILED) {
+    DBG_INFO("Recreating session in the background");
+    USDT1(yubihsm, session_recreate_start, sid);
+    refresh_session(connector, session, authkey_id, key, identifier);
+  } else if (yrc != YHR_SUCCESS) {
+    DBG_ERR("Session keepalive failed: %s", yh_strerror(yrc));
+  }
+  insecure_memzero(key, sizeof(key));
+
+  return thread_now_ms() + interval_ms;
 }
 
-yh_rc yh_get_connector_address(yh_connector *connector, char **const address) {
+static void keepalive_main(void *arg) {
+
+  yh_connector *connector = (yh_connector *) arg;
+
+  thread_mutex_lock(&connector->sessions_lock);
+  while (!connector->keepalive_stop) {
+    unsigned long long now = thread_now_ms();
+    unsigned long long next = now + connector->keepalive_ms;
+
+    /*
+     * The session is pinned while the lock is dropped for the round trip, so
+     * that it stays listed and others can list and unlist sessions meanwhile
+     */
+    for (yh_session *session = connector->sessions;
+         session != NULL && !connector->keepalive_stop;
+         session = session->next) {
+      session->pinned = true;
+      thread_mutex_unlock(&connector->sessions_lock);
+      unsigned long long due =
+        keep_session_alive(connector, session, now, connector->keepalive_ms);
+      thread_mutex_lock(&connector->sessions_lock);
+      session->pinned = false;
+      thread_cond_broadcast(&connector->keepalive_wakeup);
+      if (due < next) {
+        next = due;
+      }
+    }
 
-  if (connector == NULL || address == NULL) {
-    DBG_ERR("%s", yh_strerror(YHR_INVALID_PARAMETERS));
-    return YHR_INVALID_PARAMETERS;
+    now = thread_now_ms();
+    if (next > now) {
+      thread_cond_wait(&connector->keepalive_wakeup, &connector->sessions_lock,
+                       (int) (next - now));
+    }
+  }
+  thread_mutex_unlock(&connector->sessions_lock);
+}
+
+static void stop_keepalive(yh_connector *connector) {
+
+  if (connector->keepalive_ms == 0) {
+    return;
   }
 
-  *address = (char *) connector->address;
+  thread_mutex_lock(&connector->sessions_lock);
+  connector->keepalive_stop = true;
+  thread_cond_broadcast(&connector->keepalive_wakeup);
+  thread_mutex_unlock(&connector->sessions_lock);
 
-  return YHR_SUCCESS;
+  thread_join(connector->keepalive_thread);
+  connector->keepalive_ms = 0;
 }
 
-yh_rc yh_util_get_device_info(yh_connector *connector, uint8_t *major,
-                              uint8_t *minor, uint8_t *patch, uint32_t *serial,
-                              uint8_t *log_total, uint8_t *log_used,
-                              yh_algorithm *algorithms, size_t *n_algorithms) {
+yh_rc yh_set_session_keepalive(yh_connector *connector, int interval_ms) {
 
-  if (connector == NULL) {
+  if (connector == NULL || interval_ms < 0) {
     DBG_ERR("%s", yh_strerror(YHR_INVALID_PARAMETERS));
     return YHR_INVALID_PARAMETERS;
   }
 
-  yh_rc yrc;
-
-#pragma pack(push, 1)
-  union {
-    struct {
-      uint8_t major;
-      uint8_t minor;
-      uint8_t patch;
-      uint32_t serial;
-      uint8_t log_total;
-      uint8_t log_used;
-      uint8_t algorithms[YH_MAX_ALGORITHM_COUNT];
-    };
-    uint8_t buf[1];
-  } response;
-#pragma pack(pop)
-  size_t response_len = sizeof(response);
-  yh_cmd response_cmd;
+  stop_keepalive(connector);
+  if (interval_ms == 0) {
+    return YHR_SUCCESS;
+  }
 
-  yrc = yh_send_plain_msg(connector, YHC_GET_DEVICE_INFO, NULL, 0,
-                          &response_cmd, response.buf, &response_len);
-  if (yrc != YHR_SUCCESS) {
-    DBG_ERR("Failed to send GET DEVICE INFO command: %s", yh_strerror(yrc));
-    return yrc;
+  connector->keepalive_ms = interval_ms;
+  connector->keepalive_stop = false;
+  if (!thread_create(&connector->keepalive_thread, keepalive_main,
+                     connector)) {
+    DBG_ERR("Failed to start the keepalive thread");
+    connector->keepalive_ms = 0;
+    return YHR_GENERIC_ERROR;
   }
 
-  if (major != NULL) {
-    *major = response.major;
+  return YHR_SUCCESS;
+}
+
+static bool pool_session_failed(yh_rc result) {
+
+  switch (result) {
+    case YHR_CONNECTION_ERROR:
+    case YHR_SESSION_AUTHENTICATION_FAILED:
+    case YHR_MAC_MISMATCH:
+    case YHR_DEVICE_INVALID_SESSION:
+    case YHR_DEVICE_AUTHENTICATION_FAILED:
+      return true;
+    default:
+      return false;
   }
+}
 
-  if (minor != NULL) {
-    *minor = response.minor;
+/*
+ * Create (or re-create in place) an authenticated session using the
+ * credentials cached in the pool
+ */
+static yh_rc pool_open_session(yh_session_pool *pool, yh_session **session) {
+
+  yh_rc yrc;
+
+  if (pool->auth == POOL_AUTH_ASYMMETRIC) {
+    return yh_create_session_asym(pool->connector, pool->authkey_id,
+                                  pool->privkey, sizeof(pool->privkey),
+                                  pool->device_pubkey,
+                                  sizeof(pool->device_pubkey), session);
   }
 
-  if (patch != NULL) {
-    *patch = response.patch;
+  yrc = yh_create_session(pool->connector, pool->authkey_id, pool->key_enc,
+                          SCP_KEY_LEN, pool->key_mac, SCP_KEY_LEN, true,
+                          session);
+  if (yrc == YHR_SUCCESS) {
+    yrc = yh_authenticate_session(*session);
+  }
+
+  return yrc;
+}
+
+static void pool_free(yh_session_pool *pool) {
+
+  for (size_t i = 0; i < pool->n_sessions; i++) {
+    if (pool->sessions[i] != NULL) {
+      if (pool->health[i].established) {
+        yh_util_close_session(pool->sessions[i]);
+      }
+      yh_destroy_session(&pool->sessions[i]);
+    }
+  }
+
+  thread_cond_destroy(&pool->available);
+  thread_mutex_destroy(&pool->lock);
+  insecure_memzero(pool, sizeof(yh_session_pool));
+  free(pool);
+}
+
+static yh_rc open_session_pool(yh_session_pool *new_pool, size_t n_sessions,
+                               yh_session_pool **pool) {
+
+  yh_rc yrc;
+
+  if (!thread_mutex_init(&new_pool->lock)) {
+    insecure_memzero(new_pool, sizeof(yh_session_pool));
+    free(new_pool);
+    return YHR_GENERIC_ERROR;
+  }
+
+  if (!thread_cond_init(&new_pool->available)) {
+    thread_mutex_destroy(&new_pool->lock);
+    insecure_memzero(new_pool, sizeof(yh_session_pool));
+    free(new_pool);
+    return YHR_GENERIC_ERROR;
+  }
+
+  for (new_pool->n_sessions = 0; new_pool->n_sessions < n_sessions;
+       new_pool->n_sessions++) {
+    size_t i = new_pool->n_sessions;
+
+    yrc = pool_open_session(new_pool, &new_pool->sessions[i]);
+    if (yrc != YHR_SUCCESS) {
+      DBG_ERR("Failed to create pool session %zu: %s", i, yh_strerror(yrc));
+      if (new_pool->sessions[i] != NULL) {
+        // Partially set up, count it so that it is freed
+        new_pool->n_sessions++;
+      }
+      pool_free(new_pool);
+      return yrc;
+    }
+    new_pool->health[i].session_id = new_pool->sessions[i]->s.sid;
+    new_pool->health[i].established = true;
+    new_pool->health[i].last_result = YHR_SUCCESS;
+  }
+
+  *pool = new_pool;
+
+  return YHR_SUCCESS;
+}
+
+yh_rc yh_create_session_pool(yh_connector *connector, uint16_t authkey_id,
+                             const uint8_t *key_enc, size_t key_enc_len,
+                             const uint8_t *key_mac, size_t key_mac_len,
+                             size_t n_sessions, yh_session_pool **pool) {
+
+  if (connector == NULL || key_enc == NULL || key_enc_len != SCP_KEY_LEN ||
+      key_mac == NULL || key_mac_len != SCP_KEY_LEN || n_sessions == 0 ||
+      n_sessions > YH_MAX_SESSIONS || pool == NULL) {
+    DBG_ERR("%s", yh_strerror(YHR_INVALID_PARAMETERS));
+    return YHR_INVALID_PARAMETERS;
+  }
+
+  yh_session_pool *new_pool = calloc(1, sizeof(yh_session_pool));
+  if (new_pool == NULL) {
+    DBG_ERR("%s", yh_strerror(YHR_MEMORY_ERROR));
+    return YHR_MEMORY_ERROR;
+  }
+
+  new_pool->connector = connector;
+  new_pool->auth = POOL_AUTH_SYMMETRIC;
+  new_pool->authkey_id = authkey_id;
+  memcpy(new_pool->key_enc, key_enc, SCP_KEY_LEN);
+  memcpy(new_pool->key_mac, key_mac, SCP_KEY_LEN);
+
+  return open_session_pool(new_pool, n_sessions, pool);
+}
+
+yh_rc yh_create_session_pool_derived(yh_connector *connector,
+                                     uint16_t authkey_id,
+                                     const uint8_t *password,
+                                     size_t password_len, size_t n_sessions,
+                                     yh_session_pool **pool) {
+
+  if (connector == NULL || password == NULL || pool == NULL) {
+    DBG_ERR("%s", yh_strerror(YHR_INVALID_PARAMETERS));
+    return YHR_INVALID_PARAMETERS;
+  }
+
+  uint8_t key[2 * SCP_KEY_LEN];
+  yh_rc yrc = derive_key(password, password_len, key, sizeof(key));
+
+  if (yrc == YHR_SUCCESS) {
+    yrc = yh_create_session_pool(connector, authkey_id, key, SCP_KEY_LEN,
+                                 key + SCP_KEY_LEN, SCP_KEY_LEN, n_sessions,
+                                 pool);
+    insecure_memzero(key, sizeof(key));
+  }
+  return yrc;
+}
+
+yh_rc yh_create_session_pool_asym(yh_connector *connector, uint16_t authkey_id,
+                                  const uint8_t *privkey, size_t privkey_len,
+                                  const uint8_t *device_pubkey,
+                                  size_t device_pubkey_len, size_t n_sessions,
+                                  yh_session_pool **pool) {
+
+  if (connector == NULL || privkey == NULL ||
+      privkey_len != YH_EC_P256_PRIVKEY_LEN || device_pubkey == NULL ||
+      device_pubkey_len != YH_EC_P256_PUBKEY_LEN || n_sessions == 0 ||
+      n_sessions > YH_MAX_SESSIONS || pool == NULL) {
+    DBG_ERR("%s", yh_strerror(YHR_INVALID_PARAMETERS));
+    return YHR_INVALID_PARAMETERS;
+  }
+
+  yh_session_pool *new_pool = calloc(1, sizeof(yh_session_pool));
+  if (new_pool == NULL) {
+    DBG_ERR("%s", yh_strerror(YHR_MEMORY_ERROR));
+    return YHR_MEMORY_ERROR;
+  }
+
+  new_pool->connector = connector;
+  new_pool->auth = POOL_AUTH_ASYMMETRIC;
+  new_pool->authkey_id = authkey_id;
+  memcpy(new_pool->privkey, privkey, YH_EC_P256_PRIVKEY_LEN);
+  memcpy(new_pool->device_pubkey, device_pubkey, YH_EC_P256_PUBKEY_LEN);
+
+  return open_session_pool(new_pool, n_sessions, pool);
+}
+
+yh_rc yh_session_pool_checkout(yh_session_pool *pool, int timeout_ms,
+                               yh_session **session) {
+
+  if (pool == NULL || session == NULL) {
+    DBG_ERR("%s", yh_strerror(YHR_INVALID_PARAMETERS));
+    return YHR_INVALID_PARAMETERS;
+  }
+
+  unsigned long long deadline =
+    thread_now_ms() + (timeout_ms > 0 ? timeout_ms : 0);
+  size_t slot = pool->n_sessions;
+  bool established = false;
+  yh_session *new_session;
+  yh_rc yrc;
+
+  thread_mutex_lock(&pool->lock);
+  for (;;) {
+    // Prefer a session that is ready over one that must be re-created
+    for (size_t i = 0; i < pool->n_sessions; i++) {
+      if (!pool->health[i].checked_out) {
+        if (slot == pool->n_sessions || pool->health[i].established) {
+          slot = i;
+        }
+        if (pool->health[i].established) {
+          break;
+        }
+      }
+    }
+    if (slot < pool->n_sessions) {
+      break;
+    }
+
+    int wait_ms = -1;
+    if (timeout_ms >= 0) {
+      unsigned long long now = thread_now_ms();
+      if (now >= deadline) {
+        thread_mutex_unlock(&pool->lock);
+        DBG_ERR("No session available: %s", yh_strerror(YHR_TIMEOUT));
+        return YHR_TIMEOUT;
+      }
+      wait_ms = (int) (deadline - now);
+    }
+    thread_cond_wait(&pool->available, &pool->lock, wait_ms);
+  }
+
+  pool->health[slot].checked_out = true;
+  pool->health[slot].checkouts++;
+  established = pool->health[slot].established;
+  new_session = pool->sessions[slot];
+  thread_mutex_unlock(&pool->lock);
+
+  if (!established) {
+    // The slot is ours while checked out, so re-create it without the lock
+    yrc = pool_open_session(pool, &new_session);
+
+    thread_mutex_lock(&pool->lock);
+    if (yrc != YHR_SUCCESS) {
+      pool->health[slot].checked_out = false;
+      pool->health[slot].last_result = yrc;
+      pool->health[slot].errors++;
+      thread_cond_signal(&pool->available);
+      thread_mutex_unlock(&pool->lock);
+      DBG_ERR("Failed to re-create pool session: %s", yh_strerror(yrc));
+      return yrc;
+    }
+    pool->sessions[slot] = new_session;
+    pool->health[slot].session_id = new_session->s.sid;
+    pool->health[slot].established = true;
+    pool->health[slot].recreations++;
+    thread_mutex_unlock(&pool->lock);
+  }
+
+  *session = new_session;
+
+  return YHR_SUCCESS;
+}
+
+yh_rc yh_session_pool_checkin(yh_session_pool *pool, yh_session *session,
+                              yh_rc result) {
+
+  if (pool == NULL || session == NULL) {
+    DBG_ERR("%s", yh_strerror(YHR_INVALID_PARAMETERS));
+    return YHR_INVALID_PARAMETERS;
+  }
+
+  thread_mutex_lock(&pool->lock);
+  for (size_t i = 0; i < pool->n_sessions; i++) {
+    if (pool->sessions[i] == session && pool->health[i].checked_out) {
+      pool->health[i].checked_out = false;
+      pool->health[i].last_result = result;
+      // The session may have been re-created by yh_send_secure_msg()
+      pool->health[i].session_id = session->s.sid;
+      if (result != YHR_SUCCESS) {
+        pool->health[i].errors++;
+      }
+      if (pool_session_failed(result)) {
+        pool->health[i].established = false;
+      }
+      thread_cond_signal(&pool->available);
+      thread_mutex_unlock(&pool->lock);
+      return YHR_SUCCESS;
+    }
+  }
+  thread_mutex_unlock(&pool->lock);
+
+  DBG_ERR("Session is not checked out from the pool: %s",
+          yh_strerror(YHR_INVALID_PARAMETERS));
+  return YHR_INVALID_PARAMETERS;
+}
+
+yh_rc yh_get_session_pool_health(yh_session_pool *pool,
+                                 yh_session_health *health, size_t *n_health) {
+
+  if (pool == NULL || health == NULL || n_health == NULL) {
+    DBG_ERR("%s", yh_strerror(YHR_INVALID_PARAMETERS));
+    return YHR_INVALID_PARAMETERS;
+  }
+
+  if (*n_health < pool->n_sessions) {
+    *n_health = pool->n_sessions;
+    DBG_ERR("%s", yh_strerror(YHR_BUFFER_TOO_SMALL));
+    return YHR_BUFFER_TOO_SMALL;
+  }
+
+  thread_mutex_lock(&pool->lock);
+  memcpy(health, pool->health, pool->n_sessions * sizeof(yh_session_health));
+  thread_mutex_unlock(&pool->lock);
+  *n_health = pool->n_sessions;
+
+  return YHR_SUCCESS;
+}
+
+yh_rc yh_destroy_session_pool(yh_session_pool **pool) {
+
+  if (pool == NULL) {
+    DBG_ERR("%s", yh_strerror(YHR_INVALID_PARAMETERS));
+    return YHR_INVALID_PARAMETERS;
+  } else if (*pool == NULL) {
+    return YHR_SUCCESS;
+  }
+
+  thread_mutex_lock(&(*pool)->lock);
+  for (size_t i = 0; i < (*pool)->n_sessions; i++) {
+    if ((*pool)->health[i].checked_out) {
+      thread_mutex_unlock(&(*pool)->lock);
+      DBG_ERR("Session %zu is still checked out", i);
+      return YHR_INVALID_PARAMETERS;
+    }
+  }
+  thread_mutex_unlock(&(*pool)->lock);
+
+  pool_free(*pool);
+  *pool = NULL;
+
+  return YHR_SUCCESS;
+}
+
+bool yh_connector_has_device(yh_connector *connector) {
+
+  return connector && connector->has_device;
+}
+
+yh_rc yh_get_connector_version(yh_connector *connector, uint8_t *major,
+                               uint8_t *minor, uint8_t *patch) {
+
+  if (connector == NULL || major == NULL || minor == NULL || patch == NULL) {
+    DBG_ERR("%s", yh_strerror(YHR_INVALID_PARAMETERS));
+    return YHR_INVALID_PARAMETERS;
+  }
+
+  *major = connector->version_major;
+  *minor = connector->version_minor;
+  *patch = connector->version_patch;
+
+  return YHR_SUCCESS;
+}
+
+yh_rc yh_get_connector_address(yh_connector *connector, char **const address) {
+
+  if (connector == NULL || address == NULL) {
+    DBG_ERR("%s", yh_strerror(YHR_INVALID_PARAMETERS));
+    return YHR_INVALID_PARAMETERS;
+  }
+
+  *address = (char *) connector->address;
+
+  return YHR_SUCCESS;
+}
+
+yh_rc yh_get_connector_stats(yh_connector *connector,
+                             yh_connector_stats *stats) {
+
+  if (connector == NULL || stats == NULL) {
+    DBG_ERR("%s", yh_strerror(YHR_INVALID_PARAMETERS));
+    return YHR_INVALID_PARAMETERS;
+  }
+
+  stats_read(connector, stats);
+
+  return YHR_SUCCESS;
+}
+
+yh_rc yh_reset_connector_stats(yh_connector *connector) {
+
+  if (connector == NULL) {
+    DBG_ERR("%s", yh_strerror(YHR_INVALID_PARAMETERS));
+    return YHR_INVALID_PARAMETERS;
+  }
+
+  stats_reset(connector);
+
+  return YHR_SUCCESS;
+}
+
+yh_rc yh_set_trace_hooks(yh_connector *connector, yh_trace_callback begin,
+                         yh_trace_callback end, void *user) {
+
+  if (connector == NULL) {
+    DBG_ERR("%s", yh_strerror(YHR_INVALID_PARAMETERS));
+    return YHR_INVALID_PARAMETERS;
+  }
+
+  connector->trace_begin = begin;
+  connector->trace_end = end;
+  connector->trace_user = user;
+
+  return YHR_SUCCESS;
+}
+
+yh_rc yh_util_get_device_info(yh_connector *connector, uint8_t *major,
+                              uint8_t *minor, uint8_t *patch, uint32_t *serial,
+                              uint8_t *log_total, uint8_t *log_used,
+                              yh_algorithm *algorithms, size_t *n_algorithms) {
+
+  if (connector == NULL) {
+    DBG_ERR("%s", yh_strerror(YHR_INVALID_PARAMETERS));
+    return YHR_INVALID_PARAMETERS;
+  }
+
+  yh_rc yrc;
+
+#pragma pack(push, 1)
+  union {
+    struct {
+      uint8_t major;
+      uint8_t minor;
+      uint8_t patch;
+      uint32_t serial;
+      uint8_t log_total;
+      uint8_t log_used;
+      uint8_t algorithms[YH_MAX_ALGORITHM_COUNT];
+    };
+    uint8_t buf[1];
+  } response;
+#pragma pack(pop)
+  size_t response_len = sizeof(response);
+  yh_cmd response_cmd;
+
+  yrc = yh_send_plain_msg(connector, YHC_GET_DEVICE_INFO, NULL, 0,
+                          &response_cmd, response.buf, &response_len);
+  if (yrc != YHR_SUCCESS) {
+    DBG_ERR("Failed to send GET DEVICE INFO command: %s", yh_strerror(yrc));
+    return yrc;
+  }
+
+  if (major != NULL) {
+    *major = response.major;
+  }
+
+  if (minor != NULL) {
+    *minor = response.minor;
+  }
+
+  if (patch != NULL) {
+    *patch = response.patch;
   }
 
   if (serial != NULL) {
@@ -1407,6 +2619,7 @@ yh_rc yh_util_list_objects(yh_session *session, uint16_t id,
     }
   }
 
+  uint64_t generation = object_cache_generation(session->parent);
   yrc = yh_send_secure_msg(session, YHC_LIST_OBJECTS, data, dataptr - data,
                            &response_cmd, response, &response_len);
   if (yrc != YHR_SUCCESS) {
@@ -1427,6 +2640,7 @@ yh_rc yh_util_list_objects(yh_session *session, uint16_t id,
     objects[i / 4].type = response[i + 2];
     objects[i / 4].sequence = response[i + 3];
   }
+  object_cache_validate(session, objects, *n_objects, generation);
 
   DBG_INFO("Found %zu objects", *n_objects);
 
@@ -1472,6 +2686,11 @@ yh_rc yh_util_get_object_info(yh_session *session, uint16_t id,
 
   *dataptr++ = (uint16_t) type;
 
+  if (object != NULL && object_cache_get(session, id, type, object)) {
+    return YHR_SUCCESS;
+  }
+
+  uint64_t generation = object_cache_generation(session->parent);
   yrc = yh_send_secure_msg(session, YHC_GET_OBJECT_INFO, data, sizeof(data),
                            &response_cmd, response.buf, &response_len);
   if (yrc != YHR_SUCCESS) {
@@ -1503,6 +2722,8 @@ yh_rc yh_util_get_object_info(yh_session *session, uint16_t id,
 
       memcpy(object->delegated_capabilities.capabilities,
              response.delegated_capabilities, YH_CAPABILITIES_LEN);
+
+      object_cache_put(session, object, generation);
     }
   } else {
     DBG_ERR("Wrong response length, expecting %lu or 0, received %lu",
@@ -1514,40 +2735,120 @@ yh_rc yh_util_get_object_info(yh_session *session, uint16_t id,
   return YHR_SUCCESS;
 }
 
-yh_rc yh_util_get_public_key(yh_session *session, uint16_t id, uint8_t *data,
-                             size_t *data_len, yh_algorithm *algorithm) {
+static yh_rc get_public_key(yh_session *session, uint16_t id, uint8_t *data,
+                            size_t *data_len, yh_algorithm *algorithm,
+                            void **parsed) {
 
-  if (session == NULL || data == NULL || data_len == NULL) {
-    DBG_ERR("%s", yh_strerror(YHR_INVALID_PARAMETERS));
-    return YHR_INVALID_PARAMETERS;
+  yh_connector *connector = session->parent;
+  bool cache = pubkey_cache_enabled(connector);
+  uint64_t generation = 0;
+  uint8_t sequence = 0;
+  uint8_t response[YH_MSG_BUF_SIZE];
+  size_t response_len = sizeof(response);
+  yh_rc yrc;
+
+  if (cache) {
+    yh_object_descriptor object;
+    generation = object_cache_generation(connector);
+    // Also makes sure that the session may see the key
+    yrc = yh_util_get_object_info(session, id, YH_ASYMMETRIC_KEY, &object);
+    if (yrc != YHR_SUCCESS) {
+      return yrc;
+    }
+    sequence = object.sequence;
+
+    yh_algorithm cached_algorithm;
+    response_len = sizeof(response) - 1;
+    if (pubkey_cache_get(connector, id, sequence, response + 1, &response_len,
+                         &cached_algorithm, parsed)) {
+      response[0] = cached_algorithm;
+      response_len++;
+      if (parsed == NULL || *parsed != NULL) {
+        goto out;
+      }
+      goto parse;
+    }
   }
 
   uint8_t cmd[2] = {id >> 8, id & 0xff};
   yh_cmd response_cmd;
-  uint8_t response[YH_MSG_BUF_SIZE];
-  size_t response_len = sizeof(response);
+  response_len = sizeof(response);
 
-  yh_rc yrc = yh_send_secure_msg(session, YHC_GET_PUBLIC_KEY, cmd, sizeof(cmd),
-                                 &response_cmd, response, &response_len);
+  yrc = yh_send_secure_msg(session, YHC_GET_PUBLIC_KEY, cmd, sizeof(cmd),
+                           &response_cmd, response, &response_len);
 
   if (yrc != YHR_SUCCESS) {
     DBG_ERR("Failed to send GET PUBLIC KEY command: %s", yh_strerror(yrc));
     return yrc;
   }
 
-  if (response_len > *data_len) {
-    return YHR_BUFFER_TOO_SMALL;
+  if (response_len < 1) {
+    DBG_ERR("Wrong response length, expecting at least 1, received %lu",
+            (unsigned long) response_len);
+    return YHR_WRONG_LENGTH;
+  }
+
+parse:
+  if (parsed != NULL) {
+    *parsed =
+      pubkey_cache_parse(connector, response + 1, response_len - 1,
+                         response[0]);
+    if (*parsed == NULL) {
+      DBG_ERR("Failed to parse public key %04x", id);
+      return YHR_GENERIC_ERROR;
+    }
+  }
+
+  if (cache) {
+    pubkey_cache_put(connector, id, sequence, generation, response + 1,
+                     response_len - 1, response[0],
+                     parsed != NULL ? *parsed : NULL);
+  }
+
+out:
+  if (data != NULL) {
+    if (response_len > *data_len) {
+      // The caller gets nothing back, so drop its reference
+      if (parsed != NULL && *parsed != NULL) {
+        connector->pubkey_parser.unref(*parsed);
+        *parsed = NULL;
+      }
+      return YHR_BUFFER_TOO_SMALL;
+    }
+    *data_len = response_len - 1;
+    memcpy(data, response + 1, *data_len);
   }
 
   if (algorithm) {
     *algorithm = *response;
   }
-  *data_len = response_len - 1;
-  memcpy(data, response + 1, *data_len);
 
   return YHR_SUCCESS;
 }
 
+yh_rc yh_util_get_public_key(yh_session *session, uint16_t id, uint8_t *data,
+                             size_t *data_len, yh_algorithm *algorithm) {
+
+  if (session == NULL || data == NULL || data_len == NULL) {
+    DBG_ERR("%s", yh_strerror(YHR_INVALID_PARAMETERS));
+    return YHR_INVALID_PARAMETERS;
+  }
+
+  return get_public_key(session, id, data, data_len, algorithm, NULL);
+}
+
+yh_rc yh_util_get_public_key_parsed(yh_session *session, uint16_t id,
+                                    void **parsed, yh_algorithm *algorithm) {
+
+  if (session == NULL || parsed == NULL ||
+      session->parent->pubkey_parser.parse == NULL) {
+    DBG_ERR("%s", yh_strerror(YHR_INVALID_PARAMETERS));
+    return YHR_INVALID_PARAMETERS;
+  }
+
+  return get_public_key(session, id, NULL, NULL, algorithm, parsed);
+}
+
 yh_rc yh_util_close_session(yh_session *session) {
 
   if (session == NULL) {
@@ -1561,6 +2862,9 @@ yh_rc yh_util_close_session(yh_session *session) {
   size_t response_len = sizeof(response);
   yh_cmd response_cmd;
 
+  // A closed session is no longer kept alive, until it is used again
+  unlist_session(session);
+
   yrc = yh_send_secure_msg(session, YHC_CLOSE_SESSION, NULL, 0, &response_cmd,
                            response, &response_len);
   if (yrc != YHR_SUCCESS) {
@@ -1571,6 +2875,56 @@ yh_rc yh_util_close_session(yh_session *session) {
   return YHR_SUCCESS;
 }
 
+static yh_rc check_cmd_input(yh_cmd cmd, bool hashed, size_t in_len) {
+
+  switch (cmd) {
+    case YHC_SIGN_PKCS1:
+      if (hashed && in_len != 20 && in_len != 32 && in_len != 48 &&
+          in_len != 64) {
+        DBG_ERR("Data length must be 20, 32, 48 or 64");
+        return YHR_INVALID_PARAMETERS;
+      }
+      break;
+
+    case YHC_SIGN_ECDSA:
+      switch (in_len) {
+        case 20:
+        case 28: // p224..
+        case 32:
+        case 48:
+        case 64:
+        case 66: // p521 needs 66 bytes input
+          break;
+
+        default:
+          DBG_ERR("Data length must be 20, 28, 32, 48, 64 or 66");
+          return YHR_INVALID_PARAMETERS;
+      }
+      break;
+
+    case YHC_SIGN_EDDSA:
+    case YHC_WRAP_DATA:
+    case YHC_UNWRAP_DATA:
+      if (in_len > YH_MSG_BUF_SIZE - 2) {
+        DBG_ERR("Too much data, must be < %d", YH_MSG_BUF_SIZE - 2);
+        return YHR_INVALID_PARAMETERS;
+      }
+      break;
+
+    case YHC_GET_PSEUDO_RANDOM:
+      // The length is all there is, sent in place of a key ID
+      if (in_len != 0) {
+        return YHR_INVALID_PARAMETERS;
+      }
+      break;
+
+    default:
+      return YHR_INVALID_PARAMETERS;
+  }
+
+  return YHR_SUCCESS;
+}
+
 yh_rc yh_util_sign_pkcs1v1_5(yh_session *session, uint16_t key_id, bool hashed,
                              const uint8_t *in, size_t in_len, uint8_t *out,
                              size_t *out_len) {
@@ -1580,41 +2934,18 @@ yh_rc yh_util_sign_pkcs1v1_5(yh_session *session, uint16_t key_id, bool hashed,
     return YHR_INVALID_PARAMETERS;
   }
 
-  if (hashed)
-    switch (in_len) {
-      case 20:
-      case 32:
-      case 48:
-      case 64:
-        break;
-
-      default:
-        DBG_ERR("Data length must be 20, 32, 48 or 64");
-        return YHR_INVALID_PARAMETERS;
-    }
-
-  yh_rc yrc;
+  yh_rc yrc = check_cmd_input(YHC_SIGN_PKCS1, hashed, in_len);
+  if (yrc != YHR_SUCCESS) {
+    return yrc;
+  }
 
-#pragma pack(push, 1)
-  union {
-    struct {
-      uint16_t key_id;
-      uint8_t bytes[YH_MSG_BUF_SIZE];
-    };
-    uint8_t buf[1];
-  } data;
-#pragma pack(pop)
-  uint16_t data_len;
+  uint8_t key[2] = {key_id >> 8, key_id & 0xff};
+  yh_iovec data[] = {{key, sizeof(key)}, {in, in_len}};
 
   yh_cmd response_cmd;
 
-  data.key_id = htons(key_id);
-
-  memcpy(data.bytes, in, in_len);
-  data_len = in_len;
-
-  yrc = yh_send_secure_msg(session, YHC_SIGN_PKCS1, data.buf, data_len + 2,
-                           &response_cmd, out, out_len);
+  yrc = yh_send_secure_msgv(session, YHC_SIGN_PKCS1, data, 2, &response_cmd,
+                            out, out_len);
   if (yrc != YHR_SUCCESS) {
     DBG_ERR("Failed to send SIGN PKCS1 command: %s", yh_strerror(yrc));
     return yrc;
@@ -1646,33 +2977,16 @@ yh_rc yh_util_sign_pss(yh_session *session, uint16_t key_id, const uint8_t *in,
 
   yh_rc yrc;
 
-#pragma pack(push, 1)
-  union {
-    struct {
-      uint16_t key_id;
-      uint8_t mgf1Algo;
-      uint16_t salt_len;
-      uint8_t bytes[YH_MSG_BUF_SIZE];
-    };
-    uint8_t buf[1];
-  } data;
-#pragma pack(pop)
-  uint16_t data_len = in_len;
-
-  yh_cmd response_cmd;
-
-  data.key_id = htons(key_id);
-
-  data.mgf1Algo = mgf1Algo;
-
   // NOTE(adma): 'in' is already a hash of the data, which type is inferred from
   // the length
-  data.salt_len = htons(salt_len);
+  uint8_t params[5] = {key_id >> 8, key_id & 0xff, mgf1Algo, salt_len >> 8,
+                       salt_len & 0xff};
+  yh_iovec data[] = {{params, sizeof(params)}, {in, in_len}};
 
-  memcpy(data.bytes, in, in_len);
+  yh_cmd response_cmd;
 
-  yrc = yh_send_secure_msg(session, YHC_SIGN_PSS, data.buf, data_len + 5,
-                           &response_cmd, out, out_len);
+  yrc = yh_send_secure_msgv(session, YHC_SIGN_PSS, data, 2, &response_cmd, out,
+                            out_len);
   if (yrc != YHR_SUCCESS) {
     DBG_ERR("Failed to send SIGN PSS command: %s", yh_strerror(yrc));
     return yrc;
@@ -1690,41 +3004,18 @@ yh_rc yh_util_sign_ecdsa(yh_session *session, uint16_t key_id,
     return YHR_INVALID_PARAMETERS;
   }
 
-  switch (in_len) {
-    case 20:
-    case 28: // p224..
-    case 32:
-    case 48:
-    case 64:
-    case 66: // p521 needs 66 bytes input
-      break;
-
-    default:
-      DBG_ERR("Data length must be 20, 28, 32, 48, 64 or 66");
-      return YHR_INVALID_PARAMETERS;
+  yh_rc yrc = check_cmd_input(YHC_SIGN_ECDSA, true, in_len);
+  if (yrc != YHR_SUCCESS) {
+    return yrc;
   }
 
-  yh_rc yrc;
-
-#pragma pack(push, 1)
-  union {
-    struct {
-      uint16_t key_id;
-      uint8_t bytes[YH_MSG_BUF_SIZE];
-    };
-    uint8_t buf[1];
-  } data;
-#pragma pack(pop)
-  uint16_t data_len = in_len;
+  uint8_t key[2] = {key_id >> 8, key_id & 0xff};
+  yh_iovec data[] = {{key, sizeof(key)}, {in, in_len}};
 
   yh_cmd response_cmd;
 
-  data.key_id = htons(key_id);
-
-  memcpy(data.bytes, in, in_len);
-
-  yrc = yh_send_secure_msg(session, YHC_SIGN_ECDSA, data.buf, data_len + 2,
-                           &response_cmd, out, out_len);
+  yrc = yh_send_secure_msgv(session, YHC_SIGN_ECDSA, data, 2, &response_cmd,
+                            out, out_len);
   if (yrc != YHR_SUCCESS) {
     DBG_ERR("Failed to send SIGN ECDSA command: %s", yh_strerror(yrc));
     return yrc;
@@ -1742,40 +3033,515 @@ yh_rc yh_util_sign_eddsa(yh_session *session, uint16_t key_id,
     return YHR_INVALID_PARAMETERS;
   }
 
-  if (in_len > YH_MSG_BUF_SIZE - 2) {
-    DBG_ERR("Too much data, must be < %d", YH_MSG_BUF_SIZE - 2);
+  yh_rc yrc = check_cmd_input(YHC_SIGN_EDDSA, true, in_len);
+  if (yrc != YHR_SUCCESS) {
+    return yrc;
+  }
+
+  uint8_t key[2] = {key_id >> 8, key_id & 0xff};
+  yh_iovec data[] = {{key, sizeof(key)}, {in, in_len}};
+
+  yh_cmd response_cmd;
+
+  yrc = yh_send_secure_msgv(session, YHC_SIGN_EDDSA, data, 2, &response_cmd,
+                            out, out_len);
+  if (yrc != YHR_SUCCESS) {
+    DBG_ERR("Failed to send SIGN EDDSA command: %s", yh_strerror(yrc));
+    return yrc;
+  }
+
+  return YHR_SUCCESS;
+}
+
+typedef struct cmd_batch cmd_batch;
+
+typedef struct batch_slot batch_slot;
+
+struct batch_slot {
+  cmd_batch *batch;
+  yh_session *session;
+  size_t item;
+  // Set by batch_done() for the thread that runs the batch
+  yh_rc result;
+  batch_slot *next_done;
+};
+
+/*
+ * yh_connector_process() completes the messages of every thread using the
+ * connector, so batch_done() may run on another thread than the one running
+ * the batch. It only stores the result of its item and queues the slot, the
+ * thread running the batch drains the queue and is the only one to touch the
+ * rest of the batch.
+ */
+struct cmd_batch {
+  yh_session_pool *pool;
+  yh_cmd cmd;
+  bool hashed;
+  // Sent ahead of every input, the key ID of the commands that take one
+  const uint8_t *prefix;
+  size_t prefix_len;
+  const uint8_t *const *in;
+  const size_t *in_len;
+  size_t n;
+  uint8_t *const *out;
+  size_t *out_len;
+  yh_rc *rcs;
+  // Items are sent in order, then the ones that are retried
+  size_t next;
+  size_t *retry;
+  size_t n_retry;
+  bool *retried;
+  bool stopped;
+  size_t in_flight;
+  batch_slot slots[YH_MAX_SESSIONS];
+  size_t n_slots;
+  // Completed slots, and a pipe to wake the thread running the batch
+  thread_mutex lock;
+  batch_slot *done;
+  int wakeup[2];
+};
+
+static bool batch_next_item(cmd_batch *batch, size_t *item) {
+
+  if (batch->stopped) {
+    return false;
+  } else if (batch->next < batch->n) {
+    *item = batch->next++;
+    return true;
+  } else if (batch->n_retry > 0) {
+    *item = batch->retry[--batch->n_retry];
+    return true;
+  }
+
+  return false;
+}
+
+/*
+ * A session that broke is checked in so that the pool re-creates it, and the
+ * item is retried once on another session
+ */
+static bool batch_session_failed(cmd_batch *batch, size_t item, yh_rc yrc) {
+
+  if (!pool_session_failed(yrc)) {
+    return false;
+  }
+
+  if (!batch->retried[item]) {
+    batch->retried[item] = true;
+    batch->retry[batch->n_retry++] = item;
+  }
+
+  return true;
+}
+
+static void batch_done(yh_session *session, yh_rc result, yh_cmd response_cmd,
+                       const uint8_t *response, size_t response_len,
+                       void *user);
+
+static void batch_send_next(batch_slot *slot) {
+
+  cmd_batch *batch = slot->batch;
+  size_t item;
+
+  while (batch_next_item(batch, &item)) {
+    yh_iovec iov[] = {{batch->prefix, batch->prefix_len},
+                      {batch->in[item], batch->in_len[item]}};
+    yh_rc yrc = check_cmd_input(batch->cmd, batch->hashed, iov[1].len);
+    if (yrc == YHR_SUCCESS) {
+      slot->item = item;
+      yrc = send_secure_msgv_async(slot->session, batch->cmd, iov, 2,
+                                   batch_done, slot);
+      if (yrc == YHR_SUCCESS) {
+        batch->in_flight++;
+        return;
+      }
+    }
+    batch->rcs[item] = yrc;
+  }
+
+  // Nothing left to send, let others use the session
+  yh_session_pool_checkin(batch->pool, slot->session, YHR_SUCCESS);
+  slot->session = NULL;
+}
+
+// May run on any thread using the connector, see struct cmd_batch
+static void batch_done(yh_session *session, yh_rc result, yh_cmd response_cmd,
+                       const uint8_t *response, size_t response_len,
+                       void *user) {
+
+  batch_slot *slot = (batch_slot *) user;
+  cmd_batch *batch = slot->batch;
+  size_t item = slot->item;
+
+  (void) session;
+  (void) response_cmd;
+
+  // The output of an item in flight is not touched by the batch thread
+  if (result == YHR_SUCCESS) {
+    if (batch->out_len[item] < response_len) {
+      DBG_ERR("%s (received %zu Bytes, can fit %zu Bytes) ",
+              yh_strerror(YHR_BUFFER_TOO_SMALL), response_len,
+              batch->out_len[item]);
+      result = YHR_BUFFER_TOO_SMALL;
+    } else {
+      memcpy(batch->out[item], response, response_len);
+    }
+    batch->out_len[item] = response_len;
+  }
+  slot->result = result;
+
+  // The batch may be freed as soon as the lock is released
+  thread_mutex_lock(&batch->lock);
+  slot->next_done = batch->done;
+  batch->done = slot;
+  if (write(batch->wakeup[1], "", 1) < 0 && errno != EAGAIN) {
+    DBG_ERR("Failed to wake up batch: %s", strerror(errno));
+  }
+  thread_mutex_unlock(&batch->lock);
+}
+
+/*
+ * Handle the slots completed since the last call, on the thread running the
+ * batch
+ */
+static void batch_complete(cmd_batch *batch) {
+
+  uint8_t drain[64];
+
+  thread_mutex_lock(&batch->lock);
+  batch_slot *done = batch->done;
+  batch->done = NULL;
+  while (read(batch->wakeup[0], drain, sizeof(drain)) > 0)
+    ;
+  thread_mutex_unlock(&batch->lock);
+
+  while (done != NULL) {
+    batch_slot *slot = done;
+    done = slot->next_done;
+
+    batch->in_flight--;
+    batch->rcs[slot->item] = slot->result;
+
+    if (batch_session_failed(batch, slot->item, slot->result)) {
+      yh_session_pool_checkin(batch->pool, slot->session, slot->result);
+      slot->session = NULL;
+      // Replace it if that doesn't mean waiting for another thread
+      if (batch->stopped || yh_session_pool_checkout(batch->pool, 0,
+                                                     &slot->session) !=
+                              YHR_SUCCESS) {
+        slot->session = NULL;
+        continue;
+      }
+    }
+
+    batch_send_next(slot);
+  }
+}
+
+#ifndef __WIN32
+typedef struct {
+  yh_pollfd *fds;
+  struct pollfd *pfds;
+  size_t size;
+} poll_set;
+
+/*
+ * Wait for the sockets of a connector, its timeout or wakeup_fd, and process
+ * the connector
+ */
+static yh_rc poll_connector(yh_connector *connector, poll_set *set,
+                            int wakeup_fd) {
+
+  size_t n_fds = set->size;
+  int timeout_ms;
+
+  yh_rc yrc =
+    yh_connector_get_pollfds(connector, set->fds, &n_fds, &timeout_ms);
+  if (yrc == YHR_BUFFER_TOO_SMALL || set->pfds == NULL) {
+    if (n_fds > 0) {
+      yh_pollfd *fds = realloc(set->fds, n_fds * sizeof(yh_pollfd));
+      if (fds == NULL) {
+        return YHR_MEMORY_ERROR;
+      }
+      set->fds = fds;
+    }
+    // One more for wakeup_fd
+    struct pollfd *pfds =
+      realloc(set->pfds, (n_fds + 1) * sizeof(struct pollfd));
+    if (pfds == NULL) {
+      return YHR_MEMORY_ERROR;
+    }
+    set->pfds = pfds;
+    set->size = n_fds;
+    return YHR_SUCCESS;
+  } else if (yrc != YHR_SUCCESS) {
+    return yrc;
+  }
+
+  for (size_t i = 0; i < n_fds; i++) {
+    set->pfds[i].fd = set->fds[i].fd;
+    set->pfds[i].events = set->fds[i].events;
+    set->pfds[i].revents = 0;
+  }
+  set->pfds[n_fds].fd = wakeup_fd;
+  set->pfds[n_fds].events = POLLIN;
+  set->pfds[n_fds].revents = 0;
+  if (poll(set->pfds, n_fds + 1, timeout_ms) < 0 && errno != EINTR) {
+    DBG_ERR("poll failed: %s", strerror(errno));
+    return YHR_CONNECTION_ERROR;
+  }
+  for (size_t i = 0; i < n_fds; i++) {
+    set->fds[i].revents = set->pfds[i].revents;
+  }
+
+  return yh_connector_process(connector, set->fds, n_fds);
+}
+
+static yh_rc batch_run_async(cmd_batch *batch) {
+
+  yh_connector *connector = batch->pool->connector;
+  poll_set set = {NULL, NULL, 0};
+  yh_rc yrc = YHR_SUCCESS;
+
+  if (!thread_mutex_init(&batch->lock)) {
+    DBG_ERR("Failed to create batch lock");
+    return YHR_GENERIC_ERROR;
+  }
+  if (pipe(batch->wakeup) != 0) {
+    DBG_ERR("Failed to create batch pipe: %s", strerror(errno));
+    thread_mutex_destroy(&batch->lock);
+    return YHR_GENERIC_ERROR;
+  }
+  for (size_t i = 0; i < 2; i++) {
+    fcntl(batch->wakeup[i], F_SETFL,
+          fcntl(batch->wakeup[i], F_GETFL) | O_NONBLOCK);
+  }
+
+  for (;;) {
+    batch_complete(batch);
+
+    bool work_left = batch->next < batch->n || batch->n_retry > 0;
+
+    if (!work_left && batch->in_flight == 0) {
+      break;
+    }
+
+    // Give slots without a session one, waiting only if nothing is in flight
+    for (size_t i = 0; work_left && i < batch->n_slots; i++) {
+      batch_slot *slot = &batch->slots[i];
+      if (slot->session != NULL) {
+        continue;
+      }
+      yrc = yh_session_pool_checkout(batch->pool,
+                                     batch->in_flight == 0 ? -1 : 0,
+                                     &slot->session);
+      if (yrc == YHR_SUCCESS) {
+        batch_send_next(slot);
+      } else if (yrc == YHR_TIMEOUT) {
+        slot->session = NULL;
+        break;
+      } else {
+        slot->session = NULL;
+        goto cleanup;
+      }
+      work_left = batch->next < batch->n || batch->n_retry > 0;
+    }
+    yrc = YHR_SUCCESS;
+
+    if (batch->in_flight > 0) {
+      yrc = poll_connector(connector, &set, batch->wakeup[0]);
+      if (yrc != YHR_SUCCESS) {
+        goto cleanup;
+      }
+    }
+  }
+
+cleanup:
+  // The callbacks refer to the batch, so wait for what is still in flight
+  batch->stopped = true;
+  batch_complete(batch);
+  while (batch->in_flight > 0) {
+    if (poll_connector(connector, &set, batch->wakeup[0]) != YHR_SUCCESS) {
+      yh_connector_process(connector, NULL, 0);
+    }
+    batch_complete(batch);
+  }
+  for (size_t i = 0; i < batch->n_slots; i++) {
+    if (batch->slots[i].session != NULL) {
+      yh_session_pool_checkin(batch->pool, batch->slots[i].session, yrc);
+      batch->slots[i].session = NULL;
+    }
+  }
+  free(set.fds);
+  free(set.pfds);
+  close(batch->wakeup[0]);
+  close(batch->wakeup[1]);
+  thread_mutex_destroy(&batch->lock);
+
+  return yrc;
+}
+#endif
+
+static yh_rc batch_run_sync(cmd_batch *batch) {
+
+  yh_session *session = NULL;
+  yh_rc yrc = YHR_SUCCESS;
+  size_t item;
+
+  while (batch_next_item(batch, &item)) {
+    if (session == NULL) {
+      yrc = yh_session_pool_checkout(batch->pool, -1, &session);
+      if (yrc != YHR_SUCCESS) {
+        return yrc;
+      }
+    }
+
+    yh_iovec iov[] = {{batch->prefix, batch->prefix_len},
+                      {batch->in[item], batch->in_len[item]}};
+    yh_cmd response_cmd;
+
+    yrc = check_cmd_input(batch->cmd, batch->hashed, iov[1].len);
+    if (yrc == YHR_SUCCESS) {
+      yrc = yh_send_secure_msgv(session, batch->cmd, iov, 2, &response_cmd,
+                                batch->out[item], &batch->out_len[item]);
+    }
+    batch->rcs[item] = yrc;
+
+    if (batch_session_failed(batch, item, yrc)) {
+      yh_session_pool_checkin(batch->pool, session, yrc);
+      session = NULL;
+    }
+  }
+
+  if (session != NULL) {
+    yh_session_pool_checkin(batch->pool, session, YHR_SUCCESS);
+  }
+
+  return YHR_SUCCESS;
+}
+
+static yh_rc batch_run(yh_session_pool *pool, yh_cmd cmd, bool hashed,
+                       const uint8_t *prefix, size_t prefix_len,
+                       const uint8_t *const *in, const size_t *in_len, size_t n,
+                       uint8_t *const *out, size_t *out_len, yh_rc *rcs) {
+
+  if (pool == NULL || (n != 0 && (in == NULL || in_len == NULL ||
+                                  out == NULL || out_len == NULL ||
+                                  rcs == NULL))) {
+    DBG_ERR("%s", yh_strerror(YHR_INVALID_PARAMETERS));
     return YHR_INVALID_PARAMETERS;
   }
 
-  yh_rc yrc;
+  for (size_t i = 0; i < n; i++) {
+    if (in[i] == NULL || out[i] == NULL) {
+      DBG_ERR("%s", yh_strerror(YHR_INVALID_PARAMETERS));
+      return YHR_INVALID_PARAMETERS;
+    }
+  }
 
-#pragma pack(push, 1)
-  union {
-    struct {
-      uint16_t key_id;
-      uint8_t bytes[YH_MSG_BUF_SIZE];
-    };
-    uint8_t buf[1];
-  } data;
-#pragma pack(pop)
-  uint16_t data_len = in_len;
+  if (n == 0) {
+    return YHR_SUCCESS;
+  }
 
-  yh_cmd response_cmd;
+  cmd_batch *batch = calloc(1, sizeof(cmd_batch));
+  if (batch == NULL) {
+    DBG_ERR("%s", yh_strerror(YHR_MEMORY_ERROR));
+    return YHR_MEMORY_ERROR;
+  }
+
+  batch->retry = calloc(n, sizeof(size_t));
+  batch->retried = calloc(n, sizeof(bool));
+  if (batch->retry == NULL || batch->retried == NULL) {
+    free(batch->retry);
+    free(batch->retried);
+    free(batch);
+    DBG_ERR("%s", yh_strerror(YHR_MEMORY_ERROR));
+    return YHR_MEMORY_ERROR;
+  }
+
+  batch->pool = pool;
+  batch->cmd = cmd;
+  batch->hashed = hashed;
+  batch->prefix = prefix;
+  batch->prefix_len = prefix_len;
+  batch->in = in;
+  batch->in_len = in_len;
+  batch->n = n;
+  batch->out = out;
+  batch->out_len = out_len;
+  batch->rcs = rcs;
+  batch->n_slots = n < pool->n_sessions ? n : pool->n_sessions;
+  for (size_t i = 0; i < batch->n_slots; i++) {
+    batch->slots[i].batch = batch;
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    rcs[i] = YHR_GENERIC_ERROR;
+  }
 
-  data.key_id = htons(key_id);
+  yh_rc yrc;
+#ifndef __WIN32
+  if (pool->connector->bf != NULL &&
+      pool->connector->bf->backend_send_msg_async != NULL) {
+    yrc = batch_run_async(batch);
+  } else
+#endif
+  {
+    yrc = batch_run_sync(batch);
+  }
 
-  memcpy(data.bytes, in, in_len);
+  free(batch->retry);
+  free(batch->retried);
+  free(batch);
 
-  yrc = yh_send_secure_msg(session, YHC_SIGN_EDDSA, data.buf, data_len + 2,
-                           &response_cmd, out, out_len);
   if (yrc != YHR_SUCCESS) {
-    DBG_ERR("Failed to send SIGN EDDSA command: %s", yh_strerror(yrc));
+    DBG_ERR("Batch failed: %s", yh_strerror(yrc));
     return yrc;
   }
 
+  for (size_t i = 0; i < n; i++) {
+    if (rcs[i] != YHR_SUCCESS) {
+      return rcs[i];
+    }
+  }
+
   return YHR_SUCCESS;
 }
 
+yh_rc yh_util_sign_pkcs1v1_5_batch(yh_session_pool *pool, uint16_t key_id,
+                                   bool hashed, const uint8_t *const *in,
+                                   const size_t *in_len, size_t n,
+                                   uint8_t *const *out, size_t *out_len,
+                                   yh_rc *rcs) {
+
+  uint8_t key[2] = {key_id >> 8, key_id & 0xff};
+
+  return batch_run(pool, YHC_SIGN_PKCS1, hashed, key, sizeof(key), in, in_len,
+                   n, out, out_len, rcs);
+}
+
+yh_rc yh_util_sign_ecdsa_batch(yh_session_pool *pool, uint16_t key_id,
+                               const uint8_t *const *in, const size_t *in_len,
+                               size_t n, uint8_t *const *out, size_t *out_len,
+                               yh_rc *rcs) {
+
+  uint8_t key[2] = {key_id >> 8, key_id & 0xff};
+
+  return batch_run(pool, YHC_SIGN_ECDSA, true, key, sizeof(key), in, in_len, n,
+                   out, out_len, rcs);
+}
+
+yh_rc yh_util_sign_eddsa_batch(yh_session_pool *pool, uint16_t key_id,
+                               const uint8_t *const *in, const size_t *in_len,
+                               size_t n, uint8_t *const *out, size_t *out_len,
+                               yh_rc *rcs) {
+
+  uint8_t key[2] = {key_id >> 8, key_id & 0xff};
+
+  return batch_run(pool, YHC_SIGN_EDDSA, true, key, sizeof(key), in, in_len, n,
+                   out, out_len, rcs);
+}
+
 yh_rc yh_util_sign_hmac(yh_session *session, uint16_t key_id, const uint8_t *in,
                         size_t in_len, uint8_t *out, size_t *out_len) {
 
@@ -1789,19 +3555,13 @@ yh_rc yh_util_sign_hmac(yh_session *session, uint16_t key_id, const uint8_t *in,
     return YHR_INVALID_PARAMETERS;
   }
 
-  uint8_t data[YH_MSG_BUF_SIZE];
-  uint16_t data_len = 2;
+  uint8_t key[2] = {key_id >> 8, key_id & 0xff};
+  yh_iovec data[] = {{key, sizeof(key)}, {in, in_len}};
 
   yh_cmd response_cmd;
 
-  data[0] = htons(key_id) & 0xff;
-  data[1] = htons(key_id) >> 8;
-
-  memcpy(data + 2, in, in_len);
-  data_len += in_len;
-
-  yh_rc yrc = yh_send_secure_msg(session, YHC_SIGN_HMAC, data, data_len,
-                                 &response_cmd, out, out_len);
+  yh_rc yrc = yh_send_secure_msgv(session, YHC_SIGN_HMAC, data, 2,
+                                  &response_cmd, out, out_len);
   if (yrc != YHR_SUCCESS) {
     DBG_ERR("Failed to send SIGN HMAC command: %s", yh_strerror(yrc));
     return yrc;
@@ -1820,14 +3580,36 @@ yh_rc yh_util_get_pseudo_random(yh_session *session, size_t len, uint8_t *out,
     return YHR_INVALID_PARAMETERS;
   }
 
-  union {
-    uint16_t len;
-    uint8_t buf[2];
-  } data;
-  data.len = htons(len);
+  if (len > RANDOM_MAX_CHUNK) {
+    if (*out_len < len) {
+      DBG_ERR("%s (asked for %zu Bytes, can fit %zu Bytes) ",
+              yh_strerror(YHR_BUFFER_TOO_SMALL), len, *out_len);
+      return YHR_BUFFER_TOO_SMALL;
+    }
+    // One chunk at a time, as much as fits in a response
+    for (size_t offset = 0; offset < len; offset += RANDOM_MAX_CHUNK) {
+      size_t chunk_len = len - offset < RANDOM_MAX_CHUNK ? len - offset
+                                                         : RANDOM_MAX_CHUNK;
+      size_t got = chunk_len;
+      yrc = yh_util_get_pseudo_random(session, chunk_len, out + offset, &got);
+      if (yrc == YHR_SUCCESS && got != chunk_len) {
+        DBG_ERR("Wrong length of pseudo-random data");
+        yrc = YHR_WRONG_LENGTH;
+      }
+      if (yrc != YHR_SUCCESS) {
+        insecure_memzero(out, offset + chunk_len);
+        return yrc;
+      }
+    }
+    *out_len = len;
+    return YHR_SUCCESS;
+  }
+
+  uint8_t length[2] = {len >> 8, len & 0xff};
+  yh_iovec data = {length, sizeof(length)};
 
-  yrc = yh_send_secure_msg(session, YHC_GET_PSEUDO_RANDOM, data.buf,
-                           sizeof(data), &response_cmd, out, out_len);
+  yrc = yh_send_secure_msgv(session, YHC_GET_PSEUDO_RANDOM, &data, 1,
+                            &response_cmd, out, out_len);
   if (yrc != YHR_SUCCESS) {
     DBG_ERR("Failed to send GET PSEUDO RANDOM command: %s", yh_strerror(yrc));
     return yrc;
@@ -1836,6 +3618,85 @@ yh_rc yh_util_get_pseudo_random(yh_session *session, size_t len, uint8_t *out,
   return yrc;
 }
 
+yh_rc yh_util_get_pseudo_random_pooled(yh_session_pool *pool, size_t len,
+                                       uint8_t *out) {
+
+  const uint8_t **in = NULL;
+  size_t *in_len = NULL;
+  uint8_t **chunks = NULL;
+  size_t *chunk_lens = NULL;
+  yh_rc *rcs = NULL;
+  uint8_t tail[RANDOM_MAX_CHUNK];
+  uint8_t length[2];
+  yh_rc yrc = YHR_MEMORY_ERROR;
+
+  if (pool == NULL || out == NULL) {
+    DBG_ERR("%s", yh_strerror(YHR_INVALID_PARAMETERS));
+    return YHR_INVALID_PARAMETERS;
+  }
+
+  size_t taken = random_pool_take(pool->connector, pool, out, len);
+  if (taken == len) {
+    return YHR_SUCCESS;
+  }
+
+  // Chunks of equal length, the last one fetched into tail since it may not
+  // all be needed
+  size_t left = len - taken;
+  size_t n = (left + RANDOM_MAX_CHUNK - 1) / RANDOM_MAX_CHUNK;
+  size_t chunk_len = (left + n - 1) / n;
+
+  in = calloc(n, sizeof(uint8_t *));
+  in_len = calloc(n, sizeof(size_t));
+  chunks = calloc(n, sizeof(uint8_t *));
+  chunk_lens = calloc(n, sizeof(size_t));
+  rcs = calloc(n, sizeof(yh_rc));
+  if (in == NULL || in_len == NULL || chunks == NULL || chunk_lens == NULL ||
+      rcs == NULL) {
+    DBG_ERR("%s", yh_strerror(YHR_MEMORY_ERROR));
+    goto cleanup;
+  }
+
+  // Every command asks for chunk_len bytes
+  length[0] = chunk_len >> 8;
+  length[1] = chunk_len & 0xff;
+  for (size_t i = 0; i < n; i++) {
+    in[i] = length;
+    in_len[i] = sizeof(length);
+    chunks[i] = i + 1 < n ? out + taken + i * chunk_len : tail;
+    chunk_lens[i] = chunk_len;
+  }
+
+  yrc = batch_run(pool, YHC_GET_PSEUDO_RANDOM, false, NULL, 0, in, in_len, n,
+                  chunks, chunk_lens, rcs);
+  for (size_t i = 0; yrc == YHR_SUCCESS && i < n; i++) {
+    if (chunk_lens[i] != chunk_len) {
+      DBG_ERR("Wrong length of pseudo-random data");
+      yrc = YHR_WRONG_LENGTH;
+    }
+  }
+  if (yrc != YHR_SUCCESS) {
+    insecure_memzero(out, len);
+    goto cleanup;
+  }
+
+  // What is left over of the last chunk goes to the random pool
+  size_t tail_len = left - (n - 1) * chunk_len;
+  memcpy(out + len - tail_len, tail, tail_len);
+  random_pool_put(pool->connector, pool, tail + tail_len,
+                  chunk_len - tail_len);
+
+cleanup:
+  insecure_memzero(tail, sizeof(tail));
+  free(in);
+  free(in_len);
+  free(chunks);
+  free(chunk_lens);
+  free(rcs);
+
+  return yrc;
+}
+
 static yh_rc import_asymmetric(yh_session *session, uint16_t *key_id,
                                const char *label, uint16_t domains,
                                const yh_capabilities *capabilities,
@@ -2282,25 +4143,14 @@ yh_rc yh_util_decrypt_pkcs1v1_5(yh_session *session, uint16_t key_id,
     return YHR_INVALID_PARAMETERS;
   }
 
-#pragma pack(push, 1)
-  union {
-    struct {
-      uint16_t key_id;
-      uint8_t bytes[YH_MSG_BUF_SIZE];
-    };
-    uint8_t buf[1];
-  } data;
-#pragma pack(pop)
+  uint8_t key[2] = {key_id >> 8, key_id & 0xff};
+  yh_iovec data[] = {{key, sizeof(key)}, {in, in_len}};
 
   yh_cmd response_cmd;
   yh_rc yrc;
 
-  data.key_id = htons(key_id);
-
-  memcpy(data.bytes, in, in_len);
-
-  yrc = yh_send_secure_msg(session, YHC_DECRYPT_PKCS1, data.buf, in_len + 2,
-                           &response_cmd, out, out_len);
+  yrc = yh_send_secure_msgv(session, YHC_DECRYPT_PKCS1, data, 2, &response_cmd,
+                            out, out_len);
   if (yrc != YHR_SUCCESS) {
     DBG_ERR("Failed to send DECRYPT PKCS1 command: %s", yh_strerror(yrc));
     return yrc;
@@ -2320,26 +4170,13 @@ yh_rc yh_util_decrypt_oaep(yh_session *session, uint16_t key_id,
     return YHR_INVALID_PARAMETERS;
   }
 
-#pragma pack(push, 1)
-  union {
-    struct {
-      uint16_t key_id;
-      uint8_t mgf1Algo;
-      uint8_t bytes[YH_MSG_BUF_SIZE];
-    };
-    uint8_t buf[1];
-  } data;
-#pragma pack(pop)
+  uint8_t params[3] = {key_id >> 8, key_id & 0xff, mgf1Algo};
+  yh_iovec data[] = {{params, sizeof(params)},
+                     {in, in_len},
+                     {label, label_len}};
 
   yh_cmd response_cmd;
   yh_rc yrc;
-  uint16_t len = 0;
-
-  data.key_id = htons(key_id);
-  len += sizeof(data.key_id);
-
-  data.mgf1Algo = mgf1Algo;
-  len += sizeof(data.mgf1Algo);
 
   // in_len has to match the rsa key size
   if (in_len != 256 && in_len != 384 && in_len != 512) {
@@ -2354,13 +4191,8 @@ yh_rc yh_util_decrypt_oaep(yh_session *session, uint16_t key_id,
     return YHR_WRONG_LENGTH;
   }
 
-  memcpy(data.bytes, in, in_len);
-  len += in_len;
-  memcpy(data.bytes + in_len, label, label_len);
-  len += label_len;
-
-  yrc = yh_send_secure_msg(session, YHC_DECRYPT_OAEP, data.buf, len,
-                           &response_cmd, out, out_len);
+  yrc = yh_send_secure_msgv(session, YHC_DECRYPT_OAEP, data, 3, &response_cmd,
+                            out, out_len);
   if (yrc != YHR_SUCCESS) {
     DBG_ERR("Failed to send DECRYPT OAEP command: %s", yh_strerror(yrc));
     return yrc;
@@ -3032,14 +4864,13 @@ yh_rc yh_get_session_id(yh_session *session, uint8_t *sid) {
   return YHR_SUCCESS;
 }
 
-yh_rc yh_authenticate_session(yh_session *session) {
+static yh_rc _authenticate_session(yh_session *session) {
 
   Msg msg;
   Msg response_msg;
   yh_rc yrc;
 
-  uint8_t mac_buf[64];
-  uint16_t mac_buf_len;
+  const uint8_t zero_chaining_value[SCP_PRF_LEN] = {0};
 
   if (session == NULL) {
     DBG_ERR("%s", yh_strerror(YHR_INVALID_PARAMETERS));
@@ -3061,14 +4892,11 @@ yh_rc yh_authenticate_session(yh_session *session) {
 
   DBG_INT(msg.st.data + 1, SCP_HOST_CRYPTO_LEN, "Host cryptogram: ");
 
-  mac_buf_len = SCP_PRF_LEN + ntohs(msg.st.len) + 3 - SCP_MAC_LEN;
-  memset(mac_buf, 0, SCP_PRF_LEN); // Initial mac chaining value
-  memcpy(mac_buf + SCP_PRF_LEN, msg.raw, mac_buf_len);
-
-  yrc = compute_full_mac(mac_buf, mac_buf_len, session->s.s_mac, SCP_KEY_LEN,
-                         session->s.mac_chaining_value);
+  yrc = compute_session_mac(&session->s.s_mac_ctx, zero_chaining_value,
+                            msg.raw, ntohs(msg.st.len) + 3 - SCP_MAC_LEN,
+                            session->s.mac_chaining_value);
   if (yrc != YHR_SUCCESS) {
-    DBG_ERR("compute_full_mac %s", yh_strerror(yrc));
+    DBG_ERR("compute_session_mac %s", yh_strerror(yrc));
     return yrc;
   }
   memcpy(msg.st.data + 1 + SCP_HOST_CRYPTO_LEN, session->s.mac_chaining_value,
@@ -3090,9 +4918,48 @@ yh_rc yh_authenticate_session(yh_session *session) {
     return yrc;
   }
 
+  session->s.authenticated = true;
+  session->last_used = thread_now_ms();
+  if (session->recreate && !session->listed) {
+    list_session(session);
+  }
+
   return YHR_SUCCESS;
 }
 
+static yh_rc authenticate_session(yh_session *session) {
+
+  if (session == NULL) {
+    DBG_ERR("%s", yh_strerror(YHR_INVALID_PARAMETERS));
+    return YHR_INVALID_PARAMETERS;
+  }
+
+  yh_trace_event event;
+
+  trace_begin(session->parent, &event, YH_TRACE_AUTHENTICATE_SESSION,
+              YHC_AUTHENTICATE_SESSION, session->s.sid, 0);
+  USDT1(yubihsm, session_authenticate_start, session->s.sid);
+  yh_rc yrc = _authenticate_session(session);
+  trace_end(session->parent, &event, session->s.sid, yrc, 0);
+  USDT2(yubihsm, session_authenticate_done, session->s.sid, yrc);
+
+  return yrc;
+}
+
+yh_rc yh_authenticate_session(yh_session *session) {
+
+  if (session == NULL) {
+    DBG_ERR("%s", yh_strerror(YHR_INVALID_PARAMETERS));
+    return YHR_INVALID_PARAMETERS;
+  }
+
+  thread_mutex_lock(&session->lock);
+  yh_rc yrc = authenticate_session(session);
+  thread_mutex_unlock(&session->lock);
+
+  return yrc;
+}
+
 static uint8_t get_auth_key_algo(size_t key_len) {
   switch (key_len) {
     case 32:
@@ -3362,14 +5229,6 @@ yh_rc yh_util_decrypt_otp(yh_session *session, uint16_t key_id,
                           uint16_t *tstpl) {
 
 #pragma pack(push, 1)
-  union {
-    struct {
-      uint16_t key_id;
-      uint8_t aead[6 + 16 + 6 + 8]; // FIXME: ya.. magic numbers!
-      uint8_t otp[16];
-    };
-    uint8_t buf[1];
-  } data;
   union {
     struct {
       uint16_t useCtr;
@@ -3382,7 +5241,7 @@ yh_rc yh_util_decrypt_otp(yh_session *session, uint16_t key_id,
 #pragma pack(pop)
 
   if (session == NULL || aead == NULL || otp == NULL ||
-      aead_len != sizeof(data.aead)) {
+      aead_len != 6 + 16 + 6 + 8) { // FIXME: ya.. magic numbers!
     DBG_ERR("%s", yh_strerror(YHR_INVALID_PARAMETERS));
     return YHR_INVALID_PARAMETERS;
   }
@@ -3390,14 +5249,11 @@ yh_rc yh_util_decrypt_otp(yh_session *session, uint16_t key_id,
   yh_cmd response_cmd;
   size_t response_len = sizeof(response);
 
-  data.key_id = htons(key_id);
-  memcpy(data.aead, aead, sizeof(data.aead));
-  memcpy(data.otp, otp, sizeof(data.otp));
+  uint8_t key[2] = {key_id >> 8, key_id & 0xff};
+  yh_iovec data[] = {{key, sizeof(key)}, {aead, aead_len}, {otp, 16}};
 
-  yh_rc yrc =
-    yh_send_secure_msg(session, YHC_DECRYPT_OTP, data.buf, sizeof(data),
-                       &response_cmd, response.buf, &response_len);
-  insecure_memzero(data.buf, sizeof(data));
+  yh_rc yrc = yh_send_secure_msgv(session, YHC_DECRYPT_OTP, data, 3,
+                                  &response_cmd, response.buf, &response_len);
   if (yrc != YHR_SUCCESS) {
     DBG_ERR("Failed to send DECRYPT OTP command: %s\n", yh_strerror(yrc));
     return yrc;
@@ -3838,6 +5694,28 @@ yh_rc yh_util_unwrap_data(yh_session *session, uint16_t key_id,
   return YHR_SUCCESS;
 }
 
+yh_rc yh_util_wrap_data_batch(yh_session_pool *pool, uint16_t key_id,
+                              const uint8_t *const *in, const size_t *in_len,
+                              size_t n, uint8_t *const *out, size_t *out_len,
+                              yh_rc *rcs) {
+
+  uint8_t key[2] = {key_id >> 8, key_id & 0xff};
+
+  return batch_run(pool, YHC_WRAP_DATA, false, key, sizeof(key), in, in_len, n,
+                   out, out_len, rcs);
+}
+
+yh_rc yh_util_unwrap_data_batch(yh_session_pool *pool, uint16_t key_id,
+                                const uint8_t *const *in, const size_t *in_len,
+                                size_t n, uint8_t *const *out, size_t *out_len,
+                                yh_rc *rcs) {
+
+  uint8_t key[2] = {key_id >> 8, key_id & 0xff};
+
+  return batch_run(pool, YHC_UNWRAP_DATA, false, key, sizeof(key), in, in_len,
+                   n, out, out_len, rcs);
+}
+
 yh_rc yh_util_blink_device(yh_session *session, uint8_t seconds) {
 
   if (session == NULL) {
@@ -3920,6 +5798,10 @@ yh_rc yh_init(void) {
   if (_yh_output == NULL) {
     _yh_output = stderr;
   }
+  if (!kdf_cache_init() || !ecdh_pool_init() || !flight_init() ||
+      !status_cache_init()) {
+    return YHR_GENERIC_ERROR;
+  }
   return YHR_SUCCESS;
 }
 
@@ -3936,6 +5818,11 @@ static yh_rc load_backend(const char *name,
   } else if (strncmp(name, STATIC_HTTP_BACKEND, strlen(STATIC_HTTP_BACKEND)) ==
              0) {
     *bf = http_backend_functions();
+#ifndef WIN32
+  } else if (strncmp(name, STATIC_TCP_BACKEND, strlen(STATIC_TCP_BACKEND)) ==
+             0) {
+    *bf = tcp_backend_functions();
+#endif
   } else {
     DBG_ERR("Failed finding backend named '%s'", name);
     return YHR_GENERIC_ERROR;
@@ -3992,15 +5879,145 @@ static yh_rc load_backend(const char *name, void **backend,
 }
 #endif
 
-yh_rc yh_exit(void) { return YHR_SUCCESS; }
+yh_rc yh_exit(void) {
+
+  flight_exit();
+  ecdh_pool_exit();
+  kdf_cache_exit();
+  status_cache_exit();
+
+  return YHR_SUCCESS;
+}
+
+yh_rc yh_set_derived_key_cache(unsigned int lifetime_ms, size_t max_keys) {
+
+  if (!kdf_cache_init()) {
+    return YHR_GENERIC_ERROR;
+  }
+
+  if (!kdf_cache_configure(lifetime_ms, max_keys)) {
+    DBG_ERR("Failed to allocate locked memory for %zu keys", max_keys);
+    return YHR_MEMORY_ERROR;
+  }
+
+  return YHR_SUCCESS;
+}
+
+yh_rc yh_set_connector_status_cache(unsigned int lifetime_ms) {
+
+  if (!status_cache_init()) {
+    return YHR_GENERIC_ERROR;
+  }
+
+  status_cache_configure(lifetime_ms);
+
+  return YHR_SUCCESS;
+}
+
+yh_rc yh_set_ephemeral_key_pool(size_t n_keys) {
+
+  if (!ecdh_pool_init()) {
+    return YHR_GENERIC_ERROR;
+  }
+
+  if (!ecdh_pool_configure(n_keys)) {
+    DBG_ERR("Failed to set up a pool of %zu key pairs", n_keys);
+    return YHR_MEMORY_ERROR;
+  }
+
+  return YHR_SUCCESS;
+}
+
+yh_rc yh_set_flight_recorder(size_t records, const char *path,
+                             bool dump_on_error) {
+
+  if (!flight_init()) {
+    return YHR_GENERIC_ERROR;
+  }
+
+  yh_rc yrc = flight_configure(records, path, dump_on_error);
+  if (yrc != YHR_SUCCESS) {
+    DBG_ERR("Failed to set up the flight recorder: %s", yh_strerror(yrc));
+  }
+
+  return yrc;
+}
+
+yh_rc yh_set_object_cache(yh_connector *connector, unsigned int lifetime_ms,
+                          size_t max_objects) {
+
+  if (connector == NULL) {
+    DBG_ERR("%s", yh_strerror(YHR_INVALID_PARAMETERS));
+    return YHR_INVALID_PARAMETERS;
+  }
+
+  object_cache_configure(connector, lifetime_ms, max_objects);
+
+  return YHR_SUCCESS;
+}
+
+yh_rc yh_set_public_key_cache(yh_connector *connector, size_t max_keys,
+                              const yh_public_key_parser *parser) {
+
+  if (connector == NULL ||
+      (parser != NULL && (parser->parse == NULL || parser->ref == NULL ||
+                          parser->unref == NULL))) {
+    DBG_ERR("%s", yh_strerror(YHR_INVALID_PARAMETERS));
+    return YHR_INVALID_PARAMETERS;
+  }
+
+  if (!pubkey_cache_configure(connector, max_keys, parser)) {
+    DBG_ERR("%s", yh_strerror(YHR_MEMORY_ERROR));
+    return YHR_MEMORY_ERROR;
+  }
+
+  return YHR_SUCCESS;
+}
+
+yh_rc yh_set_random_pool(yh_connector *connector, yh_session_pool *pool,
+                         size_t low_watermark, size_t high_watermark) {
+
+  if (connector == NULL ||
+      (high_watermark != 0 &&
+       (pool == NULL || pool->connector != connector ||
+        low_watermark >= high_watermark))) {
+    DBG_ERR("%s", yh_strerror(YHR_INVALID_PARAMETERS));
+    return YHR_INVALID_PARAMETERS;
+  }
+
+  return random_pool_configure(connector, high_watermark != 0 ? pool : NULL,
+                               low_watermark, high_watermark);
+}
+
+yh_rc yh_set_log_drain(yh_connector *connector, yh_session *session,
+                       int interval_ms, yh_log_chain *chain,
+                       yh_log_store store, void *user) {
+
+  if (connector == NULL || interval_ms < 0 ||
+      (interval_ms != 0 &&
+       (session == NULL || session->parent != connector || chain == NULL ||
+        store == NULL))) {
+    DBG_ERR("%s", yh_strerror(YHR_INVALID_PARAMETERS));
+    return YHR_INVALID_PARAMETERS;
+  }
+
+  return log_drain_configure(connector, session, interval_ms, chain, store,
+                             user);
+}
+
+yh_rc yh_dump_flight_recorder(void) {
+
+  return flight_dump();
+}
 
 #define STATUS_ENDPOINT "/connector/status"
 #define API_ENDPOINT "/connector/api"
+#define UNIX_HOST "http://localhost"
 
 static yh_rc create_connector(yh_connector **connector, const char *url,
                               void *backend, struct backend_functions *bf) {
 
-  yh_rc rc;
+  yh_rc rc = YHR_GENERIC_ERROR;
 
   if (connector == NULL) {
     return YHR_INVALID_PARAMETERS;
@@ -4011,7 +6028,31 @@ static yh_rc create_connector(yh_connector **connector, const char *url,
     return YHR_MEMORY_ERROR;
   }
 
-  if (strncmp(url, YH_USB_URL_SCHEME, strlen(YH_USB_URL_SCHEME)) == 0) {
+  if (!thread_mutex_init(&(*connector)->sessions_lock)) {
+    goto cc_free;
+  }
+  if (!thread_cond_init(&(*connector)->keepalive_wakeup)) {
+    goto cc_sessions_lock;
+  }
+  if (!thread_mutex_init(&(*connector)->cache_lock)) {
+    goto cc_keepalive_wakeup;
+  }
+  if (!thread_mutex_init(&(*connector)->random_lock)) {
+    goto cc_cache_lock;
+  }
+  if (!thread_cond_init(&(*connector)->random_wakeup)) {
+    goto cc_random_lock;
+  }
+  if (!thread_mutex_init(&(*connector)->drain_lock)) {
+    goto cc_random_wakeup;
+  }
+  if (!thread_cond_init(&(*connector)->drain_wakeup)) {
+    goto cc_drain_lock;
+  }
+
+  const char *unix_socket = NULL;
+  if (strncmp(url, YH_USB_URL_SCHEME, strlen(YH_USB_URL_SCHEME)) == 0 ||
+      strncmp(url, YH_TCP_URL_SCHEME, strlen(YH_TCP_URL_SCHEME)) == 0) {
     (*connector)->status_url = strdup(url);
     if ((*connector)->status_url == NULL) {
       rc = YHR_MEMORY_ERROR;
@@ -4022,6 +6063,16 @@ static yh_rc create_connector(yh_connector **connector, const char *url,
       rc = YHR_MEMORY_ERROR;
       goto cc_failure;
     }
+  } else if (parse_unix_url(url, &unix_socket)) {
+    // The host is not used, but HTTP/1.1 requires one
+    (*connector)->unix_socket = strdup(unix_socket);
+    (*connector)->status_url = strdup(UNIX_HOST STATUS_ENDPOINT);
+    (*connector)->api_url = strdup(UNIX_HOST API_ENDPOINT);
+    if ((*connector)->unix_socket == NULL ||
+        (*connector)->status_url == NULL || (*connector)->api_url == NULL) {
+      rc = YHR_MEMORY_ERROR;
+      goto cc_failure;
+    }
   } else {
     (*connector)->status_url =
       calloc(1, strlen(url) + strlen(STATUS_ENDPOINT) + 1);
@@ -4039,6 +6090,13 @@ static yh_rc create_connector(yh_connector **connector, const char *url,
     sprintf((*connector)->api_url, "%s%s", url, API_ENDPOINT);
   }
 
+  (*connector)->stats = calloc(1, sizeof(yh_connector_stats));
+  if ((*connector)->stats == NULL) {
+    rc = YHR_MEMORY_ERROR;
+    goto cc_failure;
+  }
+  (*connector)->stats_since = thread_now_ms();
+
   (*connector)->connection = bf->backend_create();
   if ((*connector)->connection == NULL) {
     rc = YHR_CONNECTION_ERROR;
@@ -4050,21 +6108,28 @@ static yh_rc create_connector(yh_connector **connector, const char *url,
 
   return YHR_SUCCESS;
 
+  // Each label tears down what was set up before the step that jumps to it
 cc_failure:
-  if ((*connector)->status_url) {
-    free((*connector)->status_url);
-    (*connector)->status_url = NULL;
-  }
-
-  if ((*connector)->api_url) {
-    free((*connector)->api_url);
-    (*connector)->api_url = NULL;
-  }
-
-  if (*connector) {
-    free(*connector);
-    *connector = NULL;
-  }
+  free((*connector)->unix_socket);
+  free((*connector)->status_url);
+  free((*connector)->api_url);
+  free((*connector)->stats);
+  thread_cond_destroy(&(*connector)->drain_wakeup);
+cc_drain_lock:
+  thread_mutex_destroy(&(*connector)->drain_lock);
+cc_random_wakeup:
+  thread_cond_destroy(&(*connector)->random_wakeup);
+cc_random_lock:
+  thread_mutex_destroy(&(*connector)->random_lock);
+cc_cache_lock:
+  thread_mutex_destroy(&(*connector)->cache_lock);
+cc_keepalive_wakeup:
+  thread_cond_destroy(&(*connector)->keepalive_wakeup);
+cc_sessions_lock:
+  thread_mutex_destroy(&(*connector)->sessions_lock);
+cc_free:
+  free(*connector);
+  *connector = NULL;
 
   return rc;
 }
@@ -4075,6 +6140,17 @@ static void destroy_connector(yh_connector *connector) {
     return;
   }
 
+  stop_keepalive(connector);
+  log_drain_stop(connector);
+  random_pool_free(connector);
+
+  // Sessions may outlive the connector, they must not unlist themselves later
+  for (yh_session *session = connector->sessions; session != NULL;
+       session = session->next) {
+    session->listed = false;
+  }
+  connector->sessions = NULL;
+
   if (connector->bf != NULL && connector->connection != NULL) {
     connector->bf->backend_disconnect(connector->connection);
     connector->connection = NULL;
@@ -4090,6 +6166,9 @@ static void destroy_connector(yh_connector *connector) {
     connector->api_url = NULL;
   }
 
+  free(connector->unix_socket);
+  connector->unix_socket = NULL;
+
   if (connector->bf) {
     connector->bf->backend_cleanup();
 #ifndef STATIC
@@ -4103,6 +6182,17 @@ static void destroy_connector(yh_connector *connector) {
     connector->bf = NULL;
   }
 
+  locked_free(connector->asym_secrets,
+              YH_ASYM_SECRETS * sizeof(struct asym_secret));
+  free(connector->stats);
+  pubkey_cache_free(connector);
+  thread_cond_destroy(&connector->drain_wakeup);
+  thread_mutex_destroy(&connector->drain_lock);
+  thread_cond_destroy(&connector->random_wakeup);
+  thread_mutex_destroy(&connector->random_lock);
+  thread_mutex_destroy(&connector->cache_lock);
+  thread_cond_destroy(&connector->keepalive_wakeup);
+  thread_mutex_destroy(&connector->sessions_lock);
   free(connector);
 }
 
@@ -4115,15 +6205,18 @@ yh_rc yh_init_connector(const char *url, yh_connector **connector) {
 #ifdef STATIC
 #define USB_LIB STATIC_USB_BACKEND
 #define HTTP_LIB STATIC_HTTP_BACKEND
+#define TCP_LIB STATIC_TCP_BACKEND
 #elif defined WIN32
 #define USB_LIB "libyubihsm_usb.dll"
 #define HTTP_LIB "libyubihsm_http.dll"
 #elif defined __APPLE__
 #define USB_LIB "libyubihsm_usb." SOVERSION ".dylib"
 #define HTTP_LIB "libyubihsm_http." SOVERSION ".dylib"
+#define TCP_LIB "libyubihsm_tcp." SOVERSION ".dylib"
 #else
 #define USB_LIB "libyubihsm_usb.so." SOVERSION
 #define HTTP_LIB "libyubihsm_http.so." SOVERSION
+#define TCP_LIB "libyubihsm_tcp.so." SOVERSION
 #endif
 
   void *backend = NULL;
@@ -4136,6 +6229,16 @@ yh_rc yh_init_connector(const char *url, yh_connector **connector) {
              strncmp(url, "https://", strlen("https://")) == 0) {
     DBG_INFO("Loading http backend");
     load_backend(HTTP_LIB, &backend, &bf);
+#ifndef WIN32
+  } else if (strncmp(url, YH_UNIX_URL_SCHEME, strlen(YH_UNIX_URL_SCHEME)) ==
+             0) {
+    // Only the curl backend knows how to speak HTTP over a Unix socket
+    DBG_INFO("Loading http backend for a Unix socket");
+    load_backend(HTTP_LIB, &backend, &bf);
+  } else if (strncmp(url, YH_TCP_URL_SCHEME, strlen(YH_TCP_URL_SCHEME)) == 0) {
+    DBG_INFO("Loading tcp backend");
+    load_backend(TCP_LIB, &backend, &bf);
+#endif
   }
   if (bf == NULL) {
     DBG_ERR("Failed loading the backend");
@@ -4170,10 +6273,23 @@ yh_rc yh_connect(yh_connector *connector, int timeout) {
 
   yh_rc rc;
 
+  // The status is only asked for again once a message fails, see
+  // status_cache_failed()
+  if (connector->bf->backend_reconnect != NULL && status_cache_get(connector)) {
+    rc = connector->bf->backend_reconnect(connector, timeout);
+    if (rc == YHR_SUCCESS) {
+      DBG_INFO("Connected with the cached status of %s",
+               connector->status_url);
+      return rc;
+    }
+  }
+
   rc = connector->bf->backend_connect(connector, timeout);
 
   if (rc != YHR_SUCCESS) {
     DBG_ERR("Failed when connecting: %s", yh_strerror(rc));
+  } else {
+    status_cache_put(connector);
   }
 
   return rc;
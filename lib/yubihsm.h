@@ -38,6 +38,27 @@
  functions in the namespace yh_util are high-level convenience functions that do
  specific tasks with the device.
 
+ @section threads Thread safety
+
+ A connected connector can be shared by several threads. Each command is sent
+ on a transport handle of its own (HTTP), or waits for the device to finish the
+ previous command (USB), so sessions on the same connector can be used in
+ parallel. A single session must only be used by one thread at a time, a
+ #yh_session_pool hands out sessions to threads that need one.
+
+ The functions that send commands over a session, #yh_send_secure_msg(),
+ #yh_send_secure_msgv() and the yh_util functions, as well as
+ #yh_create_session(), #yh_create_session_derived(),
+ #yh_create_session_asym(), #yh_authenticate_session(),
+ #yh_destroy_session() and the session pool functions, are safe to call from
+ several threads at once. #yh_init(), #yh_exit(), #yh_set_verbosity(),
+ #yh_init_connector(), #yh_set_connector_option(),
+ #yh_set_session_keepalive(), #yh_connect() and #yh_disconnect() are not, and
+ must not run concurrently with any other function using the same connector.
+
+ The keepalive thread started by #yh_set_session_keepalive() only uses a session
+ while no caller is, and callers never wait for it to re-create a session.
+
  @section api API Reference
 
  All public functions and definitions can be found in yubihsm.h
@@ -127,6 +148,12 @@
 #define YH_LOG_DIGEST_SIZE 16
 /// URL scheme used for direct USB access
 #define YH_USB_URL_SCHEME "yhusb://"
+/// URL scheme used for a connector on a Unix domain socket, followed by the
+/// absolute path of the socket, e.g. yhunix:///run/yubihsm-connector.sock
+#define YH_UNIX_URL_SCHEME "yhunix://"
+/// URL scheme used for a relay speaking the binary framed protocol over TCP,
+/// followed by host and optional port, e.g. yhtcp://127.0.0.1:12346
+#define YH_TCP_URL_SCHEME "yhtcp://"
 
 // Debug levels
 /// Debug level quiet. No messages printed out
@@ -160,6 +187,9 @@ typedef struct yh_connector yh_connector;
 /// Reference to a session
 typedef struct yh_session yh_session;
 
+/// Reference to a session pool
+typedef struct yh_session_pool yh_session_pool;
+
 /// Capabilities representation
 typedef struct {
   /// Capabilities is represented as an 8 byte uint8_t array
@@ -236,6 +266,10 @@ typedef enum {
   YHR_DEVICE_SSH_CA_CONSTRAINT_VIOLATION = -30,
   /// Return value when an algorithm is disabled
   YHR_DEVICE_ALGORITHM_DISABLED = -31,
+  /// Return value when an operation did not complete in the given time
+  YHR_TIMEOUT = -32,
+  /// Return value when log entries do not continue the verified log
+  YHR_LOG_VERIFICATION_FAILED = -33,
 } yh_rc;
 
 /// Macro to define command and response command
@@ -527,6 +561,11 @@ typedef enum {
   /// Comma separated list of hosts ignoring proxy, `*` to disable proxy.
   /// Not implemented on Windows
   YH_CONNECTOR_NOPROXY = 5,
+  /// HTTP version to use with the connector (const char *), "1.1", "2" for
+  /// HTTP/2 negotiated over TLS or "2-prior-knowledge" for cleartext HTTP/2.
+  /// Concurrent messages are multiplexed over one connection with HTTP/2. Not
+  /// implemented on Windows
+  YH_CONNECTOR_HTTP_VERSION = 6,
 } yh_connector_option;
 
 #pragma pack(push, 1)
@@ -557,6 +596,28 @@ typedef struct {
   uint8_t digest[YH_LOG_DIGEST_SIZE];
 } yh_log_entry;
 
+/**
+ * Position of a drain in the audit log of a device
+ *
+ * @see yh_util_drain_log_entries
+ */
+typedef struct {
+  /// Whether last holds an entry. Without one, the first entry drained is
+  /// trusted as it is
+  bool started;
+  /// Last entry drained, which the next ones must follow
+  yh_log_entry last;
+} yh_log_chain;
+
+/**
+ * Durably store log entries drained from the device, after the ones stored
+ *before. Return true once they are stored, the device may then discard them
+ *
+ * @see yh_util_drain_log_entries
+ */
+typedef bool (*yh_log_store)(void *user, const yh_log_entry *entries,
+                             size_t n_entries);
+
 /**
  * Object descriptor
  */
@@ -585,6 +646,318 @@ typedef struct {
 } yh_object_descriptor;
 #pragma pack(pop)
 
+/**
+ * A piece of a scatter-gather message payload
+ *
+ * @see yh_send_secure_msgv
+ */
+typedef struct {
+  /// Start of the data
+  const uint8_t *data;
+  /// Length of the data
+  size_t len;
+} yh_iovec;
+
+/// Wait for a socket to become readable. Same value as POLLIN
+#define YH_POLLIN 0x001
+/// Wait for a socket to become writable. Same value as POLLOUT
+#define YH_POLLOUT 0x004
+/// An error occurred on a socket. Same value as POLLERR
+#define YH_POLLERR 0x008
+
+/**
+ * Socket that a connector waits on, laid out like struct pollfd
+ *
+ * @see yh_connector_get_pollfds
+ */
+typedef struct {
+  /// Socket
+  int fd;
+  /// Events to wait for, #YH_POLLIN and/or #YH_POLLOUT
+  short events;
+  /// Events that occurred, filled in by the caller
+  short revents;
+} yh_pollfd;
+
+/**
+ * Completion callback of yh_send_secure_msg_async()
+ *
+ * @param session Session the command was sent over
+ * @param result #YHR_SUCCESS, or the reason the command failed. If the device
+ *returned an error it is translated like for yh_send_secure_msg()
+ * @param response_cmd Response command
+ * @param response Verified and decrypted response data. Only valid during the
+ *callback
+ * @param response_len Length of the response data
+ * @param user User data passed to yh_send_secure_msg_async()
+ */
+typedef void (*yh_async_callback)(yh_session *session, yh_rc result,
+                                  yh_cmd response_cmd, const uint8_t *response,
+                                  size_t response_len, void *user);
+
+/**
+ * Health of a session in a session pool
+ *
+ * @see yh_get_session_pool_health
+ */
+typedef struct {
+  /// Session ID on the device
+  uint8_t session_id;
+  /// The session is checked out
+  bool checked_out;
+  /// The session is established. If not, it is re-created on the next checkout
+  bool established;
+  /// Result reported by the last checkin
+  yh_rc last_result;
+  /// Number of times the session has been checked out
+  uint64_t checkouts;
+  /// Number of checkins that reported an error
+  uint64_t errors;
+  /// Number of times the session has been re-created by the pool
+  uint64_t recreations;
+} yh_session_health;
+
+/// Number of buckets of a latency histogram
+#define YH_STATS_BUCKETS 48
+/// Number of commands with statistics, indexed by #yh_cmd
+#define YH_STATS_COMMANDS 0x80
+/// Number of return codes counted, indexed by the negated #yh_rc
+#define YH_STATS_RESULTS 33
+
+/**
+ * Latency histogram in microseconds. Latencies below 2 go to buckets 0 and 1,
+ *above that each power of two is split in two buckets: bucket i, for i >= 2,
+ *counts latencies from (2 + i % 2) << (i / 2 - 1). The last bucket also counts
+ *everything longer
+ *
+ * @see yh_get_latency_percentile
+ */
+typedef struct {
+  /// Number of latencies recorded
+  uint64_t count;
+  /// Sum of the latencies
+  uint64_t sum_us;
+  /// Longest latency
+  uint64_t max_us;
+  /// Number of latencies in each bucket
+  uint64_t buckets[YH_STATS_BUCKETS];
+} yh_latency_histogram;
+
+/**
+ * Statistics of one command
+ *
+ * @see yh_connector_stats
+ */
+typedef struct {
+  /// Number of times the command was sent
+  uint64_t calls;
+  /// Number of times the command failed, for any reason
+  uint64_t errors;
+  /// Bytes sent, including headers
+  uint64_t bytes_out;
+  /// Bytes received, including headers
+  uint64_t bytes_in;
+  /// Time spent encrypting and decrypting session messages
+  yh_latency_histogram crypto;
+  /// Time spent in the backend, sending the command and waiting for the
+  /// response
+  yh_latency_histogram transport;
+  /// Both of the above
+  yh_latency_histogram total;
+} yh_command_stats;
+
+/**
+ * Statistics of a connector. Commands sent in session messages are counted
+ *under their own #yh_cmd, and once more as #YHC_SESSION_MESSAGE, which sees
+ *only the transport
+ *
+ * @see yh_get_connector_stats
+ */
+typedef struct {
+  /// Milliseconds the statistics were collected over
+  uint64_t elapsed_ms;
+  /// Number of commands that ended with each #yh_rc, indexed by -#yh_rc
+  uint64_t results[YH_STATS_RESULTS];
+  /// Connections opened by the backend to reach the connector. Only counted
+  /// by the HTTP backend
+  uint64_t connections;
+  /// TLS handshakes done on those connections, full or resumed
+  uint64_t tls_handshakes;
+  /// Statistics of each command, indexed by #yh_cmd
+  yh_command_stats commands[YH_STATS_COMMANDS];
+} yh_connector_stats;
+
+/**
+ * Operations reported to trace hooks
+ *
+ * @see yh_set_trace_hooks
+ */
+typedef enum {
+  /// A message handed to the backend, as sent on the wire
+  YH_TRACE_SEND,
+  /// A command sent in a session message, including its encryption
+  YH_TRACE_SECURE_MSG,
+  /// Creation of a session, symmetric or asymmetric
+  YH_TRACE_CREATE_SESSION,
+  /// Authentication of a symmetric session
+  YH_TRACE_AUTHENTICATE_SESSION,
+} yh_trace_point;
+
+/**
+ * Operation reported to trace hooks. Fields marked end only are 0 in the
+ *begin callback
+ *
+ * @see yh_set_trace_hooks
+ */
+typedef struct {
+  /// Identifies the operation, the same in the begin and end callbacks
+  uint64_t id;
+  /// What is traced
+  yh_trace_point point;
+  /// Command
+  yh_cmd cmd;
+  /// Session ID on the device, or -1 if there is none (yet)
+  int session_id;
+  /// Bytes sent, the payload for #YH_TRACE_SECURE_MSG
+  size_t bytes_out;
+  /// Bytes received, end only
+  size_t bytes_in;
+  /// Result, end only
+  yh_rc result;
+  /// Monotonic time the operation began, in microseconds
+  uint64_t begin_us;
+  /// Monotonic time the operation ended, in microseconds, end only
+  uint64_t end_us;
+} yh_trace_event;
+
+/**
+ * Trace callback
+ *
+ * @param connector Connector the operation is on
+ * @param event The operation. Only valid during the callback
+ * @param user User data passed to yh_set_trace_hooks()
+ *
+ * @see yh_set_trace_hooks
+ */
+typedef void (*yh_trace_callback)(yh_connector *connector,
+                                  const yh_trace_event *event, void *user);
+
+/// Magic at the start of a flight recorder dump
+#define YH_FLIGHT_MAGIC "YHFR"
+/// Version of the flight recorder dump format
+#define YH_FLIGHT_VERSION 1
+
+/**
+ * Header of a flight recorder dump. It is followed by the records of each
+ *thread, oldest first, all in host byte order
+ *
+ * @see yh_dump_flight_recorder
+ */
+typedef struct {
+  /// #YH_FLIGHT_MAGIC
+  char magic[4];
+  /// #YH_FLIGHT_VERSION
+  uint16_t version;
+  /// Size of a #yh_flight_record
+  uint16_t record_size;
+  /// Monotonic time of the dump, in microseconds
+  uint64_t now_us;
+} yh_flight_header;
+
+/**
+ * Operation recorded by the flight recorder, a compact #yh_trace_event
+ *
+ * @see yh_set_flight_recorder
+ */
+typedef struct {
+  /// Monotonic time the operation ended, in microseconds
+  uint64_t end_us;
+  /// Duration of the operation, in microseconds
+  uint32_t elapsed_us;
+  /// Ring the record was written to. A thread writes to one ring, which is
+  /// reused after the thread exits
+  uint32_t ring;
+  /// Bytes sent
+  uint32_t bytes_out;
+  /// Bytes received
+  uint32_t bytes_in;
+  /// Session ID on the device, or -1 if there is none
+  int16_t session_id;
+  /// #yh_trace_point
+  uint8_t point;
+  /// Command
+  uint8_t cmd;
+  /// #yh_rc
+  int8_t result;
+  /// Zero
+  uint8_t reserved[3];
+} yh_flight_record;
+
+/**
+ * Callbacks turning public keys into a representation of the application's
+ *choosing, such as an OpenSSL EVP_PKEY, which is cached along with the key
+ *
+ * @see yh_set_public_key_cache
+ */
+typedef struct {
+  /// Parse a public key as returned by yh_util_get_public_key(). Returns a
+  /// parsed key holding one reference, or NULL on failure
+  void *(*parse)(const uint8_t *key, size_t key_len, yh_algorithm algorithm);
+  /// Take another reference of a parsed key and return it
+  void *(*ref)(void *parsed);
+  /// Drop a reference of a parsed key
+  void (*unref)(void *parsed);
+} yh_public_key_parser;
+
+/// Magic at the start of an envelope
+#define YH_ENVELOPE_MAGIC "YHEV"
+/// Version of the envelope format
+#define YH_ENVELOPE_VERSION 1
+/// Largest number of bytes of data in a chunk of an envelope. A chunk is
+/// wrapped with a single #YHC_WRAP_DATA command
+#define YH_ENVELOPE_MAX_CHUNK_SIZE 1920
+
+/**
+ * Read the next bytes of the data to wrap into an envelope
+ *
+ * @param user User data passed to yh_util_wrap_envelope()
+ * @param buf Buffer to read into
+ * @param len Size of the buffer. Set to the number of bytes read, which is 0
+ *only at the end of the data
+ *
+ * @return #YHR_SUCCESS if successful, anything else aborts the operation
+ *
+ * @see yh_util_wrap_envelope
+ */
+typedef yh_rc (*yh_envelope_read)(void *user, uint8_t *buf, size_t *len);
+
+/**
+ * Read bytes of an envelope at a given offset
+ *
+ * @param user User data passed to yh_util_unwrap_envelope()
+ * @param offset Offset in the envelope
+ * @param buf Buffer to read into
+ * @param len Number of bytes to read, all of which must be read
+ *
+ * @return #YHR_SUCCESS if successful, anything else aborts the operation
+ *
+ * @see yh_util_unwrap_envelope
+ */
+typedef yh_rc (*yh_envelope_read_at)(void *user, uint64_t offset, uint8_t *buf,
+                                     size_t len);
+
+/**
+ * Write the next bytes of an envelope, or of the data unwrapped from one
+ *
+ * @param user User data passed to yh_util_wrap_envelope() or
+ *yh_util_unwrap_envelope()
+ * @param buf Bytes to write
+ * @param len Number of bytes to write
+ *
+ * @return #YHR_SUCCESS if successful, anything else aborts the operation
+ */
+typedef yh_rc (*yh_envelope_write)(void *user, const uint8_t *buf, size_t len);
+
 static const struct {
   const char *name;
   int bit;
@@ -778,17 +1151,107 @@ void yh_set_debug_output(yh_connector *connector, FILE *output);
 /**
  * Global library initialization
  *
- * @return #YHR_SUCCESS
+ * @return #YHR_SUCCESS if successful.
+ *         #YHR_GENERIC_ERROR if the derived key cache could not be set up
  **/
 yh_rc yh_init(void);
 
 /**
- * Global library clean up
+ * Global library clean up. Wipes the derived key cache and frees the flight
+ *recorder
  *
  * @return #YHR_SUCCESS
  **/
 yh_rc yh_exit(void);
 
+/**
+ * Cache the keys derived from passwords by yh_create_session_derived() and the
+ *other functions taking a password, so that logging in again with the same
+ *password skips the key derivation. Cached keys are held in locked memory and
+ *are looked up by a hash of the password keyed with a random secret. The cache
+ *is disabled by default
+ *
+ * @param lifetime_ms How long a derived key is kept, in milliseconds
+ * @param max_keys Number of derived keys to keep. When the cache is full the
+ *key closest to expiring is replaced
+ *
+ * Setting either parameter to 0 disables the cache. Keys cached before the call
+ *are wiped in any case
+ *
+ * @return #YHR_SUCCESS if successful.
+ *         #YHR_MEMORY_ERROR if the locked memory could not be allocated, see
+ *RLIMIT_MEMLOCK. #YHR_GENERIC_ERROR if the cache could not be set up
+ **/
+yh_rc yh_set_derived_key_cache(unsigned int lifetime_ms, size_t max_keys);
+
+/**
+ * Cache the status that yh_connect() asks connectors for, such as their
+ *version and whether they have a device, by URL for all connectors of the
+ *process. Connecting again to a connector whose status is cached skips the
+ *round-trip and reuses the connections of the backend. The cached status of a
+ *connector is forgotten as soon as a message to it fails, so that the next
+ *yh_connect() asks again. Only HTTP and yhtcp:// connectors use the cache. The
+ *cache is disabled by default
+ *
+ * @param lifetime_ms How long a status is kept, in milliseconds. 0 disables
+ *the cache
+ *
+ * Statuses cached before the call are forgotten in any case
+ *
+ * @return #YHR_SUCCESS if successful.
+ *         #YHR_GENERIC_ERROR if the cache could not be set up
+ **/
+yh_rc yh_set_connector_status_cache(unsigned int lifetime_ms);
+
+/**
+ * Generate the ephemeral EC P-256 key pairs used by yh_create_session_asym()
+ *ahead of time, in a background thread, so that creating a session does not
+ *wait for the key generation. The key pairs are held in locked memory and each
+ *is used only once. The pool is disabled by default
+ *
+ * @param n_keys Number of key pairs to keep ready. 0 stops the background
+ *thread and wipes the pool
+ *
+ * @return #YHR_SUCCESS if successful.
+ *         #YHR_MEMORY_ERROR if the locked memory or the thread could not be set
+ *up. #YHR_GENERIC_ERROR if the pool could not be initialized
+ **/
+yh_rc yh_set_ephemeral_key_pool(size_t n_keys);
+
+/**
+ * Record the operations reported to trace hooks, see #yh_trace_point, on all
+ *connectors in a ring buffer per thread. Recording an operation takes a few
+ *stores and no locks, so the recorder can be left on to have the last
+ *operations of each thread at hand when something goes wrong. The recorder is
+ *disabled by default
+ *
+ * @param records Number of records kept per thread. 0 disables the recorder,
+ *what was recorded so far can still be dumped
+ * @param path File that yh_dump_flight_recorder() writes to, or NULL
+ * @param dump_on_error Also dump when a message could not be sent to the
+ *device. Only the first of consecutive failures dumps, so its dump is kept
+ *until a message has gone through again
+ *
+ * @return #YHR_SUCCESS if successful.
+ *         #YHR_INVALID_PARAMETERS if the path is too long.
+ *         #YHR_GENERIC_ERROR if the recorder could not be set up
+ **/
+yh_rc yh_set_flight_recorder(size_t records, const char *path,
+                             bool dump_on_error);
+
+/**
+ * Write what the flight recorder holds to the file given to
+ *yh_set_flight_recorder(), see #yh_flight_header. On POSIX systems only
+ *async-signal-safe functions are used, so this can be called from a signal
+ *handler. Records written while dumping may come out garbled
+ *
+ * @return #YHR_SUCCESS if successful.
+ *         #YHR_INVALID_PARAMETERS if there is no file to write to.
+ *         #YHR_GENERIC_ERROR if the file could not be written, or another
+ *thread is dumping
+ **/
+yh_rc yh_dump_flight_recorder(void);
+
 /**
  * Instantiate a new connector
  *
@@ -881,6 +1344,101 @@ yh_rc yh_send_secure_msg(yh_session *session, yh_cmd cmd, const uint8_t *data,
                          size_t data_len, yh_cmd *response_cmd,
                          uint8_t *response, size_t *response_len);
 
+/**
+ * Send an encrypted message to the device over a session, with the payload
+ *gathered from several buffers. The buffers are concatenated straight into the
+ *message that is encrypted in place, and the response is decrypted in place.
+ *The session has to be authenticated
+ *
+ * @param session Session to send the message over
+ * @param cmd Command to send
+ * @param iov Buffers making up the data to send
+ * @param iovcnt Number of buffers in iov
+ * @param response_cmd Response command
+ * @param response Response data
+ * @param response_len Length of response data
+ *
+ * @return #YHR_SUCCESS if successful.
+ *         #YHR_INVALID_PARAMETERS if input parameters are NULL or the
+ *buffers add up to more than #YH_MSG_BUF_SIZE. See #yh_rc for other possible
+ *errors
+ *
+ * @see yh_send_secure_msg
+ **/
+yh_rc yh_send_secure_msgv(yh_session *session, yh_cmd cmd, const yh_iovec *iov,
+                          size_t iovcnt, yh_cmd *response_cmd,
+                          uint8_t *response, size_t *response_len);
+
+/**
+ * Send an encrypted message to the device over a session without waiting for
+ *the response. The message is sent, and callback called, as the connector is
+ *driven with yh_connector_process(). A session can have one command in flight
+ *at a time, but several sessions on the same connector can have commands in
+ *flight at once. Expired sessions are not re-created. Only supported by the
+ *HTTP backend
+ *
+ * @param session Session to send the message over
+ * @param cmd Command to send
+ * @param data Data to send
+ * @param data_len Length of data to send
+ * @param callback Called with the response when the command completes
+ * @param user User data passed to callback
+ *
+ * @return #YHR_SUCCESS if the message was queued. callback is then always
+ *called, also if the connector is disconnected before the command completes.
+ *         #YHR_INVALID_PARAMETERS if input parameters are NULL or the session
+ *already has a command in flight.
+ *         #YHR_CONNECTOR_ERROR if the backend does not support asynchronous
+ *messages. See #yh_rc for other possible errors
+ *
+ * @see yh_connector_get_pollfds, yh_connector_process
+ **/
+yh_rc yh_send_secure_msg_async(yh_session *session, yh_cmd cmd,
+                               const uint8_t *data, size_t data_len,
+                               yh_async_callback callback, void *user);
+
+/**
+ * Get the sockets a connector is waiting on for its asynchronous commands, for
+ *use with poll() or an event loop
+ *
+ * @param connector Connector to the device
+ * @param fds Sockets and the events they wait for
+ * @param n_fds Number of elements in fds. Set to the number of sockets on
+ *return
+ * @param timeout_ms Milliseconds until yh_connector_process() must be called
+ *even if no socket is ready, or -1 if there is no such deadline
+ *
+ * @return #YHR_SUCCESS if successful.
+ *         #YHR_INVALID_PARAMETERS if input parameters are NULL.
+ *         #YHR_BUFFER_TOO_SMALL if fds can not hold all sockets.
+ *         #YHR_CONNECTOR_ERROR if the backend does not support asynchronous
+ *messages
+ *
+ * @see yh_send_secure_msg_async
+ **/
+yh_rc yh_connector_get_pollfds(yh_connector *connector, yh_pollfd *fds,
+                               size_t *n_fds, int *timeout_ms);
+
+/**
+ * Drive the asynchronous commands of a connector without blocking, and call
+ *the callbacks of the commands that completed. Callbacks may send new
+ *asynchronous commands
+ *
+ * @param connector Connector to the device
+ * @param fds Sockets from yh_connector_get_pollfds() with revents set to the
+ *events that occurred
+ * @param n_fds Number of elements in fds. Can be 0 when the timeout expired
+ *
+ * @return #YHR_SUCCESS if successful.
+ *         #YHR_INVALID_PARAMETERS if input parameters are NULL.
+ *         #YHR_CONNECTOR_ERROR if the backend does not support asynchronous
+ *messages
+ *
+ * @see yh_send_secure_msg_async
+ **/
+yh_rc yh_connector_process(yh_connector *connector, const yh_pollfd *fds,
+                           size_t n_fds);
+
 /**
  * Create a session that uses an encryption key and a MAC key derived from a
  *password
@@ -1067,6 +1625,10 @@ yh_rc yh_util_generate_ec_p256_key(uint8_t *privkey, size_t privkey_len,
  *session-specific keys. The session is immediately usable,
  *yh_authenticate_session should not be used.
  *
+ * The static secret shared by privkey and device_pubkey is kept in locked
+ *memory of the connector once a session was established with it, so that later
+ *sessions only compute the ephemeral one. It is wiped by yh_disconnect()
+ *
  * @param connector Connector to the device
  * @param authkey_id Object ID of the Asymmetric Authentication Key used to
  *authenticate the session
@@ -1106,6 +1668,27 @@ yh_rc yh_create_session_asym(yh_connector *connector, uint16_t authkey_id,
  **/
 yh_rc yh_destroy_session(yh_session **session);
 
+/**
+ * Look after the sessions of a connector in a background thread. Every
+ *authenticated session created with recreate_session set, including those of
+ *session pools, gets an Echo command once it has been idle for interval_ms
+ *milliseconds, which keeps the device from timing it out. If the device no
+ *longer knows a session it is re-created and re-authenticated in the
+ *background, so that the next command sent over it does not have to
+ *
+ * @param connector Connector the sessions were created on
+ * @param interval_ms Idle time before a keepalive is sent, well below the
+ *device session timeout of 30 seconds. 0 stops the thread
+ *
+ * @return #YHR_SUCCESS if successful.
+ *         #YHR_INVALID_PARAMETERS if the connector is NULL or interval_ms is
+ *negative.
+ *         #YHR_GENERIC_ERROR if the thread could not be started
+ *
+ * @see yh_create_session
+ **/
+yh_rc yh_set_session_keepalive(yh_connector *connector, int interval_ms);
+
 /**
  * Authenticate session
  *
@@ -1121,6 +1704,146 @@ yh_rc yh_destroy_session(yh_session **session);
  **/
 yh_rc yh_authenticate_session(yh_session *session);
 
+/**
+ * Create a pool of authenticated sessions, for use by several threads at once.
+ *The sessions use an encryption key and a MAC key, like yh_create_session, and
+ *are re-created when they expire. This caches the keys in memory
+ *
+ * @param connector Connector to the device
+ * @param authkey_id Object ID of the Authentication Key used to authenticate
+ *the sessions
+ * @param key_enc Long lived encryption key of the Authentication Key
+ * @param key_enc_len Length of the encryption key. Must be #YH_KEY_LEN
+ * @param key_mac Long lived MAC key of the Authentication Key
+ * @param key_mac_len Length of the MAC key. Must be #YH_KEY_LEN
+ * @param n_sessions Number of sessions in the pool, at most #YH_MAX_SESSIONS
+ * @param pool The created pool
+ *
+ * @return #YHR_SUCCESS if successful.
+ *         #YHR_INVALID_PARAMETERS if input parameters are NULL or incorrect.
+ *         See #yh_rc for other possible errors
+ *
+ * @see yh_session_pool_checkout, yh_destroy_session_pool
+ **/
+yh_rc yh_create_session_pool(yh_connector *connector, uint16_t authkey_id,
+                             const uint8_t *key_enc, size_t key_enc_len,
+                             const uint8_t *key_mac, size_t key_mac_len,
+                             size_t n_sessions, yh_session_pool **pool);
+
+/**
+ * Create a pool of authenticated sessions, using keys derived from a password
+ *
+ * @param connector Connector to the device
+ * @param authkey_id Object ID of the Authentication Key used to authenticate
+ *the sessions
+ * @param password Password used to derive the session encryption key and MAC
+ *key
+ * @param password_len Length of the password in bytes
+ * @param n_sessions Number of sessions in the pool, at most #YH_MAX_SESSIONS
+ * @param pool The created pool
+ *
+ * @return #YHR_SUCCESS if successful.
+ *         #YHR_INVALID_PARAMETERS if input parameters are NULL or incorrect.
+ *         See #yh_rc for other possible errors
+ *
+ * @see yh_create_session_pool
+ **/
+yh_rc yh_create_session_pool_derived(yh_connector *connector,
+                                     uint16_t authkey_id,
+                                     const uint8_t *password,
+                                     size_t password_len, size_t n_sessions,
+                                     yh_session_pool **pool);
+
+/**
+ * Create a pool of sessions authenticated with an asymmetric key, like
+ *yh_create_session_asym. Expired sessions are re-created on their next
+ *checkout. This caches the private key in memory
+ *
+ * @param connector Connector to the device
+ * @param authkey_id Object ID of the Asymmetric Authentication Key used to
+ *authenticate the sessions
+ * @param privkey Private key of the client
+ * @param privkey_len Length of the private key
+ * @param device_pubkey Public key of the device
+ * @param device_pubkey_len Length of the device public key
+ * @param n_sessions Number of sessions in the pool, at most #YH_MAX_SESSIONS
+ * @param pool The created pool
+ *
+ * @return #YHR_SUCCESS if successful.
+ *         #YHR_INVALID_PARAMETERS if input parameters are NULL or incorrect.
+ *         See #yh_rc for other possible errors
+ *
+ * @see yh_create_session_pool
+ **/
+yh_rc yh_create_session_pool_asym(yh_connector *connector, uint16_t authkey_id,
+                                  const uint8_t *privkey, size_t privkey_len,
+                                  const uint8_t *device_pubkey,
+                                  size_t device_pubkey_len, size_t n_sessions,
+                                  yh_session_pool **pool);
+
+/**
+ * Check out a session from a pool for exclusive use by the calling thread.
+ *Sessions that were reported as failed are re-created before they are handed
+ *out again
+ *
+ * @param pool Pool to check out a session from
+ * @param timeout_ms Milliseconds to wait for a session to become available. 0
+ *does not wait, a negative value waits indefinitely
+ * @param session The checked out session
+ *
+ * @return #YHR_SUCCESS if successful.
+ *         #YHR_INVALID_PARAMETERS if input parameters are NULL.
+ *         #YHR_TIMEOUT if no session became available in time. See #yh_rc for
+ *other possible errors
+ *
+ * @see yh_session_pool_checkin
+ **/
+yh_rc yh_session_pool_checkout(yh_session_pool *pool, int timeout_ms,
+                               yh_session **session);
+
+/**
+ * Return a checked out session to its pool
+ *
+ * @param pool Pool the session was checked out from
+ * @param session Session to return
+ * @param result Result of the last operation on the session. Errors that
+ *indicate that the session is no longer usable cause it to be re-created on
+ *its next checkout
+ *
+ * @return #YHR_SUCCESS if successful.
+ *         #YHR_INVALID_PARAMETERS if input parameters are NULL or the session
+ *is not checked out from the pool
+ **/
+yh_rc yh_session_pool_checkin(yh_session_pool *pool, yh_session *session,
+                              yh_rc result);
+
+/**
+ * Get the health of the sessions in a pool
+ *
+ * @param pool Pool to get the health of
+ * @param health Health of each session
+ * @param n_health Number of elements in health. Set to the number of sessions
+ *in the pool on return
+ *
+ * @return #YHR_SUCCESS if successful.
+ *         #YHR_INVALID_PARAMETERS if input parameters are NULL.
+ *         #YHR_BUFFER_TOO_SMALL if health can not hold all sessions
+ **/
+yh_rc yh_get_session_pool_health(yh_session_pool *pool,
+                                 yh_session_health *health, size_t *n_health);
+
+/**
+ * Close the sessions of a pool on the device and free the pool. All sessions
+ *must be checked in
+ *
+ * @param pool Pointer to the pool to destroy
+ *
+ * @return #YHR_SUCCESS if successful.
+ *         #YHR_INVALID_PARAMETERS if the pool is NULL or sessions are still
+ *checked out
+ **/
+yh_rc yh_destroy_session_pool(yh_session_pool **pool);
+
 // Utility and convenience functions below
 
 /**
@@ -1224,6 +1947,26 @@ yh_rc yh_util_get_object_info(yh_session *session, uint16_t id,
 yh_rc yh_util_get_public_key(yh_session *session, uint16_t id, uint8_t *data,
                              size_t *data_len, yh_algorithm *algorithm);
 
+/**
+ * Get the public key with the specified Object ID, parsed by the parser set
+ *with yh_set_public_key_cache()
+ *
+ * @param session Authenticated session to use
+ * @param id Object ID of the public key
+ * @param parsed The parsed key. The caller owns one reference of it
+ * @param algorithm Algorithm of the key, or NULL
+ *
+ * @return #YHR_SUCCESS if successful.
+ *         #YHR_INVALID_PARAMETERS if input parameters are NULL or no parser
+ *is set.
+ *         #YHR_GENERIC_ERROR if the key could not be parsed.
+ *         See #yh_rc for other possible errors
+ *
+ * @see yh_set_public_key_cache
+ **/
+yh_rc yh_util_get_public_key_parsed(yh_session *session, uint16_t id,
+                                    void **parsed, yh_algorithm *algorithm);
+
 /**
  * Close a session
  *
@@ -1323,6 +2066,87 @@ yh_rc yh_util_sign_eddsa(yh_session *session, uint16_t key_id,
                          const uint8_t *in, size_t in_len, uint8_t *out,
                          size_t *out_len);
 
+/**
+ * Sign many inputs using RSASSA-PKCS#1v1.5, spreading the work over the
+ *sessions of a pool. With a connector that supports asynchronous messages every
+ *session that can be checked out without waiting keeps a command in flight.
+ *Otherwise the inputs are signed one after the other on a single session.
+ *Inputs that fail because their session broke are retried once on a
+ *re-created session
+ *
+ * @param pool Pool to take sessions from
+ * @param key_id Object ID of the signing key
+ * @param hashed true if the inputs are only hashed
+ * @param in Inputs to sign
+ * @param in_len Lengths of the inputs
+ * @param n Number of inputs
+ * @param out Buffers for the signatures
+ * @param out_len Sizes of the signature buffers. Set to the lengths of the
+ *signatures on return
+ * @param rcs Result of each input
+ *
+ * @return #YHR_SUCCESS if all inputs were signed.
+ *         #YHR_INVALID_PARAMETERS if input parameters are NULL. Otherwise the
+ *result of the first input that failed
+ *
+ * @see yh_util_sign_pkcs1v1_5
+ **/
+yh_rc yh_util_sign_pkcs1v1_5_batch(yh_session_pool *pool, uint16_t key_id,
+                                   bool hashed, const uint8_t *const *in,
+                                   const size_t *in_len, size_t n,
+                                   uint8_t *const *out, size_t *out_len,
+                                   yh_rc *rcs);
+
+/**
+ * Sign many digests using ECDSA, spreading the work over the sessions of a
+ *pool like yh_util_sign_pkcs1v1_5_batch()
+ *
+ * @param pool Pool to take sessions from
+ * @param key_id Object ID of the signing key
+ * @param in Digests to sign
+ * @param in_len Lengths of the digests
+ * @param n Number of digests
+ * @param out Buffers for the signatures
+ * @param out_len Sizes of the signature buffers. Set to the lengths of the
+ *signatures on return
+ * @param rcs Result of each digest
+ *
+ * @return #YHR_SUCCESS if all digests were signed.
+ *         #YHR_INVALID_PARAMETERS if input parameters are NULL. Otherwise the
+ *result of the first digest that failed
+ *
+ * @see yh_util_sign_ecdsa
+ **/
+yh_rc yh_util_sign_ecdsa_batch(yh_session_pool *pool, uint16_t key_id,
+                               const uint8_t *const *in, const size_t *in_len,
+                               size_t n, uint8_t *const *out, size_t *out_len,
+                               yh_rc *rcs);
+
+/**
+ * Sign many inputs using EdDSA, spreading the work over the sessions of a pool
+ *like yh_util_sign_pkcs1v1_5_batch()
+ *
+ * @param pool Pool to take sessions from
+ * @param key_id Object ID of the signing key
+ * @param in Inputs to sign
+ * @param in_len Lengths of the inputs
+ * @param n Number of inputs
+ * @param out Buffers for the signatures
+ * @param out_len Sizes of the signature buffers. Set to the lengths of the
+ *signatures on return
+ * @param rcs Result of each input
+ *
+ * @return #YHR_SUCCESS if all inputs were signed.
+ *         #YHR_INVALID_PARAMETERS if input parameters are NULL. Otherwise the
+ *result of the first input that failed
+ *
+ * @see yh_util_sign_eddsa
+ **/
+yh_rc yh_util_sign_eddsa_batch(yh_session_pool *pool, uint16_t key_id,
+                               const uint8_t *const *in, const size_t *in_len,
+                               size_t n, uint8_t *const *out, size_t *out_len,
+                               yh_rc *rcs);
+
 /**
  * Sign data using HMAC
  *
@@ -1345,7 +2169,8 @@ yh_rc yh_util_sign_hmac(yh_session *session, uint16_t key_id, const uint8_t *in,
  * Get a fixed number of pseudo-random bytes from the device
  *
  * @param session Authenticated session to use
- * @param len Length of pseudo-random data to get
+ * @param len Length of pseudo-random data to get. More than fits in one
+ *response is fetched with several commands
  * @param out Pseudo-random data out
  * @param out_len Length of pseudo-random data
  *
@@ -1356,6 +2181,26 @@ yh_rc yh_util_sign_hmac(yh_session *session, uint16_t key_id, const uint8_t *in,
 yh_rc yh_util_get_pseudo_random(yh_session *session, size_t len, uint8_t *out,
                                 size_t *out_len);
 
+/**
+ * Get a fixed number of pseudo-random bytes from the device using the
+ *sessions of a pool. Bytes kept by the random pool of the connector, if it is
+ *filled from this session pool, are used first. What is left is fetched in
+ *chunks spread over the sessions of the pool, like with
+ *yh_util_sign_ecdsa_batch()
+ *
+ * @param pool Session pool to use
+ * @param len Length of pseudo-random data to get
+ * @param out Pseudo-random data out, of at least len bytes
+ *
+ * @return #YHR_SUCCESS if successful.
+ *         #YHR_INVALID_PARAMETERS input parameters are NULL.
+ *         See #yh_rc for other possible errors
+ *
+ * @see yh_set_random_pool
+ **/
+yh_rc yh_util_get_pseudo_random_pooled(yh_session_pool *pool, size_t len,
+                                       uint8_t *out);
+
 /**
  * Import an RSA key into the device
  *
@@ -1800,6 +2645,33 @@ yh_rc yh_util_get_log_entries(yh_session *session, uint16_t *unlogged_boot,
  **/
 yh_rc yh_util_set_log_index(yh_session *session, uint16_t index);
 
+/**
+ * Drain the audit log of the device once: get the new log entries, verify
+ *that they continue the log drained before, store them and then set the log
+ *index past them, so that the device may log again when forced auditing is
+ *enabled
+ *
+ * @param session Authenticated session to use
+ * @param chain Where the drain is in the log, updated once entries are stored.
+ *It should be persisted along with the entries
+ * @param store Callback storing the entries
+ * @param user Passed to the callback
+ * @param n_drained Number of entries drained. Optional
+ *
+ * @return #YHR_SUCCESS if successful.
+ *         #YHR_INVALID_PARAMETERS if input parameters are NULL.
+ *         #YHR_LOG_VERIFICATION_FAILED if the entries do not continue the log,
+ *in which case nothing is stored.
+ *         #YHR_GENERIC_ERROR if the entries could not be stored.
+ *         See #yh_rc for other possible errors
+ *
+ * @see <a
+ *href="https://developers.yubico.com/YubiHSM2/Concepts/Logs.html">Logs</a>
+ **/
+yh_rc yh_util_drain_log_entries(yh_session *session, yh_log_chain *chain,
+                                yh_log_store store, void *user,
+                                size_t *n_drained);
+
 /**
  * Get an #YH_OPAQUE object (like an X.509 certificate) from the device
  *
@@ -2246,6 +3118,141 @@ yh_rc yh_util_unwrap_data(yh_session *session, uint16_t key_id,
                           const uint8_t *in, size_t in_len, uint8_t *out,
                           size_t *out_len);
 
+/**
+ * Wrap many inputs using a #YH_WRAP_KEY, spreading the work over the sessions
+ *of a pool like yh_util_sign_pkcs1v1_5_batch()
+ *
+ * @param pool Pool to take sessions from
+ * @param key_id Object ID of the Wrap Key to use
+ * @param in Data to wrap
+ * @param in_len Lengths of the data
+ * @param n Number of inputs
+ * @param out Buffers for the wrapped data
+ * @param out_len Sizes of the buffers. Set to the lengths of the wrapped data
+ *on return
+ * @param rcs Result of each input
+ *
+ * @return #YHR_SUCCESS if all inputs were wrapped.
+ *         #YHR_INVALID_PARAMETERS if input parameters are NULL. Otherwise the
+ *result of the first input that failed
+ *
+ * @see yh_util_wrap_data
+ **/
+yh_rc yh_util_wrap_data_batch(yh_session_pool *pool, uint16_t key_id,
+                              const uint8_t *const *in, const size_t *in_len,
+                              size_t n, uint8_t *const *out, size_t *out_len,
+                              yh_rc *rcs);
+
+/**
+ * Unwrap many inputs using a #YH_WRAP_KEY, spreading the work over the
+ *sessions of a pool like yh_util_sign_pkcs1v1_5_batch()
+ *
+ * @param pool Pool to take sessions from
+ * @param key_id Object ID of the Wrap Key to use
+ * @param in Wrapped data
+ * @param in_len Lengths of the wrapped data
+ * @param n Number of inputs
+ * @param out Buffers for the unwrapped data
+ * @param out_len Sizes of the buffers. Set to the lengths of the unwrapped
+ *data on return
+ * @param rcs Result of each input
+ *
+ * @return #YHR_SUCCESS if all inputs were unwrapped.
+ *         #YHR_INVALID_PARAMETERS if input parameters are NULL. Otherwise the
+ *result of the first input that failed
+ *
+ * @see yh_util_unwrap_data
+ **/
+yh_rc yh_util_unwrap_data_batch(yh_session_pool *pool, uint16_t key_id,
+                                const uint8_t *const *in, const size_t *in_len,
+                                size_t n, uint8_t *const *out, size_t *out_len,
+                                yh_rc *rcs);
+
+/**
+ * Wrap data of any length into an envelope. The data is split into chunks,
+ *which are wrapped in batches with yh_util_wrap_data_batch(), so with a
+ *connector supporting asynchronous messages every session of the pool keeps a
+ *chunk in flight.
+ *
+ * An envelope starts with a 32 byte header: #YH_ENVELOPE_MAGIC, the
+ *#YH_ENVELOPE_VERSION byte, a zero byte, the Object ID of the Wrap Key, the
+ *chunk size on 4 bytes, 4 zero bytes, a random 8 byte envelope ID and 8 zero
+ *bytes. The wrapped chunks follow, each the output of #YHC_WRAP_DATA with the
+ *nonce chosen by the device for the chunk. The data of a chunk is prefixed by
+ *the envelope ID and the chunk number on 8 bytes, whose top bit is set in the
+ *last chunk only, so that chunks can be neither moved nor dropped. Every chunk
+ *but the last holds exactly chunk size bytes of data, and there is always at
+ *least one. An index of the offsets of the chunks, 8 bytes each, follows them,
+ *and a 24 byte trailer ends the envelope: "YHEI", 4 zero bytes, the number of
+ *chunks and the offset of the index, on 8 bytes each. All numbers are big
+ *endian
+ *
+ * @param pool Pool to take sessions from
+ * @param key_id Object ID of the Wrap Key to use
+ * @param chunk_size Number of bytes of data per chunk, at most
+ *#YH_ENVELOPE_MAX_CHUNK_SIZE. 0 uses #YH_ENVELOPE_MAX_CHUNK_SIZE
+ * @param read Reads the data to wrap
+ * @param write Writes the envelope, from start to end
+ * @param user User data passed to the callbacks
+ *
+ * @return #YHR_SUCCESS if successful.
+ *         #YHR_INVALID_PARAMETERS if input parameters are NULL or incorrect.
+ *         See #yh_rc for other possible errors
+ *
+ * @see yh_util_unwrap_envelope
+ **/
+yh_rc yh_util_wrap_envelope(yh_session_pool *pool, uint16_t key_id,
+                            size_t chunk_size, yh_envelope_read read,
+                            yh_envelope_write write, void *user);
+
+/**
+ * Get information about an envelope made by yh_util_wrap_envelope()
+ *
+ * @param read_at Reads the envelope
+ * @param size Size of the envelope in bytes
+ * @param user User data passed to read_at
+ * @param key_id Object ID of the Wrap Key the envelope was wrapped with, or
+ *NULL
+ * @param chunk_size Number of bytes of data per chunk, or NULL
+ * @param n_chunks Number of chunks, or NULL
+ *
+ * @return #YHR_SUCCESS if successful.
+ *         #YHR_INVALID_PARAMETERS if read_at is NULL or this is not an
+ *envelope.
+ *         See #yh_rc for other possible errors
+ **/
+yh_rc yh_get_envelope_info(yh_envelope_read_at read_at, uint64_t size,
+                           void *user, uint16_t *key_id, size_t *chunk_size,
+                           uint64_t *n_chunks);
+
+/**
+ * Unwrap data from an envelope made by yh_util_wrap_envelope(), starting at
+ *any chunk. Chunk n holds the data from byte n * chunk size on. The chunks are
+ *unwrapped in batches with yh_util_unwrap_data_batch(), using the Wrap Key
+ *named in the envelope
+ *
+ * @param pool Pool to take sessions from
+ * @param read_at Reads the envelope
+ * @param size Size of the envelope in bytes
+ * @param first_chunk Number of the first chunk to unwrap
+ * @param n_chunks Number of chunks to unwrap. 0 unwraps all chunks from
+ *first_chunk on
+ * @param write Writes the unwrapped data, in order
+ * @param user User data passed to the callbacks
+ *
+ * @return #YHR_SUCCESS if successful.
+ *         #YHR_INVALID_PARAMETERS if input parameters are NULL or incorrect,
+ *or this is not an envelope.
+ *         #YHR_GENERIC_ERROR if a chunk does not belong where it was found.
+ *         See #yh_rc for other possible errors
+ *
+ * @see yh_util_wrap_envelope
+ **/
+yh_rc yh_util_unwrap_envelope(yh_session_pool *pool,
+                              yh_envelope_read_at read_at, uint64_t size,
+                              uint64_t first_chunk, uint64_t n_chunks,
+                              yh_envelope_write write, void *user);
+
 /**
  * Blink the LED of the device to identify it
  *
@@ -2316,6 +3323,174 @@ yh_rc yh_get_connector_version(yh_connector *connector, uint8_t *major,
  **/
 yh_rc yh_get_connector_address(yh_connector *connector, char **const address);
 
+/**
+ * Get the statistics a connector has collected since it was created or the
+ *statistics were reset. The statistics are always collected, at the cost of a
+ *few atomic additions per command. They are updated while they are read, so
+ *the counters may be slightly apart
+ *
+ * @param connector Connector currently in use
+ * @param stats Statistics. The structure is large, so better not allocated on
+ *the stack
+ *
+ * @return #YHR_SUCCESS if successful.
+ *         #YHR_INVALID_PARAMETERS if input parameters are NULL.
+ **/
+yh_rc yh_get_connector_stats(yh_connector *connector,
+                             yh_connector_stats *stats);
+
+/**
+ * Reset the statistics of a connector
+ *
+ * @param connector Connector currently in use
+ *
+ * @return #YHR_SUCCESS if successful.
+ *         #YHR_INVALID_PARAMETERS if input parameters are NULL.
+ **/
+yh_rc yh_reset_connector_stats(yh_connector *connector);
+
+/**
+ * Set callbacks that the library calls when it begins and ends an operation
+ *on the connector, see #yh_trace_point. Operations nest: a command sent in a
+ *session message is reported both as #YH_TRACE_SECURE_MSG and, inside it, as
+ *#YH_TRACE_SEND. The callbacks are called on the thread doing the operation,
+ *except that the end of a command sent with yh_send_secure_msg_async() is
+ *reported by yh_connector_process(). They must be quick and must not use the
+ *connector.
+ *
+ * The hooks must not be changed while commands are in progress on the
+ *connector
+ *
+ * @param connector Connector to trace
+ * @param begin Called when an operation begins, or NULL
+ * @param end Called when an operation ends, or NULL
+ * @param user User data passed to the callbacks
+ *
+ * @return #YHR_SUCCESS if successful.
+ *         #YHR_INVALID_PARAMETERS if the connector is NULL.
+ **/
+yh_rc yh_set_trace_hooks(yh_connector *connector, yh_trace_callback begin,
+                         yh_trace_callback end, void *user);
+
+/**
+ * Cache the object metadata returned by yh_util_get_object_info() in each
+ *session on the connector, so that looking up the same object again costs no
+ *round-trip to the device. Objects are cached per session, as what a session
+ *may see depends on its authentication key.
+ *
+ * Cached metadata is dropped whenever an object is created or deleted through
+ *the connector, including by yh_util_reset_device(). yh_util_list_objects()
+ *confirms the cached objects it lists with an unchanged sequence, and drops
+ *those whose sequence changed. Objects changed by other clients are only
+ *noticed that way or when the metadata expires. The cache is disabled by
+ *default
+ *
+ * @param connector Connector currently in use
+ * @param lifetime_ms How long metadata is kept, in milliseconds
+ * @param max_objects Number of objects to keep per session. When full, the
+ *object closest to expiring is replaced
+ *
+ * Setting either parameter to 0 disables the cache. Metadata cached before the
+ *call is not used again
+ *
+ * @return #YHR_SUCCESS if successful.
+ *         #YHR_INVALID_PARAMETERS if the connector is NULL.
+ **/
+yh_rc yh_set_object_cache(yh_connector *connector, unsigned int lifetime_ms,
+                          size_t max_objects);
+
+/**
+ * Cache the public keys returned by yh_util_get_public_key() and
+ *yh_util_get_public_key_parsed(), shared by all sessions on the connector.
+ *A public key never changes for a given Object ID and sequence, so each
+ *lookup only checks the sequence with yh_util_get_object_info() in the calling
+ *session, which also makes sure the session may see the key. With
+ *yh_set_object_cache() enabled, a cached key usually costs no round-trip to
+ *the device. The cache is disabled by default
+ *
+ * @param connector Connector currently in use
+ * @param max_keys Number of keys to keep. When full, the least recently used
+ *key is replaced. 0 disables the cache
+ * @param parser Callbacks parsing the keys, or NULL. Parsed keys are cached
+ *along with the keys. The parser must not be changed while
+ *yh_util_get_public_key_parsed() is in use on the connector
+ *
+ * Keys cached before the call are dropped
+ *
+ * @return #YHR_SUCCESS if successful.
+ *         #YHR_INVALID_PARAMETERS if the connector is NULL or the parser is
+ *incomplete.
+ *         #YHR_MEMORY_ERROR if the cache could not be allocated
+ **/
+yh_rc yh_set_public_key_cache(yh_connector *connector, size_t max_keys,
+                              const yh_public_key_parser *parser);
+
+/**
+ * Keep pseudo-random bytes from the device in memory of the connector, for
+ *yh_util_get_pseudo_random_pooled(). A background thread fills the random
+ *pool up to the high watermark whenever no more than the low watermark is
+ *left, using the sessions of a session pool. Bytes are wiped from memory as
+ *they are handed out. The random pool is disabled by default
+ *
+ * @param connector Connector currently in use
+ * @param pool Session pool to fill the random pool from, and to serve, or NULL
+ *when disabling it. It must not be destroyed before the random pool is
+ *disabled or the connector is destroyed
+ * @param low_watermark Bytes left when the random pool is filled again
+ * @param high_watermark Bytes kept at most. 0 disables the random pool
+ *
+ * Bytes kept before the call are wiped
+ *
+ * @return #YHR_SUCCESS if successful.
+ *         #YHR_INVALID_PARAMETERS if the connector is NULL, or if the random
+ *pool is enabled without a session pool or with low_watermark not below
+ *high_watermark.
+ *         #YHR_MEMORY_ERROR if the memory could not be allocated.
+ *         #YHR_GENERIC_ERROR if the thread could not be started
+ **/
+yh_rc yh_set_random_pool(yh_connector *connector, yh_session_pool *pool,
+                         size_t low_watermark, size_t high_watermark);
+
+/**
+ * Drain the audit log of the device continuously from a background thread,
+ *with yh_util_drain_log_entries(), so that commands are not refused once the
+ *log is full when forced auditing is enabled. The log is drained every
+ *interval_ms, right away when a command on the connector is refused because
+ *the log is full, and again right away while many entries are found
+ *
+ * @param connector Connector currently in use
+ * @param session Authenticated session to drain with. It must not be used
+ *otherwise until the drain is stopped
+ * @param interval_ms Milliseconds between drains. 0 stops the drain
+ * @param chain Where the drain is in the log, see yh_util_drain_log_entries().
+ *It is updated by the thread and must not be used until the drain is stopped
+ * @param store Callback storing the entries, called from the thread
+ * @param user Passed to the callback
+ *
+ * Failures are retried at the next interval. Entries that fail verification
+ *are left on the device, see yh_util_drain_log_entries() to handle them
+ *
+ * @return #YHR_SUCCESS if successful.
+ *         #YHR_INVALID_PARAMETERS if input parameters are NULL or the session
+ *is not on the connector.
+ *         #YHR_GENERIC_ERROR if the thread could not be started
+ **/
+yh_rc yh_set_log_drain(yh_connector *connector, yh_session *session,
+                       int interval_ms, yh_log_chain *chain,
+                       yh_log_store store, void *user);
+
+/**
+ * Get a percentile of a latency histogram
+ *
+ * @param histogram Latency histogram
+ * @param percentile Percentile, from 0 to 100
+ *
+ * @return The upper bound, in microseconds, of the bucket the percentile falls
+ *in, but not above the longest latency. 0 if the histogram is empty
+ **/
+uint64_t yh_get_latency_percentile(const yh_latency_histogram *histogram,
+                                   double percentile);
+
 /**
  * Convert capability string to byte array
  *
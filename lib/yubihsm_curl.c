@@ -16,6 +16,7 @@
 
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
 
 #include <arpa/inet.h>
 
@@ -25,15 +26,100 @@
 
 #include "curl/curl.h"
 
-struct state {
-  CURL *curl;
-};
+#include "../common/thread.h"
+
+// Number of idle easy handles kept per connector for reuse
+#define MAX_IDLE_HANDLES YH_MAX_SESSIONS
+
+// Multiplexing synchronous requests needs curl_multi_poll() and
+// curl_multi_wakeup()
+#if LIBCURL_VERSION_NUM >= 0x074400
+#define HAVE_MULTIPLEXING
+#endif
+
+// Longest time a thread waits for transfers before letting another one drive
+// them
+#define MULTIPLEX_POLL_MS 1000
+
+// Seconds an idle connection waits before, and between, keepalive probes. A
+// dead connection is noticed well before the default two hours have passed
+#define KEEPALIVE_IDLE 30
+#define KEEPALIVE_INTERVAL 10
+
+/*
+ * Every in-flight request gets an easy handle of its own, duplicated from the
+ * configured template handle. Handles are returned to a small idle pool after
+ * use.
+ *
+ * The connectors of a process share DNS and TLS session caches through one
+ * share handle, so that connecting to a connector again, or to another one on
+ * the same host, resumes TLS sessions instead of doing full handshakes.
+ * Connections are not shared, libcurl does not support sharing them between
+ * easy handles used from several threads at once. They are kept open by the
+ * pooled easy handles, and by the multi handles for the requests they drive.
+ * The share handle is created with the first connection and cleaned up with
+ * the last one. shared_lock is set up by backend_init(), which like
+ * curl_global_init() is not thread safe, and is kept until the process exits
+ */
+static bool shared_ready;
+static thread_mutex shared_lock;
+static CURLSH *shared;
+static thread_mutex shared_locks[CURL_LOCK_DATA_LAST];
+static size_t shared_users;
 
 struct curl_data {
   uint8_t *ptr;
   uint8_t *end;
 };
 
+struct request {
+  CURL *curl;
+  Msg *response;
+  struct curl_data data;
+  // Built in place, so that sending a message does not allocate headers
+  struct curl_slist headers[2];
+  char hsm_identifier[64];
+  char curl_error[CURL_ERROR_SIZE];
+  // Only used by asynchronous and multiplexed requests
+  CURLcode result;
+  bool finished;
+  backend_done_cb done;
+  void *ctx;
+  struct request *next;
+};
+
+/*
+ * Asynchronous requests are driven by a multi handle, created on first use,
+ * whose sockets and timeout are tracked for backend_get_pollfds().
+ *
+ * With HTTP/2, synchronous requests are added to a second multi handle so that
+ * they are multiplexed over one connection instead of opening one each.
+ * Whichever waiting thread gets there first drives the transfers of everybody,
+ * and the others are woken up when theirs are done
+ */
+struct state {
+  CURL *curl;
+  // Set when connecting, connections and handshakes are counted in it
+  yh_connector_stats *stats;
+  thread_mutex lock;
+  CURL *idle[MAX_IDLE_HANDLES];
+  size_t n_idle;
+  thread_mutex multi_lock;
+  CURLM *multi;
+  struct request *in_flight;
+  yh_pollfd *fds;
+  size_t n_fds;
+  size_t fds_size;
+  long long timeout_at;
+  bool http2;
+  thread_mutex sync_lock;
+  thread_cond sync_done;
+  CURLM *sync_multi;
+  // Requests waiting to be added to the multi handle by the driving thread
+  struct request *sync_queue;
+  bool driving;
+};
+
 uint8_t YH_INTERNAL _yh_verbosity;
 FILE YH_INTERNAL *_yh_output;
 
@@ -78,12 +164,204 @@ static yh_rc backend_init(uint8_t verbosity, FILE *output) {
     return YHR_CONNECTION_ERROR;
   }
 
+  if (!shared_ready) {
+    if (!thread_mutex_init(&shared_lock)) {
+      DBG_ERR("Failed to create the share lock");
+      return YHR_GENERIC_ERROR;
+    }
+    shared_ready = true;
+  }
+
   return YHR_SUCCESS;
 }
 
+static void share_lock(CURL *handle, curl_lock_data data,
+                       curl_lock_access access, void *userptr) {
+
+  (void) handle;
+  (void) access;
+  (void) userptr;
+
+  thread_mutex_lock(&shared_locks[data]);
+}
+
+static void share_unlock(CURL *handle, curl_lock_data data, void *userptr) {
+
+  (void) handle;
+  (void) userptr;
+
+  thread_mutex_unlock(&shared_locks[data]);
+}
+
+static CURLSH *get_share(void) {
+
+  thread_mutex_lock(&shared_lock);
+  if (shared == NULL) {
+    shared = curl_share_init();
+    if (shared == NULL) {
+      thread_mutex_unlock(&shared_lock);
+      return NULL;
+    }
+    for (size_t i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+      thread_mutex_init(&shared_locks[i]);
+    }
+    curl_share_setopt(shared, CURLSHOPT_LOCKFUNC, share_lock);
+    curl_share_setopt(shared, CURLSHOPT_UNLOCKFUNC, share_unlock);
+    curl_share_setopt(shared, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(shared, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+  }
+  shared_users++;
+  thread_mutex_unlock(&shared_lock);
+
+  return shared;
+}
+
+// All handles using the share must be gone before this is called
+static void put_share(void) {
+
+  thread_mutex_lock(&shared_lock);
+  if (--shared_users == 0) {
+    curl_share_cleanup(shared);
+    shared = NULL;
+    for (size_t i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+      thread_mutex_destroy(&shared_locks[i]);
+    }
+  }
+  thread_mutex_unlock(&shared_lock);
+}
+
+// Counts the connections opened, and TLS handshakes done, for the last
+// transfer of curl
+static void count_connections(yh_backend *connection, CURL *curl) {
+
+  long connects = 0;
+
+  if (connection->stats == NULL ||
+      curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects) != CURLE_OK ||
+      connects <= 0) {
+    return;
+  }
+  thread_atomic_add(&connection->stats->connections, connects);
+
+#if LIBCURL_VERSION_NUM >= 0x073d00
+  // Only TLS has a handshake after the TCP connect
+  curl_off_t appconnect = 0;
+  if (curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &appconnect) ==
+        CURLE_OK &&
+      appconnect > 0) {
+    thread_atomic_add(&connection->stats->tls_handshakes, 1);
+  }
+#endif
+}
+
+static void flush_idle_handles(yh_backend *connection) {
+
+  thread_mutex_lock(&connection->lock);
+  while (connection->n_idle > 0) {
+    curl_easy_cleanup(connection->idle[--connection->n_idle]);
+  }
+  thread_mutex_unlock(&connection->lock);
+}
+
+static CURL *get_handle(yh_backend *connection) {
+
+  CURL *curl;
+
+  thread_mutex_lock(&connection->lock);
+  if (connection->n_idle > 0) {
+    curl = connection->idle[--connection->n_idle];
+  } else {
+    curl = curl_easy_duphandle(connection->curl);
+  }
+  thread_mutex_unlock(&connection->lock);
+
+  return curl;
+}
+
+static void put_handle(yh_backend *connection, CURL *curl) {
+
+  thread_mutex_lock(&connection->lock);
+  if (connection->n_idle < MAX_IDLE_HANDLES) {
+    connection->idle[connection->n_idle++] = curl;
+    curl = NULL;
+  }
+  thread_mutex_unlock(&connection->lock);
+
+  if (curl != NULL) {
+    curl_easy_cleanup(curl);
+  }
+}
+
+static void backend_disconnect(yh_backend *connection);
+static void cancel_requests(yh_backend *connection);
+
 static yh_backend *backend_create() {
   DBG_INFO("backend_create");
-  return curl_easy_init();
+
+  yh_backend *connection = calloc(1, sizeof(yh_backend));
+  if (connection == NULL) {
+    return NULL;
+  }
+
+  thread_mutex_init(&connection->lock);
+  thread_mutex_init(&connection->multi_lock);
+  thread_mutex_init(&connection->sync_lock);
+  thread_cond_init(&connection->sync_done);
+  connection->timeout_at = -1;
+
+  connection->curl = curl_easy_init();
+  if (connection->curl == NULL) {
+    backend_disconnect(connection);
+    return NULL;
+  }
+
+  CURLSH *share = get_share();
+  if (share == NULL) {
+    curl_easy_cleanup(connection->curl);
+    connection->curl = NULL;
+    backend_disconnect(connection);
+    return NULL;
+  }
+  curl_easy_setopt(connection->curl, CURLOPT_SHARE, share);
+
+  // Every message is waited for, so it has to go out right away
+  curl_easy_setopt(connection->curl, CURLOPT_TCP_NODELAY, 1L);
+#if LIBCURL_VERSION_NUM >= 0x071900
+  curl_easy_setopt(connection->curl, CURLOPT_TCP_KEEPALIVE, 1L);
+  curl_easy_setopt(connection->curl, CURLOPT_TCP_KEEPIDLE,
+                   (long) KEEPALIVE_IDLE);
+  curl_easy_setopt(connection->curl, CURLOPT_TCP_KEEPINTVL,
+                   (long) KEEPALIVE_INTERVAL);
+#endif
+
+  return connection;
+}
+
+// Sets what the template handle needs to reach the connector
+static yh_rc setup_template(yh_connector *connector, int timeout) {
+
+  CURL *curl = connector->connection->curl;
+
+  if (connector->unix_socket != NULL) {
+#if LIBCURL_VERSION_NUM >= 0x072800
+    // Handles duplicated from the template connect to the socket as well
+    curl_easy_setopt(curl, CURLOPT_UNIX_SOCKET_PATH, connector->unix_socket);
+#else
+    DBG_ERR("Unix sockets are not supported by this version of curl");
+    return YHR_CONNECTOR_NOT_FOUND;
+#endif
+  }
+  curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, timeout);
+  curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1);
+  curl_easy_setopt(curl, CURLOPT_USERAGENT,
+                   "YubiHSM curl/" VERSION);
+
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION,
+                   curl_callback_write);
+
+  connector->connection->stats = connector->stats;
+
+  return YHR_SUCCESS;
 }
 
 static yh_rc backend_connect(yh_connector *connector, int timeout) {
@@ -93,26 +371,22 @@ static yh_rc backend_connect(yh_connector *connector, int timeout) {
   uint8_t scratch[257] = {0};
   struct curl_data data = {scratch, scratch + sizeof(scratch) - 1};
   char curl_error[CURL_ERROR_SIZE] = {0};
+  CURL *curl = connector->connection->curl;
 
   DBG_INFO("Trying to connect to %s", connector->status_url);
 
-  curl_easy_setopt(connector->connection, CURLOPT_URL, connector->status_url);
-  curl_easy_setopt(connector->connection, CURLOPT_CONNECTTIMEOUT, timeout);
-#ifdef CURLOPT_TCP_KEEPALIVE
-  curl_easy_setopt(connector->connection, CURLOPT_TCP_KEEPALIVE, 1);
-#endif /* CURLOPT_TCP_KEEPALIVE */
-  curl_easy_setopt(connector->connection, CURLOPT_FAILONERROR, 1);
-  curl_easy_setopt(connector->connection, CURLOPT_USERAGENT,
-                   "YubiHSM curl/" VERSION);
-
-  curl_easy_setopt(connector->connection, CURLOPT_WRITEFUNCTION,
-                   curl_callback_write);
+  yh_rc yrc = setup_template(connector, timeout);
+  if (yrc != YHR_SUCCESS) {
+    return yrc;
+  }
+  curl_easy_setopt(curl, CURLOPT_URL, connector->status_url);
 
-  curl_easy_setopt(connector->connection, CURLOPT_ERRORBUFFER, curl_error);
+  curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, curl_error);
 
-  curl_easy_setopt(connector->connection, CURLOPT_WRITEDATA, &data);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &data);
 
-  rc = curl_easy_perform(connector->connection);
+  rc = curl_easy_perform(curl);
+  count_connections(connector->connection, curl);
   if (rc != CURLE_OK) {
     if (strlen(curl_error) > 0) {
       DBG_ERR("Failure when connecting: '%s'", curl_error);
@@ -141,73 +415,465 @@ static yh_rc backend_connect(yh_connector *connector, int timeout) {
 
   DBG_INFO("Found working connector");
 
-  curl_easy_setopt(connector->connection, CURLOPT_URL, connector->api_url);
+  curl_easy_setopt(curl, CURLOPT_URL, connector->api_url);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, NULL);
+  curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, NULL);
+  // Handles duplicated before the status check still point at it
+  flush_idle_handles(connector->connection);
+
+  return YHR_SUCCESS;
+}
+
+static yh_rc backend_reconnect(yh_connector *connector, int timeout) {
+  DBG_INFO("backend_reconnect");
+
+  // The connection itself is opened by the first message
+  yh_rc yrc = setup_template(connector, timeout);
+  if (yrc != YHR_SUCCESS) {
+    return yrc;
+  }
+  curl_easy_setopt(connector->connection->curl, CURLOPT_URL,
+                   connector->api_url);
+  flush_idle_handles(connector->connection);
 
   return YHR_SUCCESS;
 }
 
 static void backend_disconnect(yh_backend *connection) {
   DBG_INFO("backend_disconnect");
-  curl_easy_cleanup(connection);
+
+  if (connection == NULL) {
+    return;
+  }
+
+  cancel_requests(connection);
+  if (connection->multi != NULL) {
+    curl_multi_cleanup(connection->multi);
+  }
+  free(connection->fds);
+  if (connection->sync_multi != NULL) {
+    curl_multi_cleanup(connection->sync_multi);
+  }
+
+  // All handles using the share must be gone before it can be cleaned up
+  flush_idle_handles(connection);
+  if (connection->curl != NULL) {
+    curl_easy_cleanup(connection->curl);
+    put_share();
+  }
+
+  thread_cond_destroy(&connection->sync_done);
+  thread_mutex_destroy(&connection->sync_lock);
+  thread_mutex_destroy(&connection->multi_lock);
+  thread_mutex_destroy(&connection->lock);
+  free(connection);
 }
 
-static yh_rc backend_send_msg(yh_backend *connection, Msg *msg, Msg *response,
-                              const char *identifier) {
-  CURLcode rc;
-  yh_rc yrc = YHR_CONNECTION_ERROR;
+static yh_rc prepare_request(yh_backend *connection, struct request *req,
+                             Msg *msg, Msg *response, const char *identifier) {
   int32_t trf_len = ntohs(msg->st.len) + 3;
-  struct curl_data data = {response->raw,
-                           response->raw + sizeof(response->raw)};
-  struct curl_slist *headers = NULL;
-  char curl_error[CURL_ERROR_SIZE] = {0};
-  char hsm_identifier[64];
 
-  headers = curl_slist_append(NULL, "Content-Type: application/octet-stream");
+  req->curl = get_handle(connection);
+  if (req->curl == NULL) {
+    DBG_ERR("Failed to get a curl handle");
+    return YHR_MEMORY_ERROR;
+  }
+
+  req->response = response;
+  req->data.ptr = response->raw;
+  req->data.end = response->raw + sizeof(response->raw);
+
+  req->headers[0].data = (char *) "Content-Type: application/octet-stream";
+  req->headers[0].next = NULL;
 
   if (identifier != NULL && strlen(identifier) > 0 && strlen(identifier) < 32) {
-    snprintf(hsm_identifier, 64, "YubiHSM-Session: %s", identifier);
-    headers = curl_slist_append(headers, hsm_identifier);
+    snprintf(req->hsm_identifier, sizeof(req->hsm_identifier),
+             "YubiHSM-Session: %s", identifier);
+    req->headers[1].data = req->hsm_identifier;
+    req->headers[1].next = NULL;
+    req->headers[0].next = &req->headers[1];
   }
 
-  curl_easy_setopt(connection, CURLOPT_HTTPHEADER, headers);
-  curl_easy_setopt(connection, CURLOPT_POSTFIELDS, (void *) msg->raw);
-  curl_easy_setopt(connection, CURLOPT_POSTFIELDSIZE, trf_len);
+  curl_easy_setopt(req->curl, CURLOPT_HTTPHEADER, req->headers);
+  curl_easy_setopt(req->curl, CURLOPT_POSTFIELDS, (void *) msg->raw);
+  curl_easy_setopt(req->curl, CURLOPT_POSTFIELDSIZE, trf_len);
 
-  curl_easy_setopt(connection, CURLOPT_WRITEDATA, &data);
-  curl_easy_setopt(connection, CURLOPT_ERRORBUFFER, curl_error);
+  curl_easy_setopt(req->curl, CURLOPT_WRITEDATA, &req->data);
+  curl_easy_setopt(req->curl, CURLOPT_ERRORBUFFER, req->curl_error);
+
+  return YHR_SUCCESS;
+}
+
+static yh_rc finish_request(yh_backend *connection, struct request *req,
+                            CURLcode rc) {
+
+  count_connections(connection, req->curl);
+
+  // Don't leave pointers to the request in a handle that is kept for reuse
+  curl_easy_setopt(req->curl, CURLOPT_HTTPHEADER, NULL);
+  curl_easy_setopt(req->curl, CURLOPT_POSTFIELDS, NULL);
+  curl_easy_setopt(req->curl, CURLOPT_WRITEDATA, NULL);
+  curl_easy_setopt(req->curl, CURLOPT_ERRORBUFFER, NULL);
+  curl_easy_setopt(req->curl, CURLOPT_PRIVATE, NULL);
+  put_handle(connection, req->curl);
 
-  // NOTE(adma): connection is actually established here the first time
-  rc = curl_easy_perform(connection);
-  curl_slist_free_all(headers);
   if (rc != CURLE_OK) {
-    goto sm_failure;
+    if (strlen(req->curl_error) > 0) {
+      DBG_ERR("Curl perform failed: '%s'", req->curl_error);
+    } else {
+      DBG_ERR("Curl perform failed: '%s'", curl_easy_strerror(rc));
+    }
+    return YHR_CONNECTION_ERROR;
   }
 
-  size_t size = data.ptr - response->raw;
+  size_t size = req->data.ptr - req->response->raw;
 
   if (size < 3) {
     DBG_ERR("Not enough data received: %zu", size);
     return YHR_WRONG_LENGTH;
   }
 
-  if (ntohs(response->st.len) != size - 3) {
-    DBG_ERR("Wrong length received, %d vs %zu", ntohs(response->st.len), size);
+  if (ntohs(req->response->st.len) != size - 3) {
+    DBG_ERR("Wrong length received, %d vs %zu", ntohs(req->response->st.len),
+            size);
     return YHR_WRONG_LENGTH;
   }
 
   return YHR_SUCCESS;
+}
+
+#ifdef HAVE_MULTIPLEXING
+// Runs one round of transfers, only called by the thread that set driving.
+// Returns the requests that finished
+static struct request *drive_transfers(yh_backend *connection,
+                                       struct request *queue) {
+
+  CURLM *multi = connection->sync_multi;
+  struct request *done = NULL;
+  CURLMsg *info;
+  int running;
+  int left;
+
+  while (queue != NULL) {
+    struct request *next = queue->next;
+    if (curl_multi_add_handle(multi, queue->curl) != CURLM_OK) {
+      DBG_ERR("Failed to add request to the multi handle");
+      queue->result = CURLE_FAILED_INIT;
+      queue->next = done;
+      done = queue;
+    }
+    queue = next;
+  }
+
+  curl_multi_perform(multi, &running);
+  if (running > 0 && curl_multi_poll(multi, NULL, 0, MULTIPLEX_POLL_MS,
+                                     NULL) == CURLM_OK) {
+    curl_multi_perform(multi, &running);
+  }
+
+  while ((info = curl_multi_info_read(multi, &left)) != NULL) {
+    struct request *req = NULL;
+
+    if (info->msg != CURLMSG_DONE) {
+      continue;
+    }
+    curl_easy_getinfo(info->easy_handle, CURLINFO_PRIVATE, (char **) &req);
+    req->result = info->data.result;
+    curl_multi_remove_handle(multi, req->curl);
+    req->next = done;
+    done = req;
+  }
+
+  return done;
+}
+
+static CURLcode perform_multiplexed(yh_backend *connection,
+                                    struct request *req) {
+
+  curl_easy_setopt(req->curl, CURLOPT_PRIVATE, req);
+
+  thread_mutex_lock(&connection->sync_lock);
+  req->next = connection->sync_queue;
+  connection->sync_queue = req;
+  if (connection->driving) {
+    // Have the driving thread start the request right away
+    curl_multi_wakeup(connection->sync_multi);
+  }
+
+  while (!req->finished) {
+    if (connection->driving) {
+      thread_cond_wait(&connection->sync_done, &connection->sync_lock, -1);
+      continue;
+    }
+    connection->driving = true;
+    struct request *queue = connection->sync_queue;
+    connection->sync_queue = NULL;
+    thread_mutex_unlock(&connection->sync_lock);
+
+    struct request *done = drive_transfers(connection, queue);
+
+    thread_mutex_lock(&connection->sync_lock);
+    while (done != NULL) {
+      struct request *next = done->next;
+      done->finished = true;
+      done = next;
+    }
+    connection->driving = false;
+    thread_cond_broadcast(&connection->sync_done);
+  }
+  thread_mutex_unlock(&connection->sync_lock);
+
+  return req->result;
+}
+#endif
+
+static yh_rc backend_send_msg(yh_backend *connection, Msg *msg, Msg *response,
+                              const char *identifier) {
+  struct request req = {0};
+  CURLcode rc;
+
+  yh_rc yrc = prepare_request(connection, &req, msg, response, identifier);
+  if (yrc != YHR_SUCCESS) {
+    return yrc;
+  }
+
+#ifdef HAVE_MULTIPLEXING
+  if (connection->sync_multi != NULL) {
+    rc = perform_multiplexed(connection, &req);
+    return finish_request(connection, &req, rc);
+  }
+#endif
+
+  // NOTE(adma): connection is actually established here the first time
+  rc = curl_easy_perform(req.curl);
+
+  return finish_request(connection, &req, rc);
+}
+
+static int socket_callback(CURL *easy, curl_socket_t s, int what, void *userp,
+                           void *socketp) {
+
+  yh_backend *connection = (yh_backend *) userp;
+  size_t i;
+
+  (void) easy;
+  (void) socketp;
+
+  for (i = 0; i < connection->n_fds; i++) {
+    if (connection->fds[i].fd == (int) s) {
+      break;
+    }
+  }
+
+  if (what == CURL_POLL_REMOVE) {
+    if (i < connection->n_fds) {
+      connection->fds[i] = connection->fds[--connection->n_fds];
+    }
+    return 0;
+  }
+
+  if (i == connection->n_fds) {
+    if (connection->n_fds == connection->fds_size) {
+      size_t size = connection->fds_size ? 2 * connection->fds_size : 4;
+      yh_pollfd *fds = realloc(connection->fds, size * sizeof(yh_pollfd));
+      if (fds == NULL) {
+        DBG_ERR("%s", yh_strerror(YHR_MEMORY_ERROR));
+        return -1;
+      }
+      connection->fds = fds;
+      connection->fds_size = size;
+    }
+    connection->fds[connection->n_fds++].fd = (int) s;
+  }
+
+  connection->fds[i].events = ((what & CURL_POLL_IN) ? YH_POLLIN : 0) |
+                              ((what & CURL_POLL_OUT) ? YH_POLLOUT : 0);
+  connection->fds[i].revents = 0;
+
+  return 0;
+}
+
+static int timer_callback(CURLM *multi, long timeout_ms, void *userp) {
+
+  yh_backend *connection = (yh_backend *) userp;
+
+  (void) multi;
+
+  connection->timeout_at =
+    timeout_ms < 0 ? -1 : (long long) (thread_now_ms() + timeout_ms);
+
+  return 0;
+}
+
+static yh_rc backend_send_msg_async(yh_backend *connection, Msg *msg,
+                                    Msg *response, const char *identifier,
+                                    backend_done_cb done, void *ctx) {
+
+  struct request *req = calloc(1, sizeof(struct request));
+  if (req == NULL) {
+    DBG_ERR("%s", yh_strerror(YHR_MEMORY_ERROR));
+    return YHR_MEMORY_ERROR;
+  }
+
+  yh_rc yrc = prepare_request(connection, req, msg, response, identifier);
+  if (yrc != YHR_SUCCESS) {
+    free(req);
+    return yrc;
+  }
+
+  req->done = done;
+  req->ctx = ctx;
+  curl_easy_setopt(req->curl, CURLOPT_PRIVATE, req);
+
+  thread_mutex_lock(&connection->multi_lock);
+  if (connection->multi == NULL) {
+    connection->multi = curl_multi_init();
+    if (connection->multi != NULL) {
+#ifdef CURLPIPE_MULTIPLEX
+      curl_multi_setopt(connection->multi, CURLMOPT_PIPELINING,
+                        CURLPIPE_MULTIPLEX);
+#endif
+      curl_multi_setopt(connection->multi, CURLMOPT_SOCKETFUNCTION,
+                        socket_callback);
+      curl_multi_setopt(connection->multi, CURLMOPT_SOCKETDATA, connection);
+      curl_multi_setopt(connection->multi, CURLMOPT_TIMERFUNCTION,
+                        timer_callback);
+      curl_multi_setopt(connection->multi, CURLMOPT_TIMERDATA, connection);
+    }
+  }
+  if (connection->multi == NULL ||
+      curl_multi_add_handle(connection->multi, req->curl) != CURLM_OK) {
+    thread_mutex_unlock(&connection->multi_lock);
+    DBG_ERR("Failed to add request to the multi handle");
+    finish_request(connection, req, CURLE_FAILED_INIT);
+    free(req);
+    return YHR_CONNECTION_ERROR;
+  }
+  req->next = connection->in_flight;
+  connection->in_flight = req;
+  thread_mutex_unlock(&connection->multi_lock);
+
+  return YHR_SUCCESS;
+}
+
+static void unlink_request(yh_backend *connection, struct request *req) {
+
+  for (struct request **p = &connection->in_flight; *p; p = &(*p)->next) {
+    if (*p == req) {
+      *p = req->next;
+      break;
+    }
+  }
+  req->next = NULL;
+}
+
+static void complete_requests(yh_backend *connection, struct request *done) {
+
+  while (done != NULL) {
+    struct request *next = done->next;
+    yh_rc yrc = finish_request(connection, done, done->result);
+    done->done(done->ctx, yrc);
+    free(done);
+    done = next;
+  }
+}
+
+static void cancel_requests(yh_backend *connection) {
+
+  struct request *done;
+
+  thread_mutex_lock(&connection->multi_lock);
+  done = connection->in_flight;
+  connection->in_flight = NULL;
+  for (struct request *req = done; req != NULL; req = req->next) {
+    DBG_INFO("Cancelling request in flight");
+    curl_multi_remove_handle(connection->multi, req->curl);
+    req->result = CURLE_ABORTED_BY_CALLBACK;
+  }
+  thread_mutex_unlock(&connection->multi_lock);
+
+  complete_requests(connection, done);
+}
+
+static yh_rc backend_get_pollfds(yh_backend *connection, yh_pollfd *fds,
+                                 size_t *n_fds, int *timeout_ms) {
 
-sm_failure:
+  yh_rc yrc = YHR_SUCCESS;
 
-  if (strlen(curl_error) > 0) {
-    DBG_ERR("Curl perform failed: '%s'", curl_error);
+  thread_mutex_lock(&connection->multi_lock);
+  if (*n_fds < connection->n_fds) {
+    DBG_ERR("%s", yh_strerror(YHR_BUFFER_TOO_SMALL));
+    yrc = YHR_BUFFER_TOO_SMALL;
+  } else if (connection->n_fds > 0) {
+    memcpy(fds, connection->fds, connection->n_fds * sizeof(yh_pollfd));
+  }
+  *n_fds = connection->n_fds;
+
+  if (connection->timeout_at < 0) {
+    *timeout_ms = -1;
   } else {
-    DBG_ERR("Curl perform failed: '%s'", curl_easy_strerror(rc));
+    long long left = connection->timeout_at - (long long) thread_now_ms();
+    *timeout_ms = left < 0 ? 0 : left > INT_MAX ? INT_MAX : (int) left;
   }
+  thread_mutex_unlock(&connection->multi_lock);
 
   return yrc;
 }
 
+static yh_rc backend_process(yh_backend *connection, const yh_pollfd *fds,
+                             size_t n_fds) {
+
+  struct request *done = NULL;
+  struct request **tail = &done;
+  CURLMsg *info;
+  int running;
+  int left;
+
+  thread_mutex_lock(&connection->multi_lock);
+  if (connection->multi == NULL) {
+    thread_mutex_unlock(&connection->multi_lock);
+    return YHR_SUCCESS;
+  }
+
+  for (size_t i = 0; i < n_fds; i++) {
+    int ev = ((fds[i].revents & YH_POLLIN) ? CURL_CSELECT_IN : 0) |
+             ((fds[i].revents & YH_POLLOUT) ? CURL_CSELECT_OUT : 0) |
+             ((fds[i].revents & YH_POLLERR) ? CURL_CSELECT_ERR : 0);
+    if (ev != 0) {
+      curl_multi_socket_action(connection->multi, fds[i].fd, ev, &running);
+    }
+  }
+
+  if (n_fds == 0 || (connection->timeout_at >= 0 &&
+                     (long long) thread_now_ms() >= connection->timeout_at)) {
+    // The timer is one-shot, curl sets a new one if it needs to
+    connection->timeout_at = -1;
+    curl_multi_socket_action(connection->multi, CURL_SOCKET_TIMEOUT, 0,
+                             &running);
+  }
+
+  // Callbacks are called without the lock held, so that they can send
+  // new messages
+  while ((info = curl_multi_info_read(connection->multi, &left)) != NULL) {
+    struct request *req = NULL;
+
+    if (info->msg != CURLMSG_DONE) {
+      continue;
+    }
+    curl_easy_getinfo(info->easy_handle, CURLINFO_PRIVATE, (char **) &req);
+    req->result = info->data.result;
+    curl_multi_remove_handle(connection->multi, req->curl);
+    unlink_request(connection, req);
+    *tail = req;
+    tail = &req->next;
+  }
+  thread_mutex_unlock(&connection->multi_lock);
+
+  complete_requests(connection, done);
+
+  return YHR_SUCCESS;
+}
+
 static void backend_cleanup(void) {
   DBG_INFO("backend_cleanup");
   /* by all rights we should call curl_global_cleanup() here, but.. if curl is
@@ -217,12 +883,63 @@ static void backend_cleanup(void) {
   // curl_global_cleanup();
 }
 
+static yh_rc set_http_version(yh_backend *connection, const char *version) {
+
+  long http_version;
+
+  if (strcmp(version, "1.1") == 0) {
+    http_version = CURL_HTTP_VERSION_1_1;
+#ifdef HAVE_MULTIPLEXING
+  } else if (strcmp(version, "2") == 0) {
+    http_version = CURL_HTTP_VERSION_2TLS;
+  } else if (strcmp(version, "2-prior-knowledge") == 0) {
+    http_version = CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE;
+#endif
+  } else {
+    DBG_ERR("HTTP version '%s' is not supported", version);
+    return YHR_INVALID_PARAMETERS;
+  }
+
+  bool http2 = http_version != CURL_HTTP_VERSION_1_1;
+  if (http2 && !(curl_version_info(CURLVERSION_NOW)->features &
+                 CURL_VERSION_HTTP2)) {
+    DBG_ERR("HTTP/2 is not supported by this build of curl");
+    return YHR_CONNECTOR_ERROR;
+  }
+
+  curl_easy_setopt(connection->curl, CURLOPT_HTTP_VERSION, http_version);
+#ifdef HAVE_MULTIPLEXING
+  // Requests started together wait for the first connection, to multiplex
+  // over it instead of opening connections of their own
+  curl_easy_setopt(connection->curl, CURLOPT_PIPEWAIT, http2 ? 1L : 0L);
+  if (http2 && connection->sync_multi == NULL) {
+    connection->sync_multi = curl_multi_init();
+    if (connection->sync_multi == NULL) {
+      DBG_ERR("Failed to create a multi handle");
+      return YHR_MEMORY_ERROR;
+    }
+    curl_multi_setopt(connection->sync_multi, CURLMOPT_PIPELINING,
+                      CURLPIPE_MULTIPLEX);
+  } else if (!http2 && connection->sync_multi != NULL) {
+    curl_multi_cleanup(connection->sync_multi);
+    connection->sync_multi = NULL;
+  }
+#endif
+  connection->http2 = http2;
+  flush_idle_handles(connection);
+
+  DBG_INFO("Successfully set HTTP version %s.", version);
+  return YHR_SUCCESS;
+}
+
 static yh_rc backend_option(yh_backend *connection, yh_connector_option opt,
                             const void *val) {
   CURLoption option;
   const char *optname;
 
   switch (opt) {
+    case YH_CONNECTOR_HTTP_VERSION:
+      return set_http_version(connection, (const char *) val);
     case YH_CONNECTOR_HTTPS_CA:
       option = CURLOPT_CAINFO;
       optname = "CURLOPT_CAINFO";
@@ -247,8 +964,10 @@ static yh_rc backend_option(yh_backend *connection, yh_connector_option opt,
       DBG_ERR("%d is an unknown option", opt);
       return YHR_INVALID_PARAMETERS;
   }
-  CURLcode rc = curl_easy_setopt(connection, option, (char *) val);
+  CURLcode rc = curl_easy_setopt(connection->curl, option, (char *) val);
   if (rc == CURLE_OK) {
+    // Idle handles were duplicated without the option
+    flush_idle_handles(connection);
     DBG_INFO("Successfully set %s.", optname);
     return YHR_SUCCESS;
   } else {
@@ -260,7 +979,11 @@ static yh_rc backend_option(yh_backend *connection, yh_connector_option opt,
 static struct backend_functions f = {backend_init,     backend_create,
                                      backend_connect,  backend_disconnect,
                                      backend_send_msg, backend_cleanup,
-                                     backend_option,   backend_set_verbosity};
+                                     backend_option,   backend_set_verbosity,
+                                     backend_send_msg_async,
+                                     backend_get_pollfds,
+                                     backend_process,
+                                     backend_reconnect};
 
 #ifdef STATIC
 struct backend_functions *http_backend_functions(void) {
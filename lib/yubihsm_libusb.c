@@ -22,6 +22,7 @@
 #include "internal.h"
 #include "yubihsm_usb.h"
 #include "debug_lib.h"
+#include "../common/thread.h"
 
 #ifdef NO_LIBUSB_STRERROR
 #define libusb_strerror(x) libusb_error_name(x)
@@ -31,6 +32,7 @@ struct state {
   libusb_context *ctx;
   libusb_device_handle *handle;
   unsigned long serial;
+  thread_mutex lock;
 };
 
 void usb_set_serial(yh_backend *state, unsigned long serial) {
@@ -52,6 +54,7 @@ void usb_destroy(yh_backend **state) {
       libusb_exit((*state)->ctx);
       (*state)->ctx = NULL;
     }
+    thread_mutex_destroy(&(*state)->lock);
     free(*state);
     *state = NULL;
   }
@@ -64,11 +67,19 @@ yh_backend *backend_create(void) {
     if (libusb_init(&backend->ctx) != 0) {
       free(backend);
       backend = NULL;
+    } else if (!thread_mutex_init(&backend->lock)) {
+      libusb_exit(backend->ctx);
+      free(backend);
+      backend = NULL;
     }
   }
   return backend;
 }
 
+void usb_lock(yh_backend *state) { thread_mutex_lock(&state->lock); }
+
+void usb_unlock(yh_backend *state) { thread_mutex_unlock(&state->lock); }
+
 bool usb_open_device(yh_backend *backend) {
   libusb_device **list;
   libusb_device_handle *h = NULL;
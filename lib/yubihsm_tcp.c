@@ -0,0 +1,851 @@
+/*
+ * Copyright 2015-2018 Yubico AB
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "yubihsm.h"
+#include "internal.h"
+#include "yubihsm_tcp.h"
+#include "debug_lib.h"
+
+#include "../common/thread.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/*
+ * All messages share one connection. Senders write whole frames under the
+ * write lock, and whichever waiting thread gets there first reads responses
+ * for everybody, so that a lone synchronous caller never waits for another
+ * thread. Responses to asynchronous messages are queued for backend_process(),
+ * and the wakeup pipe makes poll() return when another thread read one.
+ */
+struct pending {
+  uint32_t id;
+  Msg *response;
+  yh_rc yrc;
+  bool done;
+  // Only set for asynchronous messages
+  backend_done_cb cb;
+  void *ctx;
+  struct pending *next;
+};
+
+struct state {
+  int fd;
+  struct sockaddr_storage addr;
+  socklen_t addr_len;
+  int timeout;
+  thread_mutex write_lock;
+  // Protects all of the below, and fd against being replaced
+  thread_mutex lock;
+  thread_cond read_done;
+  bool reading;
+  bool broken;
+  uint32_t next_id;
+  struct pending *pending;
+  size_t n_async;
+  // Completed asynchronous messages, oldest first
+  struct pending *completed;
+  struct pending **completed_tail;
+  int wakeup[2];
+  // The frame being read, which backend_process() may leave incomplete. Only
+  // used by the thread that set reading
+  struct yh_tcp_frame frame;
+  size_t frame_got;
+  struct pending *frame_for;
+};
+
+uint8_t YH_INTERNAL _yh_verbosity;
+FILE YH_INTERNAL *_yh_output;
+
+static void backend_set_verbosity(uint8_t verbosity, FILE *output) {
+  _yh_verbosity = verbosity;
+  _yh_output = output;
+}
+
+static yh_rc backend_init(uint8_t verbosity, FILE *output) {
+  DBG_INFO("backend_init");
+  backend_set_verbosity(verbosity, output);
+  return YHR_SUCCESS;
+}
+
+static bool write_all(int fd, const uint8_t *buf, size_t len) {
+
+  while (len > 0) {
+    ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n <= 0) {
+      DBG_ERR("Failed to send: %s", n < 0 ? strerror(errno) : "closed");
+      return false;
+    }
+    buf += n;
+    len -= n;
+  }
+
+  return true;
+}
+
+// Returns the number of bytes received, 0 if there were none to receive
+// without blocking, or -1 if the connection failed
+static ssize_t read_some(int fd, void *buf, size_t len, int flags) {
+
+  ssize_t n;
+
+  do {
+    n = recv(fd, buf, len, flags);
+  } while (n < 0 && errno == EINTR);
+
+  if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    return 0;
+  } else if (n <= 0) {
+    DBG_ERR("Failed to receive: %s", n < 0 ? strerror(errno) : "closed");
+    return -1;
+  }
+
+  return n;
+}
+
+static bool read_all(int fd, void *buf, size_t len) {
+
+  uint8_t *ptr = buf;
+
+  while (len > 0) {
+    ssize_t n = recv(fd, ptr, len, 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n <= 0) {
+      DBG_ERR("Failed to receive: %s", n < 0 ? strerror(errno) : "closed");
+      return false;
+    }
+    ptr += n;
+    len -= n;
+  }
+
+  return true;
+}
+
+// Returns false if fd does not get ready within timeout_ms, or forever if it
+// is negative
+static bool wait_fd(int fd, short events, int timeout_ms) {
+
+  struct pollfd pfd = {fd, events, 0};
+  int rc;
+
+  do {
+    rc = poll(&pfd, 1, timeout_ms);
+  } while (rc < 0 && errno == EINTR);
+
+  if (rc == 0) {
+    errno = ETIMEDOUT;
+  }
+
+  return rc > 0;
+}
+
+static int open_socket(yh_backend *connection) {
+
+  int one = 1;
+  int err = 0;
+  socklen_t err_len = sizeof(err);
+
+  int fd = socket(connection->addr.ss_family, SOCK_STREAM, 0);
+  if (fd < 0) {
+    DBG_ERR("Failed to create a socket: %s", strerror(errno));
+    return -1;
+  }
+
+  // Every frame is waited for, so it has to go out right away
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+#ifdef SO_NOSIGPIPE
+  setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+
+  // Connect without blocking to be able to give up after the timeout
+  int flags = fcntl(fd, F_GETFL, 0);
+  fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+  if (connect(fd, (struct sockaddr *) &connection->addr,
+              connection->addr_len) != 0) {
+    if (errno != EINPROGRESS ||
+        !wait_fd(fd, POLLOUT,
+                 connection->timeout > 0 ? connection->timeout * 1000 : -1) ||
+        getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &err_len) != 0 ||
+        err != 0) {
+      DBG_ERR("Failed to connect: %s", strerror(err != 0 ? err : errno));
+      close(fd);
+      return -1;
+    }
+  }
+  fcntl(fd, F_SETFL, flags);
+
+  return fd;
+}
+
+static void backend_disconnect(yh_backend *connection);
+
+static yh_backend *backend_create(void) {
+  DBG_INFO("backend_create");
+
+  yh_backend *connection = calloc(1, sizeof(yh_backend));
+  if (connection == NULL) {
+    return NULL;
+  }
+  connection->fd = -1;
+  connection->completed_tail = &connection->completed;
+
+  if (!thread_mutex_init(&connection->write_lock)) {
+    free(connection);
+    return NULL;
+  }
+  if (!thread_mutex_init(&connection->lock)) {
+    thread_mutex_destroy(&connection->write_lock);
+    free(connection);
+    return NULL;
+  }
+  if (!thread_cond_init(&connection->read_done)) {
+    thread_mutex_destroy(&connection->lock);
+    thread_mutex_destroy(&connection->write_lock);
+    free(connection);
+    return NULL;
+  }
+
+  if (pipe(connection->wakeup) != 0) {
+    DBG_ERR("Failed to create a pipe: %s", strerror(errno));
+    connection->wakeup[0] = connection->wakeup[1] = -1;
+    backend_disconnect(connection);
+    return NULL;
+  }
+  for (int i = 0; i < 2; i++) {
+    fcntl(connection->wakeup[i], F_SETFL,
+          fcntl(connection->wakeup[i], F_GETFL, 0) | O_NONBLOCK);
+  }
+
+  return connection;
+}
+
+static void wake_poller(yh_backend *connection) {
+
+  if (write(connection->wakeup[1], "", 1) < 0 && errno != EAGAIN) {
+    DBG_ERR("Failed to wake up: %s", strerror(errno));
+  }
+}
+
+// Called with the lock held, p no longer pending
+static void complete(yh_backend *connection, struct pending *p, yh_rc yrc) {
+
+  p->yrc = yrc;
+  if (p->cb != NULL) {
+    p->next = NULL;
+    // Only the first one needs to wake up a poller
+    if (connection->completed == NULL) {
+      wake_poller(connection);
+    }
+    *connection->completed_tail = p;
+    connection->completed_tail = &p->next;
+    connection->n_async--;
+  } else {
+    p->done = true;
+    thread_cond_broadcast(&connection->read_done);
+  }
+}
+
+// Called with the lock held
+static void fail_pending(yh_backend *connection) {
+
+  connection->frame_got = 0;
+  connection->frame_for = NULL;
+  while (connection->pending != NULL) {
+    struct pending *p = connection->pending;
+    connection->pending = p->next;
+    complete(connection, p, YHR_CONNECTION_ERROR);
+  }
+}
+
+// Called with the lock held. Messages in flight are failed by the reader if
+// there is one, since it may be reading into them
+static void set_broken(yh_backend *connection, bool reader) {
+
+  if (!connection->broken) {
+    connection->broken = true;
+    shutdown(connection->fd, SHUT_RDWR);
+  }
+  if (reader || !connection->reading) {
+    fail_pending(connection);
+  }
+}
+
+// Called with the lock held by the thread that set reading. A sender that
+// broke the connection meanwhile left the messages in flight to be failed here
+static void stop_reading(yh_backend *connection) {
+
+  connection->reading = false;
+  if (connection->broken) {
+    fail_pending(connection);
+  }
+  thread_cond_broadcast(&connection->read_done);
+}
+
+static void close_socket(yh_backend *connection) {
+
+  thread_mutex_lock(&connection->write_lock);
+  thread_mutex_lock(&connection->lock);
+  if (connection->fd >= 0) {
+    close(connection->fd);
+  }
+  connection->fd = -1;
+  connection->broken = false;
+  connection->frame_got = 0;
+  connection->frame_for = NULL;
+  thread_mutex_unlock(&connection->lock);
+  thread_mutex_unlock(&connection->write_lock);
+}
+
+static yh_rc get_status(yh_connector *connector, int fd, int timeout) {
+
+  struct yh_tcp_frame frame = {YH_TCP_FRAME_STATUS, 0, 0, 0};
+  char status[YH_TCP_MAX_STATUS + 1] = {0};
+
+  if (!write_all(fd, (const uint8_t *) &frame, sizeof(frame))) {
+    return YHR_CONNECTOR_NOT_FOUND;
+  }
+
+  if (!wait_fd(fd, POLLIN, timeout > 0 ? timeout * 1000 : -1) ||
+      !read_all(fd, &frame, sizeof(frame))) {
+    DBG_ERR("No status received: %s", strerror(errno));
+    return YHR_CONNECTOR_NOT_FOUND;
+  }
+
+  uint16_t len = ntohs(frame.len);
+  if (frame.type != YH_TCP_FRAME_STATUS || frame.tag_len != 0 ||
+      len > YH_TCP_MAX_STATUS) {
+    DBG_ERR("Unexpected status frame of type %u and length %u", frame.type,
+            len);
+    return YHR_CONNECTOR_NOT_FOUND;
+  }
+
+  if (!read_all(fd, status, len)) {
+    return YHR_CONNECTOR_NOT_FOUND;
+  }
+
+  parse_status_data(status, connector);
+
+  return YHR_SUCCESS;
+}
+
+// Resolves the relay and opens a socket to the first address that answers
+static yh_rc open_connection(yh_connector *connector, int timeout, int *fd) {
+
+  yh_backend *connection = connector->connection;
+  struct addrinfo hints = {0};
+  struct addrinfo *res = NULL;
+  char host[256];
+  char service[8];
+  uint16_t port;
+
+  if (!parse_tcp_url(connector->api_url, host, sizeof(host), &port)) {
+    DBG_ERR("Failed to parse URL: '%s'", connector->api_url);
+    return YHR_CONNECTOR_ERROR;
+  }
+  snprintf(service, sizeof(service), "%u", port);
+
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  int rc = getaddrinfo(host, service, &hints, &res);
+  if (rc != 0) {
+    DBG_ERR("Failed to resolve '%s': %s", host, gai_strerror(rc));
+    return YHR_CONNECTOR_NOT_FOUND;
+  }
+
+  close_socket(connection);
+
+  DBG_INFO("Trying to connect to %s", connector->api_url);
+
+  connection->timeout = timeout;
+  *fd = -1;
+  for (struct addrinfo *ai = res; ai != NULL && *fd < 0; ai = ai->ai_next) {
+    if (ai->ai_addrlen > sizeof(connection->addr)) {
+      continue;
+    }
+    memcpy(&connection->addr, ai->ai_addr, ai->ai_addrlen);
+    connection->addr_len = ai->ai_addrlen;
+    *fd = open_socket(connection);
+  }
+  freeaddrinfo(res);
+
+  if (*fd < 0) {
+    DBG_ERR("Failure when connecting to %s", connector->api_url);
+    return YHR_CONNECTOR_NOT_FOUND;
+  }
+
+  return YHR_SUCCESS;
+}
+
+static yh_rc backend_connect(yh_connector *connector, int timeout) {
+  DBG_INFO("backend_connect");
+
+  yh_backend *connection = connector->connection;
+  int fd;
+
+  yh_rc yrc = open_connection(connector, timeout, &fd);
+  if (yrc != YHR_SUCCESS) {
+    return yrc;
+  }
+
+  yrc = get_status(connector, fd, timeout);
+  if (yrc != YHR_SUCCESS) {
+    close(fd);
+    return yrc;
+  }
+
+  if (!connector->has_device) {
+    DBG_ERR("Failure when connecting: Connector has no device");
+    close(fd);
+    return YHR_CONNECTOR_NOT_FOUND;
+  }
+
+  thread_mutex_lock(&connection->lock);
+  connection->fd = fd;
+  thread_mutex_unlock(&connection->lock);
+
+  DBG_INFO("Found working connector");
+
+  return YHR_SUCCESS;
+}
+
+static yh_rc backend_reconnect(yh_connector *connector, int timeout) {
+  DBG_INFO("backend_reconnect");
+
+  yh_backend *connection = connector->connection;
+  int fd;
+
+  // Keep using a connection that is still up
+  thread_mutex_lock(&connection->lock);
+  bool open = connection->fd >= 0 && !connection->broken;
+  if (open) {
+    connection->timeout = timeout;
+  }
+  thread_mutex_unlock(&connection->lock);
+  if (open) {
+    return YHR_SUCCESS;
+  }
+
+  yh_rc yrc = open_connection(connector, timeout, &fd);
+  if (yrc != YHR_SUCCESS) {
+    return yrc;
+  }
+
+  thread_mutex_lock(&connection->lock);
+  connection->fd = fd;
+  thread_mutex_unlock(&connection->lock);
+
+  return YHR_SUCCESS;
+}
+
+static void deliver(struct pending *done) {
+
+  while (done != NULL) {
+    struct pending *next = done->next;
+    done->cb(done->ctx, done->yrc);
+    free(done);
+    done = next;
+  }
+}
+
+static void backend_disconnect(yh_backend *connection) {
+  DBG_INFO("backend_disconnect");
+
+  if (connection == NULL) {
+    return;
+  }
+
+  thread_mutex_lock(&connection->lock);
+  fail_pending(connection);
+  struct pending *done = connection->completed;
+  connection->completed = NULL;
+  connection->completed_tail = &connection->completed;
+  thread_mutex_unlock(&connection->lock);
+  deliver(done);
+
+  if (connection->fd >= 0) {
+    close(connection->fd);
+  }
+  for (int i = 0; i < 2; i++) {
+    if (connection->wakeup[i] >= 0) {
+      close(connection->wakeup[i]);
+    }
+  }
+
+  thread_cond_destroy(&connection->read_done);
+  thread_mutex_destroy(&connection->lock);
+  thread_mutex_destroy(&connection->write_lock);
+  free(connection);
+}
+
+// Called with the write lock held. The connection is opened again once the
+// messages that were in flight when it broke have been failed
+static yh_rc ensure_connected(yh_backend *connection) {
+
+  thread_mutex_lock(&connection->lock);
+  if (connection->broken) {
+    if (connection->reading || connection->pending != NULL) {
+      thread_mutex_unlock(&connection->lock);
+      return YHR_CONNECTION_ERROR;
+    }
+    close(connection->fd);
+    connection->fd = -1;
+    connection->broken = false;
+  }
+  int fd = connection->fd;
+  thread_mutex_unlock(&connection->lock);
+
+  if (fd < 0) {
+    if (connection->addr_len == 0) {
+      DBG_ERR("Not connected");
+      return YHR_CONNECTION_ERROR;
+    }
+    DBG_INFO("Reconnecting");
+    fd = open_socket(connection);
+    if (fd < 0) {
+      return YHR_CONNECTION_ERROR;
+    }
+    thread_mutex_lock(&connection->lock);
+    connection->fd = fd;
+    thread_mutex_unlock(&connection->lock);
+  }
+
+  return YHR_SUCCESS;
+}
+
+// Unless an error is returned, p is pending or completed when this returns
+static yh_rc send_frame(yh_backend *connection, struct pending *p, Msg *msg,
+                        const char *identifier) {
+
+  uint8_t buf[sizeof(struct yh_tcp_frame) + YH_TCP_MAX_TAG + sizeof(msg->raw)];
+  size_t msg_len = 3 + ntohs(msg->st.len);
+  size_t tag_len = identifier != NULL ? strlen(identifier) : 0;
+
+  if (tag_len > YH_TCP_MAX_TAG) {
+    tag_len = 0;
+  }
+
+  thread_mutex_lock(&connection->write_lock);
+  yh_rc yrc = ensure_connected(connection);
+  if (yrc != YHR_SUCCESS) {
+    thread_mutex_unlock(&connection->write_lock);
+    return yrc;
+  }
+
+  thread_mutex_lock(&connection->lock);
+  p->id = connection->next_id++;
+  p->next = connection->pending;
+  connection->pending = p;
+  if (p->cb != NULL) {
+    connection->n_async++;
+  }
+  int fd = connection->fd;
+  thread_mutex_unlock(&connection->lock);
+
+  struct yh_tcp_frame frame = {YH_TCP_FRAME_MSG, tag_len, htons(msg_len),
+                               htonl(p->id)};
+  memcpy(buf, &frame, sizeof(frame));
+  if (tag_len > 0) {
+    memcpy(buf + sizeof(frame), identifier, tag_len);
+  }
+  memcpy(buf + sizeof(frame) + tag_len, msg->raw, msg_len);
+
+  if (!write_all(fd, buf, sizeof(frame) + tag_len + msg_len)) {
+    thread_mutex_lock(&connection->lock);
+    set_broken(connection, false);
+    thread_mutex_unlock(&connection->lock);
+  }
+  thread_mutex_unlock(&connection->write_lock);
+
+  return YHR_SUCCESS;
+}
+
+static yh_rc check_response(Msg *response, size_t size) {
+
+  if (size < 3) {
+    DBG_ERR("Not enough data received: %zu", size);
+    return YHR_WRONG_LENGTH;
+  }
+
+  if (ntohs(response->st.len) != size - 3) {
+    DBG_ERR("Wrong length received, %d vs %zu", ntohs(response->st.len),
+            size);
+    return YHR_WRONG_LENGTH;
+  }
+
+  return YHR_SUCCESS;
+}
+
+enum read_result { READ_DONE, READ_PARTIAL, READ_BROKEN };
+
+/*
+ * Reads one response, only called by the thread that set reading. With
+ * MSG_DONTWAIT, returns READ_PARTIAL once there is nothing more to read and
+ * keeps what was read of the frame for the next call
+ */
+static enum read_result read_response(yh_backend *connection, int fd,
+                                      int flags) {
+
+  struct yh_tcp_frame *frame = &connection->frame;
+  struct pending *p = connection->frame_for;
+  yh_rc yrc = YHR_SUCCESS;
+  ssize_t n;
+
+  while (connection->frame_got < sizeof(*frame)) {
+    n = read_some(fd, (uint8_t *) frame + connection->frame_got,
+                  sizeof(*frame) - connection->frame_got, flags);
+    if (n <= 0) {
+      goto incomplete;
+    }
+    connection->frame_got += n;
+  }
+
+  uint16_t len = ntohs(frame->len);
+  uint32_t id = ntohl(frame->id);
+
+  if (p == NULL) {
+    // Nobody else removes pending messages while reading is set
+    thread_mutex_lock(&connection->lock);
+    for (p = connection->pending; p != NULL && p->id != id; p = p->next) {
+    }
+    thread_mutex_unlock(&connection->lock);
+
+    if (p == NULL || frame->tag_len != 0 || len > sizeof(p->response->raw) ||
+        (frame->type != YH_TCP_FRAME_MSG &&
+         (frame->type != YH_TCP_FRAME_ERROR || len != 0))) {
+      DBG_ERR("Unexpected frame of type %u and length %u for message %u",
+              frame->type, len, id);
+      goto broken;
+    }
+    connection->frame_for = p;
+  }
+
+  while (connection->frame_got < sizeof(*frame) + len) {
+    size_t got = connection->frame_got - sizeof(*frame);
+    n = read_some(fd, p->response->raw + got, len - got, flags);
+    if (n <= 0) {
+      goto incomplete;
+    }
+    connection->frame_got += n;
+  }
+
+  if (frame->type == YH_TCP_FRAME_MSG) {
+    yrc = check_response(p->response, len);
+  } else {
+    DBG_ERR("The relay failed to pass on message %u", id);
+    yrc = YHR_CONNECTION_ERROR;
+  }
+  connection->frame_got = 0;
+  connection->frame_for = NULL;
+
+  thread_mutex_lock(&connection->lock);
+  for (struct pending **q = &connection->pending; *q; q = &(*q)->next) {
+    if (*q == p) {
+      *q = p->next;
+      break;
+    }
+  }
+  complete(connection, p, yrc);
+  thread_mutex_unlock(&connection->lock);
+
+  return READ_DONE;
+
+incomplete:
+  if (n == 0) {
+    return READ_PARTIAL;
+  }
+
+broken:
+  thread_mutex_lock(&connection->lock);
+  set_broken(connection, true);
+  thread_mutex_unlock(&connection->lock);
+
+  return READ_BROKEN;
+}
+
+static yh_rc backend_send_msg(yh_backend *connection, Msg *msg, Msg *response,
+                              const char *identifier) {
+
+  struct pending p = {0};
+  p.response = response;
+
+  yh_rc yrc = send_frame(connection, &p, msg, identifier);
+  if (yrc != YHR_SUCCESS) {
+    return yrc;
+  }
+
+  thread_mutex_lock(&connection->lock);
+  while (!p.done) {
+    if (connection->reading) {
+      thread_cond_wait(&connection->read_done, &connection->lock, -1);
+      continue;
+    }
+    connection->reading = true;
+    int fd = connection->fd;
+    thread_mutex_unlock(&connection->lock);
+
+    read_response(connection, fd, 0);
+
+    thread_mutex_lock(&connection->lock);
+    stop_reading(connection);
+    // The socket was left out of backend_get_pollfds() while reading
+    if (connection->n_async > 0) {
+      wake_poller(connection);
+    }
+  }
+  thread_mutex_unlock(&connection->lock);
+
+  return p.yrc;
+}
+
+static yh_rc backend_send_msg_async(yh_backend *connection, Msg *msg,
+                                    Msg *response, const char *identifier,
+                                    backend_done_cb done, void *ctx) {
+
+  struct pending *p = calloc(1, sizeof(struct pending));
+  if (p == NULL) {
+    DBG_ERR("Failed to allocate a message");
+    return YHR_MEMORY_ERROR;
+  }
+  p->response = response;
+  p->cb = done;
+  p->ctx = ctx;
+
+  yh_rc yrc = send_frame(connection, p, msg, identifier);
+  if (yrc != YHR_SUCCESS) {
+    free(p);
+  }
+
+  return yrc;
+}
+
+static yh_rc backend_get_pollfds(yh_backend *connection, yh_pollfd *fds,
+                                 size_t *n_fds, int *timeout_ms) {
+
+  yh_rc yrc = YHR_SUCCESS;
+  size_t n = 0;
+
+  thread_mutex_lock(&connection->lock);
+  if (connection->n_async > 0 || connection->completed != NULL) {
+    // The socket is only polled when there is no reader to race with
+    n = connection->n_async > 0 && !connection->broken && !connection->reading
+          ? 2
+          : 1;
+  }
+  if (*n_fds < n) {
+    DBG_ERR("%s", yh_strerror(YHR_BUFFER_TOO_SMALL));
+    yrc = YHR_BUFFER_TOO_SMALL;
+  } else if (n > 0) {
+    fds[0].fd = connection->wakeup[0];
+    fds[0].events = YH_POLLIN;
+    fds[0].revents = 0;
+    if (n > 1) {
+      fds[1].fd = connection->fd;
+      fds[1].events = YH_POLLIN;
+      fds[1].revents = 0;
+    }
+  }
+  *n_fds = n;
+  *timeout_ms = connection->completed != NULL ? 0 : -1;
+  thread_mutex_unlock(&connection->lock);
+
+  return yrc;
+}
+
+static yh_rc backend_process(yh_backend *connection, const yh_pollfd *fds,
+                             size_t n_fds) {
+
+  char drain[64];
+
+  (void) fds;
+  (void) n_fds;
+
+  while (read(connection->wakeup[0], drain, sizeof(drain)) > 0) {
+  }
+
+  // Only read what has arrived, a synchronous sender may be reading already
+  thread_mutex_lock(&connection->lock);
+  if (!connection->reading && !connection->broken && connection->n_async > 0) {
+    connection->reading = true;
+    int fd = connection->fd;
+    while (connection->n_async > 0) {
+      thread_mutex_unlock(&connection->lock);
+      enum read_result rr = read_response(connection, fd, MSG_DONTWAIT);
+      thread_mutex_lock(&connection->lock);
+      if (rr != READ_DONE) {
+        break;
+      }
+    }
+    stop_reading(connection);
+  }
+
+  // Callbacks are called without the lock held, so that they can send new
+  // messages
+  struct pending *done = connection->completed;
+  connection->completed = NULL;
+  connection->completed_tail = &connection->completed;
+  thread_mutex_unlock(&connection->lock);
+
+  deliver(done);
+
+  return YHR_SUCCESS;
+}
+
+static void backend_cleanup(void) { DBG_INFO("backend_cleanup"); }
+
+static yh_rc backend_option(yh_backend *connection, yh_connector_option opt,
+                            const void *val) {
+  (void) connection;
+  (void) opt;
+  (void) val;
+
+  DBG_ERR("Backend options not supported for TCP");
+  return YHR_CONNECTOR_ERROR;
+}
+
+static struct backend_functions f = {backend_init,     backend_create,
+                                     backend_connect,  backend_disconnect,
+                                     backend_send_msg, backend_cleanup,
+                                     backend_option,   backend_set_verbosity,
+                                     backend_send_msg_async,
+                                     backend_get_pollfds,
+                                     backend_process,
+                                     backend_reconnect};
+
+#ifdef STATIC
+struct backend_functions *tcp_backend_functions(void) {
+#else
+struct backend_functions *backend_functions(void) {
+#endif
+  return &f;
+}
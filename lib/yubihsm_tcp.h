@@ -0,0 +1,52 @@
+/*
+ * Copyright 2015-2018 Yubico AB
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef YUBIHSM_TCP_H
+#define YUBIHSM_TCP_H
+
+#include <stdint.h>
+
+/*
+ * Frames exchanged over a yhtcp:// connection. Every frame is a header, in
+ * network byte order, followed by tag_len bytes of tag and len bytes of
+ * payload. Requests are tagged with the session identifier that the HTTP
+ * backend sends as YubiHSM-Session, responses are not tagged. A response
+ * carries the id of its request, and several requests may be in flight.
+ */
+
+// Port used when a yhtcp:// URL has none
+#define YH_TCP_DEFAULT_PORT 12346
+
+// Empty request, the response payload is the text of /connector/status
+#define YH_TCP_FRAME_STATUS 0x01
+// The payload is a message to or from the device, as sent over USB
+#define YH_TCP_FRAME_MSG 0x02
+// Empty response to a message that could not be passed on to the device
+#define YH_TCP_FRAME_ERROR 0x03
+
+#define YH_TCP_MAX_TAG 32
+#define YH_TCP_MAX_STATUS 256
+
+#pragma pack(push, 1)
+struct yh_tcp_frame {
+  uint8_t type;
+  uint8_t tag_len;
+  uint16_t len;
+  uint32_t id;
+};
+#pragma pack(pop)
+
+#endif
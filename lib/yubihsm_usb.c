@@ -82,12 +82,14 @@ static yh_rc backend_send_msg(yh_backend *connection, Msg *msg, Msg *response,
 
   (void) identifier;
 
+  usb_lock(connection);
   for (int i = 0; i <= 1; i++) {
     if (ret != YHR_GENERIC_ERROR) {
       DBG_INFO("Reconnecting device");
       usb_close(connection);
       if (usb_open_device(connection) == false) {
         DBG_ERR("Failed reconnecting device");
+        usb_unlock(connection);
         return YHR_CONNECTION_ERROR;
       }
     }
@@ -106,6 +108,7 @@ static yh_rc backend_send_msg(yh_backend *connection, Msg *msg, Msg *response,
     ret = YHR_SUCCESS;
     break;
   }
+  usb_unlock(connection);
 
   if (ret != YHR_SUCCESS) {
     return ret;
@@ -140,7 +143,9 @@ static yh_rc backend_option(yh_backend *connection, yh_connector_option opt,
 static struct backend_functions f = {backend_init,     backend_create,
                                      backend_connect,  backend_disconnect,
                                      backend_send_msg, backend_cleanup,
-                                     backend_option,   backend_set_verbosity};
+                                     backend_option,   backend_set_verbosity,
+                                     NULL,             NULL,
+                                     NULL,             NULL};
 
 #ifdef STATIC
 struct backend_functions *usb_backend_functions(void) {
@@ -32,5 +32,9 @@ int YH_INTERNAL usb_write(yh_backend *state, unsigned char *buf,
 int YH_INTERNAL usb_read(yh_backend *state, unsigned char *buf,
                          long unsigned *len);
 void YH_INTERNAL usb_set_serial(yh_backend *state, unsigned long serial);
+// The device handles one command at a time, commands from different threads
+// are serialized with these
+void YH_INTERNAL usb_lock(yh_backend *state);
+void YH_INTERNAL usb_unlock(yh_backend *state);
 
 #endif
@@ -308,7 +308,9 @@ static yh_rc backend_option(yh_backend *connection, yh_connector_option opt,
 static struct backend_functions f = {backend_init,     backend_create,
                                      backend_connect,  backend_disconnect,
                                      backend_send_msg, backend_cleanup,
-                                     backend_option,   backend_set_verbosity};
+                                     backend_option,   backend_set_verbosity,
+                                     NULL,             NULL,
+                                     NULL,             NULL};
 
 #ifdef STATIC
 struct backend_functions *http_backend_functions(void) {
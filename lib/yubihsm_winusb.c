@@ -23,11 +23,13 @@
 #include "internal.h"
 #include "yubihsm_usb.h"
 #include "debug_lib.h"
+#include "../common/thread.h"
 
 struct state {
   HANDLE hDevice;
   WINUSB_INTERFACE_HANDLE hWinUSB;
   unsigned long serial;
+  thread_mutex lock;
 };
 
 // Device GUID {D1D3C87E-0574-4E38-8346-A56439234528}
@@ -254,9 +256,16 @@ out:
 yh_backend *backend_create(void) {
   DBG_INFO("backend_create");
   yh_backend *backend = calloc(1, sizeof(yh_backend));
+  if (backend) {
+    thread_mutex_init(&backend->lock);
+  }
   return backend;
 }
 
+void usb_lock(yh_backend *state) { thread_mutex_lock(&state->lock); }
+
+void usb_unlock(yh_backend *state) { thread_mutex_unlock(&state->lock); }
+
 void usb_close(yh_backend *state) {
   if (state && state->hDevice != INVALID_HANDLE_VALUE) {
     CloseHandle(state->hDevice);
@@ -271,6 +280,7 @@ void usb_close(yh_backend *state) {
 void usb_destroy(yh_backend **state) {
   if (state && *state) {
     usb_close(*state);
+    thread_mutex_destroy(&(*state)->lock);
     free(*state);
     *state = NULL;
   }
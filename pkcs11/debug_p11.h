@@ -21,6 +21,7 @@
 #include <stdlib.h>
 
 #include "../common/debug.h"
+#include "../common/usdt.h"
 
 extern int _YHP11_DBG;
 extern int _YHP11_DINOUT;
@@ -43,10 +44,27 @@ void yh_dbg_init(int dbg, int dinout, int libdbg, const char *debug_file);
     DLN(_YHP11_DBG, _YHP11_OUTPUT, ANSI_RED, "P11", "ERR", __VA_ARGS__);       \
   } while (0)
 
+#ifdef USDT_ENABLED
+static inline void usdt_function_return(const char **function) {
+  USDT1(yubihsm_pkcs11, function_return, *function);
+}
+
+// Fires function_return when the function returns, on all paths
+#define USDT_FUNCTION                                                          \
+  USDT1(yubihsm_pkcs11, function_entry, __func__);                             \
+  const char *_usdt_function                                                   \
+    __attribute__((cleanup(usdt_function_return), unused)) = __func__
+#else
+#define USDT_FUNCTION                                                          \
+  do {                                                                         \
+  } while (0)
+#endif
+
 #define DIN                                                                    \
   do {                                                                         \
     DLN(_YHP11_DINOUT, _YHP11_OUTPUT, ANSI_BLUE, "P11", "INF", ("In"));        \
-  } while (0)
+  } while (0);                                                                 \
+  USDT_FUNCTION
 
 #define DOUT                                                                   \
   do {                                                                         \
@@ -1014,22 +1014,28 @@ static CK_RV get_attribute_private_key(CK_ATTRIBUTE_TYPE type,
   return CKR_OK;
 }
 
-static bool load_public_key(yh_session *session, uint16_t id, EVP_PKEY *key) {
+static void *parse_public_key(const uint8_t *pubkey, size_t pubkey_len,
+                              yh_algorithm algo) {
 
   uint8_t data[1024];
-  size_t data_len = sizeof(data) - 1;
+  size_t data_len = pubkey_len;
 
+  EVP_PKEY *key = NULL;
   RSA *rsa = NULL;
   BIGNUM *e = NULL;
   BIGNUM *n = NULL;
   EC_KEY *ec_key = NULL;
   EC_GROUP *ec_group = NULL;
   EC_POINT *ec_point = NULL;
-  yh_algorithm algo;
 
-  yh_rc yrc = yh_util_get_public_key(session, id, data + 1, &data_len, &algo);
-  if (yrc != YHR_SUCCESS) {
-    return false;
+  if (pubkey_len > sizeof(data) - 1) {
+    return NULL;
+  }
+  memcpy(data + 1, pubkey, pubkey_len);
+
+  key = EVP_PKEY_new();
+  if (key == NULL) {
+    return NULL;
   }
 
   if (yh_is_rsa(algo)) {
@@ -1097,7 +1103,7 @@ static bool load_public_key(yh_session *session, uint16_t id, EVP_PKEY *key) {
     EC_GROUP_free(ec_group);
   }
 
-  return true;
+  return key;
 
 l_p_k_failure:
   if (ec_point != NULL) {
@@ -1116,11 +1122,37 @@ l_p_k_failure:
     RSA_free(rsa);
   }
 
-  if (key != NULL) {
-    EVP_PKEY_free(key);
+  EVP_PKEY_free(key);
+
+  return NULL;
+}
+
+static void *ref_public_key(void *key) {
+
+  EVP_PKEY_up_ref(key);
+
+  return key;
+}
+
+static void unref_public_key(void *key) {
+
+  EVP_PKEY_free(key);
+}
+
+const yh_public_key_parser public_key_parser = {parse_public_key,
+                                                ref_public_key,
+                                                unref_public_key};
+
+// The parser is set on every connector by C_Initialize
+static EVP_PKEY *load_public_key(yh_session *session, uint16_t id) {
+
+  void *key = NULL;
+
+  if (yh_util_get_public_key_parsed(session, id, &key, NULL) != YHR_SUCCESS) {
+    return NULL;
   }
 
-  return false;
+  return key;
 }
 
 static CK_RV get_attribute_public_key(CK_ATTRIBUTE_TYPE type,
@@ -1397,13 +1429,8 @@ static CK_RV get_attribute_public_key(CK_ATTRIBUTE_TYPE type,
       break;
 
     case CKA_VALUE: {
-      EVP_PKEY *pkey = EVP_PKEY_new();
+      EVP_PKEY *pkey = load_public_key(session, object->id);
       if (pkey == NULL) {
-        return CKR_FUNCTION_FAILED;
-      }
-
-      if (load_public_key(session, object->id, pkey) == false) {
-        EVP_PKEY_free(pkey);
         return CKR_ATTRIBUTE_TYPE_INVALID;
       }
 
@@ -2192,7 +2219,7 @@ CK_RV perform_verify(yh_session *session, yubihsm_pkcs11_op_info *op_info,
     return CKR_OK;
   } else {
     CK_RV rv;
-    EVP_PKEY *key = EVP_PKEY_new();
+    EVP_PKEY *key = load_public_key(session, op_info->op.verify.key_id);
     uint8_t md_data[EVP_MAX_MD_SIZE];
     uint8_t *md = md_data;
     unsigned int md_len = sizeof(md_data);
@@ -2203,11 +2230,6 @@ CK_RV perform_verify(yh_session *session, yubihsm_pkcs11_op_info *op_info,
       goto pv_failure;
     }
 
-    if (load_public_key(session, op_info->op.verify.key_id, key) == false) {
-      rv = CKR_FUNCTION_FAILED;
-      goto pv_failure;
-    }
-
     ctx = EVP_PKEY_CTX_new(key, NULL);
     if (ctx == NULL) {
       rv = CKR_FUNCTION_FAILED;
@@ -2717,9 +2739,11 @@ yubihsm_pkcs11_slot *get_slot(yubihsm_pkcs11_context *ctx, CK_ULONG id) {
   if (item) {
     yubihsm_pkcs11_slot *slot = (yubihsm_pkcs11_slot *) item->data;
     if (slot->mutex != NULL) {
+      USDT1(yubihsm_pkcs11, slot_lock_start, slot->id);
       if (ctx->lock_mutex(slot->mutex) != CKR_OK) {
         return NULL;
       }
+      USDT1(yubihsm_pkcs11, slot_lock_acquired, slot->id);
     }
     return slot;
   }
@@ -2730,6 +2754,7 @@ yubihsm_pkcs11_slot *get_slot(yubihsm_pkcs11_context *ctx, CK_ULONG id) {
 void release_slot(yubihsm_pkcs11_context *ctx, yubihsm_pkcs11_slot *slot) {
 
   if (slot->mutex != NULL) {
+    USDT1(yubihsm_pkcs11, slot_lock_release, slot->id);
     ctx->unlock_mutex(slot->mutex);
   }
 }
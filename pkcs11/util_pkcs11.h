@@ -142,4 +142,7 @@ CK_RV populate_template(int type, void *object, CK_ATTRIBUTE_PTR pTemplate,
 
 CK_RV validate_derive_key_attribute(CK_ATTRIBUTE_TYPE type, void *value);
 
+// Parses public keys into EVP_PKEYs, for yh_util_get_public_key_parsed()
+extern const yh_public_key_parser public_key_parser;
+
 #endif
@@ -31,6 +31,7 @@
 #include "yubihsm_pkcs11.h"
 #include "../common/insecure_memzero.h"
 #include "../common/parsing.h"
+#include "../common/util.h"
 
 #ifdef __WIN32
 #include <winsock.h>
@@ -86,6 +87,18 @@ static void destroy_slot_mutex(void *data) {
   slot->mutex = NULL;
 }
 
+static void dump_slot_stats(void *data) {
+  yubihsm_pkcs11_slot *slot = (yubihsm_pkcs11_slot *) data;
+  yh_connector_stats *stats = malloc(sizeof(yh_connector_stats));
+
+  if (stats != NULL && _YHP11_OUTPUT != NULL &&
+      yh_get_connector_stats(slot->connector, stats) == YHR_SUCCESS) {
+    fprintf(_YHP11_OUTPUT, "Connector %s\n", slot->connector_name);
+    print_connector_stats(_YHP11_OUTPUT, stats);
+  }
+  free(stats);
+}
+
 static bool compare_ecdh_keys(void *data, void *item) {
   if (data == NULL || item == NULL) {
     return false;
@@ -254,6 +267,37 @@ CK_DEFINE_FUNCTION(CK_RV, C_Initialize)(CK_VOID_PTR pInitArgs) {
     return CKR_FUNCTION_FAILED;
   }
 
+  if (args_info.key_cache_lifetime_arg > 0 &&
+      args_info.key_cache_size_arg > 0) {
+    unsigned int lifetime_ms =
+      (unsigned int) args_info.key_cache_lifetime_arg * 1000;
+    if (yh_set_derived_key_cache(lifetime_ms, args_info.key_cache_size_arg) !=
+        YHR_SUCCESS) {
+      DBG_ERR("Unable to set up the derived key cache, continuing without it");
+    }
+  }
+
+  if (args_info.status_cache_lifetime_arg > 0 &&
+      yh_set_connector_status_cache(
+        (unsigned int) args_info.status_cache_lifetime_arg * 1000) !=
+        YHR_SUCCESS) {
+    DBG_ERR("Unable to set up the connector status cache, continuing without "
+            "it");
+  }
+
+  if (args_info.ephemeral_key_pool_arg > 0 &&
+      yh_set_ephemeral_key_pool(args_info.ephemeral_key_pool_arg) !=
+        YHR_SUCCESS) {
+    DBG_ERR("Unable to set up the ephemeral key pool, continuing without it");
+  }
+
+  if (args_info.flight_recorder_arg > 0 &&
+      yh_set_flight_recorder(args_info.flight_recorder_arg,
+                             args_info.flight_recorder_file_arg,
+                             true) != YHR_SUCCESS) {
+    DBG_ERR("Unable to set up the flight recorder, continuing without it");
+  }
+
   DBG_INFO("Found %u configured connector(s)", args_info.connector_given);
 
   connector_list = calloc(args_info.connector_given, sizeof(yh_connector *));
@@ -303,6 +347,21 @@ CK_DEFINE_FUNCTION(CK_RV, C_Initialize)(CK_VOID_PTR pInitArgs) {
 	goto c_i_failure;
       }
     }
+    if (args_info.http_version_given) {
+      if (yh_set_connector_option(connector_list[i], YH_CONNECTOR_HTTP_VERSION,
+                                  args_info.http_version_arg) != YHR_SUCCESS) {
+        DBG_ERR("Failed to set HTTP version option");
+        goto c_i_failure;
+      }
+    }
+    if (yh_set_public_key_cache(connector_list[i],
+                                args_info.public_key_cache_arg > 0
+                                  ? args_info.public_key_cache_arg
+                                  : 0,
+                                &public_key_parser) != YHR_SUCCESS) {
+      DBG_ERR("Failed to set public key cache");
+      goto c_i_failure;
+    }
 
     if (yh_connect(connector_list[i], args_info.timeout_arg) != YHR_SUCCESS) {
       DBG_ERR("Failed to connect '%s'", args_info.connector_arg[i]);
@@ -338,6 +397,8 @@ CK_DEFINE_FUNCTION(CK_RV, C_Initialize)(CK_VOID_PTR pInitArgs) {
   DBG_INFO("Found %d configured device public key(s)",
            g_ctx.device_pubkeys.length);
 
+  g_ctx.dump_stats = args_info.stats_flag;
+
   g_yh_initialized = true;
 
   DOUT;
@@ -383,6 +444,9 @@ CK_DEFINE_FUNCTION(CK_RV, C_Finalize)(CK_VOID_PTR pReserved) {
     return CKR_CRYPTOKI_NOT_INITIALIZED;
   }
 
+  if (g_ctx.dump_stats) {
+    list_iterate(&g_ctx.slots, dump_slot_stats);
+  }
   list_iterate(&g_ctx.slots, destroy_slot_mutex);
   list_destroy(&g_ctx.slots);
   list_destroy(&g_ctx.device_pubkeys);
@@ -1186,38 +1250,56 @@ CK_DEFINE_FUNCTION(CK_RV, C_Login)
       goto c_l_out;
     }
 
-    yrc = yh_util_get_device_pubkey(session->slot->connector, pk_sd, &pk_sd_len,
-                                    NULL);
-    if (yrc != YHR_SUCCESS) {
-      DBG_ERR("Failed to get device public key: %s", yh_strerror(yrc));
-      rv = CKR_FUNCTION_FAILED;
-      goto c_l_out;
-    }
+    bool cached_pubkey = session->slot->has_device_pubkey;
 
-    if (pk_sd_len != YH_EC_P256_PUBKEY_LEN) {
-      DBG_ERR("Invalid device public key");
-      rv = CKR_FUNCTION_FAILED;
-      goto c_l_out;
-    }
+  retry_asym:
+    if (session->slot->has_device_pubkey) {
+      memcpy(pk_sd, session->slot->device_pubkey, sizeof(pk_sd));
+    } else {
+      yrc = yh_util_get_device_pubkey(session->slot->connector, pk_sd,
+                                      &pk_sd_len, NULL);
+      if (yrc != YHR_SUCCESS) {
+        DBG_ERR("Failed to get device public key: %s", yh_strerror(yrc));
+        rv = CKR_FUNCTION_FAILED;
+        goto c_l_out;
+      }
 
-    int hits = 0;
+      if (pk_sd_len != YH_EC_P256_PUBKEY_LEN) {
+        DBG_ERR("Invalid device public key");
+        rv = CKR_FUNCTION_FAILED;
+        goto c_l_out;
+      }
+
+      int hits = 0;
 
-    for (ListItem *item = g_ctx.device_pubkeys.head; item != NULL;
-         item = item->next) {
-      if (!memcmp(item->data, pk_sd, YH_EC_P256_PUBKEY_LEN)) {
-        hits++;
+      for (ListItem *item = g_ctx.device_pubkeys.head; item != NULL;
+           item = item->next) {
+        if (!memcmp(item->data, pk_sd, YH_EC_P256_PUBKEY_LEN)) {
+          hits++;
+        }
       }
-    }
 
-    if (g_ctx.device_pubkeys.length > 0 && hits == 0) {
-      DBG_ERR("Failed to validate device public key");
-      rv = CKR_FUNCTION_FAILED;
-      goto c_l_out;
+      if (g_ctx.device_pubkeys.length > 0 && hits == 0) {
+        DBG_ERR("Failed to validate device public key");
+        rv = CKR_FUNCTION_FAILED;
+        goto c_l_out;
+      }
+
+      memcpy(session->slot->device_pubkey, pk_sd, sizeof(pk_sd));
+      session->slot->has_device_pubkey = true;
     }
 
     yrc = yh_create_session_asym(session->slot->connector, key_id, sk_oce,
-                                 sizeof(sk_oce), pk_sd, pk_sd_len,
+                                 sizeof(sk_oce), pk_sd, sizeof(pk_sd),
                                  &session->slot->device_session);
+    if (yrc == YHR_SESSION_AUTHENTICATION_FAILED && cached_pubkey) {
+      // The device behind the connector may have been replaced
+      DBG_INFO("Asymmetric session failed with the cached device public key, "
+               "fetching it again");
+      session->slot->has_device_pubkey = false;
+      cached_pubkey = false;
+      goto retry_asym;
+    }
     if (yrc != YHR_SUCCESS) {
       DBG_ERR("Failed to create asymmetric session: %s", yh_strerror(yrc));
       if (yrc == YHR_SESSION_AUTHENTICATION_FAILED) {
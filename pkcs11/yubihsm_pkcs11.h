@@ -146,6 +146,8 @@ typedef struct {
 typedef struct {
   List slots;
   List device_pubkeys;
+  // Print connector statistics when finalized
+  bool dump_stats;
   CK_CREATEMUTEX create_mutex;
   CK_DESTROYMUTEX destroy_mutex;
   CK_LOCKMUTEX lock_mutex;
@@ -163,6 +165,9 @@ typedef struct {
   yubihsm_pkcs11_object_desc objects[YH_MAX_ITEMS_COUNT];
   yh_algorithm algorithms[YH_MAX_ALGORITHM_COUNT];
   size_t n_algorithms;
+  // Validated public key of the device, fetched on the first asymmetric login
+  uint8_t device_pubkey[YH_EC_P256_PUBKEY_LEN];
+  bool has_device_pubkey;
   void *mutex;
 } yubihsm_pkcs11_slot;
 
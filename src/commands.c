@@ -49,6 +49,15 @@
 #define gettimeofday(a, b) gettimeofday_win(a)
 #endif
 
+#ifdef __WIN32
+#include <io.h>
+#define fseeko _fseeki64
+#define ftello _ftelli64
+#define fsync _commit
+#else
+#include <errno.h>
+#endif
+
 static format_t fmt_to_fmt(cmd_format fmt) {
   switch (fmt) {
     case fmt_base64:
@@ -64,6 +73,31 @@ static format_t fmt_to_fmt(cmd_format fmt) {
   }
 }
 
+static void print_log_entry_hex(FILE *out, const yh_log_entry *entry) {
+
+  char digest_buf[(2 * YH_LOG_DIGEST_SIZE) + 1];
+
+  format_digest(entry->digest, digest_buf, YH_LOG_DIGEST_SIZE);
+  fprintf(out, "%04x%02x%04x%04x%04x%04x%02x%08lx%s", entry->number,
+          entry->command, entry->length, entry->session_key, entry->target_key,
+          entry->second_key, entry->result, (unsigned long) entry->systick,
+          digest_buf);
+}
+
+static void print_log_entry(FILE *out, const yh_log_entry *entry) {
+
+  char digest_buf[(2 * YH_LOG_DIGEST_SIZE) + 1];
+
+  format_digest(entry->digest, digest_buf, YH_LOG_DIGEST_SIZE);
+  fprintf(out,
+          "item: %5u -- cmd: 0x%02x -- length: %4u -- session key: "
+          "0x%04x -- target key: 0x%04x -- second key: 0x%04x -- "
+          "result: 0x%02x -- tick: %lu -- hash: %s\n",
+          entry->number, entry->command, entry->length, entry->session_key,
+          entry->target_key, entry->second_key, entry->result,
+          (unsigned long) entry->systick, digest_buf);
+}
+
 // NOTE(adma): Extract log entries
 // argc = 1
 // arg 0: e:session
@@ -102,17 +136,11 @@ int yh_com_audit(yubihsm_context *ctx, Argument *argv, cmd_format in_fmt,
     return -1;
   }
 
-  char digest_buf[(2 * YH_LOG_DIGEST_SIZE) + 1];
-
   switch (fmt) {
     case fmt_hex:
       fprintf(ctx->out, "%04x%04x", unlogged_boot, unlogged_auth);
       for (size_t i = 0; i < n_items; i++) {
-        format_digest(logs[i].digest, digest_buf, YH_LOG_DIGEST_SIZE);
-        fprintf(ctx->out, "%04x%02x%04x%04x%04x%04x%02x%08lx%s", logs[i].number,
-                logs[i].command, logs[i].length, logs[i].session_key,
-                logs[i].target_key, logs[i].second_key, logs[i].result,
-                (unsigned long) logs[i].systick, digest_buf);
+        print_log_entry_hex(ctx->out, &logs[i]);
       }
       fprintf(ctx->out, "\n");
       break;
@@ -132,14 +160,7 @@ int yh_com_audit(yubihsm_context *ctx, Argument *argv, cmd_format in_fmt,
       }
 
       for (size_t i = 0; i < n_items; i++) {
-        format_digest(logs[i].digest, digest_buf, YH_LOG_DIGEST_SIZE);
-        fprintf(ctx->out,
-                "item: %5u -- cmd: 0x%02x -- length: %4u -- session key: "
-                "0x%04x -- target key: 0x%04x -- second key: 0x%04x -- "
-                "result: 0x%02x -- tick: %lu -- hash: %s\n",
-                logs[i].number, logs[i].command, logs[i].length,
-                logs[i].session_key, logs[i].target_key, logs[i].second_key,
-                logs[i].result, (unsigned long) logs[i].systick, digest_buf);
+        print_log_entry(ctx->out, &logs[i]);
       }
       break;
   }
@@ -167,6 +188,158 @@ int yh_com_set_log_index(yubihsm_context *ctx, Argument *argv,
   return 0;
 }
 
+// Entries are stored one per line, as printed by print_log_entry_hex(): 16
+// bytes of fields and the digest in hex, then a newline
+#define AUDIT_LINE_LEN (2 * 16 + 2 * YH_LOG_DIGEST_SIZE + 1)
+
+typedef struct {
+  FILE *file;
+  FILE *out;
+} audit_store;
+
+static bool parse_log_entry(const char *line, yh_log_entry *entry) {
+
+  unsigned int number, command, length, session_key, target_key, second_key,
+    result;
+  unsigned long systick;
+  char digest[(2 * YH_LOG_DIGEST_SIZE) + 1];
+  size_t digest_len = sizeof(entry->digest);
+
+  if (sscanf(line, "%4x%2x%4x%4x%4x%4x%2x%8lx%32[0-9a-f]", &number, &command,
+             &length, &session_key, &target_key, &second_key, &result,
+             &systick, digest) != 9 ||
+      strlen(digest) != 2 * YH_LOG_DIGEST_SIZE ||
+      !hex_decode(digest, entry->digest, &digest_len)) {
+    return false;
+  }
+
+  entry->number = (uint16_t) number;
+  entry->command = (uint8_t) command;
+  entry->length = (uint16_t) length;
+  entry->session_key = (uint16_t) session_key;
+  entry->target_key = (uint16_t) target_key;
+  entry->second_key = (uint16_t) second_key;
+  entry->result = (uint8_t) result;
+  entry->systick = (uint32_t) systick;
+
+  return true;
+}
+
+/*
+ * Continue the chain from the last entry stored in the file, if any
+ */
+static bool load_log_chain(FILE *file, yh_log_chain *chain) {
+
+  char line[AUDIT_LINE_LEN + 1];
+
+  chain->started = false;
+
+  if (fseeko(file, 0, SEEK_END) != 0) {
+    return false;
+  }
+  int64_t size = ftello(file);
+  if (size == 0) {
+    return true;
+  } else if (size < 0 || size % AUDIT_LINE_LEN != 0) {
+    return false;
+  }
+
+  if (fseeko(file, size - AUDIT_LINE_LEN, SEEK_SET) != 0 ||
+      fread(line, 1, AUDIT_LINE_LEN, file) != AUDIT_LINE_LEN ||
+      line[AUDIT_LINE_LEN - 1] != '\n') {
+    return false;
+  }
+  line[AUDIT_LINE_LEN - 1] = '\0';
+  chain->started = parse_log_entry(line, &chain->last);
+
+  return chain->started;
+}
+
+static bool store_log_entries(void *user, const yh_log_entry *entries,
+                              size_t n_entries) {
+
+  audit_store *store = (audit_store *) user;
+
+  for (size_t i = 0; i < n_entries; i++) {
+    print_log_entry_hex(store->file, &entries[i]);
+    fputc('\n', store->file);
+  }
+  if (fflush(store->file) != 0 || fsync(fileno(store->file)) != 0) {
+    return false;
+  }
+
+  for (size_t i = 0; i < n_entries; i++) {
+    print_log_entry(store->out, &entries[i]);
+  }
+  fflush(store->out);
+
+  return true;
+}
+
+static void sleep_ms(unsigned long ms) {
+
+#ifdef __WIN32
+  Sleep(ms);
+#else
+  struct timespec ts = {ms / 1000, (ms % 1000) * 1000000};
+  while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+  }
+#endif
+}
+
+// NOTE: Drain the audit log into a file, continuing from its last entry
+// argc = 4
+// arg 0: e:session
+// arg 1: s:file
+// arg 2: u:interval
+// arg 3: u:count
+int yh_com_audit_follow(yubihsm_context *ctx, Argument *argv,
+                        cmd_format in_fmt, cmd_format fmt) {
+
+  yh_log_chain chain;
+  int ret = 0;
+
+  UNUSED(in_fmt);
+  UNUSED(fmt);
+
+  FILE *file = fopen(argv[1].s, "ab+");
+  if (file == NULL) {
+    fprintf(stderr, "Failed to open %s\n", argv[1].s);
+    return -1;
+  }
+
+  if (!load_log_chain(file, &chain)) {
+    fprintf(stderr, "Failed to read the last log entry from %s\n", argv[1].s);
+    fclose(file);
+    return -1;
+  }
+
+  audit_store store = {file, ctx->out};
+  // A count of 0 drains until interrupted
+  for (unsigned long i = 0; argv[3].d == 0 || i < argv[3].d; i++) {
+    size_t n_drained = 0;
+    yh_rc yrc = yh_util_drain_log_entries(argv[0].e, &chain,
+                                          store_log_entries, &store,
+                                          &n_drained);
+    if (yrc != YHR_SUCCESS) {
+      fprintf(stderr, "Failed to drain logs: %s\n", yh_strerror(yrc));
+      ret = -1;
+      break;
+    }
+    // Keep up with a busy device
+    if (n_drained < YH_MAX_LOG_ENTRIES / 2 && i + 1 != argv[3].d) {
+      sleep_ms(argv[2].d);
+    }
+  }
+
+  if (fclose(file) != 0) {
+    fprintf(stderr, "Failed to close %s\n", argv[1].s);
+    ret = -1;
+  }
+
+  return ret;
+}
+
 // NOTE: Blink the device
 // argc = 2
 // arg 0: e:session
@@ -570,6 +743,188 @@ int yh_com_encrypt_aesccm(yubihsm_context *ctx, Argument *argv,
   return 0;
 }
 
+typedef struct {
+  FILE *in;
+  FILE *out;
+} envelope_files;
+
+static yh_rc envelope_read(void *user, uint8_t *buf, size_t *len) {
+
+  envelope_files *files = (envelope_files *) user;
+
+  *len = fread(buf, 1, *len, files->in);
+
+  return ferror(files->in) ? YHR_GENERIC_ERROR : YHR_SUCCESS;
+}
+
+static yh_rc envelope_read_at(void *user, uint64_t offset, uint8_t *buf,
+                              size_t len) {
+
+  envelope_files *files = (envelope_files *) user;
+
+  if (fseeko(files->in, offset, SEEK_SET) != 0 ||
+      fread(buf, 1, len, files->in) != len) {
+    return YHR_GENERIC_ERROR;
+  }
+
+  return YHR_SUCCESS;
+}
+
+static yh_rc envelope_write(void *user, const uint8_t *buf, size_t len) {
+
+  envelope_files *files = (envelope_files *) user;
+
+  if (fwrite(buf, 1, len, files->out) != len) {
+    return YHR_GENERIC_ERROR;
+  }
+
+  return YHR_SUCCESS;
+}
+
+static yh_session_pool *open_envelope_pool(yubihsm_context *ctx,
+                                           uint16_t authkey,
+                                           Argument *password,
+                                           unsigned long sessions) {
+
+  yh_session_pool *pool = NULL;
+
+  if (ctx->connector == NULL) {
+    fprintf(stderr, "Not connected\n");
+    return NULL;
+  }
+
+  yh_rc yrc =
+    yh_create_session_pool_derived(ctx->connector, authkey, password->x,
+                                   password->len, sessions, &pool);
+  insecure_memzero(password->x, password->len);
+  if (yrc != YHR_SUCCESS) {
+    fprintf(stderr, "Failed to create session pool: %s\n", yh_strerror(yrc));
+    return NULL;
+  }
+
+  return pool;
+}
+
+static bool open_envelope_files(envelope_files *files, const char *in,
+                                const char *out) {
+
+  files->in = fopen(in, "rb");
+  if (files->in == NULL) {
+    fprintf(stderr, "Unable to open file %s\n", in);
+    return false;
+  }
+
+  files->out = fopen(out, "wb");
+  if (files->out == NULL) {
+    fprintf(stderr, "Unable to open file %s\n", out);
+    fclose(files->in);
+    return false;
+  }
+
+  return true;
+}
+
+static int close_envelope_files(envelope_files *files, const char *out) {
+
+  int ret = 0;
+
+  fclose(files->in);
+  if (fclose(files->out) != 0) {
+    fprintf(stderr, "Failed to write %s\n", out);
+    ret = -1;
+  }
+
+  return ret;
+}
+
+// NOTE: Decrypt a file wrapped in an envelope, from a given chunk on
+// argc = 7
+// arg 0: w:authkey
+// arg 1: u:sessions
+// arg 2: s:infile
+// arg 3: s:outfile
+// arg 4: u:first
+// arg 5: u:count
+// arg 6: i:password
+int yh_com_decrypt_envelope(yubihsm_context *ctx, Argument *argv,
+                            cmd_format in_fmt, cmd_format fmt) {
+
+  envelope_files files;
+
+  UNUSED(in_fmt);
+  UNUSED(fmt);
+
+  yh_session_pool *pool =
+    open_envelope_pool(ctx, argv[0].w, &argv[6], argv[1].d);
+  if (pool == NULL) {
+    return -1;
+  }
+
+  if (!open_envelope_files(&files, argv[2].s, argv[3].s)) {
+    yh_destroy_session_pool(&pool);
+    return -1;
+  }
+
+  yh_rc yrc = YHR_GENERIC_ERROR;
+  if (fseeko(files.in, 0, SEEK_END) == 0) {
+    int64_t size = ftello(files.in);
+    if (size >= 0) {
+      yrc = yh_util_unwrap_envelope(pool, envelope_read_at, size, argv[4].d,
+                                    argv[5].d, envelope_write, &files);
+    }
+  }
+  yh_destroy_session_pool(&pool);
+
+  int ret = close_envelope_files(&files, argv[3].s);
+  if (yrc != YHR_SUCCESS) {
+    fprintf(stderr, "Failed to decrypt envelope: %s\n", yh_strerror(yrc));
+    return -1;
+  }
+
+  return ret;
+}
+
+// NOTE: Encrypt a file of any size into an envelope, spreading the chunks over
+// a pool of sessions
+// argc = 6
+// arg 0: w:authkey
+// arg 1: u:sessions
+// arg 2: w:key_id
+// arg 3: s:infile
+// arg 4: s:outfile
+// arg 5: i:password
+int yh_com_encrypt_envelope(yubihsm_context *ctx, Argument *argv,
+                            cmd_format in_fmt, cmd_format fmt) {
+
+  envelope_files files;
+
+  UNUSED(in_fmt);
+  UNUSED(fmt);
+
+  yh_session_pool *pool =
+    open_envelope_pool(ctx, argv[0].w, &argv[5], argv[1].d);
+  if (pool == NULL) {
+    return -1;
+  }
+
+  if (!open_envelope_files(&files, argv[3].s, argv[4].s)) {
+    yh_destroy_session_pool(&pool);
+    return -1;
+  }
+
+  yh_rc yrc = yh_util_wrap_envelope(pool, argv[2].w, 0, envelope_read,
+                                    envelope_write, &files);
+  yh_destroy_session_pool(&pool);
+
+  int ret = close_envelope_files(&files, argv[4].s);
+  if (yrc != YHR_SUCCESS) {
+    fprintf(stderr, "Failed to encrypt envelope: %s\n", yh_strerror(yrc));
+    return -1;
+  }
+
+  return ret;
+}
+
 // NOTE(adma): Disconnect from a connector
 // argc = 0
 int yh_com_disconnect(yubihsm_context *ctx, Argument *argv, cmd_format in_fmt,
@@ -2984,6 +3339,212 @@ int yh_com_benchmark(yubihsm_context *ctx, Argument *argv, cmd_format in_fmt,
   return 0;
 }
 
+// NOTE: Print the statistics of the connector
+// argc = 0
+int yh_com_stats_get(yubihsm_context *ctx, Argument *argv, cmd_format in_fmt,
+                     cmd_format fmt) {
+
+  UNUSED(argv);
+  UNUSED(in_fmt);
+  UNUSED(fmt);
+
+  if (ctx->connector == NULL) {
+    fprintf(stderr, "Not connected\n");
+    return -1;
+  }
+
+  yh_connector_stats *stats = malloc(sizeof(yh_connector_stats));
+  if (stats == NULL) {
+    fprintf(stderr, "Failed to allocate memory\n");
+    return -1;
+  }
+
+  yh_rc yrc = yh_get_connector_stats(ctx->connector, stats);
+  if (yrc != YHR_SUCCESS) {
+    fprintf(stderr, "Failed to get connector statistics: %s\n",
+            yh_strerror(yrc));
+    free(stats);
+    return -1;
+  }
+
+  print_connector_stats(ctx->out, stats);
+  free(stats);
+
+  return 0;
+}
+
+// NOTE: Reset the statistics of the connector
+// argc = 0
+int yh_com_stats_reset(yubihsm_context *ctx, Argument *argv,
+                       cmd_format in_fmt, cmd_format fmt) {
+
+  UNUSED(argv);
+  UNUSED(in_fmt);
+  UNUSED(fmt);
+
+  if (ctx->connector == NULL) {
+    fprintf(stderr, "Not connected\n");
+    return -1;
+  }
+
+  yh_rc yrc = yh_reset_connector_stats(ctx->connector);
+  if (yrc != YHR_SUCCESS) {
+    fprintf(stderr, "Failed to reset connector statistics: %s\n",
+            yh_strerror(yrc));
+    return -1;
+  }
+
+  return 0;
+}
+
+// NOTE: Record operations in the flight recorder, dumped to a file on errors
+// and on SIGUSR1
+// argc = 2
+// arg 0: u:records
+// arg 1: s:file
+int yh_com_flight_on(yubihsm_context *ctx, Argument *argv, cmd_format in_fmt,
+                     cmd_format fmt) {
+
+  UNUSED(ctx);
+  UNUSED(in_fmt);
+  UNUSED(fmt);
+
+  yh_rc yrc = yh_set_flight_recorder(argv[0].d, argv[1].s, true);
+  if (yrc != YHR_SUCCESS) {
+    fprintf(stderr, "Failed to set up the flight recorder: %s\n",
+            yh_strerror(yrc));
+    return -1;
+  }
+
+  return 0;
+}
+
+// NOTE: Stop recording, what was recorded can still be dumped
+// argc = 0
+int yh_com_flight_off(yubihsm_context *ctx, Argument *argv, cmd_format in_fmt,
+                      cmd_format fmt) {
+
+  UNUSED(ctx);
+  UNUSED(argv);
+  UNUSED(in_fmt);
+  UNUSED(fmt);
+
+  yh_rc yrc = yh_set_flight_recorder(0, NULL, false);
+  if (yrc != YHR_SUCCESS) {
+    fprintf(stderr, "Failed to stop the flight recorder: %s\n",
+            yh_strerror(yrc));
+    return -1;
+  }
+
+  return 0;
+}
+
+// NOTE: Dump the flight recorder to its file
+// argc = 0
+int yh_com_flight_dump(yubihsm_context *ctx, Argument *argv, cmd_format in_fmt,
+                       cmd_format fmt) {
+
+  UNUSED(ctx);
+  UNUSED(argv);
+  UNUSED(in_fmt);
+  UNUSED(fmt);
+
+  yh_rc yrc = yh_dump_flight_recorder();
+  if (yrc != YHR_SUCCESS) {
+    fprintf(stderr, "Failed to dump the flight recorder: %s\n",
+            yh_strerror(yrc));
+    return -1;
+  }
+
+  return 0;
+}
+
+static int compare_flight_records(const void *a, const void *b) {
+
+  const yh_flight_record *ra = a;
+  const yh_flight_record *rb = b;
+
+  if (ra->end_us != rb->end_us) {
+    return ra->end_us < rb->end_us ? -1 : 1;
+  }
+  return ra->ring < rb->ring ? -1 : ra->ring > rb->ring;
+}
+
+// NOTE: Print a flight recorder dump, oldest operation first
+// argc = 1
+// arg 0: s:file
+int yh_com_flight_decode(yubihsm_context *ctx, Argument *argv,
+                         cmd_format in_fmt, cmd_format fmt) {
+
+  static const char *points[] = {"send", "secure-msg", "create-session",
+                                 "authenticate"};
+  yh_flight_header header;
+  yh_flight_record *records = NULL;
+  size_t n_records = 0;
+  int ret = -1;
+
+  UNUSED(in_fmt);
+  UNUSED(fmt);
+
+  FILE *fp = fopen(argv[0].s, "rb");
+  if (fp == NULL) {
+    fprintf(stderr, "Unable to open file %s\n", argv[0].s);
+    return -1;
+  }
+
+  if (fread(&header, sizeof(header), 1, fp) != 1 ||
+      memcmp(header.magic, YH_FLIGHT_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != YH_FLIGHT_VERSION ||
+      header.record_size != sizeof(yh_flight_record)) {
+    fprintf(stderr, "%s is not a flight recorder dump\n", argv[0].s);
+    goto cleanup;
+  }
+
+  for (;;) {
+    yh_flight_record *more =
+      realloc(records, (n_records + 1024) * sizeof(yh_flight_record));
+    if (more == NULL) {
+      fprintf(stderr, "Failed to allocate memory\n");
+      goto cleanup;
+    }
+    records = more;
+    size_t n = fread(records + n_records, sizeof(yh_flight_record), 1024, fp);
+    n_records += n;
+    if (n < 1024) {
+      break;
+    }
+  }
+  if (ferror(fp)) {
+    fprintf(stderr, "Failed to read %s\n", argv[0].s);
+    goto cleanup;
+  }
+
+  qsort(records, n_records, sizeof(yh_flight_record), compare_flight_records);
+
+  fprintf(ctx->out, "%12s %4s %-14s %-4s %7s %6s %6s %10s %s\n", "time (s)",
+          "ring", "operation", "cmd", "session", "out", "in", "time (us)",
+          "result");
+  for (size_t i = 0; i < n_records; i++) {
+    const yh_flight_record *record = &records[i];
+    // Relative to the dump, which follows the last record
+    unsigned long long ago = header.now_us - record->end_us;
+    fprintf(ctx->out, "-%4llu.%06llu %4u %-14s 0x%02x %7d %6u %6u %10u %s\n",
+            ago / 1000000, ago % 1000000, record->ring,
+            record->point < sizeof(points) / sizeof(points[0])
+              ? points[record->point]
+              : "unknown",
+            record->cmd, record->session_id, record->bytes_out,
+            record->bytes_in, record->elapsed_us, yh_strerror(record->result));
+  }
+  ret = 0;
+
+cleanup:
+  free(records);
+  fclose(fp);
+
+  return ret;
+}
+
 // NOTE: create aead from OTP parameters
 // argc = 5
 // arg 0: e:session
@@ -45,6 +45,8 @@ int yh_com_audit(yubihsm_context *ctx, Argument *argv, cmd_format in_fmt,
                  cmd_format fmt);
 int yh_com_set_log_index(yubihsm_context *ctx, Argument *argv,
                          cmd_format in_fmt, cmd_format fmt);
+int yh_com_audit_follow(yubihsm_context *ctx, Argument *argv,
+                        cmd_format in_fmt, cmd_format fmt);
 int yh_com_close_session(yubihsm_context *ctx, Argument *argv,
                          cmd_format in_fmt, cmd_format fmt);
 int yh_com_connect(yubihsm_context *ctx, Argument *argv, cmd_format in_fmt,
@@ -73,6 +75,10 @@ int yh_com_decrypt_aesccm(yubihsm_context *ctx, Argument *argv,
                           cmd_format in_fmt, cmd_format fmt);
 int yh_com_encrypt_aesccm(yubihsm_context *ctx, Argument *argv,
                           cmd_format in_fmt, cmd_format fmt);
+int yh_com_decrypt_envelope(yubihsm_context *ctx, Argument *argv,
+                            cmd_format in_fmt, cmd_format fmt);
+int yh_com_encrypt_envelope(yubihsm_context *ctx, Argument *argv,
+                            cmd_format in_fmt, cmd_format fmt);
 int yh_com_disconnect(yubihsm_context *ctx, Argument *argv, cmd_format in_fmt,
                       cmd_format fmt);
 int yh_com_echo(yubihsm_context *ctx, Argument *argv, cmd_format in_fmt,
@@ -187,6 +193,18 @@ int yh_com_keepalive_on(yubihsm_context *ctx, Argument *argv, cmd_format in_fmt,
                         cmd_format fmt);
 int yh_com_keepalive_off(yubihsm_context *ctx, Argument *argv,
                          cmd_format in_fmt, cmd_format fmt);
+int yh_com_stats_get(yubihsm_context *ctx, Argument *argv, cmd_format in_fmt,
+                     cmd_format fmt);
+int yh_com_stats_reset(yubihsm_context *ctx, Argument *argv,
+                       cmd_format in_fmt, cmd_format fmt);
+int yh_com_flight_on(yubihsm_context *ctx, Argument *argv, cmd_format in_fmt,
+                     cmd_format fmt);
+int yh_com_flight_off(yubihsm_context *ctx, Argument *argv, cmd_format in_fmt,
+                      cmd_format fmt);
+int yh_com_flight_dump(yubihsm_context *ctx, Argument *argv, cmd_format in_fmt,
+                       cmd_format fmt);
+int yh_com_flight_decode(yubihsm_context *ctx, Argument *argv,
+                         cmd_format in_fmt, cmd_format fmt);
 
 int yh_com_noop(yubihsm_context *ctx, Argument *argv, cmd_format in_fmt,
                 cmd_format fmt);
@@ -254,6 +254,13 @@ void create_command_list(CommandList *c) {
   register_subcommand(*c, (Command){"set", yh_com_set_log_index,
                                     "e:session,w:index", fmt_nofmt, fmt_nofmt,
                                     "Set the log index", NULL, NULL});
+  register_subcommand(*c, (Command){"follow", yh_com_audit_follow,
+                                    "e:session,s:file,u:interval=1000,"
+                                    "u:count=0",
+                                    fmt_nofmt, fmt_nofmt,
+                                    "Drain log entries into a file, verifying "
+                                    "them and setting the log index",
+                                    NULL, NULL});
   *c = register_command(*c, (Command){"connect", yh_com_connect, NULL,
                                       fmt_nofmt, fmt_nofmt,
                                       "Connect to a connector", NULL, NULL});
@@ -300,6 +307,13 @@ void create_command_list(CommandList *c) {
                                 "e:session,w:key_id,i:data=-", fmt_base64,
                                 fmt_binary, "Decrypt data using Yubico-AES-CCM",
                                 NULL, NULL});
+  register_subcommand(*c, (Command){"envelope", yh_com_decrypt_envelope,
+                                    "w:authkey,u:sessions,s:infile,s:outfile,"
+                                    "u:first=0,u:count=0,i:password=-",
+                                    fmt_password, fmt_nofmt,
+                                    "Decrypt a file from an envelope, from a "
+                                    "given chunk on",
+                                    NULL, NULL});
   *c = register_command(*c, (Command){"derive", yh_com_noop, NULL, fmt_nofmt,
                                       fmt_nofmt, "Drive data", NULL, NULL});
   register_subcommand(*c, (Command){"ecdh", yh_com_derive_ecdh,
@@ -314,6 +328,13 @@ void create_command_list(CommandList *c) {
                                 "e:session,w:key_id,i:data=-", fmt_binary,
                                 fmt_base64, "Encrypt data using Yubico-AES-CCM",
                                 NULL, NULL});
+  register_subcommand(*c, (Command){"envelope", yh_com_encrypt_envelope,
+                                    "w:authkey,u:sessions,w:key_id,s:infile,s:"
+                                    "outfile,i:password=-",
+                                    fmt_password, fmt_nofmt,
+                                    "Encrypt a file of any size into an "
+                                    "envelope using a pool of sessions",
+                                    NULL, NULL});
   *c =
     register_command(*c, (Command){"disconnect", yh_com_disconnect, NULL,
                                    fmt_nofmt, fmt_nofmt,
@@ -601,6 +622,32 @@ void create_command_list(CommandList *c) {
   register_subcommand(*c,
                       (Command){"off", yh_com_keepalive_off, NULL, fmt_nofmt,
                                 fmt_nofmt, "Disable keepalive", NULL, NULL});
+  *c = register_command(*c, (Command){"stats", yh_com_noop, NULL, fmt_nofmt,
+                                      fmt_nofmt, "Connector statistics", NULL,
+                                      NULL});
+  register_subcommand(*c, (Command){"get", yh_com_stats_get, NULL, fmt_nofmt,
+                                    fmt_nofmt, "Print connector statistics",
+                                    NULL, NULL});
+  register_subcommand(*c, (Command){"reset", yh_com_stats_reset, NULL,
+                                    fmt_nofmt, fmt_nofmt,
+                                    "Reset connector statistics", NULL, NULL});
+  *c = register_command(*c, (Command){"flight", yh_com_noop, NULL, fmt_nofmt,
+                                      fmt_nofmt, "Flight recorder", NULL,
+                                      NULL});
+  register_subcommand(*c, (Command){"on", yh_com_flight_on,
+                                    "u:records,s:file", fmt_nofmt, fmt_nofmt,
+                                    "Record operations, dumping to a file",
+                                    NULL, NULL});
+  register_subcommand(*c,
+                      (Command){"off", yh_com_flight_off, NULL, fmt_nofmt,
+                                fmt_nofmt, "Stop recording", NULL, NULL});
+  register_subcommand(*c, (Command){"dump", yh_com_flight_dump, NULL,
+                                    fmt_nofmt, fmt_nofmt,
+                                    "Dump the flight recorder", NULL, NULL});
+  register_subcommand(*c, (Command){"decode", yh_com_flight_decode, "s:file",
+                                    fmt_nofmt, fmt_nofmt,
+                                    "Print a flight recorder dump", NULL,
+                                    NULL});
 
   *c =
     register_command(*c, (Command){"set", yh_com_noop, NULL, fmt_nofmt,
@@ -794,6 +841,13 @@ static void timer_handler(int signo __attribute__((unused))) {
   }
 }
 
+#ifndef __WIN32
+static void flight_handler(int signo __attribute__((unused))) {
+
+  (void) yh_dump_flight_recorder();
+}
+#endif
+
 static int set_keepalive(uint16_t seconds) {
 
 #ifdef __WIN32
@@ -1993,6 +2047,8 @@ int main(int argc, char *argv[]) {
   act.sa_handler = timer_handler;
   act.sa_flags = SA_RESTART;
   sigaction(SIGALRM, &act, NULL);
+  act.sa_handler = flight_handler;
+  sigaction(SIGUSR1, &act, NULL);
 
   sigset_t set;
   sigemptyset(&set);